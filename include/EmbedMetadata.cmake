@@ -27,11 +27,16 @@
 #
 # This script can embed the metadata text file for each plugin inside the plugin lib.
 # Must be included in the CMake project of each plugin.
+# justplug_add_plugin() (at the end of this file) adds a plugin library built to be loaded quickly.
 #
 # Inspired by the script at: https://gist.github.com/sivachandran/3a0de157dccef822a230
 #
 
 include(CMakeParseArguments)
+include(CheckCXXCompilerFlag)
+
+# Used to find the resource packer sources
+set(JP_EMBED_SCRIPT_DIR ${CMAKE_CURRENT_LIST_DIR})
 
 # Function to wrap a given string into multiple lines at the given column position.
 # Parameters:
@@ -126,3 +131,201 @@ function(EMBED_METADATA)
     bin2h(SOURCE_FILE ${EMBED_METADATA_METADATA_FILE} HEADER_FILE "${CMAKE_CURRENT_BINARY_DIR}/pluginMetadata/metadata.h" VARIABLE_NAME "jp_metadata" NULL_TERMINATE ON)
     include_directories(${CMAKE_CURRENT_BINARY_DIR}/pluginMetadata)
 endfunction()
+
+# Alignment of the resources embedded by embed_resources() (must be a multiple of the page size)
+if(NOT DEFINED JP_RESOURCE_ALIGNMENT)
+    set(JP_RESOURCE_ALIGNMENT 4096)
+endif()
+
+# Default size of the chunks of the compressed resources (uncompressed bytes)
+if(NOT DEFINED JP_RESOURCE_CHUNK_SIZE)
+    set(JP_RESOURCE_CHUNK_SIZE 65536)
+endif()
+
+# Packer of the compressed resources, run at build time. If empty, justplug-resourcepacker is built
+# with the project, which needs a native build: when cross compiling, set it to a packer built for the host.
+set(JUSTPLUG_RESOURCEPACKER "" CACHE FILEPATH "justplug-resourcepacker built for the host (built with the project if empty)")
+
+# Function to embed resource files (lookup tables, models, ...) into the plugin library.
+# The files are included at build time by the assembler (.incbin), each one on a page boundary
+# in the read-only .jp_resources section. They are accessed with the functions of resources.h.
+# Needs a GNU compatible assembler producing ELF objects, and the ASM language must be enabled
+# (enable_language(ASM)) by the project. Can be called only once per plugin.
+# Parameters
+#   SOURCE_VARIABLE  - The name of the variable receiving the generated source files
+#                      (must be added to the sources of the plugin).
+#   FILES            - The resource files. The name of each resource is the path given here.
+#                      Relative paths are searched in the current source dir, then in the binary dir.
+#   COMPRESSED_FILES - Same as FILES, but the resources are compressed at build time
+#                      (see lzcodec.h) by the justplug-resourcepacker tool. The tool is built with
+#                      the target toolchain: when cross compiling, set JUSTPLUG_RESOURCEPACKER
+#                      to a packer built for the host.
+#   CHUNK_SIZE       - Size of the independently compressed chunks (default: JP_RESOURCE_CHUNK_SIZE).
+#
+# Usage
+#   embed_resources(SOURCE_VARIABLE resourcesSource FILES data/table.bin COMPRESSED_FILES data/model.bin)
+#   add_library(${PROJECT_NAME} SHARED main.cpp meta.json ${resourcesSource})
+function(EMBED_RESOURCES)
+    set(oneValueArgs SOURCE_VARIABLE CHUNK_SIZE)
+    set(multiValueArgs FILES COMPRESSED_FILES)
+    cmake_parse_arguments(EMBED_RESOURCES "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN})
+
+    if(NOT CMAKE_ASM_COMPILER_LOADED)
+        message(FATAL_ERROR "embed_resources() needs the ASM language (call enable_language(ASM) first)")
+    endif()
+    if(APPLE OR WIN32)
+        message(FATAL_ERROR "embed_resources() only supports ELF platforms")
+    endif()
+
+    if(CMAKE_SIZEOF_VOID_P EQUAL 8)
+        set(pointerDirective ".quad")
+    else()
+        set(pointerDirective ".long")
+    endif()
+
+    if(NOT EMBED_RESOURCES_CHUNK_SIZE)
+        set(EMBED_RESOURCES_CHUNK_SIZE ${JP_RESOURCE_CHUNK_SIZE})
+    endif()
+    # The packer is shared by all plugins of the build
+    if(JUSTPLUG_RESOURCEPACKER)
+        set(packer ${JUSTPLUG_RESOURCEPACKER})
+    elseif(EMBED_RESOURCES_COMPRESSED_FILES)
+        if(CMAKE_CROSSCOMPILING)
+            message(FATAL_ERROR "embed_resources() cannot run the packer built for the target: "
+                                "set JUSTPLUG_RESOURCEPACKER to a justplug-resourcepacker built for the host")
+        endif()
+        if(NOT TARGET justplug-resourcepacker)
+            add_executable(justplug-resourcepacker ${JP_EMBED_SCRIPT_DIR}/../tools/resourcepacker/main.cpp)
+            set_target_properties(justplug-resourcepacker PROPERTIES RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/tools)
+        endif()
+        set(packer justplug-resourcepacker)
+    endif()
+
+    set(dataSection "\t.section .jp_resources,\"a\",%progbits\n")
+    set(nameSection "\t.section .rodata.jp_resource_names,\"a\",%progbits\n")
+    set(tableEntries "")
+    set(resourceFiles "")
+    set(packedFiles "")
+    set(index 0)
+    foreach(group FILES COMPRESSED_FILES)
+        foreach(resource ${EMBED_RESOURCES_${group}})
+            # Relative paths are searched in the source dir, then in the binary dir (generated files)
+            if(IS_ABSOLUTE ${resource} OR EXISTS ${CMAKE_CURRENT_SOURCE_DIR}/${resource})
+                get_filename_component(resourcePath ${resource} ABSOLUTE)
+            else()
+                set(resourcePath ${CMAKE_CURRENT_BINARY_DIR}/${resource})
+            endif()
+            list(APPEND resourceFiles ${resourcePath})
+
+            # RESOURCE_COMPRESSED flag in resources.h
+            set(flags 0)
+            if(group STREQUAL "COMPRESSED_FILES")
+                set(flags 1)
+                set(packedPath "${CMAKE_CURRENT_BINARY_DIR}/pluginResources/resource_${index}.jplz")
+                add_custom_command(
+                    OUTPUT ${packedPath}
+                    COMMAND ${packer} ${EMBED_RESOURCES_CHUNK_SIZE} ${resourcePath} ${packedPath}
+                    DEPENDS ${packer} ${resourcePath}
+                    COMMENT "Compressing resource ${resource}"
+                )
+                list(APPEND packedFiles ${packedPath})
+                set(resourcePath ${packedPath})
+            endif()
+
+            set(dataSection "${dataSection}\t.balign ${JP_RESOURCE_ALIGNMENT}\n.Ljp_resource_${index}_begin:\n\t.incbin \"${resourcePath}\"\n.Ljp_resource_${index}_end:\n")
+            set(nameSection "${nameSection}.Ljp_resource_${index}_name:\n\t.asciz \"${resource}\"\n")
+            set(tableEntries "${tableEntries}\t${pointerDirective} .Ljp_resource_${index}_name, .Ljp_resource_${index}_begin, .Ljp_resource_${index}_end, ${flags}\n")
+            math(EXPR index "${index} + 1")
+        endforeach()
+    endforeach()
+
+    # The table of resources is hidden (each plugin has its own), see resources.h.
+    # The jp_resource_table alias is exported for the manager (resource sharing).
+    set(tableSection "\t.section .data.rel.ro,\"aw\",%progbits\n\t.balign ${CMAKE_SIZEOF_VOID_P}\n\t.globl jp_resources\n\t.hidden jp_resources\n\t.type jp_resources, %object\n\t.globl jp_resource_table\n\t.type jp_resource_table, %object\njp_resources:\njp_resource_table:\n${tableEntries}\t${pointerDirective} 0, 0, 0, 0\n\t.size jp_resources, . - jp_resources\n\t.size jp_resource_table, . - jp_resource_table\n")
+
+    set(sourceFile "${CMAKE_CURRENT_BINARY_DIR}/pluginResources/resources.S")
+    file(WRITE ${sourceFile} "/* Generated by embed_resources(), do not edit */\n\n${dataSection}\n${nameSection}\n${tableSection}\n\t.section .note.GNU-stack,\"\",%progbits\n")
+
+    # .incbin is not seen by the dependency scanner
+    set_source_files_properties(${sourceFile} PROPERTIES OBJECT_DEPENDS "${resourceFiles};${packedFiles}")
+    # The packed files are also listed as sources, so that their custom commands are run
+    set(${EMBED_RESOURCES_SOURCE_VARIABLE} ${sourceFile} ${packedFiles} PARENT_SCOPE)
+endfunction()
+
+# Symbols of a plugin used by the plugin manager (see JP_REGISTER_PLUGIN in iplugin.h, and embed_resources())
+set(JP_PLUGIN_ENTRY_POINTS jp_name jp_metadata jp_createPlugin jp_resource_table)
+
+# Function to add a plugin library, with the flags that reduce the time spent by the dynamic
+# loader (dlopen) and the size of the library. It embeds the metadata (and the resources) too.
+#   -fno-plt                    - Calls to other libraries go through the GOT, without PLT stubs.
+#   -z now                      - Symbols are bound at load time. Needed anyway with -fno-plt, and
+#                                 the GOT is read-only after the relocations (full RELRO).
+#   -Bsymbolic                  - References to the plugin own symbols are bound inside the plugin.
+#   --hash-style=gnu            - Faster symbol lookups (bloom filter) than the SysV hash table.
+#   --gc-sections               - Unused functions and data are removed (with -ffunction-sections and -fdata-sections).
+#   --as-needed                 - Only the libraries actually used are loaded with the plugin.
+#   Exported symbols allowlist  - Only JP_PLUGIN_ENTRY_POINTS (and EXPORTS) are in the dynamic symbol
+#                                 table (version script), so template instantiations of the standard
+#                                 library are neither exported nor resolved by the loader.
+# The linker flags are only used on ELF platforms, with a GCC compatible compiler.
+# Parameters
+#   NAME                 - The name of the target (first argument).
+#   SOURCES              - The sources of the plugin.
+#   METADATA_FILE        - Metadata text file (default: meta.json).
+#   RESOURCES            - Files embedded with embed_resources() (FILES). The ASM language must be enabled.
+#   COMPRESSED_RESOURCES - Same, but compressed (COMPRESSED_FILES).
+#   EXPORTS              - Other symbols to export (for example symbols used by other libraries).
+#   NO_LOAD_OPTIMIZATION - Build the plugin only with -fvisibility=hidden (as the previous plugin template).
+#
+# Usage
+#   justplug_add_plugin(myplugin SOURCES main.cpp RESOURCES data/table.bin)
+function(JUSTPLUG_ADD_PLUGIN NAME)
+    set(options NO_LOAD_OPTIMIZATION)
+    set(oneValueArgs METADATA_FILE)
+    set(multiValueArgs SOURCES RESOURCES COMPRESSED_RESOURCES EXPORTS)
+    cmake_parse_arguments(JP_PLUGIN "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN})
+
+    if(NOT JP_PLUGIN_METADATA_FILE)
+        set(JP_PLUGIN_METADATA_FILE meta.json)
+    endif()
+    embed_metadata(METADATA_FILE ${JP_PLUGIN_METADATA_FILE})
+
+    set(resourcesSource "")
+    if(JP_PLUGIN_RESOURCES OR JP_PLUGIN_COMPRESSED_RESOURCES)
+        embed_resources(SOURCE_VARIABLE resourcesSource FILES ${JP_PLUGIN_RESOURCES} COMPRESSED_FILES ${JP_PLUGIN_COMPRESSED_RESOURCES})
+    endif()
+
+    add_library(${NAME} SHARED ${JP_PLUGIN_SOURCES} ${JP_PLUGIN_METADATA_FILE} ${resourcesSource})
+
+    if(NOT CMAKE_CXX_COMPILER_ID MATCHES "GNU|Clang")
+        return()
+    endif()
+
+    # Several plugins can have the same class names
+    set(compileFlags "-fvisibility=hidden")
+    set(linkFlags "")
+    if(NOT JP_PLUGIN_NO_LOAD_OPTIMIZATION)
+        set(compileFlags "${compileFlags} -fvisibility-inlines-hidden -ffunction-sections -fdata-sections")
+        check_cxx_compiler_flag(-fno-plt JP_COMPILER_HAS_NO_PLT)
+        if(JP_COMPILER_HAS_NO_PLT)
+            set(compileFlags "${compileFlags} -fno-plt")
+        endif()
+
+        if(NOT APPLE AND NOT WIN32)
+            set(versionScript "${CMAKE_CURRENT_BINARY_DIR}/pluginExports/${NAME}.map")
+            set(exports "")
+            foreach(symbol ${JP_PLUGIN_ENTRY_POINTS} ${JP_PLUGIN_EXPORTS})
+                set(exports "${exports}        ${symbol};\n")
+            endforeach()
+            file(WRITE ${versionScript} "/* Generated by justplug_add_plugin(), do not edit */\n{\n    global:\n${exports}    local:\n        *;\n};\n")
+
+            set(linkFlags "-Wl,--version-script=${versionScript} -Wl,-Bsymbolic -Wl,--hash-style=gnu -Wl,--gc-sections -Wl,--as-needed -Wl,-z,now -Wl,-z,relro -Wl,-O1")
+            set_property(TARGET ${NAME} APPEND PROPERTY LINK_DEPENDS ${versionScript})
+        endif()
+    endif()
+
+    set_property(TARGET ${NAME} APPEND_STRING PROPERTY COMPILE_FLAGS " ${compileFlags}")
+    if(linkFlags)
+        set_property(TARGET ${NAME} APPEND_STRING PROPERTY LINK_FLAGS " ${linkFlags}")
+    endif()
+endfunction()
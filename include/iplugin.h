@@ -119,6 +119,37 @@ public:
      */
     virtual void mainPluginExec() {}
 
+    /**
+     * @brief Called by the Plugin Manager when the memory is under pressure.
+     *
+     * The plugin should release all the memory it can rebuild later (caches, pools, ...).
+     * @note Called from a background thread of the Plugin Manager.
+     * @see PluginManager::enableMemoryPressureShedding()
+     */
+    virtual void dropCaches() {}
+
+    /**
+     * @brief The HealthState enum (from the best to the worst state)
+     */
+    enum HealthState
+    {
+        HEALTH_UNKNOWN = 0,
+        HEALTHY = 1,
+        DEGRADED = 2,
+        UNHEALTHY = 3
+    };
+
+    /**
+     * @brief Called by the Plugin Manager to check the health of the plugin.
+     *
+     * The plugin should check its internal state (queues, worker threads, connections, ...)
+     * and return quickly. A plugin that does not return before the timeout is UNHEALTHY.
+     * @note Called from a background thread of the Plugin Manager, only if the health
+     * checks are enabled.
+     * @see PluginManager::enableHealthChecks()
+     */
+    virtual HealthState healthCheck() { return HEALTHY; }
+
     /**
      * @brief Send a request to the plugin manager or other plugins
      * @param receiver The name of the receiver plugin (If NULL, the request is send to the plugin's manager). A plugin can send a request to itself.
@@ -136,6 +167,33 @@ public:
         return sendRequestImpl(receiver, code, data, dataSize);
     }
 
+    /**
+     * @brief Post a request to another plugin, without waiting for it to be handled.
+     *
+     * The receivers are the same as for sendRequest() (except the manager). The data is copied,
+     * and the receiver gets a pointer to the copy in handleRequest(), called from the request
+     * thread of the receiver (one per receiver, the requests are handled in the order they were
+     * posted). Its return code and any data it gives back are ignored.
+     * @see PluginManager::setRequestCoalescing()
+     * @return SUCCESS if the request is queued, NOT_A_DEPENDENCY if the receiver is not a dependency,
+     *         NOT_SUPPORTED if receiver is null.
+     */
+    uint16_t postRequest(const char* receiver,
+                         uint16_t code,
+                         const void* data,
+                         uint32_t dataSize)
+    {
+        if(!receiver)
+            return IPlugin::NOT_SUPPORTED;
+        PostedRequest request{receiver, findReceiver(receiver), code, data, dataSize};
+        if(!request.handler)
+            return IPlugin::NOT_A_DEPENDENCY;
+
+        void* requestData = &request;
+        uint32_t requestSize = sizeof(request);
+        return _requestFunc(jp_name(), POST_REQUEST, &requestData, &requestSize);
+    }
+
     /**
      * @brief Handle request send by other plugins to this plugin.
      *
@@ -175,6 +233,19 @@ public:
         // Get the version for the specified plugin (this plugin if data is null)
         GET_PLUGINVERSION = 11,
 
+        // State file of this plugin, data is a StateFile* (see statefile.h)
+        // Map the published state (read-only)
+        MAP_STATEFILE = 20,
+        // Create a new state to fill (StateFile::size and StateFile::formatVersion must be set)
+        CREATE_STATEFILE = 21,
+        // Replace atomically the published state by a created one
+        PUBLISH_STATEFILE = 22,
+        // Unmap a state (a created state is discarded)
+        RELEASE_STATEFILE = 23,
+
+        // Queue a request for another plugin, data is a PostedRequest* (use postRequest())
+        POST_REQUEST = 30,
+
         // Check if the specified plugin exists
         CHECK_PLUGIN = 100,
         // Check if the specified plugin is loaded
@@ -197,10 +268,29 @@ public:
         RESULT_FALSE = COMMON_ERROR,
 
         NOT_FOUND = 5,
+        // The checksum or the header of a state file is invalid
+        CORRUPTED = 6,
+        // The feature is disabled or not supported on this platform
+        NOT_SUPPORTED = 7,
+        // The request exceeded the rate limit of the sender to the receiver
+        // (see PluginManager::setRateLimit())
+        THROTTLED = 8,
 
         USER_RETURN_CODE = 100
     };
 
+    //! @cond
+    // Request given to the manager by postRequest()
+    struct PostedRequest
+    {
+        const char* receiver;
+        IPlugin* handler; // Object receiving the request for the sender (the receiver or its proxy)
+        uint16_t code;
+        const void* data;
+        uint32_t dataSize;
+    };
+    //! @endcond
+
 protected:
 
 // Implementation macro used to define the function pointer with the correct type
@@ -247,31 +337,37 @@ private:
     IPlugin(const IPlugin&) = delete;
     const IPlugin& operator=(const IPlugin&) = delete;
 
-    // Private implementation of sendRequest
-    uint16_t sendRequestImpl(const char *receiver, uint16_t code, void **data, uint32_t *dataSize)
+    // Object handling the requests sent to receiver, or NULL if it is not a dependency
+    IPlugin* findReceiver(const char* receiver)
     {
-        // Send to manager (receiver is null)
-        if(!receiver)
-            return _requestFunc(jp_name(), code, data, dataSize);
-
         // Send to the dependency
         for(int i=0; i < _depNb; ++i)
         {
             if(strcmp(receiver, _depPlugins[i]->jp_name()) == 0)
-                return _depPlugins[i]->handleRequest(jp_name(), code, data, dataSize);
+                return _depPlugins[i];
         }
 
         // Send to itself
         if(strcmp(receiver, jp_name()) == 0)
-            return this->handleRequest(jp_name(), code, data, dataSize);
+            return this;
 
         // Send to non-dependency if main plugin
         if(_isMainPlugin)
-        {
-            IPlugin* plug = _nonDepFunc(jp_name(), receiver);
-            if(plug)
-                return plug->handleRequest(jp_name(), code, data, dataSize);
-        }
+            return _nonDepFunc(jp_name(), receiver);
+
+        return nullptr;
+    }
+
+    // Private implementation of sendRequest
+    uint16_t sendRequestImpl(const char *receiver, uint16_t code, void **data, uint32_t *dataSize)
+    {
+        // Send to manager (receiver is null)
+        if(!receiver)
+            return _requestFunc(jp_name(), code, data, dataSize);
+
+        IPlugin* plug = findReceiver(receiver);
+        if(plug)
+            return plug->handleRequest(jp_name(), code, data, dataSize);
 
         // Dependency was not found
         return IPlugin::NOT_A_DEPENDENCY;
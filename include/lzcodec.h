@@ -0,0 +1,309 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LZCODEC_H
+#define LZCODEC_H
+
+/*
+ * This file is an internal header used by resources.h and the resource packer.
+ * It's not part of the public API, and may change at any moment.
+ *
+ * Self-contained LZ77 codec (byte oriented, in the spirit of LZ4) used to compress
+ * the embedded resources, and the chunked container storing a compressed resource.
+ *
+ * Block format: a list of sequences. Each sequence starts with a token byte
+ * (4 high bits: literals length, 4 low bits: match length - 4), followed by the
+ * extra literals length bytes (if the field is 15, bytes are added while they are 255),
+ * the literals, the match offset (2 bytes, little-endian) and the extra match length bytes.
+ * The last sequence only contains literals.
+ *
+ * Container format (little-endian):
+ *   "JPLZ", chunk size (u32), uncompressed size (u64), chunks count (u32), reserved (u32),
+ *   chunks count + 1 offsets (u64, relative to the first chunk), chunks.
+ * Each chunk is compressed independently (random access). A chunk whose compressed
+ * size equals its uncompressed size is stored as is.
+ */
+
+#include <cstddef> // for size_t
+#include <cstdint> // for uint8_t, uint32_t, uint64_t
+#include <cstring> // for memcpy, memcmp
+#include <vector> // for std::vector
+
+namespace jp_private
+{
+namespace lz
+{
+
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 65535;
+const size_t HASH_BITS = 16;
+
+const size_t HEADER_SIZE = 24;
+const size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+inline uint32_t read32(const uint8_t* ptr)
+{
+    return uint32_t(ptr[0]) | (uint32_t(ptr[1]) << 8) | (uint32_t(ptr[2]) << 16) | (uint32_t(ptr[3]) << 24);
+}
+
+inline uint64_t read64(const uint8_t* ptr)
+{
+    return uint64_t(read32(ptr)) | (uint64_t(read32(ptr + 4)) << 32);
+}
+
+inline void write32(std::vector<uint8_t>* out, uint32_t value)
+{
+    for(int i=0; i < 4; ++i)
+        out->push_back(uint8_t(value >> (8*i)));
+}
+
+inline void write64(std::vector<uint8_t>* out, uint64_t value)
+{
+    write32(out, uint32_t(value));
+    write32(out, uint32_t(value >> 32));
+}
+
+inline void writeLength(std::vector<uint8_t>* out, size_t length)
+{
+    for(; length >= 255; length -= 255)
+        out->push_back(255);
+    out->push_back(uint8_t(length));
+}
+
+inline void writeSequence(std::vector<uint8_t>* out, const uint8_t* literals, size_t literalsLength,
+                          size_t offset, size_t matchLength)
+{
+    const size_t matchField = matchLength == 0 ? 0 : matchLength - MIN_MATCH;
+    out->push_back(uint8_t(((literalsLength < 15 ? literalsLength : 15) << 4)
+                           | (matchField < 15 ? matchField : 15)));
+    if(literalsLength >= 15)
+        writeLength(out, literalsLength - 15);
+    out->insert(out->end(), literals, literals + literalsLength);
+
+    // Last sequence
+    if(matchLength == 0)
+        return;
+
+    out->push_back(uint8_t(offset));
+    out->push_back(uint8_t(offset >> 8));
+    if(matchField >= 15)
+        writeLength(out, matchField - 15);
+}
+
+// Append the compressed block of src to out
+inline void compressBlock(const uint8_t* src, size_t size, std::vector<uint8_t>* out)
+{
+    std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0);
+    size_t anchor = 0;
+    size_t pos = 0;
+
+    while(size >= MIN_MATCH && pos + MIN_MATCH <= size)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, src + pos, sizeof(sequence));
+        const uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+        // Positions are stored + 1 (0 is an empty slot)
+        const size_t candidate = table[hash];
+        table[hash] = uint32_t(pos + 1);
+
+        if(candidate == 0 || pos + 1 - candidate > MAX_OFFSET
+           || memcmp(src + candidate - 1, src + pos, MIN_MATCH) != 0)
+        {
+            ++pos;
+            continue;
+        }
+
+        const size_t matchPos = candidate - 1;
+        size_t length = MIN_MATCH;
+        while(pos + length < size && src[matchPos + length] == src[pos + length])
+            ++length;
+
+        writeSequence(out, src + anchor, pos - anchor, pos - matchPos, length);
+        pos += length;
+        anchor = pos;
+    }
+
+    writeSequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+inline bool readLength(const uint8_t** in, const uint8_t* end, size_t* length)
+{
+    uint8_t byte;
+    do
+    {
+        if(*in >= end)
+            return false;
+        byte = *(*in)++;
+        *length += byte;
+    } while(byte == 255);
+    return true;
+}
+
+// Decompress a block into dst (of dstSize bytes). Returns the decompressed size, or
+// size_t(-1) if the block is corrupted or does not fit.
+inline size_t decompressBlock(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+    const uint8_t* in = src;
+    const uint8_t* const inEnd = src + srcSize;
+    uint8_t* out = dst;
+    uint8_t* const outEnd = dst + dstSize;
+    const size_t error = size_t(-1);
+
+    while(in < inEnd)
+    {
+        const uint8_t token = *in++;
+
+        size_t literalsLength = token >> 4;
+        if(literalsLength == 15 && !readLength(&in, inEnd, &literalsLength))
+            return error;
+        if(literalsLength > size_t(inEnd - in) || literalsLength > size_t(outEnd - out))
+            return error;
+        memcpy(out, in, literalsLength);
+        in += literalsLength;
+        out += literalsLength;
+
+        // Last sequence
+        if(in == inEnd)
+            break;
+
+        if(inEnd - in < 2)
+            return error;
+        const size_t offset = size_t(in[0]) | (size_t(in[1]) << 8);
+        in += 2;
+        if(offset == 0 || offset > size_t(out - dst))
+            return error;
+
+        size_t matchLength = token & 15;
+        if(matchLength == 15 && !readLength(&in, inEnd, &matchLength))
+            return error;
+        matchLength += MIN_MATCH;
+        if(matchLength > size_t(outEnd - out))
+            return error;
+
+        // The match can overlap the output (repeated patterns)
+        const uint8_t* match = out - offset;
+        if(offset >= matchLength)
+            memcpy(out, match, matchLength);
+        else
+            for(size_t i=0; i < matchLength; ++i)
+                out[i] = match[i];
+        out += matchLength;
+    }
+
+    return out - dst;
+}
+
+// Create the container of a compressed resource
+inline std::vector<uint8_t> compressResource(const uint8_t* data, size_t size, size_t chunkSize = DEFAULT_CHUNK_SIZE)
+{
+    const size_t chunksCount = (size + chunkSize - 1) / chunkSize;
+
+    std::vector<uint8_t> chunks;
+    std::vector<uint64_t> offsets(1, 0);
+    std::vector<uint8_t> block;
+    for(size_t i=0; i < chunksCount; ++i)
+    {
+        const uint8_t* chunk = data + i*chunkSize;
+        const size_t chunkLength = (i+1 == chunksCount) ? size - i*chunkSize : chunkSize;
+
+        block.clear();
+        compressBlock(chunk, chunkLength, &block);
+        if(block.size() >= chunkLength)
+            chunks.insert(chunks.end(), chunk, chunk + chunkLength);
+        else
+            chunks.insert(chunks.end(), block.begin(), block.end());
+        offsets.push_back(chunks.size());
+    }
+
+    std::vector<uint8_t> container = {'J', 'P', 'L', 'Z'};
+    write32(&container, uint32_t(chunkSize));
+    write64(&container, size);
+    write32(&container, uint32_t(chunksCount));
+    write32(&container, 0);
+    for(uint64_t offset : offsets)
+        write64(&container, offset);
+    container.insert(container.end(), chunks.begin(), chunks.end());
+    return container;
+}
+
+// Read access to a container created by compressResource()
+struct Container
+{
+    size_t size = 0; // Uncompressed size
+    size_t chunkSize = 0;
+    size_t chunksCount = 0;
+    const uint8_t* offsets = nullptr;
+    const uint8_t* chunks = nullptr;
+    const uint8_t* end = nullptr;
+
+    // Returns false if data is not a valid container
+    bool parse(const uint8_t* data, size_t dataSize)
+    {
+        if(dataSize < HEADER_SIZE || memcmp(data, "JPLZ", 4) != 0)
+            return false;
+
+        chunkSize = read32(data + 4);
+        size = read64(data + 8);
+        chunksCount = read32(data + 16);
+        if(chunkSize == 0 || chunksCount != (size + chunkSize - 1) / chunkSize
+           || (dataSize - HEADER_SIZE) / 8 < chunksCount + 1)
+            return false;
+
+        offsets = data + HEADER_SIZE;
+        chunks = offsets + 8*(chunksCount + 1);
+        end = data + dataSize;
+        return read64(offsets + 8*chunksCount) <= size_t(end - chunks);
+    }
+
+    size_t chunkLength(size_t index) const
+    {
+        return (index + 1 == chunksCount) ? size - index*chunkSize : chunkSize;
+    }
+
+    // Decompress a chunk into out (of at least chunkLength(index) bytes)
+    bool decompressChunk(size_t index, uint8_t* out) const
+    {
+        if(index >= chunksCount)
+            return false;
+
+        const uint64_t begin = read64(offsets + 8*index);
+        const uint64_t next = read64(offsets + 8*(index + 1));
+        if(next < begin || next > size_t(end - chunks))
+            return false;
+
+        const size_t length = chunkLength(index);
+        // Stored as is
+        if(next - begin == length)
+        {
+            memcpy(out, chunks + begin, length);
+            return true;
+        }
+        return decompressBlock(chunks + begin, next - begin, out, length) == length;
+    }
+};
+
+} // namespace lz
+} // namespace jp_private
+
+#endif // LZCODEC_H
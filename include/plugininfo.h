@@ -79,13 +79,13 @@ struct PluginInfo
         std::free((char*)url);
         std::free((char*)license);
         std::free((char*)copyright);
-        std::free((char*)dependencies);
 
         for(int i=0; i<dependenciesNb; ++i)
         {
             std::free((char*)dependencies[i].name);
             std::free((char*)dependencies[i].version);
         }
+        std::free((char*)dependencies);
     }
 };
 
@@ -25,6 +25,8 @@
 #ifndef PLUGINMANAGER_H
 #define PLUGINMANAGER_H
 
+#include <atomic> // for std::atomic
+#include <cstdint> // for uint64_t
 #include <string> // for std::string
 #include <vector> // for std::vector
 #include <functional> // for std::function
@@ -37,6 +39,7 @@
 namespace jp_private
 {
 struct PlugMgrPrivate;
+class PluginProxy;
 }
 
 namespace jp
@@ -67,6 +70,7 @@ struct JP_EXPORT_SYMBOL ReturnCode
         SEARCH_NAME_ALREADY_EXISTS = 101,
         SEARCH_CANNOT_PARSE_METADATA = 102,
         SEARCH_LISTFILES_ERROR = 103,
+        SEARCH_INTEGRITY_MISMATCH = 104,
 
         // Raised by loadPlugins()
         LOAD_DEPENDENCY_BAD_VERSION = 200,
@@ -74,7 +78,20 @@ struct JP_EXPORT_SYMBOL ReturnCode
         LOAD_DEPENDENCY_CYCLE = 202,
 
         // Raised by unloadPlugins()
-        UNLOAD_NOT_ALL = 300
+        UNLOAD_NOT_ALL = 300,
+
+        // Raised by enableMemoryPressureShedding()
+        MEMORY_PRESSURE_NOT_AVAILABLE = 400,
+
+        // Raised by pageOutPlugin()
+        PAGEOUT_PLUGIN_NOT_LOADED = 500,
+        PAGEOUT_NOT_SUPPORTED = 501,
+
+        // Raised by enableIntegrityCheck() and createIntegrityManifest()
+        INTEGRITY_MANIFEST_ERROR = 600,
+
+        // Raised by enableSharedRegistry()
+        SHARED_REGISTRY_ERROR = 700
     };
     /**
      * @brief The type of the error (the error code).
@@ -135,11 +152,267 @@ struct JP_EXPORT_SYMBOL ReturnCode
     explicit operator bool() { return type == Type::SUCCESS; }
 };
 
+/**
+ * @brief The ManagerMetrics struct.
+ *
+ * Counters about the activity of the PluginManager, returned by PluginManager::metrics().
+ */
+struct ManagerMetrics
+{
+    /**
+     * @brief Number of plugins unloaded because they were idle.
+     * @see PluginManager::setIdleEvictionDelay()
+     */
+    uint64_t evictions = 0;
+    /**
+     * @brief Number of evicted plugins loaded again (when they were used, or when the memory pressure cleared).
+     */
+    uint64_t reloads = 0;
+    /**
+     * @brief Number of deferred plugins (only lazy dependencies of the other plugins) loaded on their first use.
+     */
+    uint64_t lazyLoads = 0;
+    /**
+     * @brief Number of times the memory went under pressure.
+     * @see PluginManager::enableMemoryPressureShedding()
+     */
+    uint64_t pressureEvents = 0;
+    /**
+     * @brief Number of calls to IPlugin::dropCaches().
+     */
+    uint64_t cacheDrops = 0;
+    /**
+     * @brief Number of plugins unloaded to reduce the memory pressure (included in evictions).
+     */
+    uint64_t shedPlugins = 0;
+    /**
+     * @brief Number of times the code of a plugin was paged out.
+     * @see PluginManager::pageOutPlugin(), PluginManager::setIdlePageOutDelay()
+     */
+    uint64_t pageOuts = 0;
+    /**
+     * @brief Total resident memory (in bytes) released by the page outs.
+     */
+    uint64_t pageOutBytes = 0;
+    /**
+     * @brief Size of the memory currently locked by the manager (in bytes).
+     * @see PluginManager::enableRealTimeMode()
+     */
+    uint64_t lockedBytes = 0;
+    /**
+     * @brief Number of times memory could not be locked (budget exceeded or mlock() error).
+     */
+    uint64_t lockFailures = 0;
+    /**
+     * @brief Size of the code of the loaded plugins backed by transparent huge pages (in bytes).
+     *
+     * Plugins opt in with `"hugePageText": true` in their metadata. Their executable
+     * segment is copied into an anonymous mapping with MADV_HUGEPAGE, which replaces the
+     * original mapping just after the library is loaded (before any plugin function is called).
+     * Only the part of the segment that contains whole huge pages (2 MB) is moved.
+     */
+    uint64_t hugePageTextBytes = 0;
+    /**
+     * @brief Number of plugins whose code could not be moved onto huge pages
+     * (code smaller than a huge page, THP disabled, no free huge pages, ...). Their code is unchanged.
+     */
+    uint64_t hugePageTextFallbacks = 0;
+    /**
+     * @brief Number of embedded resources of the loaded plugins sharing their pages with an identical resource.
+     * @see PluginManager::enableResourceSharing()
+     */
+    uint64_t sharedResources = 0;
+    /**
+     * @brief Size of the pages of these resources (in bytes), i.e. the memory saved by the sharing.
+     */
+    uint64_t sharedResourceBytes = 0;
+    /**
+     * @brief Number of plugin files hashed by the integrity check.
+     * @see PluginManager::enableIntegrityCheck()
+     */
+    uint64_t integrityHashedFiles = 0;
+    /**
+     * @brief Total size of these files (in bytes).
+     */
+    uint64_t integrityHashedBytes = 0;
+    /**
+     * @brief Number of files not hashed again because they did not change since they were hashed.
+     */
+    uint64_t integrityCacheHits = 0;
+    /**
+     * @brief Number of files rejected because they do not match the manifest.
+     */
+    uint64_t integrityFailures = 0;
+    /**
+     * @brief Number of calls to loadPlugins() that read the load order from the cache.
+     * @see PluginManager::setLoadOrderCache()
+     */
+    uint64_t loadOrderCacheHits = 0;
+    /**
+     * @brief Number of calls to loadPlugins() that resolved the dependencies with the cache enabled.
+     */
+    uint64_t loadOrderCacheMisses = 0;
+    /**
+     * @brief Number of searches that read the plugins from the shared registry.
+     * @see PluginManager::enableSharedRegistry()
+     */
+    uint64_t sharedRegistryHits = 0;
+    /**
+     * @brief Number of searches that listed and loaded the libraries with the shared registry enabled.
+     */
+    uint64_t sharedRegistryMisses = 0;
+    /**
+     * @brief Number of calls to IPlugin::healthCheck() that returned.
+     * @see PluginManager::enableHealthChecks()
+     */
+    uint64_t healthChecks = 0;
+    /**
+     * @brief Number of health checks that did not return HEALTHY (late checks included).
+     */
+    uint64_t healthCheckFailures = 0;
+    /**
+     * @brief Number of health checks that did not return before their timeout.
+     */
+    uint64_t healthCheckTimeouts = 0;
+    /**
+     * @brief Number of changes of the health state of a plugin.
+     */
+    uint64_t healthStateChanges = 0;
+    /**
+     * @brief Number of requests between plugins rejected with IPlugin::THROTTLED.
+     * @see PluginManager::setRateLimit()
+     */
+    uint64_t throttledRequests = 0;
+    /**
+     * @brief Number of requests posted with IPlugin::postRequest().
+     */
+    uint64_t postedRequests = 0;
+    /**
+     * @brief Number of wake-ups of the request threads that delivered requests (several requests per batch
+     * when they are coalesced, or when they are posted faster than they are handled).
+     * @see PluginManager::setRequestCoalescing()
+     */
+    uint64_t requestBatches = 0;
+    /**
+     * @brief Number of posted requests not delivered because their sender or receiver was unloaded.
+     */
+    uint64_t discardedRequests = 0;
+    /**
+     * @brief Number of request trees traced (the sampled ones).
+     * @see PluginManager::enableTracing()
+     */
+    uint64_t sampledTraces = 0;
+    /**
+     * @brief Number of spans recorded in these traces.
+     */
+    uint64_t tracedSpans = 0;
+};
+
+/**
+ * @brief The PluginHealth class.
+ *
+ * Health of a plugin, updated by the PluginManager. All functions are lock-free and can
+ * be called from any thread (for example on the hot path of a request router).
+ * @see PluginManager::pluginHealth()
+ */
+class PluginHealth
+{
+public:
+    /**
+     * @brief The current state: the worst of the last health check and of the request error rate.
+     */
+    IPlugin::HealthState state() const { return static_cast<IPlugin::HealthState>(_state.load(std::memory_order_acquire)); }
+    /**
+     * @brief Number of requests to the plugin seen by the manager.
+     */
+    uint64_t requests() const { return _requests.load(std::memory_order_relaxed); }
+    /**
+     * @brief Number of these requests that failed.
+     */
+    uint64_t failedRequests() const { return _failedRequests.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int> _state{IPlugin::HEALTH_UNKNOWN};
+    std::atomic<uint64_t> _requests{0};
+    std::atomic<uint64_t> _failedRequests{0};
+
+    friend struct jp_private::PlugMgrPrivate;
+    friend class jp_private::PluginProxy;
+};
+
+/**
+ * @brief The RateLimitStats struct.
+ *
+ * Requests sent by a plugin to another one through a rate limit.
+ * @see PluginManager::rateLimitStats()
+ */
+struct RateLimitStats
+{
+    std::string sender; //!< Name of the sender plugin
+    std::string receiver; //!< Name of the receiver plugin
+    uint64_t requests = 0; //!< Number of requests sent
+    uint64_t throttled = 0; //!< Number of these requests rejected with IPlugin::THROTTLED
+};
+
+/**
+ * @brief The PageOutReport struct.
+ *
+ * Memory usage around a call to PluginManager::pageOutPlugin(). All sizes are in bytes.
+ */
+struct PageOutReport
+{
+    size_t mappedSize = 0; //!< Size of the read-only mappings of the plugin (code and read-only data)
+    size_t residentBefore = 0; //!< Resident size of these mappings before the page out
+    size_t residentAfter = 0; //!< Resident size of these mappings after the page out
+    size_t processResidentBefore = 0; //!< Resident size of the process before the page out
+    size_t processResidentAfter = 0; //!< Resident size of the process after the page out
+};
+
+/**
+ * @brief The WorkerPoolInfo struct.
+ *
+ * Size of the threads pool running the parallel steps of the search (the hashing of the integrity check).
+ * @see PluginManager::workerPoolInfo()
+ */
+struct WorkerPoolInfo
+{
+    unsigned int cpuLimit = 0; //!< CPUs available to the process (affinity mask, limited by the cgroup CPU quota)
+    unsigned int workers = 0; //!< Threads used at the start of the next run (the pinned count if pinned is true)
+    unsigned int peakWorkers = 0; //!< Highest number of threads used by the last run
+    double waitRatio = 0.0; //!< Time the tasks of the last run spent waiting (I/O, locks) per unit of CPU time
+    bool pinned = false; //!< True if the count was set with PluginManager::setWorkerCount()
+};
+
+/**
+ * @brief The TraceSpan struct.
+ *
+ * A request traced by the plugin manager. The spans of a trace form a tree: the parent
+ * of a span is the request that was handled by the sender when it sent (or posted) it.
+ * @see PluginManager::enableTracing()
+ */
+struct TraceSpan
+{
+    uint64_t traceId = 0; //!< Identifier of the trace (random, shared by all its spans)
+    uint64_t spanId = 0; //!< Identifier of the span in its trace (1 for the root span)
+    uint64_t parentId = 0; //!< Span of the parent request (0 for the root span)
+    std::string sender; //!< Name of the sender plugin
+    std::string receiver; //!< Name of the receiver plugin (empty for the requests to the manager)
+    uint16_t code = 0; //!< Code of the request
+    uint16_t returnCode = 0; //!< Code returned by the receiver
+    bool async = false; //!< True if the request was posted (delivered by the request thread of the receiver)
+    int64_t startTime = 0; //!< Start of the request, in microseconds since the epoch
+    int64_t duration = 0; //!< Duration of the request, in nanoseconds
+};
+
 /**
  * @class PluginManager
  * @brief Main class to manage all plugins.
  *
  * Since it is a singleton-class, only one instance can be created.
+ *
+ * All member functions can be called from several threads.
+ * @note Plugin objects (and requests between plugins) must not be used while
+ * unloadPlugins() is running, since their libraries are unloaded.
  */
 class JP_EXPORT_SYMBOL PluginManager
 {
@@ -165,6 +438,32 @@ public:
      */
     typedef std::function<void(const ReturnCode&, const char*)> callback;
 
+    /**
+     * @brief Signature of the cryptographic hash functions used by the integrity check.
+     *
+     * The function receives the content of a file and returns its digest as a hex string.
+     * It is called from several threads at the same time.
+     * @see setCryptoHashFunction()
+     */
+    typedef std::function<std::string(const unsigned char* data, size_t size)> hashFunction;
+
+    /**
+     * @brief Signature of the functions called when the health state of a plugin changes.
+     *
+     * Receives the name of the plugin, its new state and its previous state.
+     * It is called from the health checks thread, without the manager locked.
+     * @see setHealthCallback()
+     */
+    typedef std::function<void(const std::string& name, IPlugin::HealthState state, IPlugin::HealthState previous)> healthCallback;
+
+    /**
+     * @brief Signature of the functions receiving the completed traces.
+     *
+     * The spans are sorted in the order the requests started (the root span first).
+     * @see setTraceSink()
+     */
+    typedef std::function<void(const std::vector<TraceSpan>& spans)> traceSink;
+
     /**
      * @brief Enable log output.
      *
@@ -234,6 +533,7 @@ public:
     /**
      * @brief Load all plugins found by previous searchForPlugins().
      *
+     * Plugins already loaded by a previous call are not reloaded.
      * @param tryToContinue If true, the manager will try to load other plugins if some have errors.
      * @param callbackFunc Callback function.
      * @return true if all plugins was successfully loaded.
@@ -315,6 +615,7 @@ public:
     /**
      * @brief Get the plugin object for the specified plugin.
      * @note The user can cast the object to the corresponding type if he wants.
+     * @note The object must be released before unloadPlugins() is called.
      * @return The object or NULL if the plugin is not loaded.
      */
     std::shared_ptr<IPlugin> pluginObject(const std::string& name) const;
@@ -327,6 +628,404 @@ public:
      */
     PluginInfo pluginInfo(const std::string& name) const;
 
+    /**
+     * @brief Checks if a dependency of a plugin is marked `"optional": true` in its metadata.
+     * @note The flags are not part of Dependency, to keep the layout of PluginInfo.
+     * @param name The plugin's name
+     * @param dependency The name of the dependency
+     * @return false if the plugin is not found or if dependency is not one of its dependencies
+     */
+    bool isOptionalDependency(const std::string& name, const std::string& dependency) const;
+    /**
+     * @brief Checks if a dependency of a plugin is marked `"lazy": true` in its metadata.
+     * @see isOptionalDependency()
+     */
+    bool isLazyDependency(const std::string& name, const std::string& dependency) const;
+
+    /**
+     * @brief Enable the compact mode.
+     *
+     * Once the plugins are loaded, the metadata only used by pluginInfo() (pretty name,
+     * author, url, license and copyright) is released. pluginInfo() reads it again from
+     * the plugin library when it is called, which is slower but reduces the memory used
+     * per plugin. The dependencies are kept: they are needed to reload evicted plugins.
+     * @param enable true to enable the compact mode, false to disable it (default)
+     * and restore the full metadata of the loaded plugins.
+     */
+    void setCompactMode(bool enable);
+
+    /**
+     * @brief Enable the eviction of idle plugins.
+     *
+     * Plugins that opt in with `"evictable": true` in their metadata are unloaded
+     * when they have not been used for @a delay milliseconds, if no loaded plugin
+     * depends on them. They are loaded again (with their evicted dependencies)
+     * on their next use. A plugin is used when it receives a request from the
+     * main plugin, when a request is posted to it, or when pluginObject() is called for it.
+     *
+     * The eviction is done by a background thread, so aboutToBeUnloaded() is called from this thread.
+     * @note The main plugin is never evicted, nor a plugin whose object returned
+     * by pluginObject() is still referenced, nor a plugin with posted requests
+     * (sent or received) not delivered yet. This also applies to the memory pressure shedding.
+     * @param delay The idle delay in milliseconds, 0 to disable the eviction (default).
+     */
+    void setIdleEvictionDelay(unsigned int delay);
+    /**
+     * @brief Evict now the evictable plugins unused for at least @a minIdleTime milliseconds.
+     * @see setIdleEvictionDelay()
+     * @return The number of evicted plugins.
+     */
+    size_t evictIdlePlugins(unsigned int minIdleTime = 0);
+
+    /**
+     * @brief Enable the shedding of plugins when the memory is under pressure.
+     *
+     * A background thread reads the Linux PSI memory pressure (memory.pressure of
+     * the process cgroup, or /proc/pressure/memory) every @a interval milliseconds.
+     * While some tasks are stalled on memory for more than @a threshold percent of the time,
+     * the following steps are applied one after the other (one step per check):
+     *  1. IPlugin::dropCaches() is called for all loaded plugins.
+     *  2. Evictable plugins that are not in use are evicted (see setIdleEvictionDelay()).
+     *  3. Plugins with `"priority": "background"` in their metadata are unloaded
+     *     (same conditions as evictable plugins).
+     *
+     * The plugins unloaded by these steps are loaded again when the pressure clears.
+     * Until then, they are reloaded on their next use like evicted plugins.
+     * @param threshold Part of the time (in %) with stalled tasks above which the memory is under pressure
+     * @param interval Time between two checks (in ms)
+     * @param pressureFile The PSI file to read (found automatically if empty)
+     * @return MEMORY_PRESSURE_NOT_AVAILABLE if the PSI file cannot be read (not Linux, or kernel without PSI)
+     */
+    ReturnCode enableMemoryPressureShedding(unsigned int threshold = 10,
+                                            unsigned int interval = 1000,
+                                            const std::string& pressureFile = std::string());
+    /**
+     * @brief Stop monitoring the memory pressure, and restore the plugins unloaded because of it.
+     */
+    void disableMemoryPressureShedding();
+
+    /**
+     * @brief Page out the code and read-only data of a loaded plugin.
+     *
+     * Applies madvise() on the read-only mappings of the plugin library (found with
+     * dl_iterate_phdr() when the plugin is loaded). The plugin stays loaded: pages are
+     * read again from the file when they are used.
+     *
+     * With @a reclaim, MADV_PAGEOUT reclaims the pages immediately. Otherwise, MADV_COLD
+     * only marks them as the first candidates for reclaim (the resident size does not change
+     * until the kernel needs memory).
+     * @note Requires Linux 5.4 or later.
+     * @param name The plugin's name
+     * @param reclaim Use MADV_PAGEOUT (true) or MADV_COLD (false)
+     * @param report If not null, filled with the resident sizes before and after
+     * @return PAGEOUT_PLUGIN_NOT_LOADED or PAGEOUT_NOT_SUPPORTED on error
+     */
+    ReturnCode pageOutPlugin(const std::string& name, bool reclaim = true, PageOutReport* report = nullptr);
+    /**
+     * @brief Page out the plugins that are idle.
+     *
+     * Like setIdleEvictionDelay(), but for all plugins: pageOutPlugin() is called once
+     * for each plugin unused for @a delay milliseconds (see setIdleEvictionDelay() for
+     * what a use is; requests between dependencies are not counted).
+     * @param delay The idle delay in milliseconds, 0 to disable (default).
+     */
+    void setIdlePageOutDelay(unsigned int delay);
+
+    /**
+     * @brief Enable the real-time mode.
+     *
+     * In real-time mode, all the mappings of each plugin library are faulted in and locked
+     * in memory (with mlock()) just after its loaded() function, so no page fault happens later
+     * when the plugin is used. Plugins already loaded are locked by this call.
+     * The mappings of the manager library, and the stacks of the manager threads
+     * started after this call, are also locked.
+     *
+     * The total locked size is limited by @a lockBudget. When it would be exceeded (or when
+     * mlock() fails, see RLIMIT_MEMLOCK), the pages are only prefaulted, and
+     * ManagerMetrics::lockFailures is incremented.
+     * @param lockBudget Maximum size of the locked memory (in bytes)
+     * @see lockedMemory()
+     */
+    void enableRealTimeMode(size_t lockBudget);
+    /**
+     * @brief Disable the real-time mode and unlock the memory locked by the plugins and the manager.
+     * @note The stacks of the running manager threads stay locked until these threads stop.
+     */
+    void disableRealTimeMode();
+    /**
+     * @brief Get the size of the memory locked for a plugin in real-time mode.
+     * @param name The plugin's name
+     * @return The locked size in bytes (0 if the plugin is not locked)
+     */
+    size_t lockedMemory(const std::string& name) const;
+
+    /**
+     * @brief Set the directory of the plugins state files.
+     *
+     * Each plugin can keep a persistent memory-mapped state in this directory
+     * (in a file named after the plugin), see statefile.h. The state files are
+     * disabled while the directory is empty (default).
+     * @note The directory must exist. Only supported on Linux.
+     */
+    void setStateDirectory(const std::string& dir);
+    /**
+     * @brief Get the directory of the plugins state files.
+     * @see setStateDirectory()
+     */
+    std::string stateDirectory() const;
+
+    /**
+     * @brief Share the identical resources embedded in several plugins.
+     *
+     * When a plugin is loaded, the resources embedded with embed_resources() (see EmbedMetadata.cmake)
+     * are compared with the resources of the plugins already loaded: first by size, then by
+     * a hash of the content (only computed when two resources have the same size) and by the bytes.
+     * The pages of a duplicate are replaced by a mapping of the file of the first plugin
+     * that embedded the content, so the content is only kept once in memory.
+     * The views returned by resources.h are unchanged.
+     *
+     * Only whole pages are shared: resources smaller than a page are ignored.
+     * The memory saved is reported by ManagerMetrics::sharedResourceBytes.
+     *
+     * The hash and the comparison read the whole content, which makes loading slower: with 8 plugins
+     * embedding the same 448 kB resource (justplug-bench-sharing), the memory growth goes from 3.6 MB
+     * to 0.6 MB, but the load time goes from 0.6 ms to 1.6 ms (about 2.5 times slower).
+     * The pages of a duplicate read by the comparison stay in the page cache (they are not
+     * evicted, since other processes may use them).
+     * @note Applies to the plugins loaded after the call. Only supported on Linux.
+     * @param enable true to enable the sharing, false to disable it (default).
+     */
+    void enableResourceSharing(bool enable);
+
+    /**
+     * @brief Persist the load order computed by loadPlugins() in a file.
+     *
+     * The load order and the version of each plugin are saved with a fingerprint of
+     * the names, the versions and the dependencies of all found plugins. When the
+     * fingerprint is the same on the next start, loadPlugins() reads the order from
+     * the file and skips the dependencies resolution. The order is computed (and saved)
+     * again as soon as a plugin is added, removed or updated.
+     *
+     * The order is only saved when all plugins can be loaded, so that dependency
+     * errors are always reported.
+     * @param path Path of the cache file, empty to disable the cache (default).
+     */
+    void setLoadOrderCache(const std::string& path);
+
+    /**
+     * @brief Check the plugin libraries against a manifest before loading them.
+     *
+     * searchForPlugins() hashes every library found (in parallel) before it is loaded,
+     * and rejects (with SEARCH_INTEGRITY_MISMATCH) the files that are missing from the
+     * manifest or whose hashes are different. An evicted plugin is checked again before
+     * it is reloaded. The hashes are cached: a file is hashed again only if its
+     * inode, size, mtime or ctime changed.
+     *
+     * Each line of the manifest is "<hash> <crypto hash> <path>": the 64-bit fast
+     * non-cryptographic hash of the file (16 hex digits), its cryptographic hash (hex digest of
+     * the function set with setCryptoHashFunction(), or - if not checked), and the path of the file
+     * relative to the directory given to searchForPlugins(). Lines starting with # are ignored.
+     * Use createIntegrityManifest() to write a manifest.
+     * @param manifestPath Path of the manifest file.
+     * @return INTEGRITY_MANIFEST_ERROR if the manifest cannot be read (the check is then disabled).
+     */
+    ReturnCode enableIntegrityCheck(const std::string& manifestPath);
+    /**
+     * @brief Disable the integrity check (default).
+     */
+    void disableIntegrityCheck();
+    /**
+     * @brief Set the cryptographic hash function used by the integrity check (none by default).
+     *
+     * Files with a cryptographic hash in the manifest are rejected while no function is set.
+     * @param func The hash function (an empty function removes it).
+     */
+    void setCryptoHashFunction(hashFunction func);
+    /**
+     * @brief Write the manifest of the libraries in @a pluginDir, for enableIntegrityCheck().
+     * @param pluginDir The plugins directory.
+     * @param manifestPath Path of the manifest file (overwritten).
+     * @param recursive If true, the libraries of the sub-directories are included.
+     * @return INTEGRITY_MANIFEST_ERROR if the manifest cannot be written,
+     * SEARCH_LISTFILES_ERROR if the directory cannot be read.
+     */
+    ReturnCode createIntegrityManifest(const std::string& pluginDir, const std::string& manifestPath, bool recursive = false);
+
+    /**
+     * @brief Size of the threads pool used by the search (the hashing of the integrity check).
+     *
+     * The pool starts with one thread per CPU available to the process (cpu.max of its cgroup and
+     * its affinity mask). During each run, it measures the time the tasks spend waiting (slow storage)
+     * and running, and grows up to cpuLimit * (1 + waitRatio) threads, or shrinks. The count chosen
+     * by a run is used at the start of the next one.
+     */
+    WorkerPoolInfo workerPoolInfo() const;
+    /**
+     * @brief Pin the number of threads of the pool, for example to the workers reported by workerPoolInfo().
+     * @param count The number of threads (0 to size the pool automatically, the default).
+     */
+    void setWorkerCount(unsigned int count);
+
+    /**
+     * @brief Share the search results with the other processes of the host.
+     *
+     * The plugins found by searchForPlugins() (path and metadata) are stored in the POSIX shared
+     * memory segment @a name, with the modification time of the searched directories. When another
+     * process searches the same directory, it reads the plugins from the segment instead of loading
+     * every library to read its metadata; the libraries are then loaded by loadPlugins().
+     * An entry is searched again (and replaced) as soon as the mtime of one of its directories
+     * changes (a library is added, removed or renamed), or the mtime or the size of one of its
+     * libraries changes (a library is overwritten in place). A search is not stored if one of these
+     * files was modified less than a second before it, so that a change within the mtime granularity
+     * is not missed. A library overwritten later with the same size and its previous mtime
+     * (for example restored with `cp -p` or `rsync -t`) is not detected, nor a change of the
+     * libraries the plugins link to: remove the segment in this case.
+     *
+     * The segment is only used if it belongs to the current user and is not writable by others.
+     * It persists until it is removed (shm_unlink() or /dev/shm on Linux).
+     * @param name Name of the segment, starting with a slash (for example "/justplug").
+     * @return SHARED_REGISTRY_ERROR if the segment cannot be opened or created
+     * (or if the platform is not supported).
+     */
+    ReturnCode enableSharedRegistry(const std::string& name);
+    /**
+     * @brief Stop using the shared registry (default).
+     */
+    void disableSharedRegistry();
+
+    /**
+     * @brief Monitor the health of the loaded plugins.
+     *
+     * A background thread calls IPlugin::healthCheck() of each loaded plugin every @a interval
+     * milliseconds. The checks run on worker threads, so a check that blocks does not delay the
+     * others: a plugin whose check does not return within @a timeout milliseconds is UNHEALTHY,
+     * and it is not checked again until its check returns. A plugin can set its own values
+     * with `"healthCheckInterval"` and `"healthCheckTimeout"` (in ms) in its metadata
+     * (an interval of 0 disables its checks).
+     *
+     * The health is also inferred from the requests: the plugins receive the requests of their
+     * dependents and of the main plugin through a proxy which counts the failed requests.
+     * A request fails if the plugin returns IPlugin::COMMON_ERROR (or RESULT_FALSE, which has the
+     * same value) or IPlugin::CORRUPTED, or if the plugin cannot be reloaded. Any other code
+     * (UNKNOWN_REQUEST, NOT_FOUND, NOT_SUPPORTED or a code defined by the plugin) is an answer
+     * of a healthy plugin, and a THROTTLED request does not reach it. Once @a minRequests requests
+     * were received since the previous evaluation, the plugin is UNHEALTHY if at least
+     * @a errorRate percent of them failed, DEGRADED if at least half of this rate failed.
+     * The requests are only observed for the plugins loaded after this call.
+     *
+     * The state of a plugin is the worst of both. It can be read without locking with
+     * pluginHealth(), and the changes are reported to the function set with setHealthCallback().
+     * @note A plugin is not unloaded while its check is running.
+     * @param interval Default time between two checks of a plugin (in ms, at least 1).
+     * @param timeout Default timeout of a check (in ms, at least 1).
+     * @param errorRate Part of the failed requests (in %) above which a plugin is UNHEALTHY.
+     * @param minRequests Minimum number of requests to evaluate the error rate.
+     */
+    void enableHealthChecks(unsigned int interval = 5000, unsigned int timeout = 1000,
+                            unsigned int errorRate = 50, unsigned int minRequests = 20);
+    /**
+     * @brief Stop the health checks (default). Waits for the running checks.
+     */
+    void disableHealthChecks();
+    /**
+     * @brief Get the health of a plugin.
+     *
+     * The object is updated by the manager as long as the plugin exists, and stays valid after
+     * the plugin is unloaded (its state is then HEALTH_UNKNOWN).
+     * @return The health object, or NULL if the plugin does not exist.
+     */
+    std::shared_ptr<const PluginHealth> pluginHealth(const std::string& name) const;
+    /**
+     * @brief Set the function called when the health state of a plugin changes.
+     * @param func The function (an empty function removes it).
+     */
+    void setHealthCallback(healthCallback func);
+
+    /**
+     * @brief Limit the rate of the requests sent by a plugin to another one.
+     *
+     * Each sender has its own token bucket: @a rate requests per second, with bursts of up
+     * to @a burst requests. The requests above the limit return IPlugin::THROTTLED without
+     * reaching the receiver. The buckets are lock-free, so the requests under the limit are
+     * not serialized.
+     *
+     * Limits apply to the requests sent to the dependencies and by the main plugin. They are
+     * bound when the sender is loaded: a new limit applies to the senders loaded after this
+     * call, while the limits of the pairs already bound are updated immediately.
+     * A plugin can also limit each of its senders with `"rateLimit"` (requests per second)
+     * and `"rateBurst"` in its metadata. The most specific limit is used: the limit of the
+     * pair, then the limit set for all senders here, then the metadata of the receiver.
+     * @param sender Name of the sender plugin, or an empty string for all senders.
+     * @param receiver Name of the receiver plugin.
+     * @param rate Number of requests per second (0 removes the limit).
+     * @param burst Maximum number of requests sent at once (if 0, rate / 10, at least 1).
+     * @see rateLimitStats()
+     */
+    void setRateLimit(const std::string& sender, const std::string& receiver, double rate, double burst = 0);
+    /**
+     * @brief Get the counters of the rate limited pairs of plugins.
+     *
+     * The counters are kept when the plugins are unloaded. The pairs are sorted by number
+     * of throttled requests (noisiest senders first).
+     */
+    std::vector<RateLimitStats> rateLimitStats() const;
+
+    /**
+     * @brief Coalesce the requests posted to @a receiver with IPlugin::postRequest().
+     *
+     * By default, the request thread of the receiver is woken as soon as a request is posted.
+     * With coalescing, it waits for more requests before delivering them together, until
+     * @a maxBatch requests are queued or the delay elapsed, which saves a wake-up per request.
+     * The delay adapts to the rate of the requests: it is long enough to fill a batch at the
+     * current rate (at most @a maxDelay), and 0 when no other request is expected within
+     * @a maxDelay, so that the latency does not change at low load.
+     * @param receiver Name of the receiver plugin.
+     * @param maxDelay Maximum delay in microseconds (0 disables the coalescing).
+     * @param maxBatch Maximum number of requests delivered at once.
+     */
+    void setRequestCoalescing(const std::string& receiver, unsigned int maxDelay, unsigned int maxBatch = 64);
+
+    /**
+     * @brief Trace the requests between plugins.
+     *
+     * Each request handled through the manager (sent to a dependency or by the main plugin,
+     * sent to the manager, or posted) is a span. A request is a child of the request handled
+     * by the thread that sent it, and a posted request is a child of the request that posted it,
+     * so each trace is the tree of the requests caused by a first one. The context of the requests
+     * is propagated by the manager: the plugins do not need to be changed.
+     * A request sent by a thread that does not handle a traced request starts a new trace, with
+     * the probability @a sampleRate (head sampling: the whole tree is traced, or none of it).
+     * The completed traces are given to the sink set with setTraceSink().
+     * @note The requests to the dependencies are observed through an object bound when the
+     * sender is loaded (like the health checks), so the tracing must be enabled before
+     * loadPlugins(). The requests a plugin sends to itself are not traced.
+     * @param sampleRate Probability of tracing a new request tree (0 to 1).
+     */
+    void enableTracing(double sampleRate = 1.0);
+    /**
+     * @brief Stop tracing the requests (the traces in progress are completed).
+     */
+    void disableTracing();
+    /**
+     * @brief Set the function receiving the completed traces (by default, they are dropped).
+     *
+     * The sink is called by the thread that completes the trace (the thread of the root request,
+     * or a request thread when the trace ends with a posted request), one trace at a time.
+     * It may be called while the manager is locked, so it must not use the manager.
+     * @see fileTraceSink()
+     */
+    void setTraceSink(traceSink sink);
+    /**
+     * @brief Create a sink appending each trace to @a path as one line of JSON.
+     * @return The sink, or an empty function if the file cannot be opened.
+     */
+    static traceSink fileTraceSink(const std::string& path);
+
+    /**
+     * @brief Get the counters of the plugin manager.
+     */
+    ManagerMetrics metrics() const;
+
 private:
     PluginManager();
     ~PluginManager();
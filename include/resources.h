@@ -0,0 +1,404 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RESOURCES_H
+#define RESOURCES_H
+
+/*
+ * Access to the resources embedded in a plugin with embed_resources()
+ * (see EmbedMetadata.cmake).
+ * The resources are stored in the read-only part of the plugin library: the views
+ * point directly to the mapped data (no copy), each resource starts on a page boundary,
+ * and the pages are only read from the disk when they are accessed.
+ *
+ * Resources embedded with the COMPRESSED_FILES option are stored in chunks compressed by
+ * lzcodec.h. They are read with a ResourceReader (streaming) or a ResourceCache
+ * (random access, the decompressed chunks are shared by all users of the cache).
+ * Both also work with uncompressed resources.
+ */
+
+#include <cstddef> // for size_t
+#include <cstring> // for strcmp, memcpy
+#include <functional> // for std::hash
+#include <list> // for std::list
+#include <memory> // for std::shared_ptr
+#include <mutex> // for std::mutex
+#include <unordered_map> // for std::unordered_map
+#include <utility> // for std::pair
+#include <vector> // for std::vector
+
+#include "confinfo.h"
+#include "lzcodec.h"
+
+namespace jp_private
+{
+
+// Entry of the table generated by embed_resources() (terminated by an entry with a NULL name)
+struct ResourceEntry
+{
+    const char* name;
+    const unsigned char* begin;
+    const unsigned char* end;
+    size_t flags;
+};
+
+// Values of ResourceEntry::flags
+const size_t RESOURCE_COMPRESSED = 1;
+
+} // namespace jp_private
+
+// The table is hidden in each plugin, and weak so that plugins without resources still link
+#if defined(CONFINFO_COMPILER_GCC) || defined(CONFINFO_COMPILER_CLANG)
+extern "C" __attribute__((weak, visibility("hidden"))) const jp_private::ResourceEntry jp_resources[];
+#   define _JP_RESOURCES_TABLE jp_resources
+#else
+// embed_resources() needs a GNU compatible assembler
+#   define _JP_RESOURCES_TABLE static_cast<const jp_private::ResourceEntry*>(nullptr)
+#endif
+
+namespace jp
+{
+
+/**
+ * @struct ResourceView
+ * @brief Read-only view on an embedded resource.
+ *
+ * If data is NULL, the resource does not exist.
+ */
+struct ResourceView
+{
+    const char* name = nullptr; //!< The name of the resource (its path, as given to embed_resources())
+    const unsigned char* data = nullptr; //!< The content of the resource (valid while the plugin is loaded)
+    size_t size = 0; //!< The size of the resource in bytes (the compressed size if compressed is true)
+    bool compressed = false; //!< If true, data must be read with a ResourceReader or a ResourceCache
+
+    /**
+     * @brief Returns true if the view points to an existing resource.
+     */
+    bool isValid() const { return data != nullptr; }
+
+    /**
+     * @brief Returns the size of the resource once decompressed (0 if the resource is corrupted).
+     */
+    size_t uncompressedSize() const
+    {
+        if(!compressed)
+            return size;
+        jp_private::lz::Container container;
+        return container.parse(data, size) ? container.size : 0;
+    }
+};
+
+/**
+ * @brief Returns the number of resources embedded in the calling plugin.
+ */
+inline size_t resourcesCount()
+{
+    const jp_private::ResourceEntry* table = _JP_RESOURCES_TABLE;
+    size_t count = 0;
+    while(table && table[count].name)
+        ++count;
+    return count;
+}
+
+/**
+ * @brief Returns the resource at @a index, or an invalid view if @a index is out of range.
+ * @see resourcesCount()
+ */
+inline ResourceView resourceAt(size_t index)
+{
+    ResourceView view;
+    if(index >= resourcesCount())
+        return view;
+
+    const jp_private::ResourceEntry& entry = _JP_RESOURCES_TABLE[index];
+    view.name = entry.name;
+    view.data = entry.begin;
+    view.size = entry.end - entry.begin;
+    view.compressed = (entry.flags & jp_private::RESOURCE_COMPRESSED) != 0;
+    return view;
+}
+
+/**
+ * @brief Returns the resource called @a name, or an invalid view if it does not exist.
+ */
+inline ResourceView findResource(const char* name)
+{
+    const jp_private::ResourceEntry* table = _JP_RESOURCES_TABLE;
+    for(size_t i=0; table && table[i].name; ++i)
+    {
+        if(strcmp(table[i].name, name) == 0)
+            return resourceAt(i);
+    }
+    return ResourceView();
+}
+
+/**
+ * @class ResourceReader
+ * @brief Sequential reader of a resource, decompressing one chunk at a time.
+ *
+ * The decompressed chunk is owned by the reader (it does not use the shared cache).
+ */
+class ResourceReader
+{
+public:
+    explicit ResourceReader(const ResourceView& resource): _resource(resource)
+    {
+        if(_resource.compressed && !_container.parse(_resource.data, _resource.size))
+            _resource = ResourceView();
+    }
+
+    /**
+     * @brief Returns false if the resource does not exist or is corrupted.
+     */
+    bool isValid() const { return _resource.isValid(); }
+    /**
+     * @brief Returns the uncompressed size of the resource.
+     */
+    size_t size() const { return _resource.compressed ? _container.size : _resource.size; }
+    /**
+     * @brief Returns the current position in the uncompressed resource.
+     */
+    size_t tell() const { return _pos; }
+    bool atEnd() const { return _pos >= size(); }
+    /**
+     * @brief Move the current position. Returns false if @a pos is after the end.
+     */
+    bool seek(size_t pos)
+    {
+        if(pos > size())
+            return false;
+        _pos = pos;
+        return true;
+    }
+
+    /**
+     * @brief Copy up to @a size bytes from the current position into @a buffer.
+     * @return The number of bytes read (less than @a size at the end of the resource,
+     * or if a chunk is corrupted).
+     */
+    size_t read(void* buffer, size_t size)
+    {
+        unsigned char* out = static_cast<unsigned char*>(buffer);
+        size_t done = 0;
+        while(done < size && !atEnd())
+        {
+            const unsigned char* data;
+            size_t available;
+            if(_resource.compressed)
+            {
+                const size_t index = _pos / _container.chunkSize;
+                if(index != _chunkIndex)
+                {
+                    _chunk.resize(_container.chunkLength(index));
+                    if(!_container.decompressChunk(index, _chunk.data()))
+                        break;
+                    _chunkIndex = index;
+                }
+                const size_t offset = _pos - index*_container.chunkSize;
+                data = _chunk.data() + offset;
+                available = _chunk.size() - offset;
+            }
+            else
+            {
+                data = _resource.data + _pos;
+                available = _resource.size - _pos;
+            }
+
+            const size_t length = available < size - done ? available : size - done;
+            memcpy(out + done, data, length);
+            done += length;
+            _pos += length;
+        }
+        return done;
+    }
+
+private:
+    ResourceView _resource;
+    jp_private::lz::Container _container;
+    size_t _pos = 0;
+    // Last decompressed chunk
+    std::vector<unsigned char> _chunk;
+    size_t _chunkIndex = size_t(-1);
+};
+
+/**
+ * @class ResourceCache
+ * @brief Random access to resources, with a cache of decompressed chunks.
+ *
+ * The least recently used chunks are dropped when the cache exceeds its capacity.
+ * The methods can be called from several threads.
+ * @see ResourceCache::shared()
+ */
+class ResourceCache
+{
+public:
+    typedef std::shared_ptr<const std::vector<unsigned char>> Chunk;
+
+    explicit ResourceCache(size_t capacity = 32*1024*1024): _capacity(capacity) {}
+
+    /**
+     * @brief Returns the cache shared by the whole plugin.
+     */
+    static ResourceCache& shared()
+    {
+        static ResourceCache cache;
+        return cache;
+    }
+
+    /**
+     * @brief Copy up to @a size bytes at @a offset of the uncompressed resource into @a buffer.
+     * Uncompressed resources are read directly from the library.
+     * @return The number of bytes read.
+     */
+    size_t read(const ResourceView& resource, size_t offset, void* buffer, size_t size)
+    {
+        unsigned char* out = static_cast<unsigned char*>(buffer);
+        if(!resource.compressed)
+        {
+            if(offset >= resource.size)
+                return 0;
+            const size_t length = size < resource.size - offset ? size : resource.size - offset;
+            memcpy(out, resource.data + offset, length);
+            return length;
+        }
+
+        jp_private::lz::Container container;
+        if(!container.parse(resource.data, resource.size))
+            return 0;
+
+        size_t done = 0;
+        while(done < size && offset + done < container.size)
+        {
+            const size_t index = (offset + done) / container.chunkSize;
+            const Chunk data = chunk(resource, index);
+            if(!data)
+                break;
+
+            const size_t chunkOffset = offset + done - index*container.chunkSize;
+            const size_t available = data->size() - chunkOffset;
+            const size_t length = available < size - done ? available : size - done;
+            memcpy(out + done, data->data() + chunkOffset, length);
+            done += length;
+        }
+        return done;
+    }
+
+    /**
+     * @brief Returns the decompressed chunk @a index of a compressed resource
+     * (NULL if it does not exist). It stays valid while it is referenced, even if dropped.
+     */
+    Chunk chunk(const ResourceView& resource, size_t index)
+    {
+        const Key key(resource.data, index);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _chunks.find(key);
+            if(it != _chunks.end())
+            {
+                ++_hits;
+                _lru.splice(_lru.begin(), _lru, it->second.second);
+                return it->second.first;
+            }
+            ++_misses;
+        }
+
+        // Decompress without the lock (another thread may decompress the same chunk)
+        jp_private::lz::Container container;
+        if(!container.parse(resource.data, resource.size) || index >= container.chunksCount)
+            return Chunk();
+        std::shared_ptr<std::vector<unsigned char>> data(new std::vector<unsigned char>(container.chunkLength(index)));
+        if(!container.decompressChunk(index, data->data()))
+            return Chunk();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _chunks.find(key);
+        if(it != _chunks.end())
+            return it->second.first;
+        _lru.push_front(key);
+        _chunks.emplace(key, std::make_pair(Chunk(data), _lru.begin()));
+        _memoryUsage += data->size();
+        shrink(_capacity);
+        return data;
+    }
+
+    void setCapacity(size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _capacity = capacity;
+        shrink(_capacity);
+    }
+
+    size_t capacity() const { std::lock_guard<std::mutex> lock(_mutex); return _capacity; }
+    /**
+     * @brief Returns the size of the decompressed chunks kept by the cache.
+     */
+    size_t memoryUsage() const { std::lock_guard<std::mutex> lock(_mutex); return _memoryUsage; }
+    size_t hits() const { std::lock_guard<std::mutex> lock(_mutex); return _hits; }
+    size_t misses() const { std::lock_guard<std::mutex> lock(_mutex); return _misses; }
+
+    /**
+     * @brief Drop all chunks (for instance from IPlugin::dropCaches()).
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        shrink(0);
+    }
+
+private:
+    // Resource data and chunk index
+    typedef std::pair<const unsigned char*, size_t> Key;
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        { return std::hash<const unsigned char*>()(key.first) ^ (key.second * 0x9e3779b9u); }
+    };
+
+    // Must be called with the mutex locked
+    void shrink(size_t capacity)
+    {
+        while(_memoryUsage > capacity && !_lru.empty())
+        {
+            auto it = _chunks.find(_lru.back());
+            _memoryUsage -= it->second.first->size();
+            _chunks.erase(it);
+            _lru.pop_back();
+        }
+    }
+
+    mutable std::mutex _mutex;
+    size_t _capacity;
+    size_t _memoryUsage = 0;
+    size_t _hits = 0;
+    size_t _misses = 0;
+    // Most recently used first
+    std::list<Key> _lru;
+    std::unordered_map<Key, std::pair<Chunk, std::list<Key>::iterator>, KeyHash> _chunks;
+};
+
+} // namespace jp
+
+#endif // RESOURCES_H
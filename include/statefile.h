@@ -0,0 +1,73 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef STATEFILE_H
+#define STATEFILE_H
+
+#include <cstdint> // for uint32_t, uint64_t
+
+namespace jp
+{
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @struct StateFile
+ * @brief A memory-mapped state file of a plugin.
+ *
+ * Each plugin can keep a persistent state (for instance a prebuilt index) in a file of
+ * the state directory of the manager (see PluginManager::setStateDirectory()), to avoid
+ * rebuilding it on every start. The state is accessed with manager requests, data being
+ * a pointer to a StateFile object owned by the plugin:
+ *  - IPlugin::MAP_STATEFILE maps the published state (read-only). The request fails with
+ *    IPlugin::CORRUPTED if the checksum does not match. The plugin should also check
+ *    pluginVersion and formatVersion before using the content.
+ *  - IPlugin::CREATE_STATEFILE creates a new writable state of @a size bytes (size and
+ *    formatVersion must be set before the request).
+ *  - IPlugin::PUBLISH_STATEFILE replaces atomically the published state by a created one,
+ *    and unmaps it. Mappings of the previous state stay valid until they are released.
+ *  - IPlugin::RELEASE_STATEFILE unmaps a state (a created state is discarded).
+ *
+ * All states still mapped are released when the plugin is unloaded.
+ */
+struct StateFile
+{
+    void* data = nullptr; //!< The content of the state (page-aligned, read-only if mapped with MAP_STATEFILE)
+    uint64_t size = 0; //!< The size of the content in bytes
+    uint32_t formatVersion = 0; //!< Version of the content layout, chosen by the plugin
+    const char* pluginVersion = nullptr; //!< Version of the plugin that published the state
+    uint64_t checksum = 0; //!< Checksum of the content (computed by the manager on publish)
+    uint64_t generation = 0; //!< Incremented on each publish
+    void* handle = nullptr; //!< Used by the manager
+};
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+} // namespace jp
+
+#endif // STATEFILE_H
@@ -0,0 +1,193 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "private/blobcache.h"
+
+#include <algorithm> // for std::find
+#include <cstring> // for memcmp
+
+#include "confinfo.h"
+
+#include "private/hash.h"
+#include "private/sysutil.h"
+
+#ifdef CONFINFO_PLATFORM_LINUX
+#  include <fcntl.h> // for open
+#  include <sys/mman.h> // for mmap, mremap
+#  include <unistd.h> // for close, sysconf
+#endif
+
+using namespace jp_private;
+
+BlobCache::~BlobCache()
+{
+#ifdef CONFINFO_PLATFORM_LINUX
+    for(auto& blob : _blobs)
+    {
+        if(blob.second.fd != -1)
+            close(blob.second.fd);
+    }
+#endif
+}
+
+void BlobCache::release(std::vector<Ref>* refs)
+{
+    for(const Ref& ref : *refs)
+    {
+        auto range = _blobs.equal_range(ref.blob->size);
+        for(auto it = range.first; it != range.second; ++it)
+        {
+            Blob& blob = it->second;
+            if(&blob != ref.blob)
+                continue;
+
+            // Another copy is used to hash the content (the pages of the copies are the same)
+            blob.copies.erase(std::find(blob.copies.begin(), blob.copies.end(), ref.address));
+            if(blob.copies.empty())
+            {
+#ifdef CONFINFO_PLATFORM_LINUX
+                if(blob.fd != -1)
+                    close(blob.fd);
+#endif
+                _blobs.erase(it);
+            }
+            break;
+        }
+    }
+    refs->clear();
+}
+
+uint64_t BlobCache::blobHash(Blob& blob)
+{
+    if(!blob.hashed)
+    {
+        blob.hash = hash::hash64(blob.copies.front(), blob.size);
+        blob.hashed = true;
+    }
+    return blob.hash;
+}
+
+#ifdef CONFINFO_PLATFORM_LINUX
+
+size_t BlobCache::shareResources(const std::string& path, const ResourceEntry* table, std::vector<Ref>* refs)
+{
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t shared = 0;
+
+    for(const ResourceEntry* entry = table; entry->name; ++entry)
+    {
+        const size_t size = static_cast<size_t>(entry->end - entry->begin);
+        const uintptr_t address = reinterpret_cast<uintptr_t>(entry->begin);
+        uint64_t offset = 0;
+        // The file and the memory must have the same page alignment to be mapped
+        if(size < pageSize || address % pageSize != 0
+           || !sysutil::fileOffset(entry->begin, &offset) || offset % pageSize != 0)
+            continue;
+
+        // Only hash the content if another blob has the same size
+        Blob* match = nullptr;
+        size_t sharedBytes = 0;
+        bool hashed = false;
+        uint64_t hash = 0;
+        auto range = _blobs.equal_range(size);
+        for(auto it = range.first; it != range.second && !match; ++it)
+        {
+            if(!hashed)
+            {
+                hash = hash::hash64(entry->begin, size);
+                hashed = true;
+            }
+            if(blobHash(it->second) != hash)
+                continue;
+
+            sharedBytes = remap(it->second, entry->begin, pageSize);
+            if(sharedBytes > 0)
+                match = &it->second;
+        }
+
+        if(!match)
+        {
+            Blob blob;
+            blob.size = size;
+            blob.hashed = hashed;
+            blob.hash = hash;
+            blob.path = path;
+            blob.offset = offset;
+            match = &_blobs.emplace(size, std::move(blob))->second;
+        }
+
+        match->copies.push_back(entry->begin);
+        refs->push_back({match, entry->begin, sharedBytes});
+        shared += sharedBytes;
+    }
+
+    return shared;
+}
+
+size_t BlobCache::remap(Blob& blob, const unsigned char* address, size_t pageSize)
+{
+    // The file of the first copy is kept open, so the content of the
+    // blob does not change if the file is replaced on the disk
+    if(blob.fd == -1)
+    {
+        blob.fd = open(blob.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(blob.fd == -1)
+            return 0;
+    }
+
+    // The last partial page is shared with the data that follows the blob
+    const size_t length = blob.size - blob.size % pageSize;
+    void* file = mmap(nullptr, length, PROT_READ, MAP_SHARED, blob.fd, static_cast<off_t>(blob.offset));
+    if(file == MAP_FAILED)
+        return 0;
+
+    // Same hash, but the content may still be different
+    if(memcmp(file, address, length) != 0
+       || mremap(file, length, length, MREMAP_MAYMOVE | MREMAP_FIXED, const_cast<unsigned char*>(address)) == MAP_FAILED)
+    {
+        munmap(file, length);
+        return 0;
+    }
+
+    // The pages of the duplicate read by the comparison stay in the page cache: they may be
+    // used by other processes, and are reclaimed by the kernel like any other clean page
+
+    return length;
+}
+
+#else // CONFINFO_PLATFORM_LINUX
+
+size_t BlobCache::shareResources(const std::string& path, const ResourceEntry* table, std::vector<Ref>* refs)
+{
+    (void)path;(void)table;(void)refs;
+    return 0;
+}
+
+size_t BlobCache::remap(Blob& blob, const unsigned char* address, size_t pageSize)
+{
+    (void)blob;(void)address;(void)pageSize;
+    return 0;
+}
+
+#endif // CONFINFO_PLATFORM_LINUX
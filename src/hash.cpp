@@ -0,0 +1,145 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "private/hash.h"
+
+#include <cstring> // for memcpy
+
+
+namespace jp_private
+{
+namespace hash
+{
+
+namespace
+{
+
+const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// Little-endian reads (the hash must not depend on the machine)
+inline uint64_t read64(const unsigned char* ptr)
+{
+    uint64_t value = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&value, ptr, sizeof(value));
+#else
+    for(int i=7; i >= 0; --i)
+        value = (value << 8) | ptr[i];
+#endif
+    return value;
+}
+
+inline uint64_t read32(const unsigned char* ptr)
+{
+    return uint64_t(ptr[0]) | (uint64_t(ptr[1]) << 8) | (uint64_t(ptr[2]) << 16) | (uint64_t(ptr[3]) << 24);
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t value)
+{
+    acc ^= round(0, value);
+    return acc * PRIME1 + PRIME4;
+}
+
+} // namespace
+
+uint64_t hash64(const void* data, size_t size, uint64_t seed)
+{
+    const unsigned char* ptr = static_cast<const unsigned char*>(data);
+    const unsigned char* const end = ptr + size;
+    uint64_t h;
+
+    if(size >= 32)
+    {
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+
+        const unsigned char* const limit = end - 32;
+        do
+        {
+            v1 = round(v1, read64(ptr));
+            v2 = round(v2, read64(ptr + 8));
+            v3 = round(v3, read64(ptr + 16));
+            v4 = round(v4, read64(ptr + 24));
+            ptr += 32;
+        } while(ptr <= limit);
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeRound(h, v1);
+        h = mergeRound(h, v2);
+        h = mergeRound(h, v3);
+        h = mergeRound(h, v4);
+    }
+    else
+    {
+        h = seed + PRIME5;
+    }
+
+    h += size;
+
+    for(; ptr + 8 <= end; ptr += 8)
+    {
+        h ^= round(0, read64(ptr));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+    }
+    if(ptr + 4 <= end)
+    {
+        h ^= read32(ptr) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        ptr += 4;
+    }
+    for(; ptr < end; ++ptr)
+    {
+        h ^= (*ptr) * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+
+    // Avalanche
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+} // namespace hash
+} // namespace jp_private
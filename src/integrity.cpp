@@ -0,0 +1,221 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "private/integrity.h"
+
+#include <cstdio> // for snprintf
+#include <cstdlib> // for strtoull
+#include <fstream> // for std::ifstream
+#include <iterator> // for std::istreambuf_iterator
+#include <sstream> // for std::istringstream
+
+#include "confinfo.h"
+
+#include "private/hash.h"
+#include "private/workerpool.h"
+
+#ifdef CONFINFO_PLATFORM_LINUX
+#  include <fcntl.h> // for open
+#  include <sys/mman.h> // for mmap
+#  include <sys/stat.h> // for fstat
+#  include <unistd.h> // for close
+#endif
+
+using namespace jp_private;
+
+bool IntegrityChecker::loadManifest(const std::string& path)
+{
+    std::ifstream file(path);
+    if(!file)
+        return false;
+
+    std::unordered_map<std::string, ManifestEntry> manifest;
+    std::string line;
+    while(std::getline(file, line))
+    {
+        if(line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream stream(line);
+        std::string hash, cryptoHash;
+        if(!(stream >> hash >> cryptoHash) || hash.size() != 16)
+            return false;
+        // The path is the rest of the line (it can contain spaces)
+        std::string relativePath;
+        std::getline(stream >> std::ws, relativePath);
+        if(relativePath.empty())
+            return false;
+
+        char* end = nullptr;
+        const uint64_t value = strtoull(hash.c_str(), &end, 16);
+        if(*end != '\0')
+            return false;
+        manifest[relativePath] = ManifestEntry{value, cryptoHash == "-" ? std::string() : cryptoHash};
+    }
+
+    _manifest.swap(manifest);
+    _enabled = true;
+    return true;
+}
+
+void IntegrityChecker::setCryptoHash(const CryptoHash& cryptoHash)
+{
+    _cryptoHash = cryptoHash;
+    _cache.clear();
+}
+
+std::vector<IntegrityChecker::Digest> IntegrityChecker::hashFiles(const std::vector<std::string>& paths,
+                                                                  WorkerPool* pool,
+                                                                  Stats* stats)
+{
+    std::vector<Digest> digests(paths.size());
+    std::vector<FileKey> keys(paths.size());
+    std::vector<size_t> toHash;
+
+    // Reuse the digests of the unchanged files
+    for(size_t i=0; i < paths.size(); ++i)
+    {
+        if(!fileKey(paths[i], &keys[i]))
+        {
+            toHash.push_back(i);
+            continue;
+        }
+        const auto cached = _cache.find(cacheId(keys[i]));
+        const FileKey& key = keys[i];
+        if(cached != _cache.end()
+           && cached->second.key.device == key.device && cached->second.key.inode == key.inode
+           && cached->second.key.size == key.size
+           && cached->second.key.mtime == key.mtime && cached->second.key.ctime == key.ctime)
+        {
+            digests[i] = cached->second.digest;
+            stats->cacheHits++;
+        }
+        else
+        {
+            toHash.push_back(i);
+        }
+    }
+
+    pool->run(toHash.size(), [&](size_t i) {
+        digests[toHash[i]] = hashFile(paths[toHash[i]]);
+    });
+
+    for(size_t i : toHash)
+    {
+        if(!digests[i].valid)
+            continue;
+        stats->hashedFiles++;
+        stats->hashedBytes += keys[i].size;
+        // Files without a key (not supported on this platform) are always hashed
+        if(keys[i].inode != 0)
+            _cache[cacheId(keys[i])] = CacheEntry{keys[i], digests[i]};
+    }
+
+    return digests;
+}
+
+bool IntegrityChecker::verify(const std::string& relativePath, const Digest& digest) const
+{
+    const auto entry = _manifest.find(relativePath);
+    if(!digest.valid || entry == _manifest.end() || entry->second.hash != digest.hash)
+        return false;
+    // A file with a cryptographic hash in the manifest cannot be checked without the function
+    return entry->second.cryptoHash.empty() || entry->second.cryptoHash == digest.cryptoHash;
+}
+
+std::string IntegrityChecker::manifestLine(const std::string& relativePath, const Digest& digest)
+{
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(digest.hash));
+    return std::string(hash) + " " + (digest.cryptoHash.empty() ? "-" : digest.cryptoHash) + " " + relativePath;
+}
+
+#ifdef CONFINFO_PLATFORM_LINUX
+
+IntegrityChecker::Digest IntegrityChecker::hashFile(const std::string& path) const
+{
+    Digest digest;
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+        return digest;
+
+    struct stat st;
+    if(fstat(fd, &st) == 0)
+    {
+        const size_t size = static_cast<size_t>(st.st_size);
+        void* data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+        if(data != MAP_FAILED)
+        {
+            if(data)
+                madvise(data, size, MADV_SEQUENTIAL);
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            digest.hash = hash::hash64(bytes, size);
+            if(_cryptoHash)
+                digest.cryptoHash = _cryptoHash(bytes, size);
+            digest.valid = true;
+            if(data)
+                munmap(data, size);
+        }
+    }
+    close(fd);
+    return digest;
+}
+
+bool IntegrityChecker::fileKey(const std::string& path, FileKey* key)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0)
+        return false;
+    key->device = static_cast<uint64_t>(st.st_dev);
+    key->inode = static_cast<uint64_t>(st.st_ino);
+    key->size = static_cast<uint64_t>(st.st_size);
+    key->mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    key->ctime = static_cast<int64_t>(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+    return true;
+}
+
+#else // CONFINFO_PLATFORM_LINUX
+
+IntegrityChecker::Digest IntegrityChecker::hashFile(const std::string& path) const
+{
+    Digest digest;
+    std::ifstream file(path, std::ios::binary);
+    if(!file)
+        return digest;
+    const std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    digest.hash = hash::hash64(data.data(), data.size());
+    if(_cryptoHash)
+        digest.cryptoHash = _cryptoHash(data.data(), data.size());
+    digest.valid = true;
+    return digest;
+}
+
+bool IntegrityChecker::fileKey(const std::string& path, FileKey* key)
+{
+    // Without a file identity, the digests are not cached
+    (void)path;(void)key;
+    return false;
+}
+
+#endif // CONFINFO_PLATFORM_LINUX
@@ -59,6 +59,17 @@ jp::PluginInfo PluginInfoStd::toPluginInfo()
     return info;
 }
 
+void PluginInfoStd::compact()
+{
+    // Swap with empty strings, since clear() keeps the allocated memory
+    std::string().swap(prettyName);
+    std::string().swap(author);
+    std::string().swap(url);
+    std::string().swap(license);
+    std::string().swap(copyright);
+    dependencies.shrink_to_fit();
+}
+
 std::string PluginInfoStd::toString()
 {
     if(name.empty())
@@ -74,7 +85,8 @@ std::string PluginInfoStd::toString()
     str += "Copyright: " + copyright + "\n";
     str += "Dependencies:\n";
     for(const Dependency& dep : dependencies)
-        str += " - " + dep.name + " (" + dep.version + ")\n";
+        str += " - " + dep.name + " (" + dep.version + ")"
+               + (dep.optional ? " optional" : "") + (dep.lazy ? " lazy" : "") + "\n";
     return str;
 }
 
@@ -24,14 +24,18 @@
 
 #include "pluginmanager.h"
 
-#include <algorithm> // for std::find
+#include <algorithm> // for std::find, std::sort, std::stable_sort
+#include <fstream> // for std::ofstream
+#include <thread> // for std::thread
 #include <unordered_map> // for std::unordered_map
+#include <utility> // for std::move
 
 #include "sharedlibrary.h"
 
 #include "private/graph.h"
 #include "private/fsutil.h"
 #include "private/stringutil.h"
+#include "private/sysutil.h"
 #include "private/plugin.h"
 
 #include "version/version.h"
@@ -94,6 +98,9 @@ const char* ReturnCode::message(const ReturnCode &code)
     case SEARCH_LISTFILES_ERROR:
         return "An error occurs during the scan of the plugin dir";
         break;
+    case SEARCH_INTEGRITY_MISMATCH:
+        return "The plugin library does not match the integrity manifest";
+        break;
     case LOAD_DEPENDENCY_BAD_VERSION:
         return "The plugin requires a dependency that's in an incorrect version";
         break;
@@ -106,6 +113,21 @@ const char* ReturnCode::message(const ReturnCode &code)
     case UNLOAD_NOT_ALL:
         return "Not all plugins have been unloaded";
         break;
+    case MEMORY_PRESSURE_NOT_AVAILABLE:
+        return "The memory pressure information (PSI) is not available";
+        break;
+    case PAGEOUT_PLUGIN_NOT_LOADED:
+        return "The plugin is not loaded";
+        break;
+    case PAGEOUT_NOT_SUPPORTED:
+        return "The plugin code cannot be paged out (requires Linux 5.4 or later)";
+        break;
+    case INTEGRITY_MANIFEST_ERROR:
+        return "The integrity manifest cannot be read or written";
+        break;
+    case SHARED_REGISTRY_ERROR:
+        return "The shared registry cannot be opened";
+        break;
     }
     return "";
 }
@@ -120,8 +142,12 @@ PluginManager::PluginManager() : _p(new PlugMgrPrivate(this))
 
 PluginManager::~PluginManager()
 {
+    _p->stopIdleThread();
+    _p->stopMemoryPressureThread();
+    _p->stopHealthThread();
     if(!_p->pluginsMap.empty())
         unloadPlugins();
+    _p->stopRequestQueues();
     delete _p;
 }
 
@@ -134,11 +160,13 @@ PluginManager& PluginManager::instance()
 
 void PluginManager::setLogStream(std::ostream& logStream)
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     _p->log = std::ref(logStream);
 }
 
 void PluginManager::enableLogOutput(const bool &enable)
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     if(!_p->useLog && enable)
         _p->log.get() << "Enable log output" << std::endl;
     _p->useLog = enable;
@@ -151,9 +179,27 @@ void PluginManager::disableLogOutput()
 
 ReturnCode PluginManager::searchForPlugins(const std::string &pluginDir, bool recursive, callback callbackFunc)
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     if(_p->useLog)
         _p->log.get() << "Search for plugins in " << pluginDir << std::endl;
 
+    // The plugins found by another process are reused if the directories did not change since
+    SharedRegistry::DirTimes dirTimes;
+    bool publish = false;
+    if(_p->sharedRegistry.isOpen())
+    {
+        std::vector<SharedRegistry::Record> records;
+        if(_p->sharedRegistry.lookup(pluginDir, recursive, &records))
+        {
+            _p->metrics.sharedRegistryHits++;
+            return _p->addRegisteredPlugins(pluginDir, recursive, records, callbackFunc);
+        }
+        _p->metrics.sharedRegistryMisses++;
+        // The times are read before the listing, so that any later change invalidates the entry
+        publish = SharedRegistry::directoryTimes(pluginDir, recursive, &dirTimes);
+    }
+    std::vector<SharedRegistry::Record> records;
+
     bool atLeastOneFound = false;
     fsutil::PathList libList;
     if(!fsutil::listLibrariesInDir(pluginDir, &libList, recursive))
@@ -164,6 +210,18 @@ ReturnCode PluginManager::searchForPlugins(const std::string &pluginDir, bool re
         // Only return if no files was found
         if(libList.empty())
             return ReturnCode::SEARCH_LISTFILES_ERROR;
+        // The listing may be incomplete
+        publish = false;
+    }
+
+    // The libraries must be checked before they are loaded (loading them runs their code)
+    if(_p->integrity.isEnabled())
+    {
+        const size_t listedCount = libList.size();
+        _p->checkIntegrity(pluginDir, &libList, callbackFunc);
+        // Rejected libraries are not loaded, so they would be missing for the other processes
+        if(libList.size() != listedCount)
+            publish = false;
     }
 
     for(const std::string& path : libList)
@@ -180,10 +238,18 @@ ReturnCode PluginManager::searchForPlugins(const std::string &pluginDir, bool re
             if(_p->useLog)
                 _p->log.get() << "Found library at: " << path << std::endl;
             plugin->path = path;
+            plugin->relativePath = PlugMgrPrivate::relativePath(pluginDir, path);
             std::string name = plugin->lib.get<const char*>("jp_name");;
 
             // name must be unique for each plugin
-            if(_p->pluginsMap.count(name) == 1)
+            const bool nameExists = _p->pluginsMap.count(name) == 1;
+            PluginInfoStd info;
+            if(!nameExists || publish)
+                info = _p->parseMetadata(plugin->lib.get<const char[]>("jp_metadata"));
+            if(publish)
+                records.push_back(SharedRegistry::Record{plugin->relativePath, info.name.empty() ? std::string() : name, info});
+
+            if(nameExists)
             {
                 if(callbackFunc)
                     callbackFunc(ReturnCode::SEARCH_NAME_ALREADY_EXISTS, strdup(path.c_str()));
@@ -194,7 +260,6 @@ ReturnCode PluginManager::searchForPlugins(const std::string &pluginDir, bool re
             if(_p->useLog)
                 _p->log.get() << "Library name: " << name << std::endl;
 
-            PluginInfoStd info = _p->parseMetadata(plugin->lib.get<const char[]>("jp_metadata"));
             if(info.name.empty())
             {
                 if(callbackFunc)
@@ -204,6 +269,7 @@ ReturnCode PluginManager::searchForPlugins(const std::string &pluginDir, bool re
             }
 
             plugin->info = info;
+            plugin->fingerprint = PlugMgrPrivate::pluginFingerprint(info);
             // Print plugin's info
             if(_p->useLog)
                 _p->log.get() << info.toString() << std::endl;
@@ -217,6 +283,9 @@ ReturnCode PluginManager::searchForPlugins(const std::string &pluginDir, bool re
         }
     }
 
+    if(publish && !_p->sharedRegistry.publish(pluginDir, recursive, dirTimes, records) && _p->useLog)
+        _p->log.get() << "Search results of " << pluginDir << " not published in the shared registry" << std::endl;
+
     if(atLeastOneFound)
     {
         // Only add the location if it's not already in the list
@@ -234,6 +303,7 @@ ReturnCode PluginManager::searchForPlugins(const std::string &pluginDir, callbac
 
 ReturnCode PluginManager::registerMainPlugin(const std::string &pluginName)
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     if(_p->mainPluginName.empty() && hasPlugin(pluginName))
     {
         _p->mainPluginName = pluginName;
@@ -245,63 +315,41 @@ ReturnCode PluginManager::registerMainPlugin(const std::string &pluginName)
 
 ReturnCode PluginManager::loadPlugins(bool tryToContinue, callback callbackFunc)
 {
-    // First step: For each plugins, check if it's dependencies have been found
-    // Also creates a node list used by the graph to sort the dependencies
-    // NOTE: The graph is re-created even if loadPlugins() was already called.
+    // NOTE: The load order is computed again even if loadPlugins() was already called.
+    // Already loaded plugins are kept as is.
+
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
 
     if(_p->useLog)
         _p->log.get() << "Load plugins ..." << std::endl;
 
-    Graph::NodeList nodeList;
-    nodeList.reserve(_p->pluginsMap.size());
+    if(_p->sharedRegistry.isOpen())
+        _p->checkRegisteredPlugins(callbackFunc);
 
-    for(auto& val : _p->pluginsMap)
+    // The load order of the previous start is reused if the plugins and their dependencies did not change
+    const bool useCache = !_p->loadOrderCachePath.empty();
+    const uint64_t fingerprint = useCache ? _p->graphFingerprint() : 0;
+    if(useCache && _p->readLoadOrderCache(fingerprint))
     {
-        // Init the ID to the default value (in case loadPlugins is called several times)
-        val.second->graphId = -1;
-
-        ReturnCode retCode = _p->checkDependencies(val.second, callbackFunc);
-        if(!tryToContinue && !retCode)
-        {
-            // An error occured on one plugin, stop everything
-            return retCode;
-        }
-
-        if(val.second->dependenciesExists == true)
-        {
-            Graph::Node node;
-            node.name = &(val.first);
-            nodeList.push_back(node);
-            val.second->graphId = nodeList.size() - 1;
-        }
+        _p->metrics.loadOrderCacheHits++;
+        if(_p->useLog)
+            _p->log.get() << "Load order read from " << _p->loadOrderCachePath << std::endl;
     }
-
-    // Fill parentNodes list for each node
-    for(auto& val : _p->pluginsMap)
+    else
     {
-        const int nodeId = val.second->graphId;
-        if(nodeId != -1)
+        ReturnCode retCode = _p->resolveLoadOrder(tryToContinue, callbackFunc);
+        if(!retCode)
+            return retCode;
+
+        if(useCache)
         {
-            for(size_t i=0; i<val.second->info.dependencies.size(); ++i)
-                nodeList[nodeId].parentNodes.push_back(_p->pluginsMap[val.second->info.dependencies[i].name]->graphId);
+            _p->metrics.loadOrderCacheMisses++;
+            // Only a complete resolution is saved (the errors must be reported on each start)
+            if(_p->loadOrderList.size() == _p->pluginsMap.size())
+                _p->writeLoadOrderCache(fingerprint);
         }
     }
 
-
-    // Second step: create a graph of all dependencies
-    Graph graph(nodeList);
-
-    // Third step: find the correct loading order using the topological Sort
-    bool error = false;
-    _p->loadOrderList = graph.topologicalSort(error);
-    if(error)
-    {
-        // There is a cycle inside the graph
-        if(callbackFunc)
-            callbackFunc(ReturnCode::LOAD_DEPENDENCY_CYCLE, nullptr);
-        return ReturnCode::LOAD_DEPENDENCY_CYCLE;
-    }
-
     if(_p->useLog)
     {
         _p->log.get() << "Load order:" << std::endl;
@@ -309,15 +357,23 @@ ReturnCode PluginManager::loadPlugins(bool tryToContinue, callback callbackFunc)
             _p->log.get() << " - " << name << std::endl;
     }
 
-    // Fourth step: load plugins
-    _p->loadPluginsInOrder();
+    // Load plugins
+    ReturnCode loadCode = _p->loadPluginsInOrder(tryToContinue, callbackFunc);
+    if(!tryToContinue && !loadCode)
+        return loadCode;
+    if(_p->compactMode)
+        _p->compactPlugins();
 
-    // Call the main plugin function
+    // Call the main plugin function (if it could be loaded)
     if(!_p->mainPluginName.empty())
-        _p->pluginsMap.at(_p->mainPluginName)->iplugin->mainPluginExec();
+    {
+        PluginPtr& mainPlugin = _p->pluginsMap.at(_p->mainPluginName);
+        if(mainPlugin->iplugin)
+            mainPlugin->iplugin->mainPluginExec();
+    }
 
     // Here, all plugins are loaded, the function can return
-    return ReturnCode::SUCCESS;
+    return loadCode;
 }
 
 ReturnCode PluginManager::loadPlugins(callback callbackFunc)
@@ -327,6 +383,7 @@ ReturnCode PluginManager::loadPlugins(callback callbackFunc)
 
 ReturnCode PluginManager::unloadPlugins(callback callbackFunc)
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     if(_p->useLog)
         _p->log.get() << "Unload plugins ..." << std::endl;
 
@@ -358,11 +415,13 @@ std::string PluginManager::pluginApi()
 
 size_t PluginManager::pluginsCount() const
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     return _p->pluginsMap.size();
 }
 
 std::vector<std::string> PluginManager::pluginsList() const
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     std::vector<std::string> nameList;
     nameList.reserve(_p->pluginsMap.size());
     for(auto const& x : _p->pluginsMap)
@@ -372,35 +431,412 @@ std::vector<std::string> PluginManager::pluginsList() const
 
 std::vector<std::string> PluginManager::pluginsLocation() const
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     return _p->locations;
 }
 
 bool PluginManager::hasPlugin(const std::string &name) const
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     return _p->pluginsMap.count(name) == 1;
 }
 
 bool PluginManager::hasPlugin(const std::string &name, const std::string &minVersion) const
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     return hasPlugin(name) && Version(_p->pluginsMap[name]->info.version).compatible(minVersion);
 }
 
 bool PluginManager::isPluginLoaded(const std::string &name) const
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     return hasPlugin(name) && _p->pluginsMap[name]->lib.isLoaded() && _p->pluginsMap[name]->iplugin;
 }
 
 std::shared_ptr<IPlugin> PluginManager::pluginObject(const std::string& name) const
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     if(!hasPlugin(name))
         return std::shared_ptr<IPlugin>();
 
-    return _p->pluginsMap[name]->iplugin;
+    PluginPtr& plugin = _p->pluginsMap[name];
+    if(plugin->evicted || plugin->deferred)
+        _p->reloadPlugin(plugin);
+    plugin->lastUse = std::chrono::steady_clock::now();
+    return plugin->iplugin;
 }
 
 PluginInfo PluginManager::pluginInfo(const std::string &name) const
 {
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
     if(!hasPlugin(name))
         return PluginInfo();
-    return _p->pluginsMap[name]->info.toPluginInfo();
+    return _p->fullInfo(_p->pluginsMap[name]).toPluginInfo();
+}
+
+bool PluginManager::isOptionalDependency(const std::string& name, const std::string& dependency) const
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    const PluginInfoStd::Dependency* dep = _p->findDependency(name, dependency);
+    return dep && dep->optional;
+}
+
+bool PluginManager::isLazyDependency(const std::string& name, const std::string& dependency) const
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    const PluginInfoStd::Dependency* dep = _p->findDependency(name, dependency);
+    return dep && dep->lazy;
+}
+
+void PluginManager::setCompactMode(bool enable)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->compactMode = enable;
+
+    if(enable)
+    {
+        _p->compactPlugins();
+        return;
+    }
+
+    // Restore the full info of the compacted plugins
+    for(auto& val : _p->pluginsMap)
+    {
+        if(val.second->compacted)
+        {
+            val.second->info = _p->fullInfo(val.second);
+            val.second->compacted = false;
+        }
+    }
+}
+
+void PluginManager::setIdleEvictionDelay(unsigned int delay)
+{
+    {
+        std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+        _p->idleEvictionDelay = delay;
+    }
+    _p->updateIdleThread();
+}
+
+size_t PluginManager::evictIdlePlugins(unsigned int minIdleTime)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    return _p->evictIdlePlugins(minIdleTime);
+}
+
+ReturnCode PluginManager::pageOutPlugin(const std::string& name, bool reclaim, PageOutReport* report)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    if(!isPluginLoaded(name))
+        return ReturnCode::PAGEOUT_PLUGIN_NOT_LOADED;
+    return _p->pageOutPlugin(_p->pluginsMap[name], reclaim, report);
+}
+
+void PluginManager::setIdlePageOutDelay(unsigned int delay)
+{
+    {
+        std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+        _p->idlePageOutDelay = delay;
+    }
+    _p->updateIdleThread();
+}
+
+void PluginManager::enableRealTimeMode(size_t lockBudget)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->realTimeMode = true;
+    _p->lockBudget = lockBudget;
+
+    _p->lockManager();
+    for(const std::string& name : _p->loadOrderList)
+    {
+        PluginPtr& plugin = _p->pluginsMap.at(name);
+        if(plugin->iplugin)
+            _p->lockPlugin(plugin);
+    }
+}
+
+void PluginManager::disableRealTimeMode()
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->realTimeMode = false;
+
+    _p->unlockManager();
+    for(auto& val : _p->pluginsMap)
+        _p->unlockPlugin(val.second);
+}
+
+size_t PluginManager::lockedMemory(const std::string& name) const
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    if(!hasPlugin(name))
+        return 0;
+    return _p->pluginsMap[name]->lockedBytes;
+}
+
+void PluginManager::setStateDirectory(const std::string& dir)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->stateDirectory = dir;
+    // Remove the trailing separators
+    while(_p->stateDirectory.size() > 1 && _p->stateDirectory.back() == '/')
+        _p->stateDirectory.pop_back();
+}
+
+std::string PluginManager::stateDirectory() const
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    return _p->stateDirectory;
+}
+
+void PluginManager::setLoadOrderCache(const std::string& path)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->loadOrderCachePath = path;
+}
+
+ReturnCode PluginManager::enableIntegrityCheck(const std::string& manifestPath)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    if(!_p->integrity.loadManifest(manifestPath))
+    {
+        _p->integrity.clearManifest();
+        return ReturnCode::INTEGRITY_MANIFEST_ERROR;
+    }
+    return ReturnCode::SUCCESS;
+}
+
+void PluginManager::disableIntegrityCheck()
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->integrity.clearManifest();
+}
+
+void PluginManager::setCryptoHashFunction(hashFunction func)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->integrity.setCryptoHash(func);
+}
+
+ReturnCode PluginManager::createIntegrityManifest(const std::string& pluginDir, const std::string& manifestPath, bool recursive)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    fsutil::PathList libList;
+    if(!fsutil::listLibrariesInDir(pluginDir, &libList, recursive))
+        return ReturnCode::SEARCH_LISTFILES_ERROR;
+    std::sort(libList.begin(), libList.end());
+
+    IntegrityChecker::Stats stats;
+    const std::vector<IntegrityChecker::Digest> digests = _p->integrity.hashFiles(libList, &_p->workerPool, &stats);
+
+    std::ofstream file(manifestPath);
+    file << "# Generated by PluginManager::createIntegrityManifest()" << std::endl;
+    for(size_t i=0; i < libList.size(); ++i)
+    {
+        if(!digests[i].valid)
+            return ReturnCode::INTEGRITY_MANIFEST_ERROR;
+        file << IntegrityChecker::manifestLine(PlugMgrPrivate::relativePath(pluginDir, libList[i]), digests[i]) << std::endl;
+    }
+    return file ? ReturnCode::SUCCESS : ReturnCode::INTEGRITY_MANIFEST_ERROR;
+}
+
+WorkerPoolInfo PluginManager::workerPoolInfo() const
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    const WorkerPool::Info poolInfo = _p->workerPool.info();
+    WorkerPoolInfo info;
+    info.cpuLimit = poolInfo.cpuLimit;
+    info.workers = poolInfo.workers;
+    info.peakWorkers = poolInfo.peakWorkers;
+    info.waitRatio = poolInfo.waitRatio;
+    info.pinned = poolInfo.pinned;
+    return info;
+}
+
+void PluginManager::setWorkerCount(unsigned int count)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->workerPool.setWorkers(count);
+}
+
+ReturnCode PluginManager::enableSharedRegistry(const std::string& name)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    if(!_p->sharedRegistry.open(name))
+    {
+        if(_p->useLog)
+            _p->log.get() << "Cannot open the shared registry " << name << std::endl;
+        return ReturnCode::SHARED_REGISTRY_ERROR;
+    }
+    return ReturnCode::SUCCESS;
+}
+
+void PluginManager::disableSharedRegistry()
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->sharedRegistry.close();
+}
+
+void PluginManager::enableHealthChecks(unsigned int interval, unsigned int timeout,
+                                       unsigned int errorRate, unsigned int minRequests)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->healthChecks = true;
+    _p->healthInterval = std::max(interval, 1u);
+    _p->healthTimeout = std::max(timeout, 1u);
+    _p->healthErrorRate = errorRate;
+    _p->healthMinRequests = minRequests;
+    if(!_p->healthThread.joinable())
+        _p->healthThread = std::thread(&PlugMgrPrivate::healthLoop, _p);
+    _p->healthCond.notify_all();
+}
+
+void PluginManager::disableHealthChecks()
+{
+    _p->stopHealthThread();
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->healthChecks = false;
+}
+
+std::shared_ptr<const PluginHealth> PluginManager::pluginHealth(const std::string& name) const
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    auto it = _p->pluginsMap.find(name);
+    if(it == _p->pluginsMap.end())
+        return nullptr;
+    return it->second->health;
+}
+
+void PluginManager::setHealthCallback(healthCallback func)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->healthCallbackFunc = func;
+}
+
+void PluginManager::enableResourceSharing(bool enable)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->resourceSharing = enable;
+}
+
+void PluginManager::setRateLimit(const std::string& sender, const std::string& receiver, double rate, double burst)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->rateLimits[std::make_pair(sender, receiver)] = PlugMgrPrivate::RateLimit{rate, burst};
+
+    // Update the pairs already bound (a removed limit lets all requests pass)
+    for(auto& val : _p->rateLimiters)
+    {
+        PlugMgrPrivate::RateLimit limit;
+        if(_p->effectiveRateLimit(val.first.first, val.first.second, &limit))
+            val.second->setLimit(limit.rate, limit.burst);
+        else
+            val.second->setLimit(0.0, 0.0);
+    }
+}
+
+std::vector<RateLimitStats> PluginManager::rateLimitStats() const
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    std::vector<RateLimitStats> stats;
+    stats.reserve(_p->rateLimiters.size());
+    for(const auto& val : _p->rateLimiters)
+    {
+        RateLimitStats pair;
+        pair.sender = val.second->sender();
+        pair.receiver = val.second->receiver();
+        pair.requests = val.second->requests();
+        pair.throttled = val.second->throttled();
+        stats.push_back(pair);
+    }
+    std::stable_sort(stats.begin(), stats.end(), [](const RateLimitStats& a, const RateLimitStats& b) {
+        return a.throttled > b.throttled;
+    });
+    return stats;
+}
+
+void PluginManager::setRequestCoalescing(const std::string& receiver, unsigned int maxDelay, unsigned int maxBatch)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    PlugMgrPrivate::RequestQueue* queue = _p->requestQueue(receiver);
+    queue->maxDelay = int64_t(maxDelay) * 1000;
+    queue->maxBatch = std::max(maxBatch, 1u);
+    // Low load until the requests are measured
+    queue->arrivalGap = 4 * queue->maxDelay;
+}
+
+void PluginManager::enableTracing(double sampleRate)
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->tracer.enable(sampleRate);
+}
+
+void PluginManager::disableTracing()
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->tracer.disable();
+}
+
+void PluginManager::setTraceSink(traceSink sink)
+{
+    _p->tracer.setSink(std::move(sink));
+}
+
+// Static
+PluginManager::traceSink PluginManager::fileTraceSink(const std::string& path)
+{
+    std::shared_ptr<std::ofstream> file = std::make_shared<std::ofstream>(path, std::ios::app);
+    if(!file->is_open())
+        return traceSink();
+
+    // The tracer calls the sink one trace at a time
+    return [file](const std::vector<TraceSpan>& spans) {
+        writeTrace(*file, spans);
+        file->flush();
+    };
+}
+
+ManagerMetrics PluginManager::metrics() const
+{
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    ManagerMetrics metrics = _p->metrics;
+    // Counted by the buckets and the tracer without locking
+    for(const auto& val : _p->rateLimiters)
+        metrics.throttledRequests += val.second->throttled();
+    metrics.sampledTraces = _p->tracer.sampledTraces();
+    metrics.tracedSpans = _p->tracer.tracedSpans();
+    return metrics;
+}
+
+ReturnCode PluginManager::enableMemoryPressureShedding(unsigned int threshold,
+                                                       unsigned int interval,
+                                                       const std::string& pressureFile)
+{
+    const std::string file = pressureFile.empty() ? sysutil::memoryPressureFile() : pressureFile;
+    uint64_t stallTime = 0;
+    if(file.empty() || !sysutil::readMemoryStallTime(file, &stallTime))
+        return ReturnCode::MEMORY_PRESSURE_NOT_AVAILABLE;
+
+    // Restart the thread with the new settings
+    disableMemoryPressureShedding();
+
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    _p->pressureThreshold = threshold;
+    _p->pressureInterval = interval > 0 ? interval : 1;
+    _p->pressureFile = file;
+    _p->pressureThread = std::thread(&PlugMgrPrivate::memoryPressureLoop, _p);
+
+    if(_p->useLog)
+        _p->log.get() << "Monitor the memory pressure with " << file << std::endl;
+    return ReturnCode::SUCCESS;
+}
+
+void PluginManager::disableMemoryPressureShedding()
+{
+    _p->stopMemoryPressureThread();
+
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+    if(_p->shedStep != PlugMgrPrivate::SHED_NONE)
+        _p->restoreShedPlugins();
 }
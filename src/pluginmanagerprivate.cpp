@@ -24,19 +24,43 @@
 
 #include "private/pluginmanagerprivate.h"
 
+#include <algorithm> // for std::find, std::find_if, std::remove_if
+#include <chrono> // for std::chrono::steady_clock
+#include <cstdio> // for std::rename, std::remove, snprintf
+#include <cstdlib> // for strtoull
+#include <cstring> // for strdup
+#include <fstream> // for std::ifstream, std::ofstream
+#include <iterator> // for std::make_move_iterator
+
 #include "sharedlibrary.h"
 
 #include "version/version.h"
 #include "json/json.hpp"
 
 #include "private/graph.h"
+#include "private/hash.h"
 #include "private/tribool.h"
 #include "private/fsutil.h"
 #include "private/stringutil.h"
+#include "private/sysutil.h"
 
 using namespace jp_private;
 using namespace jp;
 
+namespace
+{
+
+// First word of the load order cache (changed with the format)
+const char LOAD_ORDER_CACHE_MAGIC[] = "JPLOADORDER1";
+
+int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
 // Parse json metadata using json.hpp (in thirdparty/ folder)
 PluginInfoStd PlugMgrPrivate::parseMetadata(const char *metadata)
 {
@@ -56,6 +80,25 @@ PluginInfoStd PlugMgrPrivate::parseMetadata(const char *metadata)
             info.url = tree.at("url").get<std::string>();
             info.license = tree.at("license").get<std::string>();
             info.copyright = tree.at("copyright").get<std::string>();
+            // Optional
+            const auto evictable = tree.find("evictable");
+            info.evictable = evictable != tree.end() && evictable->get<bool>();
+            const auto priority = tree.find("priority");
+            info.backgroundPriority = priority != tree.end() && priority->get<std::string>() == "background";
+            const auto hugePageText = tree.find("hugePageText");
+            info.hugePageText = hugePageText != tree.end() && hugePageText->get<bool>();
+            const auto healthCheckInterval = tree.find("healthCheckInterval");
+            if(healthCheckInterval != tree.end())
+                info.healthCheckInterval = healthCheckInterval->get<int>();
+            const auto healthCheckTimeout = tree.find("healthCheckTimeout");
+            if(healthCheckTimeout != tree.end())
+                info.healthCheckTimeout = healthCheckTimeout->get<int>();
+            const auto rateLimit = tree.find("rateLimit");
+            if(rateLimit != tree.end())
+                info.rateLimit = rateLimit->get<double>();
+            const auto rateBurst = tree.find("rateBurst");
+            if(rateBurst != tree.end())
+                info.rateBurst = rateBurst->get<double>();
 
             json jsonDep = tree.at("dependencies");
             for(json& jdep : jsonDep)
@@ -63,6 +106,10 @@ PluginInfoStd PlugMgrPrivate::parseMetadata(const char *metadata)
                 PluginInfoStd::Dependency dep;
                 dep.name = jdep.at("name").get<std::string>();
                 dep.version = jdep.at("version").get<std::string>();
+                const auto optional = jdep.find("optional");
+                dep.optional = optional != jdep.end() && optional->get<bool>();
+                const auto lazy = jdep.find("lazy");
+                dep.lazy = lazy != jdep.end() && lazy->get<bool>();
                 info.dependencies.push_back(dep);
             }
 
@@ -88,6 +135,14 @@ ReturnCode PlugMgrPrivate::checkDependencies(PluginPtr& plugin, PluginManager::c
     {
         const std::string& depName = plugin->info.dependencies[i].name;
         const std::string& depVer = plugin->info.dependencies[i].version;
+        // The plugin is loaded without its missing optional dependencies
+        if(plugin->info.dependencies[i].optional)
+        {
+            if(pluginsMap.count(depName) == 1 && Version(pluginsMap[depName]->info.version).compatible(depVer))
+                checkDependencies(pluginsMap[depName], callbackFunc);
+            continue;
+        }
+
         // Checks if the plugin dep is compatible
         if(pluginsMap.count(depName) == 0)
         {
@@ -115,30 +170,300 @@ ReturnCode PlugMgrPrivate::checkDependencies(PluginPtr& plugin, PluginManager::c
     return ReturnCode::SUCCESS;
 }
 
-void PlugMgrPrivate::loadPluginsInOrder()
+PluginPtr* PlugMgrPrivate::resolvedDependency(const PluginInfoStd::Dependency& dep)
+{
+    auto it = pluginsMap.find(dep.name);
+    if(it == pluginsMap.end())
+        return nullptr;
+    if(dep.optional && (it->second->dependenciesExists != true
+                        || !Version(it->second->info.version).compatible(dep.version)))
+        return nullptr;
+    return &it->second;
+}
+
+const PluginInfoStd::Dependency* PlugMgrPrivate::findDependency(const std::string& name, const std::string& dependency)
+{
+    auto it = pluginsMap.find(name);
+    if(it == pluginsMap.end())
+        return nullptr;
+    // The dependencies (with their flags) are kept by compact()
+    for(const PluginInfoStd::Dependency& dep : it->second->info.dependencies)
+    {
+        if(dep.name == dependency)
+            return &dep;
+    }
+    return nullptr;
+}
+
+ReturnCode PlugMgrPrivate::resolveLoadOrder(bool tryToContinue, PluginManager::callback callbackFunc)
+{
+    // First step: For each plugins, check if it's dependencies have been found
+    // Also creates a node list used by the graph to sort the dependencies
+    Graph::NodeList nodeList;
+    nodeList.reserve(pluginsMap.size());
+
+    for(auto& val : pluginsMap)
+    {
+        // Init the ID to the default value (in case loadPlugins is called several times)
+        val.second->graphId = -1;
+
+        ReturnCode retCode = checkDependencies(val.second, callbackFunc);
+        if(!tryToContinue && !retCode)
+        {
+            // An error occured on one plugin, stop everything
+            return retCode;
+        }
+
+        if(val.second->dependenciesExists == true)
+        {
+            Graph::Node node;
+            node.name = &(val.first);
+            nodeList.push_back(node);
+            val.second->graphId = nodeList.size() - 1;
+        }
+    }
+
+    // Fill parentNodes list for each node
+    for(auto& val : pluginsMap)
+    {
+        const int nodeId = val.second->graphId;
+        if(nodeId != -1)
+        {
+            // Lazy dependencies are ordered too: they are unloaded after their dependents
+            for(const PluginInfoStd::Dependency& dep : val.second->info.dependencies)
+            {
+                if(PluginPtr* depPlugin = resolvedDependency(dep))
+                    nodeList[nodeId].parentNodes.push_back((*depPlugin)->graphId);
+            }
+        }
+    }
+
+    // Second step: create a graph of all dependencies
+    Graph graph(nodeList);
+
+    // Third step: find the correct loading order using the topological Sort
+    bool error = false;
+    loadOrderList = graph.topologicalSort(error);
+    if(error)
+    {
+        // There is a cycle inside the graph
+        if(callbackFunc)
+            callbackFunc(ReturnCode::LOAD_DEPENDENCY_CYCLE, nullptr);
+        return ReturnCode::LOAD_DEPENDENCY_CYCLE;
+    }
+
+    return ReturnCode::SUCCESS;
+}
+
+uint64_t PlugMgrPrivate::pluginFingerprint(const PluginInfoStd& info)
+{
+    std::string record = info.name + '\0' + info.version + '\0';
+    for(const PluginInfoStd::Dependency& dep : info.dependencies)
+    {
+        record += dep.name + '\0' + dep.version + '\0';
+        if(dep.optional || dep.lazy)
+            record += std::string(dep.optional ? "o" : "") + (dep.lazy ? "l" : "") + '\0';
+    }
+    return hash::hash64(record.data(), record.size());
+}
+
+uint64_t PlugMgrPrivate::graphFingerprint() const
+{
+    // The sum does not depend on the order of the plugins in the map
+    uint64_t fingerprint = hash::hash64(LOAD_ORDER_CACHE_MAGIC, strlen(LOAD_ORDER_CACHE_MAGIC), pluginsMap.size());
+    for(const auto& val : pluginsMap)
+        fingerprint += val.second->fingerprint;
+    return fingerprint;
+}
+
+bool PlugMgrPrivate::readLoadOrderCache(uint64_t fingerprint)
+{
+    std::ifstream file(loadOrderCachePath);
+    std::string magic, fingerprintHex;
+    if(!(file >> magic >> fingerprintHex) || magic != LOAD_ORDER_CACHE_MAGIC
+       || strtoull(fingerprintHex.c_str(), nullptr, 16) != fingerprint)
+        return false;
+
+    // One line per plugin: "<name> <version>", in the load order
+    std::vector<std::string> order;
+    order.reserve(pluginsMap.size());
+    std::string name, version;
+    while(file >> name >> version)
+    {
+        const auto plugin = pluginsMap.find(name);
+        if(plugin == pluginsMap.end() || plugin->second->info.version != version)
+            return false;
+        order.push_back(name);
+    }
+    if(order.size() != pluginsMap.size())
+        return false;
+
+    for(auto& val : pluginsMap)
+        val.second->dependenciesExists = true;
+    loadOrderList.swap(order);
+    return true;
+}
+
+void PlugMgrPrivate::writeLoadOrderCache(uint64_t fingerprint)
+{
+    // Written next to the cache, then renamed: a reader never sees a partial file
+    const std::string tempPath = loadOrderCachePath + ".tmp";
+    {
+        std::ofstream file(tempPath);
+        char fingerprintHex[17];
+        snprintf(fingerprintHex, sizeof(fingerprintHex), "%016llx", static_cast<unsigned long long>(fingerprint));
+        file << LOAD_ORDER_CACHE_MAGIC << " " << fingerprintHex << "\n";
+        for(const std::string& name : loadOrderList)
+            file << name << " " << pluginsMap.at(name)->info.version << "\n";
+        if(!file.flush())
+        {
+            std::remove(tempPath.c_str());
+            return;
+        }
+    }
+    if(std::rename(tempPath.c_str(), loadOrderCachePath.c_str()) != 0)
+        std::remove(tempPath.c_str());
+}
+
+void PlugMgrPrivate::deferLazyDependencies()
+{
+    std::unordered_map<std::string, std::vector<std::pair<Plugin*, bool>>> dependents;
+    for(const std::string& name : loadOrderList)
+    {
+        PluginPtr& plugin = pluginsMap.at(name);
+        for(const PluginInfoStd::Dependency& dep : plugin->info.dependencies)
+            dependents[dep.name].emplace_back(plugin.get(), dep.lazy);
+    }
+
+    // Dependents are before their dependencies in the reverse load order. A plugin is loaded
+    // at startup if nothing depends on it, or if a plugin loaded at startup depends on it eagerly.
+    for(auto it = loadOrderList.rbegin(); it != loadOrderList.rend(); ++it)
+    {
+        PluginPtr& plugin = pluginsMap.at(*it);
+        const auto& pluginDependents = dependents[*it];
+        bool needed = plugin->iplugin || plugin->isMainPlugin || pluginDependents.empty();
+        for(const auto& dependent : pluginDependents)
+            needed = needed || (!dependent.second && !dependent.first->deferred);
+        plugin->deferred = !needed;
+    }
+}
+
+ReturnCode PlugMgrPrivate::loadPluginsInOrder(bool tryToContinue, PluginManager::callback callbackFunc)
 {
+    ReturnCode result = ReturnCode::SUCCESS;
+    deferLazyDependencies();
     for(const std::string& name : loadOrderList)
-        loadPlugin(pluginsMap.at(name));
+    {
+        PluginPtr& plugin = pluginsMap.at(name);
+        if(plugin->deferred)
+            continue;
+
+        // The plugins depending on a plugin that failed fail too (they are not given a null object)
+        ReturnCode retCode = loadPlugin(plugin);
+        if(!retCode)
+        {
+            if(useLog)
+                log.get() << "Cannot load " << name << " (" << retCode.message() << ")" << std::endl;
+            if(callbackFunc)
+                callbackFunc(retCode, strdup(plugin->path.c_str()));
+            if(!tryToContinue)
+                return retCode;
+            if(result)
+                result = retCode;
+        }
+    }
+    return result;
 }
 
-void PlugMgrPrivate::loadPlugin(PluginPtr& plugin)
+ReturnCode PlugMgrPrivate::loadPlugin(PluginPtr& plugin)
 {
+    // loadPlugins() can be called several times, keep existing plugin objects
+    if(plugin->iplugin)
+        return ReturnCode::SUCCESS;
+
+    // The eager dependencies must be loaded (an evicted or deferred one is loaded again)
+    for(const PluginInfoStd::Dependency& dep : plugin->info.dependencies)
+    {
+        PluginPtr* depPlugin = resolvedDependency(dep);
+        if(!depPlugin || dep.lazy || (*depPlugin)->iplugin)
+            continue;
+        if(((*depPlugin)->evicted || (*depPlugin)->deferred) && reloadPlugin(*depPlugin))
+            continue;
+        if(!dep.optional)
+            return ReturnCode::LOAD_DEPENDENCY_NOT_FOUND;
+    }
+
+    // The library of an evicted plugin was unloaded (the file may have changed since)
+    if(!plugin->lib.isLoaded())
+    {
+        if(integrity.isEnabled() && !checkIntegrity(plugin->path, plugin->relativePath))
+            return ReturnCode::SEARCH_INTEGRITY_MISMATCH;
+        if(!plugin->lib.load(plugin->path))
+            return ReturnCode::UNKNOWN_ERROR;
+        // The file may have been replaced by another library
+        if(!plugin->lib.hasSymbol("jp_createPlugin"))
+        {
+            plugin->lib.unload();
+            return ReturnCode::UNKNOWN_ERROR;
+        }
+    }
+
     plugin->creator = *(plugin->lib.get<Plugin::iplugin_create_t*>("jp_createPlugin"));
 
+    // Cache the segments of the library (used to page them out or lock them)
+    plugin->segments.clear();
+    plugin->writableSegments.clear();
+    sysutil::objectSegments(plugin->lib.getRawAddress("jp_createPlugin"),
+                            &plugin->segments, &plugin->writableSegments);
+
+    // Must be done before any code of the plugin is used
+    if(plugin->info.hugePageText)
+        remapTextOnHugePages(plugin);
+    if(resourceSharing)
+        shareResources(plugin);
+
     // Get a list of dependencies names and handle request functions
-    const int depNb = plugin->info.dependencies.size();
-    IPlugin** depPlugins = (IPlugin**)malloc(sizeof(IPlugin*)*depNb);
+    plugin->depPlugins.clear();
+    plugin->depPlugins.reserve(plugin->info.dependencies.size());
+    for(const PluginInfoStd::Dependency& dep : plugin->info.dependencies)
+    {
+        // Missing optional dependencies are not given to the plugin (NOT_A_DEPENDENCY)
+        PluginPtr* depPlugin = resolvedDependency(dep);
+        if(!depPlugin)
+            continue;
 
-    // Dependencies are already loaded, so it's safe to get the plugin object
-    for(int i=0; i < depNb; ++i)
-        depPlugins[i] = pluginsMap[plugin->info.dependencies[i].name]->iplugin.get();
+        // Lazy dependencies are bound to their proxy, which loads them on the first request
+        if(dep.lazy)
+        {
+            if(!(*depPlugin)->proxy)
+                (*depPlugin)->proxy.reset(new PluginProxy(depPlugin->get(), &tracer));
+            if(!(*depPlugin)->iplugin)
+                (*depPlugin)->loadOnUse = true;
+            plugin->depPlugins.push_back(limitRequests(plugin, dep.name, (*depPlugin)->proxy.get()));
+        }
+        // Other dependencies are loaded (checked above), so it's safe to get the plugin object
+        else if((*depPlugin)->iplugin)
+        {
+            plugin->depPlugins.push_back(limitRequests(plugin, dep.name, pluginInterface(*depPlugin)));
+        }
+    }
+    const int depNb = plugin->depPlugins.size();
 
     plugin->iplugin.reset(plugin->creator(PlugMgrPrivate::handleRequest,
                                           PlugMgrPrivate::getNonDepPlugin,
-                                          depPlugins,
+                                          plugin->depPlugins.data(),
                                           depNb,
                                           plugin->isMainPlugin));
+    plugin->evicted = false;
+    plugin->deferred = false;
+    plugin->lastUse = std::chrono::steady_clock::now();
     plugin->iplugin->loaded();
+    // The proxy can use the plugin object directly from now on
+    plugin->loadOnUse.store(false, std::memory_order_release);
+
+    if(realTimeMode)
+        lockPlugin(plugin);
+    return ReturnCode::SUCCESS;
 }
 
 bool PlugMgrPrivate::unloadPluginsInOrder()
@@ -148,10 +473,14 @@ bool PlugMgrPrivate::unloadPluginsInOrder()
     for(auto it = loadOrderList.rbegin();
         it != loadOrderList.rend(); ++it)
     {
-        if(!unloadPlugin(pluginsMap[*it]))
+        auto plugin = pluginsMap.find(*it);
+        if(plugin == pluginsMap.end())
+            continue;
+        if(!unloadPlugin(plugin->second))
             allUnloaded = false;
-        pluginsMap.erase(*it);
+        pluginsMap.erase(plugin);
     }
+    loadOrderList.clear();
 
     // Remove remaining plugins (if they are not in the loading list)
     while(!pluginsMap.empty())
@@ -164,114 +493,1356 @@ bool PlugMgrPrivate::unloadPluginsInOrder()
     // Clear the locations list
     locations.clear();
 
+    // Nothing to restore after the memory pressure
+    shedPlugins.clear();
+    shedStep = SHED_NONE;
+
     return allUnloaded;
 }
 
 // Return true if the plugin is successfully unloaded
 bool PlugMgrPrivate::unloadPlugin(PluginPtr& plugin)
+{
+    waitForHealthCheck(plugin);
+    discardRequests(plugin);
+    plugin->health->_state.store(IPlugin::HEALTH_UNKNOWN, std::memory_order_release);
+    bool isLoaded = false;
+    // The request thread of the plugin is running its code (it may be the current thread):
+    // the library is unloaded by the thread at the end of the batch
+    if(plugin->delivering)
+    {
+        plugin->unloadAfterDelivery = true;
+    }
+    else
+    {
+        unloadLibrary(plugin);
+        isLoaded = plugin->lib.isLoaded();
+    }
+    plugin.reset();
+
+    return !isLoaded;
+}
+
+void PlugMgrPrivate::unloadLibrary(PluginPtr& plugin)
 {
     if(plugin->iplugin)
     {
         plugin->iplugin->aboutToBeUnloaded();
         plugin->iplugin.reset();
     }
+    plugin->stateMappings.clear();
+    releaseResources(plugin);
+    unlockPlugin(plugin);
     plugin->lib.unload();
-    const bool isLoaded = plugin->lib.isLoaded();
-    plugin.reset();
-
-    return !isLoaded;
+    metrics.hugePageTextBytes -= plugin->hugePageTextBytes;
+    plugin->hugePageTextBytes = 0;
 }
 
-// Static
-uint16_t PlugMgrPrivate::handleRequest(const char *sender,
-                                       uint16_t code,
-                                       void **data,
-                                       uint32_t *dataSize)
+void PlugMgrPrivate::evictPlugin(PluginPtr& plugin)
 {
-    PlugMgrPrivate *_p = PluginManager::instance()._p;
+    if(useLog)
+        log.get() << "Evict plugin " << plugin->info.name << std::endl;
 
-    if(_p->useLog)
-        _p->log.get() << "Request from " << sender << " !" << std::endl;
+    waitForHealthCheck(plugin);
+    discardRequests(plugin);
+    unloadLibrary(plugin);
+    plugin->depPlugins.clear();
+    plugin->evicted = true;
+    metrics.evictions++;
+}
 
-    // All requests to the manager sent or receive data, so check here if dataSize is null
-    if(!dataSize)
-        return IPlugin::DATASIZE_NULL;
+size_t PlugMgrPrivate::evictPlugins(const std::function<bool(const Plugin&)>& filter,
+                                    unsigned int minIdleTime,
+                                    std::vector<std::string>* evictedList)
+{
+    // Count the loaded dependents of each plugin
+    std::unordered_map<std::string, int> dependentsCount;
+    for(const std::string& name : loadOrderList)
+    {
+        const PluginPtr& plugin = pluginsMap.at(name);
+        if(!plugin->iplugin)
+            continue;
+        // Lazy dependencies are reloaded by their proxy
+        for(const PluginInfoStd::Dependency& dep : plugin->info.dependencies)
+        {
+            if(!dep.lazy)
+                dependentsCount[dep.name]++;
+        }
+    }
 
-    switch(code)
+    // Dependents are before their dependencies in the reverse load order,
+    // so evicting a plugin can free its dependencies in the same pass
+    const auto now = std::chrono::steady_clock::now();
+    size_t evictedCount = 0;
+    for(auto it = loadOrderList.rbegin(); it != loadOrderList.rend(); ++it)
     {
-    case IPlugin::GET_APPDIRECTORY:
+        PluginPtr& plugin = pluginsMap.at(*it);
+        if(!plugin->iplugin
+           || !filter(*plugin)
+           || plugin->isMainPlugin
+           || plugin->activeRequests > 0
+           || plugin->healthCheckRunning
+           || plugin->delivering
+           || hasPendingRequests(*it) // Accepted requests are delivered first
+           || plugin->iplugin.use_count() > 1 // Still referenced by the user
+           || dependentsCount[*it] > 0
+           || now - plugin->lastUse < std::chrono::milliseconds(minIdleTime))
+        {
+            continue;
+        }
+
+        evictPlugin(plugin);
+        evictedCount++;
+        if(evictedList)
+            evictedList->push_back(*it);
+        for(const PluginInfoStd::Dependency& dep : plugin->info.dependencies)
+        {
+            if(!dep.lazy)
+                dependentsCount[dep.name]--;
+        }
+    }
+    return evictedCount;
+}
+
+size_t PlugMgrPrivate::evictIdlePlugins(unsigned int minIdleTime)
+{
+    return evictPlugins([](const Plugin& plugin) { return plugin.info.evictable; }, minIdleTime);
+}
+
+bool PlugMgrPrivate::reloadPlugin(PluginPtr& plugin)
+{
+    const bool deferred = plugin->deferred;
+    if(useLog)
+        log.get() << (deferred ? "Load deferred plugin " : "Reload evicted plugin ") << plugin->info.name << std::endl;
+
+    for(const PluginInfoStd::Dependency& dep : plugin->info.dependencies)
     {
-        *data = (void*)strdup(PluginManager::appDirectory().c_str());
-        *dataSize = strlen((char*)*data);
-        break;
+        PluginPtr* depPlugin = resolvedDependency(dep);
+        if(!depPlugin || dep.lazy)
+            continue;
+        if(!(*depPlugin)->iplugin && !reloadPlugin(*depPlugin) && !dep.optional)
+            return false;
     }
-    case IPlugin::GET_PLUGINAPI:
+
+    if(!loadPlugin(plugin))
+        return false;
+
+    if(deferred)
+        metrics.lazyLoads++;
+    else
+        metrics.reloads++;
+    return true;
+}
+
+ReturnCode PlugMgrPrivate::pageOutPlugin(PluginPtr& plugin, bool reclaim, PageOutReport* report)
+{
+    if(!plugin->iplugin)
+        return ReturnCode::PAGEOUT_PLUGIN_NOT_LOADED;
+
+    const size_t residentBefore = sysutil::residentSize(plugin->segments);
+    const size_t processResidentBefore = sysutil::processResidentSize();
+
+    if(plugin->segments.empty() || sysutil::adviseColdRanges(plugin->segments, reclaim) != 0)
+        return ReturnCode::PAGEOUT_NOT_SUPPORTED;
+
+    const size_t residentAfter = sysutil::residentSize(plugin->segments);
+    plugin->pageOutTime = std::chrono::steady_clock::now();
+    metrics.pageOuts++;
+    if(residentBefore > residentAfter)
+        metrics.pageOutBytes += residentBefore - residentAfter;
+
+    if(useLog)
     {
-        *data = (void*)strdup(PluginManager::pluginApi().c_str());
-        *dataSize = strlen((char*)*data);
-        break;
+        log.get() << "Page out plugin " << plugin->info.name << ": "
+                  << residentBefore / 1024 << " kB -> " << residentAfter / 1024 << " kB resident" << std::endl;
     }
-    case IPlugin::GET_PLUGINSCOUNT:
+
+    if(report)
     {
-        *data = (void*)(new size_t(PluginManager::instance().pluginsCount()));
-        *dataSize = 1;
-        break;
+        report->mappedSize = 0;
+        for(const sysutil::MemoryRange& range : plugin->segments)
+            report->mappedSize += range.size;
+        report->residentBefore = residentBefore;
+        report->residentAfter = residentAfter;
+        report->processResidentBefore = processResidentBefore;
+        report->processResidentAfter = sysutil::processResidentSize();
     }
-    case IPlugin::GET_PLUGININFO:
+    return ReturnCode::SUCCESS;
+}
+
+size_t PlugMgrPrivate::pageOutIdlePlugins(unsigned int minIdleTime)
+{
+    const auto now = std::chrono::steady_clock::now();
+    size_t count = 0;
+    for(const std::string& name : loadOrderList)
     {
-        PluginInfo info = PluginManager::instance().pluginInfo(*data ? (const char*)*data : sender);
-        if(!info.name)
-            return IPlugin::NOT_FOUND;
+        PluginPtr& plugin = pluginsMap.at(name);
+        if(!plugin->iplugin
+           || plugin->activeRequests > 0
+           || plugin->pageOutTime > plugin->lastUse // Already paged out since the last use
+           || now - plugin->lastUse < std::chrono::milliseconds(minIdleTime))
+        {
+            continue;
+        }
 
-        *data = (void*)(new PluginInfo(info));
-        *dataSize = 1;
-        break;
+        if(pageOutPlugin(plugin, true, nullptr))
+            count++;
     }
-    case IPlugin::GET_PLUGINVERSION:
+    return count;
+}
+
+void PlugMgrPrivate::idleLoop()
+{
+    std::unique_lock<std::recursive_mutex> lock(mutex);
+    const size_t stackLockedBytes = realTimeMode ? lockThreadStack() : 0;
+
+    while(!stopIdle)
     {
-        PluginInfo info = PluginManager::instance().pluginInfo(*data ? (const char*)*data : sender);
-        if(!info.name)
-            return IPlugin::NOT_FOUND;
+        // Check several times per delay, so plugins are handled close to their deadline
+        unsigned int delay = idleEvictionDelay;
+        if(idlePageOutDelay > 0 && (delay == 0 || idlePageOutDelay < delay))
+            delay = idlePageOutDelay;
+        idleCond.wait_for(lock, std::chrono::milliseconds(delay / 4 + 1));
 
-        *data = (void*)strdup(info.version);
-        *dataSize = strlen((char*)*data);
-        info.free();
-        break;
+        if(!stopIdle && idleEvictionDelay > 0)
+            evictIdlePlugins(idleEvictionDelay);
+        if(!stopIdle && idlePageOutDelay > 0)
+            pageOutIdlePlugins(idlePageOutDelay);
     }
-    case IPlugin::CHECK_PLUGIN:
+    metrics.lockedBytes -= stackLockedBytes;
+}
+
+void PlugMgrPrivate::updateIdleThread()
+{
     {
-        if(PluginManager::instance().hasPlugin((const char*)*data))
-            return IPlugin::RESULT_TRUE;
-        return IPlugin::RESULT_FALSE;
-        break;
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        if(idleEvictionDelay > 0 || idlePageOutDelay > 0)
+        {
+            if(!idleThread.joinable())
+                idleThread = std::thread(&PlugMgrPrivate::idleLoop, this);
+            idleCond.notify_all();
+            return;
+        }
     }
-    case IPlugin::CHECK_PLUGINLOADED:
+    stopIdleThread();
+}
+
+void PlugMgrPrivate::stopIdleThread()
+{
+    if(!idleThread.joinable())
+        return;
+
     {
-        if(PluginManager::instance().isPluginLoaded((const char*)*data))
-            return IPlugin::RESULT_TRUE;
-        return IPlugin::RESULT_FALSE;
-        break;
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        stopIdle = true;
     }
-    default:
-        return IPlugin::UNKNOWN_REQUEST;
-        break;
+    idleCond.notify_all();
+    idleThread.join();
+    stopIdle = false;
+}
+
+void PlugMgrPrivate::lockPlugin(PluginPtr& plugin)
+{
+    if(plugin->lockedBytes > 0)
+        return;
+
+    const size_t size = sysutil::rangesSize(plugin->segments) + sysutil::rangesSize(plugin->writableSegments);
+    if(metrics.lockedBytes + size <= lockBudget
+       && sysutil::lockRanges(plugin->segments) == 0
+       && sysutil::lockRanges(plugin->writableSegments) == 0)
+    {
+        plugin->lockedBytes = size;
+        metrics.lockedBytes += size;
+        if(useLog)
+            log.get() << "Lock " << size / 1024 << " kB of plugin " << plugin->info.name << std::endl;
+        return;
     }
 
-    return IPlugin::SUCCESS;
+    // Over budget or not allowed (RLIMIT_MEMLOCK): only prefault the pages
+    sysutil::unlockRanges(plugin->segments);
+    sysutil::unlockRanges(plugin->writableSegments);
+    sysutil::prefaultRanges(plugin->segments);
+    sysutil::prefaultRanges(plugin->writableSegments);
+    metrics.lockFailures++;
+    if(useLog)
+        log.get() << "Cannot lock plugin " << plugin->info.name << " (" << size / 1024 << " kB), prefault only" << std::endl;
 }
 
-// Static
-IPlugin* PlugMgrPrivate::getNonDepPlugin(const char* sender, const char* pluginName)
+void PlugMgrPrivate::unlockPlugin(PluginPtr& plugin)
 {
-    PlugMgrPrivate *_p = PluginManager::instance()._p;
+    if(plugin->lockedBytes == 0)
+        return;
+
+    sysutil::unlockRanges(plugin->segments);
+    sysutil::unlockRanges(plugin->writableSegments);
+    metrics.lockedBytes -= plugin->lockedBytes;
+    plugin->lockedBytes = 0;
+}
 
-    if(_p->pluginsMap[std::string(sender)]->isMainPlugin)
+void PlugMgrPrivate::lockManager()
+{
+    if(managerLockedBytes > 0)
+        return;
+
+    managerSegments.clear();
+    sysutil::objectSegments(reinterpret_cast<const void*>(&PlugMgrPrivate::handleRequest),
+                            &managerSegments, &managerSegments);
+
+    const size_t size = sysutil::rangesSize(managerSegments);
+    if(metrics.lockedBytes + size <= lockBudget && sysutil::lockRanges(managerSegments) == 0)
     {
-        if(_p->useLog)
-            _p->log.get() << "Get plugin object of " << pluginName << " plugin (request from the main plugin)" << std::endl;
+        managerLockedBytes = size;
+        metrics.lockedBytes += size;
+        return;
+    }
+
+    sysutil::unlockRanges(managerSegments);
+    sysutil::prefaultRanges(managerSegments);
+    metrics.lockFailures++;
+}
 
-        if(_p->pluginManager->isPluginLoaded(pluginName))
-            return _p->pluginsMap[std::string(pluginName)]->iplugin.get();
+void PlugMgrPrivate::unlockManager()
+{
+    if(managerLockedBytes == 0)
+        return;
+
+    sysutil::unlockRanges(managerSegments);
+    metrics.lockedBytes -= managerLockedBytes;
+    managerLockedBytes = 0;
+}
+
+size_t PlugMgrPrivate::lockThreadStack()
+{
+    // Enough for the manager functions and the plugins callbacks
+    const size_t stackSize = 64 * 1024;
+
+    size_t locked = 0;
+    if(metrics.lockedBytes + stackSize <= lockBudget)
+        locked = sysutil::lockCurrentStack(stackSize);
+    if(locked == 0)
+        metrics.lockFailures++;
+    metrics.lockedBytes += locked;
+    return locked;
+}
+
+void PlugMgrPrivate::remapTextOnHugePages(PluginPtr& plugin)
+{
+    // The mapping of the code is replaced by an anonymous one: the pages
+    // are not shared with other processes, and they cannot be paged out to the file
+    size_t remapped = 0;
+    for(const sysutil::MemoryRange& range : plugin->segments)
+    {
+        if(range.executable)
+            remapped += sysutil::remapOnHugePages(range);
+    }
+
+    // The kernel may not have found free huge pages
+    plugin->hugePageTextBytes = remapped > 0 ? sysutil::hugePagesSize(plugin->segments) : 0;
+    metrics.hugePageTextBytes += plugin->hugePageTextBytes;
+    if(plugin->hugePageTextBytes == 0)
+        metrics.hugePageTextFallbacks++;
+
+    if(useLog)
+    {
+        if(plugin->hugePageTextBytes > 0)
+            log.get() << "Code of plugin " << plugin->info.name << " on huge pages: " << plugin->hugePageTextBytes / 1024 << " kB" << std::endl;
+        else
+            log.get() << "Code of plugin " << plugin->info.name << " is not on huge pages (code too small, or THP not available)" << std::endl;
+    }
+}
+
+void PlugMgrPrivate::shareResources(PluginPtr& plugin)
+{
+    // Only plugins using embed_resources() export the table
+    if(!plugin->lib.hasSymbol("jp_resource_table"))
+        return;
+
+    const ResourceEntry* table = static_cast<const ResourceEntry*>(plugin->lib.getRawAddress("jp_resource_table"));
+    const size_t refsBefore = plugin->resourceRefs.size();
+    const size_t shared = blobCache.shareResources(plugin->path, table, &plugin->resourceRefs);
+
+    for(size_t i = refsBefore; i < plugin->resourceRefs.size(); ++i)
+    {
+        if(plugin->resourceRefs[i].sharedBytes > 0)
+            metrics.sharedResources++;
+    }
+    metrics.sharedResourceBytes += shared;
+
+    if(useLog && shared > 0)
+        log.get() << "Resources of plugin " << plugin->info.name << " shared with other plugins: " << shared / 1024 << " kB" << std::endl;
+}
+
+void PlugMgrPrivate::releaseResources(PluginPtr& plugin)
+{
+    for(const BlobCache::Ref& ref : plugin->resourceRefs)
+    {
+        if(ref.sharedBytes > 0)
+        {
+            metrics.sharedResources--;
+            metrics.sharedResourceBytes -= ref.sharedBytes;
+        }
+    }
+    blobCache.release(&plugin->resourceRefs);
+}
+
+void PlugMgrPrivate::checkIntegrity(const std::string& pluginDir, fsutil::PathList* libList, PluginManager::callback callbackFunc)
+{
+    IntegrityChecker::Stats stats;
+    const std::vector<IntegrityChecker::Digest> digests = integrity.hashFiles(*libList, &workerPool, &stats);
+    metrics.integrityHashedFiles += stats.hashedFiles;
+    metrics.integrityHashedBytes += stats.hashedBytes;
+    metrics.integrityCacheHits += stats.cacheHits;
+    if(useLog && stats.hashedFiles > 0)
+    {
+        const WorkerPool::Info poolInfo = workerPool.info();
+        log.get() << "Hashed " << stats.hashedFiles << " libraries on up to " << poolInfo.peakWorkers
+                  << " threads (wait/CPU ratio " << poolInfo.waitRatio << ", next run: " << poolInfo.workers << " threads)" << std::endl;
+    }
+
+    fsutil::PathList checkedList;
+    for(size_t i=0; i < libList->size(); ++i)
+    {
+        const std::string& path = (*libList)[i];
+        if(integrity.verify(relativePath(pluginDir, path), digests[i]))
+        {
+            checkedList.push_back(path);
+            continue;
+        }
+
+        metrics.integrityFailures++;
+        if(useLog)
+            log.get() << "Library " << path << " does not match the integrity manifest" << std::endl;
+        if(callbackFunc)
+            callbackFunc(ReturnCode::SEARCH_INTEGRITY_MISMATCH, strdup(path.c_str()));
+    }
+    libList->swap(checkedList);
+}
+
+bool PlugMgrPrivate::checkIntegrity(const std::string& path, const std::string& relativePath)
+{
+    IntegrityChecker::Stats stats;
+    const IntegrityChecker::Digest digest = integrity.hashFiles({path}, &workerPool, &stats).front();
+    metrics.integrityHashedFiles += stats.hashedFiles;
+    metrics.integrityHashedBytes += stats.hashedBytes;
+    metrics.integrityCacheHits += stats.cacheHits;
+
+    if(integrity.verify(relativePath, digest))
+        return true;
+    metrics.integrityFailures++;
+    if(useLog)
+        log.get() << "Library " << path << " does not match the integrity manifest" << std::endl;
+    return false;
+}
+
+std::string PlugMgrPrivate::relativePath(const std::string& pluginDir, const std::string& path)
+{
+    if(path.compare(0, pluginDir.size(), pluginDir) != 0)
+        return path;
+    size_t start = pluginDir.size();
+    while(start < path.size() && (path[start] == '/' || path[start] == '\\'))
+        ++start;
+    return path.substr(start);
+}
+
+ReturnCode PlugMgrPrivate::addRegisteredPlugins(const std::string& pluginDir, bool recursive,
+                                                const std::vector<SharedRegistry::Record>& records,
+                                                PluginManager::callback callbackFunc)
+{
+    if(useLog)
+        log.get() << "Plugins of " << pluginDir << " read from the shared registry" << std::endl;
+
+    // Same paths as the ones listed by fsutil::listLibrariesInDir() (without the trailing separator)
+    std::string dir = pluginDir;
+    if(dir.size() > 1 && (dir.back() == '/' || dir.back() == '\\'))
+        dir.pop_back();
+    fsutil::PathList libList;
+    for(const SharedRegistry::Record& record : records)
+        libList.push_back(dir + "/" + record.relativePath);
+    fsutil::PathList checkedList = libList;
+    if(integrity.isEnabled())
+        checkIntegrity(pluginDir, &checkedList, callbackFunc);
+
+    bool atLeastOneFound = false;
+    auto checkedPath = checkedList.begin();
+    for(size_t i=0; i < records.size(); ++i)
+    {
+        // checkedList keeps the order of libList
+        if(checkedPath == checkedList.end() || *checkedPath != libList[i])
+            continue;
+        ++checkedPath;
+
+        const SharedRegistry::Record& record = records[i];
+        const std::string& path = libList[i];
+        if(pluginsMap.count(record.name) == 1)
+        {
+            if(callbackFunc)
+                callbackFunc(ReturnCode::SEARCH_NAME_ALREADY_EXISTS, strdup(path.c_str()));
+            continue;
+        }
+        if(record.name.empty())
+        {
+            if(callbackFunc)
+                callbackFunc(ReturnCode::SEARCH_CANNOT_PARSE_METADATA, strdup(path.c_str()));
+            continue;
+        }
+
+        // The library is loaded by loadPlugin()
+        PluginPtr plugin(new Plugin());
+        plugin->path = path;
+        plugin->relativePath = record.relativePath;
+        plugin->info = record.info;
+        plugin->fingerprint = pluginFingerprint(plugin->info);
+        plugin->registryDir = pluginDir;
+        plugin->registryRecursive = recursive;
+        pluginsMap[record.name] = plugin;
+        atLeastOneFound = true;
+    }
+
+    if(!atLeastOneFound)
+        return ReturnCode::SEARCH_NOTHING_FOUND;
+    if(std::find(locations.begin(), locations.end(), pluginDir) == locations.end())
+        locations.push_back(pluginDir);
+    return ReturnCode::SUCCESS;
+}
+
+void PlugMgrPrivate::checkRegisteredPlugins(PluginManager::callback callbackFunc)
+{
+    std::vector<std::pair<std::string, bool>> replacedDirs;
+    for(auto& entry : pluginsMap)
+    {
+        PluginPtr& plugin = entry.second;
+        if(plugin->registryDir.empty())
+            continue;
+        // A rejected library is not loaded (loadPlugin() reports it)
+        if(integrity.isEnabled() && !checkIntegrity(plugin->path, plugin->relativePath))
+            continue;
+
+        if(plugin->lib.load(plugin->path)
+           && plugin->lib.hasSymbol("jp_name")
+           && plugin->lib.hasSymbol("jp_metadata")
+           && plugin->lib.hasSymbol("jp_createPlugin")
+           && entry.first == plugin->lib.get<const char*>("jp_name"))
+            continue;
+
+        if(useLog)
+            log.get() << "The library of " << entry.first << " was replaced since the search: "
+                      << plugin->path << std::endl;
+        plugin->lib.unload();
+        const std::pair<std::string, bool> dir(plugin->registryDir, plugin->registryRecursive);
+        if(std::find(replacedDirs.begin(), replacedDirs.end(), dir) == replacedDirs.end())
+            replacedDirs.push_back(dir);
+    }
+
+    for(const std::pair<std::string, bool>& dir : replacedDirs)
+    {
+        sharedRegistry.remove(dir.first, dir.second);
+        // The plugins of the entry are not used yet: they are replaced by the ones found by the search
+        for(auto it = pluginsMap.begin(); it != pluginsMap.end();)
+        {
+            const Plugin& plugin = *it->second;
+            if(plugin.registryDir == dir.first && plugin.registryRecursive == dir.second)
+                it = pluginsMap.erase(it);
+            else
+                ++it;
+        }
+        pluginManager->searchForPlugins(dir.first, dir.second, callbackFunc);
+    }
+
+    for(auto& entry : pluginsMap)
+    {
+        if(entry.second->lib.isLoaded())
+            entry.second->registryDir.clear();
+    }
+}
+
+void PlugMgrPrivate::compactPlugins()
+{
+    for(const std::string& name : loadOrderList)
+    {
+        PluginPtr& plugin = pluginsMap.at(name);
+        if(plugin->iplugin && !plugin->compacted)
+        {
+            plugin->info.compact();
+            plugin->compacted = true;
+        }
+    }
+    loadOrderList.shrink_to_fit();
+}
+
+PluginInfoStd PlugMgrPrivate::fullInfo(PluginPtr& plugin)
+{
+    if(!plugin->compacted)
+        return plugin->info;
+
+    // The library of an evicted plugin is only loaded to read the metadata
+    jp::SharedLibrary evictedLib;
+    jp::SharedLibrary* lib = &plugin->lib;
+    if(!lib->isLoaded())
+    {
+        evictedLib.load(plugin->path);
+        lib = &evictedLib;
+    }
+
+    if(!lib->isLoaded() || !lib->hasSymbol("jp_metadata"))
+        return plugin->info;
+    PluginInfoStd info = parseMetadata(lib->get<const char[]>("jp_metadata"));
+    return info.name.empty() ? plugin->info : info;
+}
+
+uint16_t PlugMgrPrivate::handleStateRequest(PluginPtr& plugin, uint16_t code, StateFile* state)
+{
+    if(stateDirectory.empty())
+        return IPlugin::NOT_SUPPORTED;
+    const std::string path = stateDirectory + "/" + plugin->info.name + ".state";
+
+    uint16_t error = IPlugin::SUCCESS;
+    StateMapping* mapping = nullptr;
+    switch(code)
+    {
+    case IPlugin::MAP_STATEFILE:
+        mapping = StateMapping::map(path, &error);
+        break;
+    case IPlugin::CREATE_STATEFILE:
+        mapping = StateMapping::create(path, state->size, state->formatVersion, &error);
+        break;
+    default:
+    {
+        // Only handles given by the manager to this plugin are accepted
+        auto it = std::find_if(plugin->stateMappings.begin(), plugin->stateMappings.end(),
+                               [state](const std::unique_ptr<StateMapping>& m) { return m.get() == state->handle; });
+        if(it == plugin->stateMappings.end())
+            return IPlugin::NOT_FOUND;
+
+        if(code == IPlugin::PUBLISH_STATEFILE)
+        {
+            if(!(*it)->isWritable())
+                return IPlugin::COMMON_ERROR;
+            if(!(*it)->publish(plugin->info.version))
+                error = IPlugin::COMMON_ERROR;
+            else if(useLog)
+                log.get() << "State of plugin " << plugin->info.name << " published" << std::endl;
+            (*it)->fill(state);
+        }
+        plugin->stateMappings.erase(it);
+        state->data = nullptr;
+        state->handle = nullptr;
+        return error;
+    }
+    }
+
+    if(!mapping)
+        return error;
+    plugin->stateMappings.emplace_back(mapping);
+    mapping->fill(state);
+    return IPlugin::SUCCESS;
+}
+
+void PlugMgrPrivate::shedLoad()
+{
+    if(shedStep == SHED_NONE)
+        metrics.pressureEvents++;
+    // Stay on the last step while the pressure lasts (more plugins may become idle)
+    if(shedStep != SHED_UNLOAD_BACKGROUND)
+        shedStep = static_cast<ShedStep>(shedStep + 1);
+
+    if(useLog)
+        log.get() << "Memory pressure: shedding step " << shedStep << std::endl;
+
+    switch(shedStep)
+    {
+    case SHED_DROP_CACHES:
+        for(const std::string& name : loadOrderList)
+        {
+            const PluginPtr& plugin = pluginsMap.at(name);
+            if(plugin->iplugin)
+            {
+                plugin->iplugin->dropCaches();
+                metrics.cacheDrops++;
+            }
+        }
+        break;
+    case SHED_EVICT_IDLE:
+        metrics.shedPlugins += evictPlugins([](const Plugin& plugin) { return plugin.info.evictable; },
+                                            0, &shedPlugins);
+        break;
+    case SHED_UNLOAD_BACKGROUND:
+        metrics.shedPlugins += evictPlugins([](const Plugin& plugin) { return plugin.info.backgroundPriority; },
+                                            0, &shedPlugins);
+        break;
+    default:
+        break;
+    }
+}
+
+void PlugMgrPrivate::restoreShedPlugins()
+{
+    if(useLog)
+        log.get() << "Memory pressure cleared: restore " << shedPlugins.size() << " plugins" << std::endl;
+
+    // Plugins were evicted in reverse load order
+    for(auto it = shedPlugins.rbegin(); it != shedPlugins.rend(); ++it)
+    {
+        auto plugin = pluginsMap.find(*it);
+        if(plugin != pluginsMap.end() && plugin->second->evicted)
+            reloadPlugin(plugin->second);
+    }
+    shedPlugins.clear();
+    shedStep = SHED_NONE;
+}
+
+void PlugMgrPrivate::memoryPressureLoop()
+{
+    // Number of checks without pressure before restoring the plugins,
+    // to not reload them between two peaks
+    const int clearChecksCount = 3;
+
+    std::unique_lock<std::recursive_mutex> lock(mutex);
+    const size_t stackLockedBytes = realTimeMode ? lockThreadStack() : 0;
+
+    uint64_t lastStallTime = 0;
+    bool hasLastStallTime = sysutil::readMemoryStallTime(pressureFile, &lastStallTime);
+    auto lastCheck = std::chrono::steady_clock::now();
+    int clearChecks = 0;
+
+    while(!stopPressure)
+    {
+        pressureCond.wait_for(lock, std::chrono::milliseconds(pressureInterval));
+        if(stopPressure)
+            break;
+
+        uint64_t stallTime = 0;
+        if(!sysutil::readMemoryStallTime(pressureFile, &stallTime))
+            continue;
+
+        // Part of the elapsed time during which some tasks were stalled on memory
+        const auto now = std::chrono::steady_clock::now();
+        const double elapsedUs = std::chrono::duration<double, std::micro>(now - lastCheck).count();
+        const double pressure = hasLastStallTime && elapsedUs > 0 && stallTime >= lastStallTime
+                ? 100.0 * (stallTime - lastStallTime) / elapsedUs : 0.0;
+        lastStallTime = stallTime;
+        hasLastStallTime = true;
+        lastCheck = now;
+
+        if(pressure >= pressureThreshold)
+        {
+            clearChecks = 0;
+            shedLoad();
+        }
+        else if(shedStep != SHED_NONE && ++clearChecks >= clearChecksCount)
+        {
+            restoreShedPlugins();
+        }
+    }
+    metrics.lockedBytes -= stackLockedBytes;
+}
+
+void PlugMgrPrivate::stopMemoryPressureThread()
+{
+    if(!pressureThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        stopPressure = true;
+    }
+    pressureCond.notify_all();
+    pressureThread.join();
+    stopPressure = false;
+}
+
+void PlugMgrPrivate::healthLoop()
+{
+    std::unique_lock<std::recursive_mutex> lock(mutex);
+    std::vector<HealthEvent> events;
+
+    while(!stopHealth)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        auto wakeUp = now + std::chrono::milliseconds(healthInterval);
+        for(auto& entry : pluginsMap)
+        {
+            PluginPtr& plugin = entry.second;
+            if(!plugin->iplugin)
+                continue;
+
+            const int interval = plugin->info.healthCheckInterval >= 0 ? plugin->info.healthCheckInterval : healthInterval;
+            const int timeout = plugin->info.healthCheckTimeout > 0 ? plugin->info.healthCheckTimeout : healthTimeout;
+
+            // A check that does not return is not cancelled, but the plugin is unhealthy until it returns
+            if(plugin->healthCheckPending && !plugin->healthCheckTimedOut)
+            {
+                if(now >= plugin->healthCheckDeadline)
+                {
+                    plugin->healthCheckTimedOut = true;
+                    plugin->checkState = IPlugin::UNHEALTHY;
+                    metrics.healthCheckTimeouts++;
+                    if(useLog)
+                        log.get() << "Health check of " << entry.first << " timed out" << std::endl;
+                }
+                else if(plugin->healthCheckDeadline < wakeUp)
+                {
+                    wakeUp = plugin->healthCheckDeadline;
+                }
+            }
+
+            if(now >= plugin->nextHealthCheck)
+            {
+                evaluateRequests(plugin);
+                if(interval > 0 && !plugin->healthCheckPending)
+                {
+                    plugin->healthCheckPending = true;
+                    plugin->healthCheckTimedOut = false;
+                    plugin->healthCheckDeadline = now + std::chrono::milliseconds(timeout);
+                    healthQueue.push_back(plugin);
+                    if(plugin->healthCheckDeadline < wakeUp)
+                        wakeUp = plugin->healthCheckDeadline;
+                }
+                // The error rate is also evaluated for the plugins without checks
+                plugin->nextHealthCheck = now + std::chrono::milliseconds(interval > 0 ? interval : healthInterval);
+            }
+            if(plugin->nextHealthCheck < wakeUp)
+                wakeUp = plugin->nextHealthCheck;
+
+            updateHealthState(plugin, &events);
+        }
+
+        // A blocked worker cannot run the other checks: start a worker for each check
+        // that cannot be run by an idle one
+        for(size_t i = idleHealthWorkers; i < healthQueue.size(); ++i)
+        {
+            healthWorkers.emplace_back(&PlugMgrPrivate::healthWorkerLoop, this);
+            idleHealthWorkers++;
+        }
+        if(!healthQueue.empty())
+            healthWorkCond.notify_all();
+
+        // The callback can use the manager
+        if(!events.empty() && healthCallbackFunc)
+        {
+            const jp::PluginManager::healthCallback callbackFunc = healthCallbackFunc;
+            lock.unlock();
+            for(const HealthEvent& event : events)
+                callbackFunc(event.name, event.state, event.previous);
+            lock.lock();
+        }
+        events.clear();
+
+        if(!stopHealth)
+            healthCond.wait_until(lock, wakeUp);
+    }
+}
+
+void PlugMgrPrivate::healthWorkerLoop()
+{
+    std::unique_lock<std::recursive_mutex> lock(mutex);
+    while(true)
+    {
+        while(!stopHealth && healthQueue.empty())
+            healthWorkCond.wait(lock);
+        if(stopHealth)
+            break;
+
+        PluginPtr plugin = healthQueue.front();
+        healthQueue.pop_front();
+        idleHealthWorkers--;
+
+        // The plugin may have been unloaded since the check was queued
+        if(plugin->iplugin)
+        {
+            IPlugin* iplugin = plugin->iplugin.get();
+            plugin->healthCheckRunning = true;
+            lock.unlock();
+            const IPlugin::HealthState state = iplugin->healthCheck();
+            lock.lock();
+            plugin->healthCheckRunning = false;
+
+            metrics.healthChecks++;
+            if(state != IPlugin::HEALTHY)
+                metrics.healthCheckFailures++;
+            plugin->checkState = state;
+            healthDoneCond.notify_all();
+            // The new state is published by the scheduler
+            healthCond.notify_all();
+        }
+        plugin->healthCheckPending = false;
+        idleHealthWorkers++;
+    }
+}
+
+void PlugMgrPrivate::stopHealthThread()
+{
+    if(!healthThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        stopHealth = true;
+    }
+    healthCond.notify_all();
+    healthWorkCond.notify_all();
+    healthThread.join();
+    for(std::thread& worker : healthWorkers)
+        worker.join();
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    for(PluginPtr& plugin : healthQueue)
+        plugin->healthCheckPending = false;
+    healthQueue.clear();
+    healthWorkers.clear();
+    idleHealthWorkers = 0;
+    stopHealth = false;
+}
+
+void PlugMgrPrivate::evaluateRequests(PluginPtr& plugin)
+{
+    const uint64_t requests = plugin->health->requests();
+    const uint64_t failures = plugin->health->failedRequests();
+    const uint64_t count = requests - plugin->evaluatedRequests;
+    if(count == 0 || count < healthMinRequests)
+        return;
+
+    const uint64_t failed = failures - plugin->evaluatedFailures;
+    if(failed * 100 >= uint64_t(healthErrorRate) * count)
+        plugin->requestsState = IPlugin::UNHEALTHY;
+    else if(failed * 200 >= uint64_t(healthErrorRate) * count)
+        plugin->requestsState = IPlugin::DEGRADED;
+    else
+        plugin->requestsState = IPlugin::HEALTHY;
+    plugin->evaluatedRequests = requests;
+    plugin->evaluatedFailures = failures;
+}
+
+void PlugMgrPrivate::updateHealthState(PluginPtr& plugin, std::vector<HealthEvent>* events)
+{
+    // The states are ordered from the best to the worst
+    const IPlugin::HealthState state = std::max(plugin->checkState, plugin->requestsState);
+    const IPlugin::HealthState previous = plugin->health->state();
+    if(state == previous)
+        return;
+
+    plugin->health->_state.store(state, std::memory_order_release);
+    metrics.healthStateChanges++;
+    events->push_back(HealthEvent{plugin->info.name, state, previous});
+}
+
+void PlugMgrPrivate::waitForHealthCheck(PluginPtr& plugin)
+{
+    // The library cannot be unloaded while its code is running
+    while(plugin->healthCheckRunning)
+        healthDoneCond.wait(mutex);
+}
+
+IPlugin* PlugMgrPrivate::pluginInterface(PluginPtr& plugin)
+{
+    if(!healthChecks && !tracer.isEnabled())
+        return plugin->iplugin.get();
+    if(!plugin->proxy)
+        plugin->proxy.reset(new PluginProxy(plugin.get(), &tracer));
+    return plugin->proxy.get();
+}
+
+bool PlugMgrPrivate::effectiveRateLimit(const std::string& sender, const std::string& receiver, RateLimit* limit)
+{
+    auto it = rateLimits.find(std::make_pair(sender, receiver));
+    if(it == rateLimits.end())
+        it = rateLimits.find(std::make_pair(std::string(), receiver));
+    if(it != rateLimits.end())
+    {
+        *limit = it->second;
+    }
+    else
+    {
+        auto plugin = pluginsMap.find(receiver);
+        if(plugin == pluginsMap.end())
+            return false;
+        *limit = RateLimit{plugin->second->info.rateLimit, plugin->second->info.rateBurst};
+    }
+
+    if(limit->rate <= 0.0)
+        return false;
+    if(limit->burst < 1.0)
+        limit->burst = std::max(limit->rate / 10.0, 1.0);
+    return true;
+}
+
+IPlugin* PlugMgrPrivate::limitRequests(PluginPtr& sender, const std::string& receiver, IPlugin* target)
+{
+    RateLimit limit;
+    if(!effectiveRateLimit(sender->info.name, receiver, &limit))
+        return target;
+
+    std::shared_ptr<RateLimiter>& limiter = rateLimiters[std::make_pair(sender->info.name, receiver)];
+    if(!limiter)
+        limiter = std::make_shared<RateLimiter>(sender->info.name, receiver);
+    limiter->setLimit(limit.rate, limit.burst);
+
+    std::unique_ptr<RateLimitedProxy>& proxy = sender->limitedReceivers[receiver];
+    if(!proxy)
+        proxy.reset(new RateLimitedProxy(limiter));
+    proxy->setTarget(target);
+    return proxy.get();
+}
+
+// Static
+IPlugin* PlugMgrPrivate::acquirePlugin(Plugin* plugin)
+{
+    PlugMgrPrivate *_p = PluginManager::instance()._p;
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+
+    if(!plugin->iplugin)
+    {
+        auto it = _p->pluginsMap.find(plugin->info.name);
+        if(!(plugin->evicted || plugin->deferred) || it == _p->pluginsMap.end() || !_p->reloadPlugin(it->second))
+            return nullptr;
+    }
+
+    plugin->activeRequests++;
+    plugin->lastUse = std::chrono::steady_clock::now();
+    return plugin->iplugin.get();
+}
+
+// Static
+void PlugMgrPrivate::releasePlugin(Plugin* plugin)
+{
+    PlugMgrPrivate *_p = PluginManager::instance()._p;
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+
+    plugin->activeRequests--;
+    plugin->lastUse = std::chrono::steady_clock::now();
+}
+
+uint16_t PlugMgrPrivate::postRequest(const char* sender, const IPlugin::PostedRequest& request)
+{
+    if(!request.receiver || !request.handler)
+        return IPlugin::COMMON_ERROR;
+    RequestQueue* queue = requestQueue(request.receiver);
+
+    // The handler is given by the sender: it must be an object given to it for the receiver
+    // (checked once for each sender and handler, until a plugin is unloaded)
+    if(request.handler != queue->checkedHandler
+       || sender != queue->checkedSender
+       || unloadGeneration != queue->checkedGeneration)
+    {
+        if(!isReceiverHandler(sender, request.receiver, request.handler))
+            return IPlugin::COMMON_ERROR;
+        queue->checkedHandler = request.handler;
+        queue->checkedSender = sender;
+        queue->checkedReceiver = pluginsMap.at(request.receiver).get();
+        queue->checkedGeneration = unloadGeneration;
+    }
+    // A posted request is a use of the receiver (see evictIdlePlugins())
+    queue->checkedReceiver->lastUse = std::chrono::steady_clock::now();
+
+    if(queue->maxDelay > 0)
+    {
+        // Moving average of the time between two requests (an idle period counts as a few max delays)
+        const int64_t now = nowNs();
+        const int64_t gap = std::min(now - queue->lastArrival, 4 * queue->maxDelay);
+        queue->arrivalGap += (gap - queue->arrivalGap) / 8;
+        queue->lastArrival = now;
+    }
+
+    queue->pending.push_back(RequestQueue::Entry{
+        sender, request.handler, request.code,
+        request.data ? std::string(static_cast<const char*>(request.data), request.dataSize) : std::string(),
+        TraceHandoff::capture()});
+    metrics.postedRequests++;
+
+    // The thread is woken once for each batch: by its first request, or when it is full
+    if(queue->state == RequestQueue::IDLE
+       || (queue->state == RequestQueue::GATHERING && queue->pending.size() >= queue->maxBatch))
+    {
+        queue->state = RequestQueue::WAKING;
+        queue->cond.notify_one();
+    }
+    return IPlugin::SUCCESS;
+}
+
+bool PlugMgrPrivate::isReceiverHandler(const char* sender, const char* receiver, IPlugin* handler)
+{
+    auto senderIt = pluginsMap.find(sender);
+    auto receiverIt = pluginsMap.find(receiver);
+    if(senderIt == pluginsMap.end() || receiverIt == pluginsMap.end())
+        return false;
+    if(handler == receiverIt->second->iplugin.get() || handler == receiverIt->second->proxy.get())
+        return true;
+    auto limited = senderIt->second->limitedReceivers.find(receiver);
+    return limited != senderIt->second->limitedReceivers.end() && handler == limited->second.get();
+}
+
+bool PlugMgrPrivate::hasPendingRequests(const std::string& name) const
+{
+    for(const auto& val : requestQueues)
+    {
+        const RequestQueue& queue = *val.second;
+        if(queue.pending.empty())
+            continue;
+        if(queue.receiver == name)
+            return true;
+        for(const RequestQueue::Entry& entry : queue.pending)
+        {
+            if(entry.sender == name)
+                return true;
+        }
+    }
+    return false;
+}
+
+PlugMgrPrivate::RequestQueue* PlugMgrPrivate::requestQueue(const std::string& receiver)
+{
+    std::unique_ptr<RequestQueue>& queue = requestQueues[receiver];
+    if(!queue)
+    {
+        queue.reset(new RequestQueue());
+        queue->receiver = receiver;
+        queue->thread = std::thread(&PlugMgrPrivate::requestQueueLoop, this, queue.get());
+    }
+    return queue.get();
+}
+
+void PlugMgrPrivate::requestQueueLoop(RequestQueue* queue)
+{
+    std::unique_lock<std::recursive_mutex> lock(mutex);
+    while(true)
+    {
+        while(!queue->stop && queue->pending.empty())
+        {
+            queue->state = RequestQueue::IDLE;
+            queue->cond.wait(lock);
+        }
+        if(queue->stop)
+            break;
+
+        // Wait for more requests, until the batch is full or the delay elapsed
+        const int64_t delay = coalescingDelay(*queue);
+        if(delay > 0 && queue->pending.size() < queue->maxBatch)
+        {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(delay);
+            queue->state = RequestQueue::GATHERING;
+            while(!queue->stop && queue->pending.size() < queue->maxBatch
+                  && queue->cond.wait_until(lock, deadline) == std::cv_status::no_timeout) {}
+            if(queue->stop)
+                break;
+        }
+
+        // The requests may have been discarded meanwhile (all of them if the receiver was unloaded)
+        queue->state = RequestQueue::DELIVERING;
+        const size_t count = std::min(queue->pending.size(), queue->maxBatch);
+        if(count == 0)
+            continue;
+        queue->batch.assign(std::make_move_iterator(queue->pending.begin()),
+                            std::make_move_iterator(queue->pending.begin() + count));
+        queue->pending.erase(queue->pending.begin(), queue->pending.begin() + count);
+        metrics.requestBatches++;
+        // The library of the receiver is not unloaded until the end of the batch
+        queue->receiverPlugin = pluginsMap.at(queue->receiver);
+        queue->receiverPlugin->delivering = true;
+
+        lock.unlock();
+        for(RequestQueue::Entry& entry : queue->batch)
+        {
+            void* data = entry.data.empty() ? nullptr : &entry.data[0];
+            uint32_t dataSize = static_cast<uint32_t>(entry.data.size());
+            // The request is a child of the span that posted it
+            TraceResume resume(entry.trace);
+            entry.handler->handleRequest(entry.sender.c_str(), entry.code, &data, &dataSize);
+        }
+        lock.lock();
+        queue->batch.clear();
+        queue->retiredSenders.clear();
+        queue->receiverPlugin->delivering = false;
+        // The receiver was unloaded during the batch (see unloadPlugin())
+        if(queue->receiverPlugin->unloadAfterDelivery)
+            unloadLibrary(queue->receiverPlugin);
+        queue->receiverPlugin.reset();
+    }
+}
+
+int64_t PlugMgrPrivate::coalescingDelay(const RequestQueue& queue)
+{
+    // No other request is expected within the maximum delay: waiting would only add latency
+    if(queue.maxDelay == 0 || queue.arrivalGap >= queue.maxDelay)
+        return 0;
+    // Long enough to fill the batch at the current rate
+    return std::min(queue.maxDelay, queue.arrivalGap * static_cast<int64_t>(queue.maxBatch - 1));
+}
+
+void PlugMgrPrivate::discardRequests(const PluginPtr& plugin)
+{
+    const std::string& name = plugin->info.name;
+    // The objects of the plugin are not valid handlers anymore
+    unloadGeneration++;
+    for(auto& val : requestQueues)
+    {
+        RequestQueue& queue = *val.second;
+        const bool isReceiver = queue.receiver == name;
+        const size_t count = queue.pending.size();
+        queue.pending.erase(std::remove_if(queue.pending.begin(), queue.pending.end(),
+                                           [&](const RequestQueue::Entry& entry) { return isReceiver || name == entry.sender; }),
+                            queue.pending.end());
+        metrics.discardedRequests += count - queue.pending.size();
+
+        // The batch being delivered is not waited for (it may be delivered by the current thread).
+        // Its handlers may be rate limited proxies of the plugin: they are kept until its end.
+        if(std::any_of(queue.batch.begin(), queue.batch.end(),
+                       [&](const RequestQueue::Entry& entry) { return name == entry.sender; }))
+            queue.retiredSenders.push_back(plugin);
+    }
+}
+
+void PlugMgrPrivate::stopRequestQueues()
+{
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        for(auto& val : requestQueues)
+        {
+            val.second->stop = true;
+            val.second->cond.notify_one();
+        }
+    }
+    for(auto& val : requestQueues)
+        val.second->thread.join();
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    for(auto& val : requestQueues)
+        metrics.discardedRequests += val.second->pending.size();
+    requestQueues.clear();
+}
+
+// Static
+uint16_t PlugMgrPrivate::handleRequest(const char *sender,
+                                       uint16_t code,
+                                       void **data,
+                                       uint32_t *dataSize)
+{
+    PlugMgrPrivate *_p = PluginManager::instance()._p;
+    // Traced only in the trace of the sender (ends after the mutex is unlocked)
+    TraceScope trace(_p->tracer, sender, nullptr, code, false);
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+
+    if(_p->useLog)
+        _p->log.get() << "Request from " << sender << " !" << std::endl;
+
+    const uint16_t ret = _p->handleManagerRequest(sender, code, data, dataSize);
+    trace.setReturnCode(ret);
+    return ret;
+}
+
+uint16_t PlugMgrPrivate::handleManagerRequest(const char* sender, uint16_t code, void** data, uint32_t* dataSize)
+{
+    // All requests to the manager sent or receive data, so check here if dataSize is null
+    if(!dataSize)
+        return IPlugin::DATASIZE_NULL;
+
+    switch(code)
+    {
+    case IPlugin::GET_APPDIRECTORY:
+    {
+        *data = (void*)strdup(PluginManager::appDirectory().c_str());
+        *dataSize = strlen((char*)*data);
+        break;
+    }
+    case IPlugin::GET_PLUGINAPI:
+    {
+        *data = (void*)strdup(PluginManager::pluginApi().c_str());
+        *dataSize = strlen((char*)*data);
+        break;
+    }
+    case IPlugin::GET_PLUGINSCOUNT:
+    {
+        *data = (void*)(new size_t(PluginManager::instance().pluginsCount()));
+        *dataSize = 1;
+        break;
+    }
+    case IPlugin::GET_PLUGININFO:
+    {
+        PluginInfo info = PluginManager::instance().pluginInfo(*data ? (const char*)*data : sender);
+        if(!info.name)
+            return IPlugin::NOT_FOUND;
+
+        *data = (void*)(new PluginInfo(info));
+        *dataSize = 1;
+        break;
+    }
+    case IPlugin::GET_PLUGINVERSION:
+    {
+        PluginInfo info = PluginManager::instance().pluginInfo(*data ? (const char*)*data : sender);
+        if(!info.name)
+            return IPlugin::NOT_FOUND;
+
+        *data = (void*)strdup(info.version);
+        *dataSize = strlen((char*)*data);
+        info.free();
+        break;
+    }
+    case IPlugin::CHECK_PLUGIN:
+    {
+        if(PluginManager::instance().hasPlugin((const char*)*data))
+            return IPlugin::RESULT_TRUE;
+        return IPlugin::RESULT_FALSE;
+        break;
+    }
+    case IPlugin::CHECK_PLUGINLOADED:
+    {
+        if(PluginManager::instance().isPluginLoaded((const char*)*data))
+            return IPlugin::RESULT_TRUE;
+        return IPlugin::RESULT_FALSE;
+        break;
+    }
+    case IPlugin::POST_REQUEST:
+    {
+        if(!*data || *dataSize != sizeof(IPlugin::PostedRequest))
+            return IPlugin::COMMON_ERROR;
+        return postRequest(sender, *static_cast<const IPlugin::PostedRequest*>(*data));
+        break;
+    }
+    case IPlugin::MAP_STATEFILE:
+    case IPlugin::CREATE_STATEFILE:
+    case IPlugin::PUBLISH_STATEFILE:
+    case IPlugin::RELEASE_STATEFILE:
+    {
+        auto it = pluginsMap.find(sender);
+        if(!*data || it == pluginsMap.end())
+            return IPlugin::COMMON_ERROR;
+        return handleStateRequest(it->second, code, static_cast<StateFile*>(*data));
+        break;
+    }
+    default:
+        return IPlugin::UNKNOWN_REQUEST;
+        break;
+    }
+
+    return IPlugin::SUCCESS;
+}
+
+// Static
+IPlugin* PlugMgrPrivate::getNonDepPlugin(const char* sender, const char* pluginName)
+{
+    PlugMgrPrivate *_p = PluginManager::instance()._p;
+    std::lock_guard<std::recursive_mutex> lock(_p->mutex);
+
+    PluginPtr& mainPlugin = _p->pluginsMap[std::string(sender)];
+    if(mainPlugin->isMainPlugin)
+    {
+        if(_p->useLog)
+            _p->log.get() << "Get plugin object of " << pluginName << " plugin (request from the main plugin)" << std::endl;
+
+        // Plugins that can be evicted are accessed through their proxy, so that they
+        // are reloaded if needed, and not evicted during the request.
+        // Deferred plugins are loaded by their first request.
+        auto it = _p->pluginsMap.find(pluginName);
+        if(it != _p->pluginsMap.end()
+           && ((it->second->canBeEvicted() && (it->second->iplugin || it->second->evicted)) || it->second->deferred))
+        {
+            if(!it->second->proxy)
+                it->second->proxy.reset(new PluginProxy(it->second.get(), &_p->tracer));
+            if(it->second->deferred)
+                it->second->loadOnUse = true;
+            return _p->limitRequests(mainPlugin, pluginName, it->second->proxy.get());
+        }
+        // The requests are observed by the health checks
+        if(it != _p->pluginsMap.end() && it->second->iplugin)
+            return _p->limitRequests(mainPlugin, pluginName, _p->pluginInterface(it->second));
     }
 
     return nullptr;
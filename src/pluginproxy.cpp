@@ -0,0 +1,95 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "private/pluginproxy.h"
+
+#include <utility> // for std::move
+
+#include "private/plugin.h"
+#include "private/pluginmanagerprivate.h"
+#include "private/ratelimiter.h"
+#include "private/tracing.h"
+
+using namespace jp_private;
+
+PluginProxy::PluginProxy(Plugin* plugin, Tracer* tracer)
+    : jp::IPlugin(PlugMgrPrivate::handleRequest, PlugMgrPrivate::getNonDepPlugin, nullptr, 0, false),
+      _plugin(plugin),
+      _tracer(tracer)
+{
+}
+
+uint16_t PluginProxy::handleRequest(const char* sender, uint16_t code, void** data, uint32_t* dataSize)
+{
+    TraceScope trace(*_tracer, sender, _plugin->info.name.c_str(), code);
+    jp::PluginHealth& health = *_plugin->health;
+    health._requests.fetch_add(1, std::memory_order_relaxed);
+
+    // Other plugins stay loaded as long as their dependents and the main plugin are loaded
+    const bool evictable = _plugin->canBeEvicted() || _plugin->loadOnUse.load(std::memory_order_acquire);
+    jp::IPlugin* plugin = evictable ? PlugMgrPrivate::acquirePlugin(_plugin) : _plugin->iplugin.get();
+    if(!plugin)
+    {
+        health._failedRequests.fetch_add(1, std::memory_order_relaxed);
+        trace.setReturnCode(jp::IPlugin::NOT_FOUND);
+        return jp::IPlugin::NOT_FOUND;
+    }
+
+    const uint16_t ret = plugin->handleRequest(sender, code, data, dataSize);
+    trace.setReturnCode(ret);
+    if(evictable)
+        PlugMgrPrivate::releasePlugin(_plugin);
+    if(ret == jp::IPlugin::COMMON_ERROR || ret == jp::IPlugin::CORRUPTED)
+        health._failedRequests.fetch_add(1, std::memory_order_relaxed);
+    return ret;
+}
+
+const char* PluginProxy::jp_name()
+{
+    return _plugin->info.name.c_str();
+}
+
+RateLimitedProxy::RateLimitedProxy(std::shared_ptr<RateLimiter> limiter)
+    : jp::IPlugin(PlugMgrPrivate::handleRequest, PlugMgrPrivate::getNonDepPlugin, nullptr, 0, false),
+      _limiter(std::move(limiter)),
+      _target(nullptr)
+{
+}
+
+uint16_t RateLimitedProxy::handleRequest(const char* sender, uint16_t code, void** data, uint32_t* dataSize)
+{
+    if(!_limiter->tryAcquire())
+        return jp::IPlugin::THROTTLED;
+
+    jp::IPlugin* target = _target.load(std::memory_order_acquire);
+    if(!target)
+        return jp::IPlugin::NOT_FOUND;
+    return target->handleRequest(sender, code, data, dataSize);
+}
+
+const char* RateLimitedProxy::jp_name()
+{
+    return _limiter->receiver().c_str();
+}
@@ -0,0 +1,104 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BLOBCACHE_H
+#define BLOBCACHE_H
+
+/*
+ * This file is an internal header. It's not part of the public API,
+ * and may change at any moment.
+ */
+
+#include <cstddef> // for size_t
+#include <cstdint> // for uint64_t
+#include <string> // for std::string
+#include <unordered_map> // for std::unordered_multimap
+#include <vector> // for std::vector
+
+#include "resources.h"
+
+namespace jp_private
+{
+
+// Content-addressed cache of the resources embedded in the plugins (see embed_resources()).
+//
+// When a plugin is loaded, its resources are compared to the resources of the
+// plugins already loaded: the size is used as a first filter, then the hash of the
+// content (computed only when two blobs have the same size) and finally the bytes.
+// The pages of a duplicate are replaced by a mapping of the file of the first
+// plugin which embedded the content, so all copies share the same page cache pages.
+// Only whole pages are shared: resources smaller than a page are ignored.
+class BlobCache
+{
+public:
+    struct Blob;
+
+    // A resource of a loaded plugin registered in the cache
+    struct Ref
+    {
+        Blob* blob;
+        const unsigned char* address;
+        size_t sharedBytes; // 0 if the resource is the first copy of the content
+    };
+
+    BlobCache() = default;
+    ~BlobCache();
+
+    // Register the resources of the table (from the library at path).
+    // Duplicates of known content are remapped, refs of all the registered
+    // resources are appended to refs. Returns the number of bytes shared.
+    size_t shareResources(const std::string& path, const ResourceEntry* table, std::vector<Ref>* refs);
+    // Must be called before the library of the resources is unloaded
+    void release(std::vector<Ref>* refs);
+
+    struct Blob
+    {
+        size_t size = 0;
+        bool hashed = false;
+        uint64_t hash = 0;
+        // File containing the first copy of the content (opened when it is shared)
+        std::string path;
+        uint64_t offset = 0;
+        int fd = -1;
+        // Copies in the loaded plugins (the first is used to hash the content)
+        std::vector<const unsigned char*> copies;
+    };
+
+private:
+    // Non-copyable
+    BlobCache(const BlobCache&) = delete;
+    const BlobCache& operator=(const BlobCache&) = delete;
+
+    uint64_t blobHash(Blob& blob);
+    // Replace the pages of the copy at address by the pages of the file of blob.
+    // Returns the size of the remapped pages.
+    size_t remap(Blob& blob, const unsigned char* address, size_t pageSize);
+
+    // Blobs indexed by size (the pointers to the elements are stable)
+    std::unordered_multimap<size_t, Blob> _blobs;
+};
+
+} // namespace jp_private
+
+#endif // BLOBCACHE_H
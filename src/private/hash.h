@@ -0,0 +1,49 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+/*
+ * This file is an internal header. It's not part of the public API,
+ * and may change at any moment.
+ */
+
+#include <cstddef> // for size_t
+#include <cstdint> // for uint64_t
+
+namespace jp_private
+{
+namespace hash
+{
+
+// Fast non-cryptographic 64-bit hash (XXH64 algorithm).
+// The input is processed in 4 independent lanes of 8 bytes, which the CPU
+// (and the compiler, with SIMD instructions) can run in parallel.
+uint64_t hash64(const void* data, size_t size, uint64_t seed = 0);
+
+} // namespace hash
+} // namespace jp_private
+
+#endif // HASH_H
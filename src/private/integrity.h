@@ -0,0 +1,124 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef INTEGRITY_H
+#define INTEGRITY_H
+
+/*
+ * This file is an internal header. It's not part of the public API,
+ * and may change at any moment.
+ */
+
+#include <cstddef> // for size_t
+#include <cstdint> // for uint64_t
+#include <functional> // for std::function
+#include <string> // for std::string
+#include <unordered_map> // for std::unordered_map
+#include <vector> // for std::vector
+
+namespace jp_private
+{
+
+class WorkerPool;
+
+// Integrity checking of the plugin libraries against a manifest of expected hashes.
+//
+// Each file is hashed with hash64() and, if a cryptographic hash function is set, with
+// this function too. Files are hashed in parallel (on a WorkerPool), and the results are cached by
+// (device, inode): a file is hashed again only if its size, mtime or ctime changed.
+//
+// Manifest format: one file per line, "<hash64 in hex> <cryptographic hash in hex, or -> <path>",
+// where path is relative to the searched plugin directory. Lines starting with # are ignored.
+class IntegrityChecker
+{
+public:
+    // Returns the digest (in hex) of the data
+    typedef std::function<std::string(const unsigned char* data, size_t size)> CryptoHash;
+
+    struct Digest
+    {
+        bool valid = false; // false if the file cannot be read
+        uint64_t hash = 0;
+        std::string cryptoHash; // Empty if no function is set
+    };
+
+    struct Stats
+    {
+        size_t hashedFiles = 0;
+        uint64_t hashedBytes = 0;
+        size_t cacheHits = 0;
+    };
+
+    // Read the manifest at path (replaces the previous one). Returns false on error.
+    bool loadManifest(const std::string& path);
+    void clearManifest() { _manifest.clear(); _enabled = false; }
+    bool isEnabled() const { return _enabled; }
+
+    // The cached digests are cleared
+    void setCryptoHash(const CryptoHash& cryptoHash);
+
+    // Hash the files on the threads of pool (cached digests are reused)
+    std::vector<Digest> hashFiles(const std::vector<std::string>& paths, WorkerPool* pool, Stats* stats);
+    // Returns true if the digest matches the manifest entry of relativePath
+    bool verify(const std::string& relativePath, const Digest& digest) const;
+
+    // Line of the manifest for the file at relativePath
+    static std::string manifestLine(const std::string& relativePath, const Digest& digest);
+
+private:
+    struct ManifestEntry
+    {
+        uint64_t hash;
+        std::string cryptoHash; // Empty if the manifest has no cryptographic hash for this file
+    };
+
+    // Identity and version of a file
+    struct FileKey
+    {
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        uint64_t size = 0;
+        int64_t mtime = 0; // In ns
+        int64_t ctime = 0; // In ns, cannot be set back by the user (unlike mtime)
+    };
+    struct CacheEntry
+    {
+        FileKey key;
+        Digest digest;
+    };
+
+    Digest hashFile(const std::string& path) const;
+    static bool fileKey(const std::string& path, FileKey* key);
+    static uint64_t cacheId(const FileKey& key) { return key.device * 0x9E3779B97F4A7C15ULL ^ key.inode; }
+
+    bool _enabled = false;
+    std::unordered_map<std::string, ManifestEntry> _manifest;
+    CryptoHash _cryptoHash;
+    // Digests indexed by (device, inode)
+    std::unordered_map<uint64_t, CacheEntry> _cache;
+};
+
+} // namespace jp_private
+
+#endif // INTEGRITY_H
@@ -30,16 +30,24 @@
  * and may change at any moment.
  */
 
+#include <atomic> // for std::atomic
+#include <chrono> // for std::chrono::steady_clock
 #include <string> // for std::string
 #include <memory> // for std::shared_ptr
+#include <unordered_map> // for std::unordered_map
 #include <vector> // for std::vector
 #include <functional> // for std::function
 
 #include "plugininfo.h"
 #include "iplugin.h"
+#include "pluginmanager.h"
 #include "sharedlibrary.h"
 
 #include "tribool.h"
+#include "blobcache.h"
+#include "pluginproxy.h"
+#include "statemapping.h"
+#include "sysutil.h"
 
 namespace jp_private
 {
@@ -61,13 +69,35 @@ struct PluginInfoStd
     {
         std::string name;
         std::string version;
+        // Optional: the plugin is loaded even if the dependency is missing or incompatible
+        bool optional = false;
+        // Optional: the dependency is not loaded for this plugin, but on its first request
+        bool lazy = false;
     };
 
     std::vector<Dependency> dependencies;
 
+    // Optional: the plugin can be unloaded by the manager when it is idle
+    bool evictable = false;
+    // Optional ("priority": "background"): the plugin can be unloaded when the memory is under pressure
+    bool backgroundPriority = false;
+    // Optional: the code of the plugin is moved onto transparent huge pages after loading
+    bool hugePageText = false;
+    // Optional: interval and timeout of the health checks (in ms, -1 for the defaults of the manager)
+    int healthCheckInterval = -1;
+    int healthCheckTimeout = -1;
+    // Optional: rate limit of the requests of each sender to this plugin (requests per second, 0 for no limit)
+    double rateLimit = 0.0;
+    double rateBurst = 0.0;
+
     // A copy of each string is performed
     jp::PluginInfo toPluginInfo();
 
+    // Release the strings only used by toPluginInfo() (never read after loading).
+    // The name, the version and the dependencies (names, versions and flags) are kept,
+    // since they are used again to reload a plugin and to resolve the load order.
+    void compact();
+
     std::string toString();
 };
 
@@ -85,13 +115,109 @@ struct Plugin
     jp::SharedLibrary lib;
 
     std::string path;
+    // Path relative to the searched directory (entry of the integrity manifest)
+    std::string relativePath;
     PluginInfoStd info;
+    // Searched directory if the plugin was read from the shared registry and its library
+    // was not checked yet (see PlugMgrPrivate::checkRegisteredPlugins())
+    std::string registryDir;
+    bool registryRecursive = false;
 
     bool isMainPlugin = false;
 
+    // Plugin objects of the dependencies (given to the plugin object)
+    std::vector<jp::IPlugin*> depPlugins;
+
+    //
+    // Eviction (only for evictable and background plugins)
+
+    bool canBeEvicted() const { return info.evictable || info.backgroundPriority; }
+
+    // Last time the plugin was used (requests and access to the plugin object)
+    std::chrono::steady_clock::time_point lastUse;
+    // Number of requests currently running through the proxy
+    int activeRequests = 0;
+    // true if the plugin was unloaded because it was idle or to reduce the memory pressure
+    bool evicted = false;
+    // Given to the main plugin instead of the plugin object (created on first use)
+    std::unique_ptr<PluginProxy> proxy;
+
+    //
+    // Lazy dependencies
+
+    // true if the plugin is not loaded yet because it is only a lazy dependency
+    // of the other plugins (it is loaded on its first request)
+    bool deferred = false;
+    // true if the requests through the proxy must load the plugin first (cleared once loaded)
+    std::atomic<bool> loadOnUse{false};
+
+    //
+    // Rate limits
+
+    // Given to this plugin instead of the rate limited receivers (by receiver name)
+    std::unordered_map<std::string, std::unique_ptr<RateLimitedProxy>> limitedReceivers;
+
+    //
+    // Posted requests
+
+    // true while the request thread of the plugin delivers a batch (it cannot be evicted)
+    bool delivering = false;
+    // true if the plugin was unloaded during a batch: its library is unloaded at the end of the batch
+    bool unloadAfterDelivery = false;
+
+    //
+    // Page out
+
+    // Read-only and writable segments of the library (found when it is loaded)
+    sysutil::MemoryRanges segments;
+    sysutil::MemoryRanges writableSegments;
+    // Last time the segments were paged out
+    std::chrono::steady_clock::time_point pageOutTime;
+
+    // Size of the segments locked in memory (real-time mode)
+    size_t lockedBytes = 0;
+    // Size of the code backed by transparent huge pages
+    size_t hugePageTextBytes = 0;
+
+    // true if the info was compacted (the full info is read again from jp_metadata)
+    bool compacted = false;
+
+    //
+    // State files
+
+    // State files mapped by the plugin (released when it is unloaded)
+    std::vector<std::unique_ptr<StateMapping>> stateMappings;
+
+    //
+    // Resource sharing
+
+    // Embedded resources registered in the blob cache of the manager
+    std::vector<BlobCache::Ref> resourceRefs;
+
+    //
+    // Health checks
+
+    // Shared with the users of PluginManager::pluginHealth()
+    std::shared_ptr<jp::PluginHealth> health = std::make_shared<jp::PluginHealth>();
+    // Result of the last check, and state inferred from the request error rate
+    jp::IPlugin::HealthState checkState = jp::IPlugin::HEALTH_UNKNOWN;
+    jp::IPlugin::HealthState requestsState = jp::IPlugin::HEALTH_UNKNOWN;
+    std::chrono::steady_clock::time_point nextHealthCheck;
+    std::chrono::steady_clock::time_point healthCheckDeadline;
+    // A check is queued or running (the plugin is not checked again until it returns)
+    bool healthCheckPending = false;
+    // A worker is running the check (the plugin cannot be unloaded)
+    bool healthCheckRunning = false;
+    bool healthCheckTimedOut = false;
+    // Counters of the health object when the error rate was evaluated
+    uint64_t evaluatedRequests = 0;
+    uint64_t evaluatedFailures = 0;
+
     //
     // Flags used when loading
 
+    // Hash of the name, the version and the dependencies (see PlugMgrPrivate::graphFingerprint())
+    uint64_t fingerprint = 0;
     // true if all dependencies are present, indeterminate if not yet checked
     TriBool dependenciesExists = TriBool::Indeterminate;
     int graphId = -1;
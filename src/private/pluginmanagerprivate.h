@@ -30,11 +30,24 @@
  * and may change at any moment.
  */
 
+#include <condition_variable> // for std::condition_variable_any
+#include <deque> // for std::deque
+#include <functional> // for std::function
 #include <iostream> // for std::cout
+#include <map> // for std::map
+#include <memory> // for std::unique_ptr
+#include <mutex> // for std::recursive_mutex
+#include <thread> // for std::thread
 #include <unordered_map> // for std::unordered_map
 #include <vector> // for std::vector
 
 #include "plugin.h"
+#include "integrity.h"
+#include "sharedregistry.h"
+#include "ratelimiter.h"
+#include "tracing.h"
+#include "workerpool.h"
+#include "fsutil.h"
 
 #include "pluginmanager.h"
 
@@ -50,6 +63,11 @@ struct PlugMgrPrivate
 
     jp::PluginManager* pluginManager;
 
+    // Guards all members below, since the manager can be used from several threads.
+    // It is recursive because plugins send requests to the manager from loaded()
+    // and aboutToBeUnloaded(), which are called while the mutex is locked.
+    std::recursive_mutex mutex;
+
     std::unordered_map<std::string, PluginPtr> pluginsMap;
 
     // Contains the last load order used
@@ -66,24 +84,355 @@ struct PlugMgrPrivate
 
     std::string mainPluginName;
 
+    jp::ManagerMetrics metrics;
+
+    //
+    // Idle eviction and page out
+
+    // Idle delay before evicting a plugin (in ms, 0 if disabled)
+    unsigned int idleEvictionDelay = 0;
+    // Idle delay before paging out the code of a plugin (in ms, 0 if disabled)
+    unsigned int idlePageOutDelay = 0;
+    std::thread idleThread;
+    std::condition_variable_any idleCond;
+    bool stopIdle = false;
+
+    //
+    // Memory pressure shedding
+
+    // Steps applied one after the other while the memory is under pressure
+    enum ShedStep
+    {
+        SHED_NONE = 0,
+        SHED_DROP_CACHES,
+        SHED_EVICT_IDLE,
+        SHED_UNLOAD_BACKGROUND
+    };
+
+    // Ratio of stall time (in %) above which the memory is under pressure
+    unsigned int pressureThreshold = 10;
+    // Check interval (in ms)
+    unsigned int pressureInterval = 1000;
+    std::string pressureFile;
+    std::thread pressureThread;
+    std::condition_variable_any pressureCond;
+    bool stopPressure = false;
+    ShedStep shedStep = SHED_NONE;
+    // Plugins unloaded to reduce the memory pressure (restored when it clears)
+    std::vector<std::string> shedPlugins;
+
+    //
+    // Real-time mode
+
+    bool realTimeMode = false;
+    // Maximum size of the memory locked by the manager (in bytes)
+    size_t lockBudget = 0;
+    // Segments of the manager library, and their locked size
+    sysutil::MemoryRanges managerSegments;
+    size_t managerLockedBytes = 0;
+
+    //
+    // Compact mode
+
+    // Release the metadata only needed to resolve the dependencies once the plugins are loaded
+    bool compactMode = false;
+
+    // Directory of the plugins state files (empty if disabled)
+    std::string stateDirectory;
+
+    //
+    // Resource sharing
+
+    bool resourceSharing = false;
+    // Resources of the loaded plugins, indexed by content
+    BlobCache blobCache;
+
+    //
+    // Load order cache
+
+    // File of the persisted load order (empty if disabled)
+    std::string loadOrderCachePath;
+
+    //
+    // Integrity check
+
+    IntegrityChecker integrity;
+    // Threads of the parallel steps of the search (the hashing)
+    WorkerPool workerPool;
+
+    //
+    // Shared registry
+
+    // Search results shared with the other processes (not open if disabled)
+    SharedRegistry sharedRegistry;
+
+    //
+    // Health checks
+
+    bool healthChecks = false;
+    // Defaults of the plugins (in ms)
+    unsigned int healthInterval = 5000;
+    unsigned int healthTimeout = 1000;
+    // Error rate (in %) above which a plugin is unhealthy, and minimum number of requests to evaluate it
+    unsigned int healthErrorRate = 50;
+    unsigned int healthMinRequests = 20;
+    jp::PluginManager::healthCallback healthCallbackFunc;
+    // The scheduler thread queues the checks, the workers run them
+    std::thread healthThread;
+    std::condition_variable_any healthCond;
+    std::vector<std::thread> healthWorkers;
+    std::condition_variable_any healthWorkCond;
+    // Signaled when a check returns
+    std::condition_variable_any healthDoneCond;
+    std::deque<PluginPtr> healthQueue;
+    size_t idleHealthWorkers = 0;
+    bool stopHealth = false;
+
+    struct HealthEvent
+    {
+        std::string name;
+        jp::IPlugin::HealthState state;
+        jp::IPlugin::HealthState previous;
+    };
+
+    //
+    // Rate limits
+
+    struct RateLimit
+    {
+        double rate;
+        double burst;
+    };
+    // Limits set with PluginManager::setRateLimit(), by (sender, receiver) (empty sender for all senders)
+    std::map<std::pair<std::string, std::string>, RateLimit> rateLimits;
+    // Buckets of the pairs bound to a limit (kept when the plugins are unloaded)
+    std::map<std::pair<std::string, std::string>, std::shared_ptr<RateLimiter>> rateLimiters;
+
+    //
+    // Posted requests
+
+    // Requests posted to a plugin, delivered by its request thread
+    struct RequestQueue
+    {
+        struct Entry
+        {
+            std::string sender; // Copied: the library of the sender can be unloaded during the delivery
+            jp::IPlugin* handler;
+            uint16_t code;
+            std::string data;
+            // Span that posted the request
+            TraceHandoff trace;
+        };
+        enum State
+        {
+            IDLE, // Waiting for a request
+            WAKING, // Notified, not running yet
+            GATHERING, // Waiting for more requests to coalesce
+            DELIVERING
+        };
+
+        std::string receiver;
+        std::deque<Entry> pending;
+        // The requests being delivered (the lock is released meanwhile)
+        std::vector<Entry> batch;
+        // Receiver of the batch, and senders unloaded during the batch (kept until its end)
+        PluginPtr receiverPlugin;
+        std::vector<PluginPtr> retiredSenders;
+        State state = IDLE;
+        bool stop = false;
+        std::thread thread;
+        std::condition_variable_any cond;
+
+        // Coalescing (disabled if maxDelay is 0), times in ns
+        int64_t maxDelay = 0;
+        size_t maxBatch = 64;
+        int64_t lastArrival = 0;
+        // Average time between two requests
+        int64_t arrivalGap = 0;
+
+        // Last handler accepted by postRequest() (checked again once a plugin is unloaded)
+        const char* checkedSender = nullptr;
+        jp::IPlugin* checkedHandler = nullptr;
+        Plugin* checkedReceiver = nullptr;
+        uint64_t checkedGeneration = 0;
+    };
+    // Queues by receiver (kept until the manager is destroyed)
+    std::unordered_map<std::string, std::unique_ptr<RequestQueue>> requestQueues;
+    // Incremented when a plugin is unloaded or evicted (see discardRequests())
+    uint64_t unloadGeneration = 0;
+
+    //
+    // Tracing
+
+    // Spans of the requests (its state is not guarded by the mutex)
+    Tracer tracer;
+
     //
     // Functions
 
     PluginInfoStd parseMetadata(const char* metadata);
     jp::ReturnCode checkDependencies(PluginPtr& plugin, jp::PluginManager::callback callbackFunc);
+    // The plugin of a dependency, or NULL if an optional dependency is missing, incompatible
+    // or cannot be loaded (the dependencies must be checked)
+    PluginPtr* resolvedDependency(const PluginInfoStd::Dependency& dep);
+    // The dependency of the plugin name, or NULL if not found
+    const PluginInfoStd::Dependency* findDependency(const std::string& name, const std::string& dependency);
+
+    // Check the dependencies and sort the plugins into loadOrderList
+    jp::ReturnCode resolveLoadOrder(bool tryToContinue, jp::PluginManager::callback callbackFunc);
 
-    // Simply load all plugins in the order specified by loadOrderList
-    // Called by PluginManager::loadPlugins()
-    void loadPluginsInOrder();
-    // No checks is performed for the dependencies, they MUST be loaded
-    void loadPlugin(PluginPtr& plugin);
+    // Hash of the name, the version and the dependencies of a plugin
+    static uint64_t pluginFingerprint(const PluginInfoStd& info);
+    // Combination of the fingerprints of all plugins (independent of their order)
+    uint64_t graphFingerprint() const;
+    // Read the load order from the cache if it was saved with the same fingerprint
+    bool readLoadOrderCache(uint64_t fingerprint);
+    void writeLoadOrderCache(uint64_t fingerprint);
+
+    // Mark the plugins only needed by lazy dependents as deferred
+    void deferLazyDependencies();
+    // Simply load all plugins in the order specified by loadOrderList (except the deferred ones)
+    // Called by PluginManager::loadPlugins(). The plugins that cannot be loaded are reported to callbackFunc.
+    jp::ReturnCode loadPluginsInOrder(bool tryToContinue, jp::PluginManager::callback callbackFunc);
+    // The dependencies must be checked. Fails if an eager dependency is not loaded
+    // (LOAD_DEPENDENCY_NOT_FOUND) or if the library cannot be loaded.
+    // Does nothing if the plugin is already loaded
+    jp::ReturnCode loadPlugin(PluginPtr& plugin);
 
     // Like loadPluginsInOrder, but for the unload step
     bool unloadPluginsInOrder();
     bool unloadPlugin(PluginPtr &plugin);
+    // Destroy the plugin object and unload its library
+    void unloadLibrary(PluginPtr& plugin);
+
+    // Unload an evictable plugin (no checks are performed)
+    void evictPlugin(PluginPtr& plugin);
+    // Evict all plugins accepted by filter and unused for at least minIdleTime ms,
+    // if no loaded plugins depend on them. The names of the evicted plugins are
+    // appended to evictedList (if not null). Returns the number of evicted plugins.
+    size_t evictPlugins(const std::function<bool(const Plugin&)>& filter,
+                        unsigned int minIdleTime,
+                        std::vector<std::string>* evictedList = nullptr);
+    // Evict all evictable plugins unused for at least minIdleTime ms
+    size_t evictIdlePlugins(unsigned int minIdleTime);
+    // Load an evicted or deferred plugin (and its evicted or deferred dependencies)
+    bool reloadPlugin(PluginPtr& plugin);
+
+    // madvise() the read-only segments of a loaded plugin
+    jp::ReturnCode pageOutPlugin(PluginPtr& plugin, bool reclaim, jp::PageOutReport* report);
+    // Page out the plugins unused for at least minIdleTime ms (once per idle period)
+    size_t pageOutIdlePlugins(unsigned int minIdleTime);
+
+    // Background thread that periodically evicts and pages out idle plugins
+    void idleLoop();
+    // Start or stop the thread depending on the idle delays.
+    // Must be called without the mutex locked
+    void updateIdleThread();
+    // Must be called without the mutex locked
+    void stopIdleThread();
+
+    // Prefault the segments of a loaded plugin, and lock them if the budget allows it
+    void lockPlugin(PluginPtr& plugin);
+    // Must be called before unloading the library
+    void unlockPlugin(PluginPtr& plugin);
+    // Same for the segments of the manager library
+    void lockManager();
+    void unlockManager();
+    // Lock the stack of the calling manager thread. Returns the locked size.
+    size_t lockThreadStack();
+
+    // Move the code of a plugin onto transparent huge pages (before it is used)
+    void remapTextOnHugePages(PluginPtr& plugin);
+
+    // Share the embedded resources of a plugin with identical ones of the loaded plugins
+    void shareResources(PluginPtr& plugin);
+    // Must be called before unloading the library
+    void releaseResources(PluginPtr& plugin);
+
+    // Remove from libList the libraries that do not match the integrity manifest
+    void checkIntegrity(const std::string& pluginDir, fsutil::PathList* libList, jp::PluginManager::callback callbackFunc);
+    // Check one library (before reloading an evicted plugin)
+    bool checkIntegrity(const std::string& path, const std::string& relativePath);
+    // Path of a library found in pluginDir, relative to pluginDir
+    static std::string relativePath(const std::string& pluginDir, const std::string& path);
+
+    // Add the plugins of pluginDir read from the shared registry (their libraries are loaded by loadPlugins())
+    jp::ReturnCode addRegisteredPlugins(const std::string& pluginDir, bool recursive,
+                                        const std::vector<SharedRegistry::Record>& records,
+                                        jp::PluginManager::callback callbackFunc);
+    // Load the libraries of the plugins read from the shared registry and check their names:
+    // a library may have been replaced since the search. The entry of a directory with a
+    // replaced library is removed and the directory is searched again without the registry.
+    void checkRegisteredPlugins(jp::PluginManager::callback callbackFunc);
+
+    // Compact the info of all loaded plugins (and the load order list)
+    void compactPlugins();
+    // Complete metadata of a plugin (read again from the library if it was compacted)
+    PluginInfoStd fullInfo(PluginPtr& plugin);
+
+    // Handle the *_STATEFILE requests of a plugin
+    uint16_t handleStateRequest(PluginPtr& plugin, uint16_t code, jp::StateFile* state);
+
+    // Apply the next shedding step
+    void shedLoad();
+    // Reload the plugins unloaded by shedLoad()
+    void restoreShedPlugins();
+    // Background thread that monitors the memory pressure
+    void memoryPressureLoop();
+    // Must be called without the mutex locked
+    void stopMemoryPressureThread();
+
+    // Background thread that queues the health checks and evaluates the request error rates
+    void healthLoop();
+    // Thread running the queued checks (blocked as long as a check does not return)
+    void healthWorkerLoop();
+    // Must be called without the mutex locked. Waits for the running checks.
+    void stopHealthThread();
+    // Update the state of the error rate of a plugin, once enough requests were received
+    void evaluateRequests(PluginPtr& plugin);
+    // Publish the state of a plugin, a change is appended to events
+    void updateHealthState(PluginPtr& plugin, std::vector<HealthEvent>* events);
+    // Must be called before unloading a plugin (the mutex must be locked only once)
+    void waitForHealthCheck(PluginPtr& plugin);
+
+    // Object given to the dependents and the main plugin: the proxy of the plugin if its
+    // requests are observed (health checks or tracing), else the plugin object
+    jp::IPlugin* pluginInterface(PluginPtr& plugin);
+
+    // Limit of the requests of sender to receiver. Returns false if they are not limited.
+    bool effectiveRateLimit(const std::string& sender, const std::string& receiver, RateLimit* limit);
+    // Object given to sender for receiver: target, or a RateLimitedProxy forwarding to target
+    // if the requests between them are limited
+    jp::IPlugin* limitRequests(PluginPtr& sender, const std::string& receiver, jp::IPlugin* target);
+
+    // Called by PluginProxy around each request: reload the plugin if needed,
+    // and prevent it from being evicted until releasePlugin() is called.
+    // Return nullptr if the plugin cannot be loaded.
+    static jp::IPlugin* acquirePlugin(Plugin* plugin);
+    static void releasePlugin(Plugin* plugin);
+
+    // Queue a request posted by sender (POST_REQUEST)
+    uint16_t postRequest(const char* sender, const jp::IPlugin::PostedRequest& request);
+    // true if handler is the plugin object or a proxy of receiver given to sender
+    bool isReceiverHandler(const char* sender, const char* receiver, jp::IPlugin* handler);
+    // true if requests to or from the plugin are queued and not delivered yet
+    bool hasPendingRequests(const std::string& name) const;
+    // Queue of receiver, created with its thread on the first use
+    RequestQueue* requestQueue(const std::string& receiver);
+    // Thread delivering the requests of a queue
+    void requestQueueLoop(RequestQueue* queue);
+    // Time to wait for more requests once the first one of a batch arrived (0 to deliver it now)
+    static int64_t coalescingDelay(const RequestQueue& queue);
+    // Must be called before unloading or evicting a plugin: the requests it posted or it did not
+    // receive yet are discarded. The batch being delivered is not waited for (see unloadPlugin()).
+    void discardRequests(const PluginPtr& plugin);
+    // Must be called without the mutex locked. The pending requests are discarded.
+    void stopRequestQueues();
 
     // Function called by plugins throught IPlugin::sendRequest()
     static uint16_t handleRequest(const char* sender, uint16_t code, void** data, uint32_t *dataSize);
+    // Request to the manager (the mutex must be locked)
+    uint16_t handleManagerRequest(const char* sender, uint16_t code, void** data, uint32_t *dataSize);
     // Return nullptr if sender is not the main plugin or if pluginName is not loaded
     static jp::IPlugin* getNonDepPlugin(const char* sender, const char* pluginName);
 };
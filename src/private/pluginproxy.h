@@ -0,0 +1,94 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef PLUGINPROXY_H
+#define PLUGINPROXY_H
+
+/*
+ * This file is an internal header. It's not part of the public API,
+ * and may change at any moment.
+ */
+
+#include <atomic> // for std::atomic
+#include <memory> // for std::shared_ptr
+
+#include "iplugin.h"
+
+namespace jp_private
+{
+
+struct Plugin;
+class RateLimiter;
+class Tracer;
+
+// Object given instead of the plugin object when the manager can unload the
+// plugin at any time (idle eviction), when it is a lazy dependency, or when its
+// requests are observed (health checks, tracing).
+// Each request is forwarded to the plugin object (loaded first if needed),
+// and the plugin cannot be unloaded while a request is running.
+// The requests and the failed requests are counted in the health of the plugin,
+// and each request is a span if the tracing is enabled.
+class PluginProxy: public jp::IPlugin
+{
+public:
+    PluginProxy(Plugin* plugin, Tracer* tracer);
+
+    void loaded() override {}
+    void aboutToBeUnloaded() override {}
+
+    uint16_t handleRequest(const char* sender, uint16_t code, void** data, uint32_t* dataSize) override;
+
+private:
+    Plugin* _plugin;
+    Tracer* _tracer;
+
+    const char* jp_name() override;
+};
+
+// Object given to a sender instead of the receiver when the requests between them
+// are rate limited. Throttled requests return THROTTLED without reaching the receiver,
+// the others are forwarded to the target (the plugin object or its PluginProxy).
+class RateLimitedProxy: public jp::IPlugin
+{
+public:
+    RateLimitedProxy(std::shared_ptr<RateLimiter> limiter);
+
+    void loaded() override {}
+    void aboutToBeUnloaded() override {}
+
+    uint16_t handleRequest(const char* sender, uint16_t code, void** data, uint32_t* dataSize) override;
+
+    void setTarget(jp::IPlugin* target) { _target.store(target, std::memory_order_release); }
+
+private:
+    std::shared_ptr<RateLimiter> _limiter;
+    std::atomic<jp::IPlugin*> _target;
+
+    const char* jp_name() override;
+};
+
+} // namespace jp_private
+
+#endif // PLUGINPROXY_H
@@ -0,0 +1,79 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+/*
+ * This file is an internal header. It's not part of the public API,
+ * and may change at any moment.
+ */
+
+#include <atomic> // for std::atomic
+#include <cstdint> // for int64_t, uint64_t
+#include <string> // for std::string
+
+namespace jp_private
+{
+
+// Token bucket limiting the requests sent by a plugin to another one.
+//
+// Implemented with the generic cell rate algorithm: the bucket is a single
+// timestamp (the theoretical arrival time of the next request), advanced by
+// one interval for each accepted request with a CAS. A request is throttled
+// if this time is more than burst - 1 intervals ahead of now. No lock is taken,
+// and the limit can be changed while requests are running.
+class RateLimiter
+{
+public:
+    RateLimiter(const std::string& sender, const std::string& receiver);
+
+    // rate in requests per second (0 to remove the limit), burst in requests (at least 1)
+    void setLimit(double rate, double burst);
+    bool isLimited() const { return _interval.load(std::memory_order_relaxed) > 0; }
+
+    // Returns false if the request must be throttled
+    bool tryAcquire();
+
+    const std::string& sender() const { return _sender; }
+    const std::string& receiver() const { return _receiver; }
+    uint64_t requests() const { return _requests.load(std::memory_order_relaxed); }
+    uint64_t throttled() const { return _throttled.load(std::memory_order_relaxed); }
+
+private:
+    const std::string _sender;
+    const std::string _receiver;
+
+    // Time between two requests, and advance allowed to the theoretical arrival time (in ns)
+    std::atomic<int64_t> _interval;
+    std::atomic<int64_t> _tolerance;
+    std::atomic<int64_t> _arrivalTime;
+
+    std::atomic<uint64_t> _requests;
+    std::atomic<uint64_t> _throttled;
+};
+
+} // namespace jp_private
+
+#endif // RATELIMITER_H
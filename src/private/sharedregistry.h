@@ -0,0 +1,123 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef SHAREDREGISTRY_H
+#define SHAREDREGISTRY_H
+
+/*
+ * This file is an internal header. It's not part of the public API,
+ * and may change at any moment.
+ */
+
+#include <cstddef> // for size_t
+#include <cstdint> // for uint64_t
+#include <string> // for std::string
+#include <vector> // for std::vector
+
+#include "plugin.h"
+
+namespace jp_private
+{
+
+// Registry of the search results shared by the processes of a host.
+//
+// The registry is a POSIX shared memory segment. The first process which searches
+// a directory stores the plugins found (path and metadata) with the modification
+// time of the searched directories; the other processes read them instead of
+// loading every library of the directory. An entry is ignored (and replaced by the
+// next search) as soon as the mtime of one of its directories changes, i.e. when
+// a file is added, removed or renamed in it, or when one of its libraries changes.
+//
+// Layout: a header, followed by the entries. All references inside the segment are
+// offsets (entries from the start of the segment, strings and records from the start
+// of their entry), so that the segment can be mapped at any address and an entry can
+// be moved with memcpy(). Writers are serialized with flock() and update the segment
+// under a seqlock: readers copy an entry without any lock and retry if the sequence
+// changed meanwhile. The segment only grows (readers remap it when needed).
+//
+// The segment is only used if it is owned by the current user and not writable by
+// others, because the libraries it references are loaded by the process.
+class SharedRegistry
+{
+public:
+    // A plugin found by a search
+    struct Record
+    {
+        std::string relativePath; // Relative to the searched directory
+        std::string name; // jp_name, empty if the metadata cannot be parsed
+        PluginInfoStd info;
+    };
+
+    // A directory of a search and its modification time (in ns)
+    struct DirTime
+    {
+        std::string path;
+        int64_t mtime;
+    };
+    typedef std::vector<DirTime> DirTimes;
+
+    SharedRegistry() = default;
+    ~SharedRegistry();
+
+    // Open (or create) the segment name (e.g. "/justplug"). Returns false on error.
+    bool open(const std::string& name);
+    void close();
+    bool isOpen() const { return _address != nullptr; }
+
+    // Directories searched by a search of dir (the sub-directories if recursive).
+    // Must be called before the libraries are listed.
+    static bool directoryTimes(const std::string& dir, bool recursive, DirTimes* dirs);
+
+    // Read the plugins found in dir. Returns false if dir is not in the registry
+    // or if one of its directories changed since it was searched.
+    bool lookup(const std::string& dir, bool recursive, std::vector<Record>* records);
+    // Store the plugins found in dir (replaces the previous entry of dir)
+    bool publish(const std::string& dir, bool recursive, const DirTimes& dirs, const std::vector<Record>& records);
+    // Remove the entry of dir (e.g. when one of its libraries was replaced since the search)
+    bool remove(const std::string& dir, bool recursive);
+
+private:
+    // Non-copyable
+    SharedRegistry(const SharedRegistry&) = delete;
+    const SharedRegistry& operator=(const SharedRegistry&) = delete;
+
+    struct Header;
+
+    Header* header() const { return static_cast<Header*>(_address); }
+    // Map the whole segment (if it has grown since it was mapped)
+    bool remap();
+    // Copy the entry of key with the seqlock (false if not found or if the segment is busy)
+    bool readEntry(const std::string& key, std::vector<char>* entry);
+    // Replace the entry of key by newEntry (removed if null) under the lock of the writers
+    bool writeEntry(const std::string& key, const std::vector<char>* newEntry);
+
+    static std::string entryKey(const std::string& dir, bool recursive);
+
+    int _fd = -1;
+    void* _address = nullptr;
+    size_t _mappedSize = 0;
+};
+
+} // namespace jp_private
+
+#endif // SHAREDREGISTRY_H
@@ -0,0 +1,90 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef STATEMAPPING_H
+#define STATEMAPPING_H
+
+/*
+ * This file is an internal header. It's not part of the public API,
+ * and may change at any moment.
+ */
+
+#include <cstddef> // for size_t
+#include <cstdint> // for uint16_t, uint32_t, uint64_t
+#include <string> // for std::string
+
+#include "statefile.h"
+
+namespace jp_private
+{
+
+// Mapping of a plugin state file (see jp::StateFile).
+// The file starts with a header of one page, followed by the content.
+// Fields of the header are stored with the native endianness.
+class StateMapping
+{
+public:
+    // Unmap the file (an unpublished created file is removed)
+    ~StateMapping();
+
+    // Map the state file at path (read-only) and check it.
+    // Returns nullptr on error and sets error to a jp::IPlugin::RequestReturnCode.
+    static StateMapping* map(const std::string& path, uint16_t* error);
+    // Create a temporary file next to path, to be published as path.
+    // Returns nullptr on error and sets error to a jp::IPlugin::RequestReturnCode.
+    static StateMapping* create(const std::string& path, uint64_t size, uint32_t formatVersion, uint16_t* error);
+
+    // Write the header, flush the content and rename the temporary file over the
+    // published one. The file is unmapped in all cases. Returns false on error.
+    bool publish(const std::string& pluginVersion);
+
+    bool isWritable() const { return _writable; }
+
+    // Fill the fields of state (data is null once published)
+    void fill(jp::StateFile* state) const;
+
+private:
+    StateMapping() = default;
+
+    // Non-copyable
+    StateMapping(const StateMapping&) = delete;
+    const StateMapping& operator=(const StateMapping&) = delete;
+
+    void unmap();
+
+    std::string _path;
+    std::string _tempPath; // Empty if the file is not a created one
+    bool _writable = false;
+    int _fd = -1; // Only kept for created files
+    void* _base = nullptr;
+    size_t _mapSize = 0;
+    uint64_t _size = 0;
+    uint32_t _formatVersion = 0;
+    uint64_t _checksum = 0;
+    uint64_t _generation = 0;
+};
+
+} // namespace jp_private
+
+#endif // STATEMAPPING_H
@@ -0,0 +1,135 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SYSUTIL_H
+#define SYSUTIL_H
+
+/*
+ * This file is an internal header. It's not part of the public API,
+ * and may change at any moment.
+ */
+
+#include <cstddef> // for size_t
+#include <cstdint> // for uint64_t
+#include <string> // for std::string
+#include <vector> // for std::vector
+
+/*
+ * Collection of some system functions (mostly Linux specific).
+ */
+
+namespace jp_private
+{
+namespace sysutil
+{
+
+// Returns the PSI file for the memory pressure: memory.pressure of the cgroup (v2)
+// of the process if available, otherwise /proc/pressure/memory.
+// Returns an empty string if PSI is not supported.
+std::string memoryPressureFile();
+
+// Read the total time (in us) during which some tasks were stalled on memory
+// ("some" line of the PSI file). Returns false on error.
+bool readMemoryStallTime(const std::string& pressureFile, uint64_t* stallTime);
+
+// Number of CPUs the process can run on: the CPUs of its affinity mask, limited by
+// the CPU quota of its cgroup (cpu.max of the cgroup and of its parents for v2,
+// cpu.cfs_quota_us for v1), rounded up. Returns 0 if unknown.
+unsigned int availableCpus();
+
+// CPU time and run queue delay (in ns) of the thread which created the object.
+// The delay (time spent runnable but waiting for a CPU) is read from
+// /proc/thread-self/schedstat, and is 0 if the scheduler statistics are not available.
+class ThreadTimes
+{
+public:
+    ThreadTimes();
+    ~ThreadTimes();
+    ThreadTimes(const ThreadTimes&) = delete;
+    ThreadTimes& operator=(const ThreadTimes&) = delete;
+
+    // Must be called from the thread which created the object
+    void read(uint64_t* cpuTime, uint64_t* runQueueDelay) const;
+
+private:
+    int _schedStat;
+};
+
+// Page-aligned range of memory
+struct MemoryRange
+{
+    uintptr_t start;
+    size_t size;
+    bool executable;
+};
+typedef std::vector<MemoryRange> MemoryRanges;
+
+// Find the loaded object (executable or library) containing address, and append
+// the ranges of its read-only segments (code and read-only data) to readOnly, and
+// of its writable segments to writable (if not null).
+// Uses dl_iterate_phdr(). Returns false if the object is not found.
+bool objectSegments(const void* address, MemoryRanges* readOnly, MemoryRanges* writable = nullptr);
+
+// Find the offset of address in the file of the loaded object containing it.
+// Returns false if the address is not in the file-backed part of a loaded segment.
+bool fileOffset(const void* address, uint64_t* offset);
+
+// Resident size (in bytes) of the mappings overlapping ranges (Rss fields of /proc/self/smaps)
+size_t residentSize(const MemoryRanges& ranges);
+// Size (in bytes) of the mappings overlapping ranges backed by transparent huge pages (AnonHugePages fields)
+size_t hugePagesSize(const MemoryRanges& ranges);
+// Resident size (in bytes) of the process (/proc/self/statm)
+size_t processResidentSize();
+
+// Apply madvise() on each range: MADV_PAGEOUT if reclaim is true, else MADV_COLD
+// Returns 0 on success, or the errno value of the first error
+// (EINVAL if the kernel is older than 5.4).
+int adviseColdRanges(const MemoryRanges& ranges, bool reclaim);
+
+// Read one byte of each page of ranges, so they are mapped before being used
+void prefaultRanges(const MemoryRanges& ranges);
+// mlock() each range. Returns 0 on success, or the errno value of the first error
+// (the ranges locked before the error stay locked).
+int lockRanges(const MemoryRanges& ranges);
+void unlockRanges(const MemoryRanges& ranges);
+// Prefault and lock the size bytes of the stack below the current frame.
+// Returns the number of locked bytes (0 on error).
+size_t lockCurrentStack(size_t size);
+
+// Size of the transparent huge pages, or 0 if they cannot be used with madvise()
+// (THP disabled, or not Linux)
+size_t transparentHugePageSize();
+// Move the huge page aligned part of an executable range onto transparent huge pages:
+// the code is copied into an anonymous MADV_HUGEPAGE mapping, which replaces the
+// original mapping with mremap(). No code of the range must run during the call.
+// Returns the size of the remapped part (0 if nothing was remapped, the range is unchanged).
+size_t remapOnHugePages(const MemoryRange& range);
+
+// Total size of ranges
+size_t rangesSize(const MemoryRanges& ranges);
+
+} // namespace sysutil
+} // namespace jp_private
+
+#endif // SYSUTIL_H
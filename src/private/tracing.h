@@ -0,0 +1,173 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TRACING_H
+#define TRACING_H
+
+/*
+ * This file is an internal header. It's not part of the public API,
+ * and may change at any moment.
+ */
+
+#include <atomic> // for std::atomic
+#include <chrono> // for std::chrono::steady_clock
+#include <cstdint> // for uint64_t
+#include <memory> // for std::shared_ptr
+#include <mutex> // for std::mutex
+#include <ostream> // for std::ostream
+#include <vector> // for std::vector
+
+#include "pluginmanager.h"
+
+namespace jp_private
+{
+
+class Trace;
+
+// Records the spans of the requests between plugins.
+//
+// The context of a request (its trace and its span) is kept in a thread-local
+// variable of the manager library: the proxies and the manager request function
+// open a span as a child of the current one, so nested requests are linked
+// without any help from the plugins. A request sent by a thread without context
+// starts a new trace if it is sampled (head sampling: the decision is taken once
+// for the whole tree). A trace is given to the sink when its last span ends and
+// no posted request refers to it anymore.
+class Tracer
+{
+public:
+    Tracer();
+
+    // sampleRate is the probability of tracing a new request tree (0 to 1)
+    void enable(double sampleRate);
+    void disable();
+    bool isEnabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+    // The sink is called from the thread ending the trace (an empty sink drops the traces)
+    void setSink(jp::PluginManager::traceSink sink);
+
+    uint64_t sampledTraces() const { return _sampledTraces.load(std::memory_order_relaxed); }
+    uint64_t tracedSpans() const { return _tracedSpans.load(std::memory_order_relaxed); }
+
+private:
+    // Head sampling decision of a new trace
+    bool sample();
+    // Give the spans of a completed trace to the sink
+    void emit(const std::vector<jp::TraceSpan>& spans);
+
+    std::atomic<bool> _enabled;
+    // A trace is sampled if a random 64-bit value is below this threshold
+    std::atomic<uint64_t> _threshold;
+
+    std::mutex _sinkMutex;
+    jp::PluginManager::traceSink _sink;
+
+    std::atomic<uint64_t> _sampledTraces;
+    std::atomic<uint64_t> _tracedSpans;
+
+    friend class Trace;
+    friend class TraceScope;
+};
+
+// Span of a request, from the construction to the destruction of the object.
+// The span is a child of the current span of the thread, or the root of a new
+// trace (if it is sampled) when there is none and startTrace is true.
+// Does nothing if the tracing is disabled.
+class TraceScope
+{
+public:
+    TraceScope(Tracer& tracer, const char* sender, const char* receiver, uint16_t code, bool startTrace = true);
+    ~TraceScope();
+
+    void setReturnCode(uint16_t code) { _returnCode = code; }
+
+private:
+    enum Mode
+    {
+        INACTIVE,
+        UNSAMPLED, // In a request tree that is not sampled
+        SAMPLED
+    };
+
+    Mode _mode = INACTIVE;
+    uint16_t _returnCode = 0;
+    std::shared_ptr<Trace> _trace;
+    // Span of the thread before this one
+    uint64_t _parentId = 0;
+    bool _parentAsync = false;
+    jp::TraceSpan _span;
+    std::chrono::steady_clock::time_point _start;
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+// Span of the thread captured when a request is posted: the trace is not completed
+// before the request is delivered (or discarded). The delivery of a request posted
+// in a tree that is not sampled is not sampled either.
+class TraceHandoff
+{
+public:
+    TraceHandoff() = default;
+    TraceHandoff(TraceHandoff&& other) noexcept;
+    TraceHandoff& operator=(TraceHandoff&& other) noexcept;
+    ~TraceHandoff() { release(); }
+
+    static TraceHandoff capture();
+    void release();
+
+private:
+    std::shared_ptr<Trace> _trace;
+    uint64_t _spanId = 0;
+    bool _unsampled = false;
+
+    friend class TraceResume;
+};
+
+// Makes the span captured by a handoff the current span of the thread (the next span
+// is asynchronous) until the destruction, which restores the previous context and
+// releases the handoff.
+class TraceResume
+{
+public:
+    TraceResume(TraceHandoff& handoff);
+    ~TraceResume();
+
+private:
+    TraceHandoff& _handoff;
+    std::shared_ptr<Trace> _previousTrace;
+    uint64_t _previousSpanId;
+    unsigned int _previousUnsampled;
+    bool _previousAsync;
+
+    TraceResume(const TraceResume&) = delete;
+    TraceResume& operator=(const TraceResume&) = delete;
+};
+
+// Write a trace as one line of JSON
+void writeTrace(std::ostream& stream, const std::vector<jp::TraceSpan>& spans);
+
+} // namespace jp_private
+
+#endif // TRACING_H
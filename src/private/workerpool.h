@@ -0,0 +1,77 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+/*
+ * This file is an internal header. It's not part of the public API,
+ * and may change at any moment.
+ */
+
+#include <cstddef> // for size_t
+#include <functional> // for std::function
+
+namespace jp_private
+{
+
+// Runs the tasks of a parallel step (the hashing of the integrity check) on several threads.
+// The first run uses one thread per available CPU (affinity mask and cgroup quota). During
+// the run, the threads measure the time each task spends waiting (I/O, locks) and running,
+// and the pool grows or shrinks to cpus * (1 + wait / cpu) threads. The size chosen at the
+// end of a run is the start size of the next one, unless a size is pinned.
+// Not thread-safe: the runs are serialized by the manager mutex.
+class WorkerPool
+{
+public:
+    struct Info
+    {
+        unsigned int cpuLimit = 0;
+        unsigned int workers = 0;
+        unsigned int peakWorkers = 0;
+        double waitRatio = 0.0;
+        bool pinned = false;
+    };
+
+    // Call task(i) for each i in [0, count). The calling thread is one of the workers.
+    void run(size_t count, const std::function<void(size_t)>& task);
+
+    // Use count threads on each run (0 to size the pool automatically)
+    void setWorkers(unsigned int count);
+    Info info();
+
+private:
+    // Maximum number of threads per CPU, however long the tasks wait
+    static constexpr unsigned int maxWorkersPerCpu = 8;
+
+    unsigned int _cpuLimit = 0;
+    unsigned int _pinned = 0;
+    unsigned int _workers = 0; // 0 until the first run
+    unsigned int _peakWorkers = 0;
+    double _waitRatio = 0.0;
+};
+
+} // namespace jp_private
+
+#endif // WORKERPOOL_H
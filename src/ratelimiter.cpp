@@ -0,0 +1,80 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "private/ratelimiter.h"
+
+#include <chrono> // for std::chrono::steady_clock
+
+using namespace jp_private;
+
+RateLimiter::RateLimiter(const std::string& sender, const std::string& receiver)
+    : _sender(sender),
+      _receiver(receiver),
+      _interval(0),
+      _tolerance(0),
+      _arrivalTime(0),
+      _requests(0),
+      _throttled(0)
+{
+}
+
+void RateLimiter::setLimit(double rate, double burst)
+{
+    if(rate <= 0.0)
+    {
+        _interval.store(0, std::memory_order_relaxed);
+        return;
+    }
+
+    int64_t interval = static_cast<int64_t>(1e9 / rate);
+    if(interval < 1)
+        interval = 1;
+    _tolerance.store(static_cast<int64_t>(interval * (burst > 1.0 ? burst - 1.0 : 0.0)), std::memory_order_relaxed);
+    _interval.store(interval, std::memory_order_relaxed);
+}
+
+bool RateLimiter::tryAcquire()
+{
+    _requests.fetch_add(1, std::memory_order_relaxed);
+    const int64_t interval = _interval.load(std::memory_order_relaxed);
+    if(interval == 0)
+        return true;
+    const int64_t tolerance = _tolerance.load(std::memory_order_relaxed);
+
+    const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t arrivalTime = _arrivalTime.load(std::memory_order_relaxed);
+    while(true)
+    {
+        // An idle bucket is full: the next request can be sent now
+        const int64_t start = arrivalTime > now ? arrivalTime : now;
+        if(start - now > tolerance)
+        {
+            _throttled.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if(_arrivalTime.compare_exchange_weak(arrivalTime, start + interval, std::memory_order_relaxed))
+            return true;
+    }
+}
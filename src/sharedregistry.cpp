@@ -0,0 +1,674 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "private/sharedregistry.h"
+
+#include "confinfo.h"
+
+#ifdef CONFINFO_PLATFORM_LINUX
+
+#include <algorithm> // for std::min
+#include <atomic> // for std::atomic
+#include <climits> // for PATH_MAX
+#include <cstdlib> // for realpath
+#include <cstring> // for memcpy
+#include <ctime> // for clock_gettime
+
+#include <dirent.h> // for opendir
+#include <fcntl.h> // for O_RDWR
+#include <sched.h> // for sched_yield
+#include <sys/file.h> // for flock
+#include <sys/mman.h> // for shm_open
+#include <sys/stat.h> // for fstat
+#include <unistd.h> // for ftruncate
+
+using namespace jp_private;
+
+namespace
+{
+
+const char REGISTRY_MAGIC[8] = {'J', 'P', 'R', 'E', 'G', 'S', 'T', '5'};
+const uint32_t MAX_ENTRIES = 64;
+const size_t INITIAL_SIZE = 256 * 1024;
+// Number of attempts to read an entry while writers update the segment
+const int READ_ATTEMPTS = 1000;
+// Directories modified less than this time before the search are not published: a change
+// made in the same timestamp tick after the listing could not be detected (in ns)
+const int64_t RACY_DELAY = 1000000000LL;
+
+// All offsets are relative to the start of the entry
+
+struct StringRef
+{
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct EntryHeader
+{
+    uint32_t size; // Size of the entry (header included, multiple of 8)
+    uint32_t dirCount;
+    uint32_t dirsOffset; // Array of DirRecord
+    uint32_t recordCount;
+    uint32_t recordsOffset; // Array of PluginRecord
+    StringRef key;
+};
+
+struct DirRecord
+{
+    StringRef path;
+    int64_t mtime;
+};
+
+// PluginRecord flags
+const uint32_t FLAG_EVICTABLE = 1 << 0;
+const uint32_t FLAG_BACKGROUND = 1 << 1;
+const uint32_t FLAG_HUGE_PAGE_TEXT = 1 << 2;
+
+struct PluginRecord
+{
+    StringRef relativePath;
+    StringRef name;
+    // PluginInfoStd strings: name, prettyName, version, author, url, license, copyright
+    StringRef fields[7];
+    double rateLimit;
+    double rateBurst;
+    uint32_t flags;
+    int32_t healthCheckInterval;
+    int32_t healthCheckTimeout;
+    uint32_t dependencyCount;
+    uint32_t dependenciesOffset; // Array of DependencyRecord
+    // Modification time (in ns) and size of the library: a file replaced in place
+    // does not change the mtime of its directory
+    int64_t mtime;
+    int64_t size;
+};
+
+// DependencyRecord flags
+const uint32_t FLAG_OPTIONAL = 1 << 0;
+const uint32_t FLAG_LAZY = 1 << 1;
+
+struct DependencyRecord
+{
+    StringRef name;
+    StringRef version;
+    uint32_t flags;
+};
+
+std::string* infoField(PluginInfoStd& info, int index)
+{
+    std::string* fields[7] = {&info.name, &info.prettyName, &info.version, &info.author,
+                              &info.url, &info.license, &info.copyright};
+    return fields[index];
+}
+
+int64_t mtimeOf(const struct stat& st)
+{
+    return int64_t(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+// Serialize an entry: the fixed-size records first, then the strings
+class EntryWriter
+{
+public:
+    explicit EntryWriter(size_t fixedSize) : _data(fixedSize, '\0') {}
+
+    template<typename T>
+    void write(size_t offset, const T& value) { memcpy(&_data[offset], &value, sizeof(T)); }
+
+    StringRef addString(const std::string& str)
+    {
+        StringRef ref{uint32_t(_data.size()), uint32_t(str.size())};
+        _data.insert(_data.end(), str.begin(), str.end());
+        return ref;
+    }
+
+    std::vector<char>& finish()
+    {
+        _data.resize((_data.size() + 7) & ~size_t(7), '\0');
+        return _data;
+    }
+
+private:
+    std::vector<char> _data;
+};
+
+// Read the (untrusted) bytes of an entry copied from the segment
+class EntryReader
+{
+public:
+    explicit EntryReader(const std::vector<char>& data) : _data(data) {}
+
+    template<typename T>
+    bool read(uint64_t offset, T* value) const
+    {
+        if(offset + sizeof(T) > _data.size())
+            return false;
+        memcpy(value, &_data[offset], sizeof(T));
+        return true;
+    }
+
+    bool readString(const StringRef& ref, std::string* str) const
+    {
+        if(uint64_t(ref.offset) + ref.size > _data.size())
+            return false;
+        str->assign(&_data[ref.offset], ref.size);
+        return true;
+    }
+
+private:
+    const std::vector<char>& _data;
+};
+
+} // namespace
+
+struct SharedRegistry::Header
+{
+    char magic[8];
+    uint32_t entryCount;
+    uint32_t reserved;
+    // Odd while a writer updates the segment
+    std::atomic<uint64_t> sequence;
+    uint64_t segmentSize;
+    uint64_t entryOffsets[MAX_ENTRIES]; // From the start of the segment
+};
+
+SharedRegistry::~SharedRegistry()
+{
+    close();
+}
+
+bool SharedRegistry::open(const std::string& name)
+{
+    close();
+
+    _fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(_fd == -1)
+        return false;
+
+    // The segment references libraries loaded by the process: it must not be writable by other users
+    struct stat st;
+    if(fstat(_fd, &st) != 0
+       || st.st_uid != geteuid()
+       || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0
+       || flock(_fd, LOCK_EX) != 0)
+    {
+        close();
+        return false;
+    }
+
+    bool success = fstat(_fd, &st) == 0;
+    // The first process initializes the segment
+    const bool created = success && st.st_size == 0;
+    if(created)
+        success = ftruncate(_fd, INITIAL_SIZE) == 0;
+    const size_t size = created ? INITIAL_SIZE : size_t(st.st_size);
+    if(success && size >= sizeof(Header))
+    {
+        _address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if(_address == MAP_FAILED)
+            _address = nullptr;
+        _mappedSize = size;
+    }
+
+    if(_address && created)
+    {
+        memcpy(header()->magic, REGISTRY_MAGIC, sizeof(REGISTRY_MAGIC));
+        header()->segmentSize = size;
+    }
+    success = _address && memcmp(header()->magic, REGISTRY_MAGIC, sizeof(REGISTRY_MAGIC)) == 0;
+
+    flock(_fd, LOCK_UN);
+    if(!success)
+        close();
+    return success;
+}
+
+void SharedRegistry::close()
+{
+    if(_address)
+        munmap(_address, _mappedSize);
+    if(_fd != -1)
+        ::close(_fd);
+    _address = nullptr;
+    _mappedSize = 0;
+    _fd = -1;
+}
+
+bool SharedRegistry::remap()
+{
+    // The segment only grows, so the size of the file can be used without any lock
+    if(header()->segmentSize <= _mappedSize)
+        return true;
+    struct stat st;
+    if(fstat(_fd, &st) != 0)
+        return false;
+    void* address = mremap(_address, _mappedSize, st.st_size, MREMAP_MAYMOVE);
+    if(address == MAP_FAILED)
+        return false;
+    _address = address;
+    _mappedSize = st.st_size;
+    return true;
+}
+
+std::string SharedRegistry::entryKey(const std::string& dir, bool recursive)
+{
+    char path[PATH_MAX];
+    if(!realpath(dir.c_str(), path))
+        return std::string();
+    return std::string(recursive ? "r:" : "n:") + path;
+}
+
+bool SharedRegistry::directoryTimes(const std::string& dir, bool recursive, DirTimes* dirs)
+{
+    char canonical[PATH_MAX];
+    if(!realpath(dir.c_str(), canonical))
+        return false;
+
+    struct stat st;
+    if(stat(canonical, &st) != 0)
+        return false;
+    dirs->push_back(DirTime{canonical, mtimeOf(st)});
+    if(!recursive)
+        return true;
+
+    // The sub-directories are listed like fsutil::listFilesInDir() (symbolic links are followed)
+    for(size_t i=0; i < dirs->size(); ++i)
+    {
+        const std::string parent = (*dirs)[i].path;
+        DIR* handle = opendir(parent.c_str());
+        if(!handle)
+            return false;
+        while(struct dirent* entry = readdir(handle))
+        {
+            if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            if(entry->d_type != DT_DIR && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN)
+                continue;
+            const std::string path = parent + "/" + entry->d_name;
+            if(stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+                dirs->push_back(DirTime{path, mtimeOf(st)});
+        }
+        closedir(handle);
+    }
+    return true;
+}
+
+bool SharedRegistry::readEntry(const std::string& key, std::vector<char>* entry)
+{
+    for(int attempt=0; attempt < READ_ATTEMPTS; ++attempt)
+    {
+        if(!remap())
+            return false;
+
+        const Header* head = header();
+        const char* base = static_cast<const char*>(_address);
+        const uint64_t sequence = head->sequence.load(std::memory_order_acquire);
+        if(sequence & 1)
+        {
+            sched_yield();
+            continue;
+        }
+
+        // The segment can change at any time: everything read is checked before it is used
+        bool found = false;
+        entry->clear();
+        const uint32_t count = std::min(head->entryCount, MAX_ENTRIES);
+        for(uint32_t i=0; i < count; ++i)
+        {
+            const uint64_t offset = head->entryOffsets[i];
+            EntryHeader entryHeader;
+            if(offset > _mappedSize || _mappedSize - offset < sizeof(EntryHeader))
+                break;
+            memcpy(&entryHeader, base + offset, sizeof(EntryHeader));
+            if(entryHeader.size < sizeof(EntryHeader) || entryHeader.size > _mappedSize - offset
+               || uint64_t(entryHeader.key.offset) + entryHeader.key.size > entryHeader.size)
+                break;
+            if(entryHeader.key.size == key.size()
+               && memcmp(base + offset + entryHeader.key.offset, key.data(), key.size()) == 0)
+            {
+                entry->assign(base + offset, base + offset + entryHeader.size);
+                found = true;
+                break;
+            }
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(head->sequence.load(std::memory_order_relaxed) == sequence)
+            return found;
+    }
+    return false;
+}
+
+bool SharedRegistry::lookup(const std::string& dir, bool recursive, std::vector<Record>* records)
+{
+    const std::string key = entryKey(dir, recursive);
+    std::vector<char> data;
+    if(!isOpen() || key.empty() || !readEntry(key, &data))
+        return false;
+
+    EntryReader reader(data);
+    EntryHeader entryHeader;
+    if(!reader.read(0, &entryHeader))
+        return false;
+
+    // The entry is outdated if a directory was modified since the search
+    std::string searchedDir;
+    for(uint32_t i=0; i < entryHeader.dirCount; ++i)
+    {
+        DirRecord dirRecord;
+        std::string path;
+        struct stat st;
+        if(!reader.read(entryHeader.dirsOffset + uint64_t(i) * sizeof(DirRecord), &dirRecord)
+           || !reader.readString(dirRecord.path, &path)
+           || stat(path.c_str(), &st) != 0
+           || mtimeOf(st) != dirRecord.mtime)
+            return false;
+        if(i == 0)
+            searchedDir = path;
+    }
+
+    std::vector<Record> result(entryHeader.recordCount);
+    for(uint32_t i=0; i < entryHeader.recordCount; ++i)
+    {
+        Record& record = result[i];
+        PluginRecord pluginRecord;
+        if(!reader.read(entryHeader.recordsOffset + uint64_t(i) * sizeof(PluginRecord), &pluginRecord)
+           || !reader.readString(pluginRecord.relativePath, &record.relativePath)
+           || !reader.readString(pluginRecord.name, &record.name))
+            return false;
+        // Or if a library was replaced
+        struct stat st;
+        const std::string path = searchedDir + "/" + record.relativePath;
+        if(stat(path.c_str(), &st) != 0 || mtimeOf(st) != pluginRecord.mtime || st.st_size != pluginRecord.size)
+            return false;
+        for(int f=0; f < 7; ++f)
+        {
+            if(!reader.readString(pluginRecord.fields[f], infoField(record.info, f)))
+                return false;
+        }
+        record.info.evictable = pluginRecord.flags & FLAG_EVICTABLE;
+        record.info.backgroundPriority = pluginRecord.flags & FLAG_BACKGROUND;
+        record.info.hugePageText = pluginRecord.flags & FLAG_HUGE_PAGE_TEXT;
+        record.info.healthCheckInterval = pluginRecord.healthCheckInterval;
+        record.info.healthCheckTimeout = pluginRecord.healthCheckTimeout;
+        record.info.rateLimit = pluginRecord.rateLimit;
+        record.info.rateBurst = pluginRecord.rateBurst;
+
+        record.info.dependencies.resize(pluginRecord.dependencyCount);
+        for(uint32_t d=0; d < pluginRecord.dependencyCount; ++d)
+        {
+            DependencyRecord dep;
+            if(!reader.read(pluginRecord.dependenciesOffset + uint64_t(d) * sizeof(DependencyRecord), &dep)
+               || !reader.readString(dep.name, &record.info.dependencies[d].name)
+               || !reader.readString(dep.version, &record.info.dependencies[d].version))
+                return false;
+            record.info.dependencies[d].optional = dep.flags & FLAG_OPTIONAL;
+            record.info.dependencies[d].lazy = dep.flags & FLAG_LAZY;
+        }
+    }
+
+    records->swap(result);
+    return true;
+}
+
+bool SharedRegistry::publish(const std::string& dir, bool recursive,
+                             const DirTimes& dirs, const std::vector<Record>& records)
+{
+    const std::string key = entryKey(dir, recursive);
+    if(!isOpen() || key.empty() || dirs.empty())
+        return false;
+
+    // A directory modified just before the search may be modified again without changing its mtime
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    const int64_t nowNs = int64_t(now.tv_sec) * 1000000000LL + now.tv_nsec;
+    for(const DirTime& dirTime : dirs)
+    {
+        if(nowNs - dirTime.mtime < RACY_DELAY)
+            return false;
+    }
+    // Same for the libraries (the first directory is the searched one)
+    std::vector<struct stat> libStats(records.size());
+    for(size_t i=0; i < records.size(); ++i)
+    {
+        const std::string path = dirs.front().path + "/" + records[i].relativePath;
+        if(stat(path.c_str(), &libStats[i]) != 0 || nowNs - mtimeOf(libStats[i]) < RACY_DELAY)
+            return false;
+    }
+
+    //
+    // Serialize the entry
+
+    size_t depCount = 0;
+    for(const Record& record : records)
+        depCount += record.info.dependencies.size();
+
+    const size_t dirsOffset = sizeof(EntryHeader);
+    const size_t recordsOffset = dirsOffset + dirs.size() * sizeof(DirRecord);
+    const size_t depsOffset = recordsOffset + records.size() * sizeof(PluginRecord);
+    EntryWriter writer(depsOffset + depCount * sizeof(DependencyRecord));
+
+    EntryHeader entryHeader;
+    entryHeader.dirCount = dirs.size();
+    entryHeader.dirsOffset = dirsOffset;
+    entryHeader.recordCount = records.size();
+    entryHeader.recordsOffset = recordsOffset;
+    entryHeader.key = writer.addString(key);
+
+    for(size_t i=0; i < dirs.size(); ++i)
+        writer.write(dirsOffset + i * sizeof(DirRecord), DirRecord{writer.addString(dirs[i].path), dirs[i].mtime});
+
+    size_t depIndex = 0;
+    for(size_t i=0; i < records.size(); ++i)
+    {
+        const Record& record = records[i];
+        PluginRecord pluginRecord;
+        pluginRecord.relativePath = writer.addString(record.relativePath);
+        pluginRecord.name = writer.addString(record.name);
+        PluginInfoStd info = record.info;
+        for(int f=0; f < 7; ++f)
+            pluginRecord.fields[f] = writer.addString(*infoField(info, f));
+        pluginRecord.flags = (info.evictable ? FLAG_EVICTABLE : 0)
+                             | (info.backgroundPriority ? FLAG_BACKGROUND : 0)
+                             | (info.hugePageText ? FLAG_HUGE_PAGE_TEXT : 0);
+        pluginRecord.healthCheckInterval = info.healthCheckInterval;
+        pluginRecord.healthCheckTimeout = info.healthCheckTimeout;
+        pluginRecord.rateLimit = info.rateLimit;
+        pluginRecord.rateBurst = info.rateBurst;
+        pluginRecord.mtime = mtimeOf(libStats[i]);
+        pluginRecord.size = libStats[i].st_size;
+        pluginRecord.dependencyCount = info.dependencies.size();
+        pluginRecord.dependenciesOffset = depsOffset + depIndex * sizeof(DependencyRecord);
+        for(const PluginInfoStd::Dependency& dep : info.dependencies)
+        {
+            writer.write(depsOffset + depIndex * sizeof(DependencyRecord),
+                         DependencyRecord{writer.addString(dep.name), writer.addString(dep.version),
+                                          (dep.optional ? FLAG_OPTIONAL : 0) | (dep.lazy ? FLAG_LAZY : 0)});
+            ++depIndex;
+        }
+        writer.write(recordsOffset + i * sizeof(PluginRecord), pluginRecord);
+    }
+
+    std::vector<char>& newEntry = writer.finish();
+    entryHeader.size = newEntry.size();
+    writer.write(0, entryHeader);
+
+    return writeEntry(key, &newEntry);
+}
+
+bool SharedRegistry::remove(const std::string& dir, bool recursive)
+{
+    const std::string key = entryKey(dir, recursive);
+    if(!isOpen() || key.empty())
+        return false;
+    return writeEntry(key, nullptr);
+}
+
+bool SharedRegistry::writeEntry(const std::string& key, const std::vector<char>* newEntry)
+{
+    if(flock(_fd, LOCK_EX) != 0)
+        return false;
+    if(!remap())
+    {
+        flock(_fd, LOCK_UN);
+        return false;
+    }
+
+    // Other writers are locked out: the entries can be read without the seqlock.
+    // If the previous writer died during its update (odd sequence), its entries are dropped.
+    std::vector<char> image;
+    std::vector<uint64_t> offsets;
+    const char* base = static_cast<const char*>(_address);
+    const uint64_t sequence = header()->sequence.load(std::memory_order_relaxed);
+    const uint32_t count = (sequence & 1) ? 0 : std::min(header()->entryCount, MAX_ENTRIES);
+    for(uint32_t i=0; i < count; ++i)
+    {
+        const uint64_t offset = header()->entryOffsets[i];
+        EntryHeader other;
+        if(offset > _mappedSize || _mappedSize - offset < sizeof(EntryHeader))
+            break;
+        memcpy(&other, base + offset, sizeof(EntryHeader));
+        if(other.size < sizeof(EntryHeader) || other.size > _mappedSize - offset
+           || uint64_t(other.key.offset) + other.key.size > other.size)
+            break;
+        if(other.key.size == key.size() && memcmp(base + offset + other.key.offset, key.data(), key.size()) == 0)
+            continue;
+        offsets.push_back(sizeof(Header) + image.size());
+        image.insert(image.end(), base + offset, base + offset + other.size);
+    }
+    if(newEntry)
+    {
+        // The oldest entry is dropped when the registry is full
+        if(offsets.size() == MAX_ENTRIES)
+        {
+            const uint64_t removed = offsets[1] - offsets[0];
+            image.erase(image.begin(), image.begin() + removed);
+            offsets.erase(offsets.begin());
+            for(uint64_t& offset : offsets)
+                offset -= removed;
+        }
+        offsets.push_back(sizeof(Header) + image.size());
+        image.insert(image.end(), newEntry->begin(), newEntry->end());
+    }
+
+    // Grow the segment (readers remap it when they see the new size)
+    bool success = true;
+    const size_t neededSize = sizeof(Header) + image.size();
+    if(neededSize > _mappedSize)
+    {
+        size_t newSize = _mappedSize;
+        while(newSize < neededSize)
+            newSize *= 2;
+        void* address = MAP_FAILED;
+        if(ftruncate(_fd, newSize) == 0)
+            address = mremap(_address, _mappedSize, newSize, MREMAP_MAYMOVE);
+        success = address != MAP_FAILED;
+        if(success)
+        {
+            _address = address;
+            _mappedSize = newSize;
+            header()->segmentSize = newSize;
+        }
+    }
+
+    if(success)
+    {
+        Header* head = header();
+        const uint64_t start = (sequence | 1) + 1;
+        head->sequence.store(start + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        memcpy(static_cast<char*>(_address) + sizeof(Header), image.data(), image.size());
+        head->entryCount = offsets.size();
+        std::copy(offsets.begin(), offsets.end(), head->entryOffsets);
+
+        head->sequence.store(start + 2, std::memory_order_release);
+    }
+
+    flock(_fd, LOCK_UN);
+    return success;
+}
+
+#else // CONFINFO_PLATFORM_LINUX
+
+using namespace jp_private;
+
+struct SharedRegistry::Header
+{
+};
+
+SharedRegistry::~SharedRegistry()
+{
+}
+
+bool SharedRegistry::open(const std::string&)
+{
+    return false;
+}
+
+void SharedRegistry::close()
+{
+}
+
+bool SharedRegistry::remap()
+{
+    return false;
+}
+
+std::string SharedRegistry::entryKey(const std::string&, bool)
+{
+    return std::string();
+}
+
+bool SharedRegistry::directoryTimes(const std::string&, bool, DirTimes*)
+{
+    return false;
+}
+
+bool SharedRegistry::readEntry(const std::string&, std::vector<char>*)
+{
+    return false;
+}
+
+bool SharedRegistry::lookup(const std::string&, bool, std::vector<Record>*)
+{
+    return false;
+}
+
+bool SharedRegistry::publish(const std::string&, bool, const DirTimes&, const std::vector<Record>&)
+{
+    return false;
+}
+
+bool SharedRegistry::remove(const std::string&, bool)
+{
+    return false;
+}
+
+bool SharedRegistry::writeEntry(const std::string&, const std::vector<char>*)
+{
+    return false;
+}
+
+#endif // CONFINFO_PLATFORM_LINUX
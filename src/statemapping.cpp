@@ -0,0 +1,262 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "private/statemapping.h"
+
+#include <cstring> // for memcpy, memchr, strncpy
+
+#include "confinfo.h"
+#include "iplugin.h"
+
+#include "private/hash.h"
+
+#ifdef CONFINFO_PLATFORM_LINUX
+#  include <cerrno> // for errno
+#  include <fcntl.h> // for open, posix_fallocate
+#  include <sys/mman.h> // for mmap
+#  include <sys/stat.h> // for fstat
+#  include <unistd.h> // for close, fsync, getpid
+#endif
+
+using namespace jp;
+using namespace jp_private;
+
+namespace
+{
+
+const char STATE_MAGIC[8] = "JPSTATE";
+const uint32_t STATE_HEADER_VERSION = 1;
+// The content starts on the next page
+const size_t STATE_HEADER_SIZE = 4096;
+
+struct StateHeader
+{
+    char magic[8];
+    uint32_t headerVersion;
+    uint32_t formatVersion;
+    uint64_t size;
+    uint64_t checksum;
+    uint64_t generation;
+    char pluginVersion[64];
+};
+
+} // namespace
+
+#ifdef CONFINFO_PLATFORM_LINUX
+
+StateMapping::~StateMapping()
+{
+    unmap();
+    if(!_tempPath.empty())
+        unlink(_tempPath.c_str());
+}
+
+void StateMapping::unmap()
+{
+    if(_base)
+        munmap(_base, _mapSize);
+    _base = nullptr;
+    if(_fd != -1)
+        close(_fd);
+    _fd = -1;
+}
+
+StateMapping* StateMapping::map(const std::string& path, uint16_t* error)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+    {
+        *error = (errno == ENOENT) ? IPlugin::NOT_FOUND : IPlugin::COMMON_ERROR;
+        return nullptr;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || size_t(st.st_size) < STATE_HEADER_SIZE)
+    {
+        close(fd);
+        *error = IPlugin::CORRUPTED;
+        return nullptr;
+    }
+
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+    {
+        *error = IPlugin::COMMON_ERROR;
+        return nullptr;
+    }
+
+    StateMapping* mapping = new StateMapping();
+    mapping->_path = path;
+    mapping->_base = base;
+    mapping->_mapSize = st.st_size;
+
+    const StateHeader* header = static_cast<const StateHeader*>(base);
+    const unsigned char* content = static_cast<const unsigned char*>(base) + STATE_HEADER_SIZE;
+    if(memcmp(header->magic, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0
+       || header->headerVersion != STATE_HEADER_VERSION
+       || header->size > uint64_t(st.st_size) - STATE_HEADER_SIZE
+       || !memchr(header->pluginVersion, 0, sizeof(header->pluginVersion))
+       || hash::hash64(content, header->size) != header->checksum)
+    {
+        delete mapping;
+        *error = IPlugin::CORRUPTED;
+        return nullptr;
+    }
+
+    mapping->_size = header->size;
+    mapping->_formatVersion = header->formatVersion;
+    mapping->_checksum = header->checksum;
+    mapping->_generation = header->generation;
+    return mapping;
+}
+
+StateMapping* StateMapping::create(const std::string& path, uint64_t size, uint32_t formatVersion, uint16_t* error)
+{
+    // Unique in the process (the manager mutex is locked)
+    static unsigned int counter = 0;
+    const std::string tempPath = path + "." + std::to_string(getpid()) + "." + std::to_string(counter++) + ".tmp";
+
+    const int fd = open(tempPath.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fd == -1)
+    {
+        *error = IPlugin::COMMON_ERROR;
+        return nullptr;
+    }
+
+    StateMapping* mapping = new StateMapping();
+    mapping->_path = path;
+    mapping->_tempPath = tempPath;
+    mapping->_writable = true;
+    mapping->_fd = fd;
+    mapping->_mapSize = STATE_HEADER_SIZE + size;
+    mapping->_size = size;
+    mapping->_formatVersion = formatVersion;
+
+    // Reserve the blocks, so that writing the content cannot fail with SIGBUS (disk full)
+    const int allocError = posix_fallocate(fd, 0, mapping->_mapSize);
+    if((allocError != 0 && allocError != EINVAL && allocError != EOPNOTSUPP)
+       || (allocError != 0 && ftruncate(fd, mapping->_mapSize) != 0))
+    {
+        delete mapping;
+        *error = IPlugin::COMMON_ERROR;
+        return nullptr;
+    }
+
+    void* base = mmap(nullptr, mapping->_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED)
+    {
+        delete mapping;
+        *error = IPlugin::COMMON_ERROR;
+        return nullptr;
+    }
+    mapping->_base = base;
+    return mapping;
+}
+
+bool StateMapping::publish(const std::string& pluginVersion)
+{
+    if(!_writable || !_base)
+        return false;
+
+    // Generation of the published file (if valid)
+    _generation = 1;
+    const int publishedFd = open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(publishedFd != -1)
+    {
+        StateHeader published;
+        if(read(publishedFd, &published, sizeof(published)) == ssize_t(sizeof(published))
+           && memcmp(published.magic, STATE_MAGIC, sizeof(STATE_MAGIC)) == 0)
+            _generation = published.generation + 1;
+        close(publishedFd);
+    }
+
+    const unsigned char* content = static_cast<const unsigned char*>(_base) + STATE_HEADER_SIZE;
+    _checksum = hash::hash64(content, _size);
+
+    StateHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+    header.headerVersion = STATE_HEADER_VERSION;
+    header.formatVersion = _formatVersion;
+    header.size = _size;
+    header.checksum = _checksum;
+    header.generation = _generation;
+    strncpy(header.pluginVersion, pluginVersion.c_str(), sizeof(header.pluginVersion) - 1);
+    memcpy(_base, &header, sizeof(header));
+
+    // The content must be on the disk before the file replaces the published one
+    bool success = msync(_base, _mapSize, MS_SYNC) == 0 && fsync(_fd) == 0
+                   && rename(_tempPath.c_str(), _path.c_str()) == 0;
+    unmap();
+    if(!success)
+        return false;
+    _tempPath.clear();
+
+    // Make the rename durable
+    const std::string dir = _path.substr(0, _path.find_last_of('/') + 1);
+    const int dirFd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dirFd != -1)
+    {
+        fsync(dirFd);
+        close(dirFd);
+    }
+    return true;
+}
+
+#else // CONFINFO_PLATFORM_LINUX
+
+StateMapping::~StateMapping() {}
+
+void StateMapping::unmap() {}
+
+StateMapping* StateMapping::map(const std::string&, uint16_t* error)
+{
+    *error = IPlugin::NOT_SUPPORTED;
+    return nullptr;
+}
+
+StateMapping* StateMapping::create(const std::string&, uint64_t, uint32_t, uint16_t* error)
+{
+    *error = IPlugin::NOT_SUPPORTED;
+    return nullptr;
+}
+
+bool StateMapping::publish(const std::string&)
+{
+    return false;
+}
+
+#endif // CONFINFO_PLATFORM_LINUX
+
+void StateMapping::fill(StateFile* state) const
+{
+    state->data = _base ? static_cast<unsigned char*>(_base) + STATE_HEADER_SIZE : nullptr;
+    state->size = _size;
+    state->formatVersion = _formatVersion;
+    state->pluginVersion = (_base && !_writable) ? static_cast<const StateHeader*>(_base)->pluginVersion : nullptr;
+    state->checksum = _checksum;
+    state->generation = _generation;
+    state->handle = const_cast<StateMapping*>(this);
+}
@@ -0,0 +1,602 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "private/sysutil.h"
+
+#include <algorithm> // for std::max
+#include <cerrno> // for errno
+#include <cstdlib> // for strtoull
+#include <cstring> // for memcpy
+#include <fstream> // for std::ifstream
+
+#include "confinfo.h"
+
+#ifdef CONFINFO_PLATFORM_LINUX
+#  include <alloca.h> // for alloca
+#  include <fcntl.h> // for open
+#  include <link.h> // for dl_iterate_phdr
+#  include <sched.h> // for sched_getaffinity
+#  include <sys/mman.h> // for madvise
+#  include <time.h> // for clock_gettime
+#  include <unistd.h> // for sysconf
+
+// Not defined by older C libraries (the kernel returns EINVAL if unsupported)
+#  ifndef MADV_COLD
+#    define MADV_COLD 20
+#  endif
+#  ifndef MADV_PAGEOUT
+#    define MADV_PAGEOUT 21
+#  endif
+#endif
+
+namespace jp_private
+{
+namespace sysutil
+{
+
+#ifdef CONFINFO_PLATFORM_LINUX
+
+namespace
+{
+
+bool fileExists(const std::string& path)
+{
+    return std::ifstream(path).good();
+}
+
+// Returns the cgroup v2 path of the process (the "0::" entry), or an empty string
+std::string cgroupPath()
+{
+    std::ifstream file("/proc/self/cgroup");
+    std::string line;
+    while(std::getline(file, line))
+    {
+        if(line.compare(0, 3, "0::") == 0)
+            return line.substr(3);
+    }
+    return std::string();
+}
+
+// Returns the cgroup v1 path of the process in the hierarchy of controller, or an empty string.
+// mountDir is set to the name of the hierarchy (for example "cpu,cpuacct").
+std::string cgroupV1Path(const std::string& controller, std::string* mountDir)
+{
+    // Format: "id:controller1,controller2:path"
+    std::ifstream file("/proc/self/cgroup");
+    std::string line;
+    while(std::getline(file, line))
+    {
+        const size_t first = line.find(':');
+        const size_t second = line.find(':', first + 1);
+        if(first == std::string::npos || second == std::string::npos)
+            continue;
+        const std::string controllers = line.substr(first + 1, second - first - 1);
+        const std::string list = "," + controllers + ",";
+        if(list.find("," + controller + ",") != std::string::npos)
+        {
+            *mountDir = controllers;
+            return line.substr(second + 1);
+        }
+    }
+    return std::string();
+}
+
+// CPU quota of the cgroup at dir, in CPUs rounded up. Returns 0 if unlimited or unknown.
+unsigned int cgroupCpuQuota(const std::string& dir, bool v2)
+{
+    long long quota = -1;
+    long long period = 0;
+    if(v2)
+    {
+        // Format: "quota period", the quota is "max" if unlimited
+        std::ifstream file(dir + "/cpu.max");
+        std::string max;
+        if(!(file >> max >> period) || max == "max")
+            return 0;
+        quota = std::strtoll(max.c_str(), nullptr, 10);
+    }
+    else
+    {
+        // The quota is -1 if unlimited
+        std::ifstream(dir + "/cpu.cfs_quota_us") >> quota;
+        std::ifstream(dir + "/cpu.cfs_period_us") >> period;
+    }
+    if(quota <= 0 || period <= 0)
+        return 0;
+    return static_cast<unsigned int>((quota + period - 1) / period);
+}
+
+// Lowest CPU quota of the cgroup at path and of its parents (0 if none is limited)
+unsigned int cgroupCpuLimit(const std::string& root, std::string path, bool v2)
+{
+    unsigned int limit = 0;
+    while(!path.empty() && path.back() == '/')
+        path.pop_back();
+    while(true)
+    {
+        const unsigned int quota = cgroupCpuQuota(root + path, v2);
+        if(quota > 0 && (limit == 0 || quota < limit))
+            limit = quota;
+        if(path.empty())
+            break;
+        path.erase(path.rfind('/'));
+    }
+    return limit;
+}
+
+struct SegmentsSearch
+{
+    uintptr_t address;
+    MemoryRanges* readOnly;
+    MemoryRanges* writable;
+    bool found;
+};
+
+int findSegmentsCallback(struct dl_phdr_info* info, size_t, void* data)
+{
+    SegmentsSearch* search = static_cast<SegmentsSearch*>(data);
+
+    // Check if the address is inside one of the loaded segments of this object
+    bool contains = false;
+    for(int i=0; i < info->dlpi_phnum && !contains; ++i)
+    {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        const uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+        contains = phdr.p_type == PT_LOAD
+                && search->address >= start && search->address < start + phdr.p_memsz;
+    }
+    if(!contains)
+        return 0;
+
+    const uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    for(int i=0; i < info->dlpi_phnum; ++i)
+    {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        if(phdr.p_type != PT_LOAD)
+            continue;
+
+        const uintptr_t start = (info->dlpi_addr + phdr.p_vaddr) & ~(pageSize - 1);
+        const uintptr_t end = (info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz + pageSize - 1) & ~(pageSize - 1);
+        const bool executable = phdr.p_flags & PF_X;
+        if(!(phdr.p_flags & PF_W))
+            search->readOnly->push_back({start, end - start, executable});
+        else if(search->writable)
+            search->writable->push_back({start, end - start, executable});
+    }
+    search->found = true;
+    return 1; // Stop the iteration
+}
+
+struct OffsetSearch
+{
+    uintptr_t address;
+    uint64_t offset;
+    bool found;
+};
+
+int findOffsetCallback(struct dl_phdr_info* info, size_t, void* data)
+{
+    OffsetSearch* search = static_cast<OffsetSearch*>(data);
+    for(int i=0; i < info->dlpi_phnum; ++i)
+    {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        const uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+        // Only the first p_filesz bytes of the segment are read from the file
+        if(phdr.p_type == PT_LOAD && search->address >= start && search->address < start + phdr.p_filesz)
+        {
+            search->offset = phdr.p_offset + (search->address - start);
+            search->found = true;
+            return 1; // Stop the iteration
+        }
+    }
+    return 0;
+}
+
+// Sum a field of /proc/self/smaps for the mappings overlapping ranges
+size_t smapsFieldSize(const MemoryRanges& ranges, const std::string& field)
+{
+    // Each mapping starts with a line "start-end perms offset dev inode path",
+    // followed by its fields ("Rss:        12 kB")
+    std::ifstream file("/proc/self/smaps");
+    std::string line;
+    bool overlaps = false;
+    size_t size = 0;
+    while(std::getline(file, line))
+    {
+        if(line.compare(0, field.size(), field) == 0)
+        {
+            if(overlaps)
+                size += std::strtoull(line.c_str() + field.size(), nullptr, 10) * 1024;
+            continue;
+        }
+
+        char* end = nullptr;
+        const uintptr_t start = std::strtoull(line.c_str(), &end, 16);
+        if(*end != '-')
+            continue; // Another field
+
+        const uintptr_t stop = std::strtoull(end + 1, nullptr, 16);
+        overlaps = false;
+        for(const MemoryRange& range : ranges)
+            overlaps = overlaps || (start < range.start + range.size && range.start < stop);
+    }
+    return size;
+}
+
+} // namespace
+
+std::string memoryPressureFile()
+{
+    const std::string cgroup = cgroupPath();
+    if(!cgroup.empty())
+    {
+        // Unified hierarchy, or hybrid hierarchy (v2 mounted in the unified folder)
+        for(const char* root : {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"})
+        {
+            const std::string path = root + cgroup + (cgroup.back() == '/' ? "" : "/") + "memory.pressure";
+            if(fileExists(path))
+                return path;
+        }
+    }
+
+    if(fileExists("/proc/pressure/memory"))
+        return "/proc/pressure/memory";
+    return std::string();
+}
+
+bool readMemoryStallTime(const std::string& pressureFile, uint64_t* stallTime)
+{
+    // Format: "some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+    std::ifstream file(pressureFile);
+    std::string line;
+    while(std::getline(file, line))
+    {
+        if(line.compare(0, 5, "some ") != 0)
+            continue;
+
+        const size_t pos = line.find("total=");
+        if(pos == std::string::npos)
+            return false;
+        *stallTime = std::strtoull(line.c_str() + pos + 6, nullptr, 10);
+        return true;
+    }
+    return false;
+}
+
+unsigned int availableCpus()
+{
+    unsigned int cpus = 0;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0)
+        cpus = static_cast<unsigned int>(CPU_COUNT(&set));
+    else // More CPUs than cpu_set_t can hold
+        cpus = static_cast<unsigned int>(std::max(sysconf(_SC_NPROCESSORS_ONLN), 0L));
+
+    // Unified hierarchy (v2), and cpu controller of the legacy hierarchy (v1)
+    unsigned int limit = 0;
+    const std::string cgroup = cgroupPath();
+    if(!cgroup.empty())
+        limit = cgroupCpuLimit("/sys/fs/cgroup", cgroup, true);
+    std::string mountDir;
+    const std::string cgroupV1 = cgroupV1Path("cpu", &mountDir);
+    if(!cgroupV1.empty())
+    {
+        const unsigned int limitV1 = cgroupCpuLimit("/sys/fs/cgroup/" + mountDir, cgroupV1, false);
+        if(limitV1 > 0 && (limit == 0 || limitV1 < limit))
+            limit = limitV1;
+    }
+
+    if(limit > 0 && (cpus == 0 || limit < cpus))
+        cpus = limit;
+    return cpus;
+}
+
+ThreadTimes::ThreadTimes()
+    : _schedStat(open("/proc/thread-self/schedstat", O_RDONLY | O_CLOEXEC))
+{
+}
+
+ThreadTimes::~ThreadTimes()
+{
+    if(_schedStat >= 0)
+        close(_schedStat);
+}
+
+void ThreadTimes::read(uint64_t* cpuTime, uint64_t* runQueueDelay) const
+{
+    // The CPU time of schedstat is only updated on the scheduler ticks
+    struct timespec time;
+    *cpuTime = clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0
+            ? static_cast<uint64_t>(time.tv_sec) * 1000000000 + static_cast<uint64_t>(time.tv_nsec) : 0;
+
+    // Format: "cpu_time run_queue_delay timeslices"
+    *runQueueDelay = 0;
+    char buffer[64];
+    const ssize_t size = _schedStat >= 0 ? pread(_schedStat, buffer, sizeof(buffer) - 1, 0) : -1;
+    if(size <= 0)
+        return;
+    buffer[size] = '\0';
+    char* end = nullptr;
+    std::strtoull(buffer, &end, 10);
+    *runQueueDelay = std::strtoull(end, nullptr, 10);
+}
+
+bool objectSegments(const void* address, MemoryRanges* readOnly, MemoryRanges* writable)
+{
+    SegmentsSearch search = {reinterpret_cast<uintptr_t>(address), readOnly, writable, false};
+    dl_iterate_phdr(findSegmentsCallback, &search);
+    return search.found;
+}
+
+bool fileOffset(const void* address, uint64_t* offset)
+{
+    OffsetSearch search = {reinterpret_cast<uintptr_t>(address), 0, false};
+    dl_iterate_phdr(findOffsetCallback, &search);
+    *offset = search.offset;
+    return search.found;
+}
+
+size_t residentSize(const MemoryRanges& ranges)
+{
+    return smapsFieldSize(ranges, "Rss:");
+}
+
+size_t hugePagesSize(const MemoryRanges& ranges)
+{
+    return smapsFieldSize(ranges, "AnonHugePages:");
+}
+
+size_t processResidentSize()
+{
+    // Format: "size resident shared text lib data dt" (in pages)
+    std::ifstream file("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    if(!(file >> size >> resident))
+        return 0;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+int adviseColdRanges(const MemoryRanges& ranges, bool reclaim)
+{
+    for(const MemoryRange& range : ranges)
+    {
+        if(madvise(reinterpret_cast<void*>(range.start), range.size, reclaim ? MADV_PAGEOUT : MADV_COLD) != 0)
+            return errno;
+    }
+    return 0;
+}
+
+void prefaultRanges(const MemoryRanges& ranges)
+{
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    for(const MemoryRange& range : ranges)
+    {
+        for(size_t offset = 0; offset < range.size; offset += pageSize)
+            (void)*reinterpret_cast<const volatile char*>(range.start + offset);
+    }
+}
+
+int lockRanges(const MemoryRanges& ranges)
+{
+    // mlock() also faults in the pages (and breaks copy-on-write of writable ones)
+    for(const MemoryRange& range : ranges)
+    {
+        if(mlock(reinterpret_cast<void*>(range.start), range.size) != 0)
+            return errno;
+    }
+    return 0;
+}
+
+void unlockRanges(const MemoryRanges& ranges)
+{
+    for(const MemoryRange& range : ranges)
+        munlock(reinterpret_cast<void*>(range.start), range.size);
+}
+
+size_t transparentHugePageSize()
+{
+    // Format: "always [madvise] never"
+    std::ifstream enabledFile("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string enabled;
+    if(!std::getline(enabledFile, enabled) || enabled.find("[never]") != std::string::npos)
+        return 0;
+
+    std::ifstream sizeFile("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+    size_t size = 0;
+    if(!(sizeFile >> size))
+        size = 2 * 1024 * 1024;
+    return size;
+}
+
+size_t remapOnHugePages(const MemoryRange& range)
+{
+    const uintptr_t hugePageSize = transparentHugePageSize();
+    if(hugePageSize == 0)
+        return 0;
+
+    // Only the part of the range that contains whole huge pages can be remapped
+    const uintptr_t start = (range.start + hugePageSize - 1) & ~(hugePageSize - 1);
+    const uintptr_t end = (range.start + range.size) & ~(hugePageSize - 1);
+    if(end <= start)
+        return 0;
+    const size_t size = end - start;
+
+    // Allocate a huge page aligned anonymous area
+    void* area = mmap(nullptr, size + hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(area == MAP_FAILED)
+        return 0;
+    const uintptr_t areaStart = reinterpret_cast<uintptr_t>(area);
+    const uintptr_t alignedStart = (areaStart + hugePageSize - 1) & ~(hugePageSize - 1);
+    if(alignedStart > areaStart)
+        munmap(area, alignedStart - areaStart);
+    if(areaStart + size + hugePageSize > alignedStart + size)
+        munmap(reinterpret_cast<void*>(alignedStart + size), areaStart + hugePageSize - alignedStart);
+    void* aligned = reinterpret_cast<void*>(alignedStart);
+
+    // Copy the code, and replace the original mapping (never writable and executable at the same time)
+    if(madvise(aligned, size, MADV_HUGEPAGE) != 0)
+    {
+        munmap(aligned, size);
+        return 0;
+    }
+    memcpy(aligned, reinterpret_cast<const void*>(start), size);
+    if(mprotect(aligned, size, PROT_READ | PROT_EXEC) != 0
+       || mremap(aligned, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, reinterpret_cast<void*>(start)) == MAP_FAILED)
+    {
+        munmap(aligned, size);
+        return 0;
+    }
+    return size;
+}
+
+size_t lockCurrentStack(size_t size)
+{
+    // The memory is allocated in the frame of this function, which is
+    // still part of the stack mapping after the function returns
+    volatile char* buffer = static_cast<volatile char*>(alloca(size));
+    const uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    for(size_t offset = 0; offset < size; offset += pageSize)
+        buffer[offset] = 0;
+
+    const uintptr_t start = (reinterpret_cast<uintptr_t>(buffer) + pageSize - 1) & ~(pageSize - 1);
+    const uintptr_t end = (reinterpret_cast<uintptr_t>(buffer) + size) & ~(pageSize - 1);
+    if(end <= start || mlock(reinterpret_cast<void*>(start), end - start) != 0)
+        return 0;
+    return end - start;
+}
+
+#else
+
+unsigned int availableCpus()
+{
+    return 0;
+}
+
+ThreadTimes::ThreadTimes()
+    : _schedStat(-1)
+{
+}
+
+ThreadTimes::~ThreadTimes()
+{
+}
+
+void ThreadTimes::read(uint64_t* cpuTime, uint64_t* runQueueDelay) const
+{
+    *cpuTime = 0;
+    *runQueueDelay = 0;
+}
+
+std::string memoryPressureFile()
+{
+    return std::string();
+}
+
+bool readMemoryStallTime(const std::string& pressureFile, uint64_t* stallTime)
+{
+    (void)pressureFile;(void)stallTime;
+    return false;
+}
+
+bool objectSegments(const void* address, MemoryRanges* readOnly, MemoryRanges* writable)
+{
+    (void)address;(void)readOnly;(void)writable;
+    return false;
+}
+
+bool fileOffset(const void* address, uint64_t* offset)
+{
+    (void)address;(void)offset;
+    return false;
+}
+
+size_t residentSize(const MemoryRanges& ranges)
+{
+    (void)ranges;
+    return 0;
+}
+
+size_t hugePagesSize(const MemoryRanges& ranges)
+{
+    (void)ranges;
+    return 0;
+}
+
+size_t processResidentSize()
+{
+    return 0;
+}
+
+int adviseColdRanges(const MemoryRanges& ranges, bool reclaim)
+{
+    (void)ranges;(void)reclaim;
+    return ENOSYS;
+}
+
+void prefaultRanges(const MemoryRanges& ranges)
+{
+    (void)ranges;
+}
+
+int lockRanges(const MemoryRanges& ranges)
+{
+    (void)ranges;
+    return ENOSYS;
+}
+
+void unlockRanges(const MemoryRanges& ranges)
+{
+    (void)ranges;
+}
+
+size_t transparentHugePageSize()
+{
+    return 0;
+}
+
+size_t remapOnHugePages(const MemoryRange& range)
+{
+    (void)range;
+    return 0;
+}
+
+size_t lockCurrentStack(size_t size)
+{
+    (void)size;
+    return 0;
+}
+
+#endif // CONFINFO_PLATFORM_LINUX
+
+size_t rangesSize(const MemoryRanges& ranges)
+{
+    size_t size = 0;
+    for(const MemoryRange& range : ranges)
+        size += range.size;
+    return size;
+}
+
+} // namespace sysutil
+} // namespace jp_private
@@ -0,0 +1,391 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "private/tracing.h"
+
+#include <algorithm> // for std::sort
+#include <cstdio> // for snprintf
+#include <functional> // for std::hash
+#include <random> // for std::random_device
+#include <string> // for std::string
+#include <thread> // for std::this_thread
+#include <utility> // for std::move
+
+using namespace jp_private;
+
+namespace jp_private
+{
+
+// Spans of a sampled request tree
+class Trace
+{
+public:
+    Trace(Tracer* tracer, uint64_t id): tracer(tracer), id(id) {}
+
+    Tracer* const tracer;
+    const uint64_t id;
+
+    uint64_t newSpanId() { return _nextSpanId.fetch_add(1, std::memory_order_relaxed); }
+    void addSpan(jp::TraceSpan&& span)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _spans.push_back(std::move(span));
+    }
+
+    // Each open span and each handoff holds a reference: the trace is completed
+    // when the last one is released
+    void retain() { _references.fetch_add(1, std::memory_order_relaxed); }
+    void release()
+    {
+        if(_references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            complete();
+    }
+
+private:
+    std::atomic<uint64_t> _nextSpanId{1};
+    std::atomic<size_t> _references{0};
+    std::mutex _mutex;
+    std::vector<jp::TraceSpan> _spans;
+
+    void complete()
+    {
+        std::vector<jp::TraceSpan> spans;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            spans.swap(_spans);
+        }
+        // Spans are recorded when they end: sort them in the order they started (root first)
+        std::sort(spans.begin(), spans.end(),
+                  [](const jp::TraceSpan& a, const jp::TraceSpan& b) { return a.spanId < b.spanId; });
+        tracer->emit(spans);
+    }
+};
+
+} // namespace jp_private
+
+namespace
+{
+
+// Request context of the thread
+struct TraceContext
+{
+    // Sampled trace of the request being handled (null if none)
+    std::shared_ptr<Trace> trace;
+    uint64_t spanId = 0;
+    // Depth of the requests being handled in a tree that is not sampled
+    unsigned int unsampled = 0;
+    // The next span is the delivery of a posted request
+    bool async = false;
+};
+
+thread_local TraceContext context;
+
+uint64_t randomSeed()
+{
+    std::random_device device;
+    return (uint64_t(device()) << 32 | device()) ^ std::hash<std::thread::id>()(std::this_thread::get_id());
+}
+
+// splitmix64, seeded once per thread
+uint64_t randomValue()
+{
+    thread_local uint64_t state = randomSeed();
+    uint64_t value = (state += 0x9e3779b97f4a7c15ULL);
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+// Quoted and escaped JSON string
+void appendJsonString(std::string* out, const std::string& str)
+{
+    *out += '"';
+    for(char c : str)
+    {
+        if(c == '"' || c == '\\')
+        {
+            *out += '\\';
+            *out += c;
+        }
+        else if(static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(c));
+            *out += escaped;
+        }
+        else
+        {
+            *out += c;
+        }
+    }
+    *out += '"';
+}
+
+int64_t systemTimeUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+/*****************************************************************************/
+/* Tracer class **************************************************************/
+/*****************************************************************************/
+
+Tracer::Tracer()
+    : _enabled(false),
+      _threshold(0),
+      _sampledTraces(0),
+      _tracedSpans(0)
+{
+}
+
+void Tracer::enable(double sampleRate)
+{
+    // 2^64, the probability 1 samples every trace
+    const double range = 18446744073709551616.0;
+    uint64_t threshold = 0;
+    if(sampleRate * range >= range)
+        threshold = UINT64_MAX;
+    else if(sampleRate > 0.0)
+        threshold = static_cast<uint64_t>(sampleRate * range);
+    _threshold.store(threshold, std::memory_order_relaxed);
+    _enabled.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::disable()
+{
+    // The open spans are still recorded
+    _enabled.store(false, std::memory_order_relaxed);
+}
+
+void Tracer::setSink(jp::PluginManager::traceSink sink)
+{
+    std::lock_guard<std::mutex> lock(_sinkMutex);
+    _sink = std::move(sink);
+}
+
+bool Tracer::sample()
+{
+    const uint64_t threshold = _threshold.load(std::memory_order_relaxed);
+    return threshold != 0 && randomValue() <= threshold;
+}
+
+void Tracer::emit(const std::vector<jp::TraceSpan>& spans)
+{
+    std::lock_guard<std::mutex> lock(_sinkMutex);
+    if(_sink)
+        _sink(spans);
+}
+
+/*****************************************************************************/
+/* TraceScope class **********************************************************/
+/*****************************************************************************/
+
+TraceScope::TraceScope(Tracer& tracer, const char* sender, const char* receiver, uint16_t code, bool startTrace)
+{
+    if(!tracer.isEnabled())
+        return;
+
+    TraceContext& ctx = context;
+    if(ctx.unsampled > 0)
+    {
+        ctx.unsampled++;
+        _mode = UNSAMPLED;
+        return;
+    }
+    if(!ctx.trace)
+    {
+        if(!startTrace)
+            return;
+        if(!tracer.sample())
+        {
+            ctx.unsampled = 1;
+            _mode = UNSAMPLED;
+            return;
+        }
+        uint64_t id = randomValue();
+        ctx.trace = std::make_shared<Trace>(&tracer, id != 0 ? id : 1);
+        tracer._sampledTraces.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    _mode = SAMPLED;
+    _trace = ctx.trace;
+    _trace->retain();
+    _parentId = ctx.spanId;
+    _parentAsync = ctx.async;
+
+    _span.traceId = _trace->id;
+    _span.spanId = _trace->newSpanId();
+    _span.parentId = ctx.spanId;
+    _span.sender = sender ? sender : "";
+    _span.receiver = receiver ? receiver : "";
+    _span.code = code;
+    _span.async = ctx.async;
+    _span.startTime = systemTimeUs();
+
+    ctx.spanId = _span.spanId;
+    ctx.async = false;
+    _start = std::chrono::steady_clock::now();
+}
+
+TraceScope::~TraceScope()
+{
+    if(_mode == INACTIVE)
+        return;
+
+    TraceContext& ctx = context;
+    if(_mode == UNSAMPLED)
+    {
+        ctx.unsampled--;
+        return;
+    }
+
+    _span.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - _start).count();
+    _span.returnCode = _returnCode;
+
+    ctx.spanId = _parentId;
+    ctx.async = _parentAsync;
+    // End of the root span
+    if(_parentId == 0)
+        ctx.trace.reset();
+
+    _trace->tracer->_tracedSpans.fetch_add(1, std::memory_order_relaxed);
+    _trace->addSpan(std::move(_span));
+    _trace->release();
+}
+
+/*****************************************************************************/
+/* TraceHandoff class ********************************************************/
+/*****************************************************************************/
+
+TraceHandoff::TraceHandoff(TraceHandoff&& other) noexcept
+    : _trace(std::move(other._trace)),
+      _spanId(other._spanId),
+      _unsampled(other._unsampled)
+{
+}
+
+TraceHandoff& TraceHandoff::operator=(TraceHandoff&& other) noexcept
+{
+    if(this != &other)
+    {
+        release();
+        _trace = std::move(other._trace);
+        _spanId = other._spanId;
+        _unsampled = other._unsampled;
+    }
+    return *this;
+}
+
+// Static
+TraceHandoff TraceHandoff::capture()
+{
+    TraceHandoff handoff;
+    const TraceContext& ctx = context;
+    if(ctx.trace)
+    {
+        handoff._trace = ctx.trace;
+        handoff._spanId = ctx.spanId;
+        handoff._trace->retain();
+    }
+    handoff._unsampled = ctx.unsampled > 0;
+    return handoff;
+}
+
+void TraceHandoff::release()
+{
+    if(!_trace)
+        return;
+    std::shared_ptr<Trace> trace = std::move(_trace);
+    trace->release();
+}
+
+/*****************************************************************************/
+/* TraceResume class *********************************************************/
+/*****************************************************************************/
+
+TraceResume::TraceResume(TraceHandoff& handoff)
+    : _handoff(handoff)
+{
+    TraceContext& ctx = context;
+    _previousTrace = std::move(ctx.trace);
+    _previousSpanId = ctx.spanId;
+    _previousUnsampled = ctx.unsampled;
+    _previousAsync = ctx.async;
+
+    ctx.trace = handoff._trace;
+    ctx.spanId = handoff._spanId;
+    ctx.unsampled = handoff._unsampled ? 1 : 0;
+    ctx.async = static_cast<bool>(handoff._trace);
+}
+
+TraceResume::~TraceResume()
+{
+    TraceContext& ctx = context;
+    ctx.trace = std::move(_previousTrace);
+    ctx.spanId = _previousSpanId;
+    ctx.unsampled = _previousUnsampled;
+    ctx.async = _previousAsync;
+    _handoff.release();
+}
+
+/*****************************************************************************/
+/* Functions *****************************************************************/
+/*****************************************************************************/
+
+void jp_private::writeTrace(std::ostream& stream, const std::vector<jp::TraceSpan>& spans)
+{
+    // Written by hand: building a json object for each span costs more than the requests
+    std::string line;
+    line.reserve(64 + spans.size() * 192);
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "{\"traceId\":\"%016llx\",\"spans\":[",
+             static_cast<unsigned long long>(spans.empty() ? 0 : spans.front().traceId));
+    line += buffer;
+
+    for(size_t i=0; i < spans.size(); ++i)
+    {
+        const jp::TraceSpan& span = spans[i];
+        snprintf(buffer, sizeof(buffer), "%s{\"spanId\":%llu,\"parentId\":%llu,\"sender\":",
+                 i > 0 ? "," : "",
+                 static_cast<unsigned long long>(span.spanId),
+                 static_cast<unsigned long long>(span.parentId));
+        line += buffer;
+        appendJsonString(&line, span.sender);
+        line += ",\"receiver\":";
+        appendJsonString(&line, span.receiver);
+        snprintf(buffer, sizeof(buffer), ",\"code\":%u,\"returnCode\":%u,\"async\":%s,\"startTime\":%lld,\"duration\":%lld}",
+                 static_cast<unsigned int>(span.code),
+                 static_cast<unsigned int>(span.returnCode),
+                 span.async ? "true" : "false",
+                 static_cast<long long>(span.startTime),
+                 static_cast<long long>(span.duration));
+        line += buffer;
+    }
+    line += "]}\n";
+    stream.write(line.data(), static_cast<std::streamsize>(line.size()));
+}
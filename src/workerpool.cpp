@@ -0,0 +1,187 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "private/workerpool.h"
+
+#include <algorithm> // for std::min, std::max
+#include <atomic> // for std::atomic
+#include <chrono> // for std::chrono::steady_clock
+#include <cmath> // for std::lround
+#include <cstdint> // for uint64_t
+#include <mutex> // for std::mutex
+#include <system_error> // for std::system_error
+#include <thread> // for std::thread
+#include <vector> // for std::vector
+
+#include "private/sysutil.h"
+
+using namespace jp_private;
+
+namespace
+{
+
+uint64_t nowNs()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+unsigned int cpuLimit()
+{
+    const unsigned int cpus = sysutil::availableCpus();
+    return cpus > 0 ? cpus : std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+} // namespace
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)>& task)
+{
+    // A single task is run directly (it tells nothing about the pool size)
+    if(count == 1)
+        task(0);
+    if(count <= 1)
+        return;
+
+    // The quota and the affinity can change while the process runs
+    _cpuLimit = cpuLimit();
+    const unsigned int maxWorkers = _pinned > 0 ? _pinned : _cpuLimit * maxWorkersPerCpu;
+    const unsigned int startWorkers = std::min(_pinned > 0 ? _pinned : (_workers > 0 ? _workers : _cpuLimit), maxWorkers);
+
+    std::atomic<size_t> next(0);
+    std::atomic<unsigned int> target(startWorkers);
+    std::atomic<unsigned int> running(1); // The calling thread
+    std::atomic<uint64_t> waitTime(0);
+    std::atomic<uint64_t> cpuTime(0);
+
+    // Guard the members below (the workers only try to lock it, so they never wait for each other)
+    std::mutex resizeMutex;
+    std::vector<std::thread> threads;
+    unsigned int chosen = startWorkers;
+    unsigned int peak = 1;
+
+    std::function<void(bool)> worker;
+    // Start threads until target are running, or until each remaining task has one (must be called with resizeMutex locked)
+    auto spawn = [&]() {
+        while(running.load() < target.load() && running.load() < count - std::min(next.load(), count))
+        {
+            running++;
+            try
+            {
+                threads.emplace_back(worker, false);
+            }
+            catch(const std::system_error&)
+            {
+                // Thread limit reached: keep the current threads
+                running--;
+                break;
+            }
+        }
+        peak = std::max(peak, running.load());
+    };
+    // Size the pool from the times measured so far (must be called with resizeMutex locked)
+    auto resize = [&]() {
+        const uint64_t cpu = cpuTime.load();
+        if(cpu == 0)
+            return; // No CPU time measured yet (or not supported)
+        const double ratio = static_cast<double>(waitTime.load()) / static_cast<double>(cpu);
+        const long size = std::lround(_cpuLimit * (1.0 + ratio));
+        chosen = static_cast<unsigned int>(std::max(1L, std::min(size, static_cast<long>(maxWorkers))));
+        // The first measures are noisy: the pool at most doubles at each step
+        target = std::min(chosen, 2 * running.load());
+        spawn();
+    };
+
+    worker = [&](bool caller) {
+        const sysutil::ThreadTimes times;
+        while(true)
+        {
+            // The extra threads leave when the pool shrinks (the calling thread always stays)
+            unsigned int current = running.load();
+            while(!caller && current > target.load())
+            {
+                if(running.compare_exchange_weak(current, current - 1))
+                    return;
+            }
+
+            const size_t i = next++;
+            if(i >= count)
+                break;
+
+            uint64_t cpuStart, delayStart, cpuEnd, delayEnd;
+            times.read(&cpuStart, &delayStart);
+            const uint64_t start = nowNs();
+            task(i);
+            const uint64_t wall = nowNs() - start;
+            times.read(&cpuEnd, &delayEnd);
+
+            // The time spent waiting for a CPU is not a wait of the task: more threads would not help
+            const uint64_t busy = (cpuEnd - cpuStart) + (delayEnd - delayStart);
+            cpuTime += cpuEnd - cpuStart;
+            waitTime += wall > busy ? wall - busy : 0;
+
+            if(_pinned == 0 && resizeMutex.try_lock())
+            {
+                resize();
+                resizeMutex.unlock();
+            }
+        }
+        if(!caller)
+            running--;
+    };
+
+    resizeMutex.lock();
+    spawn();
+    resizeMutex.unlock();
+    worker(true);
+
+    // No thread is started once the mutex is held here
+    std::lock_guard<std::mutex> lock(resizeMutex);
+    for(std::thread& thread : threads)
+        thread.join();
+
+    _peakWorkers = peak;
+    if(cpuTime.load() > 0)
+        _waitRatio = static_cast<double>(waitTime.load()) / static_cast<double>(cpuTime.load());
+    if(_pinned == 0)
+        _workers = chosen;
+}
+
+void WorkerPool::setWorkers(unsigned int count)
+{
+    _pinned = count;
+}
+
+WorkerPool::Info WorkerPool::info()
+{
+    if(_cpuLimit == 0)
+        _cpuLimit = cpuLimit();
+
+    Info info;
+    info.cpuLimit = _cpuLimit;
+    info.workers = _pinned > 0 ? _pinned : (_workers > 0 ? _workers : _cpuLimit);
+    info.peakWorkers = _peakWorkers;
+    info.waitRatio = _waitRatio;
+    info.pinned = _pinned > 0;
+    return info;
+}
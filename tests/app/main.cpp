@@ -41,6 +41,8 @@ int main()
     PluginManager& mgr = PluginManager::instance();
     std::string appDir(mgr.appDirectory());
     std::cout << appDir << std::endl;
+    // plugin_test keeps a state file next to the executable
+    mgr.setStateDirectory(appDir);
     mgr.searchForPlugins(appDir + "/plugin", callBackFunc);
     mgr.loadPlugins(callBackFunc);
     mgr.unloadPlugins(callBackFunc);
@@ -27,12 +27,28 @@
 include_directories(${PLUGIN_INCLUDE_DIR})
 include(${PLUGIN_INCLUDE_DIR}/EmbedMetadata.cmake)
 
-# -fvisibility=hidden must be set for every plugin in case several plugins have the same class names
-set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -fvisibility=hidden")
-
 # Needed on Windows
 set(CMAKE_RUNTIME_OUTPUT_DIRECTORY ${CMAKE_LIBRARY_OUTPUT_DIRECTORY})
 
-embed_metadata(METADATA_FILE meta.json)
+# Plugins are built with the load optimizations of justplug_add_plugin(), unless
+# the plugin project sets PLUGIN_LOAD_OPTIMIZED to OFF
+if(NOT DEFINED PLUGIN_LOAD_OPTIMIZED)
+    set(PLUGIN_LOAD_OPTIMIZED ON)
+endif()
+set(loadOptimization "")
+if(NOT PLUGIN_LOAD_OPTIMIZED)
+    set(loadOptimization NO_LOAD_OPTIMIZATION)
+endif()
+
+# Resources listed in PLUGIN_RESOURCES and PLUGIN_COMPRESSED_RESOURCES by the plugin project
+if(PLUGIN_RESOURCES OR PLUGIN_COMPRESSED_RESOURCES)
+    enable_language(ASM)
+endif()
 
-add_library(${PROJECT_NAME} SHARED main.cpp meta.json)
+justplug_add_plugin(
+    ${PROJECT_NAME}
+    SOURCES main.cpp
+    RESOURCES ${PLUGIN_RESOURCES}
+    COMPRESSED_RESOURCES ${PLUGIN_COMPRESSED_RESOURCES}
+    ${loadOptimization}
+)
@@ -27,6 +27,8 @@
 #include <string>
 #include "iplugin.h"
 #include "plugininfo.h"
+#include "resources.h"
+#include "statefile.h"
 
 class PluginTest: public jp::IPlugin
 {
@@ -70,6 +72,44 @@ public:
                 std::cout << buffer->name << std::endl;
         }
 
+        for(size_t i=0; i < jp::resourcesCount(); ++i)
+        {
+            const jp::ResourceView resource = jp::resourceAt(i);
+            std::cout << "Resource " << resource.name << " (" << resource.size << " bytes): "
+                      << std::string((const char*)resource.data, resource.size);
+        }
+
+        loadState();
+
+    }
+
+    // Map the state saved by the previous run, or build and publish it
+    void loadState()
+    {
+        const uint32_t formatVersion = 1;
+        const char message[] = "State of plugin_test";
+
+        jp::StateFile state;
+        jp::StateFile* statePtr = &state;
+        uint32_t dataSize = sizeof(state);
+        if(sendRequest(nullptr, IPlugin::MAP_STATEFILE, (void**)&statePtr, &dataSize) == IPlugin::SUCCESS)
+        {
+            if(state.formatVersion == formatVersion && state.size == sizeof(message))
+            {
+                std::cout << "State mapped (generation " << state.generation << "): "
+                          << (const char*)state.data << std::endl;
+                return;
+            }
+            sendRequest(nullptr, IPlugin::RELEASE_STATEFILE, (void**)&statePtr, &dataSize);
+        }
+
+        state.size = sizeof(message);
+        state.formatVersion = formatVersion;
+        if(sendRequest(nullptr, IPlugin::CREATE_STATEFILE, (void**)&statePtr, &dataSize) != IPlugin::SUCCESS)
+            return;
+        memcpy(state.data, message, sizeof(message));
+        if(sendRequest(nullptr, IPlugin::PUBLISH_STATEFILE, (void**)&statePtr, &dataSize) == IPlugin::SUCCESS)
+            std::cout << "State published (generation " << state.generation << ")" << std::endl;
     }
 
     void aboutToBeUnloaded() override
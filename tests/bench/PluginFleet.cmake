@@ -0,0 +1,197 @@
+###############################################################################
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2017 Fabien Caylus
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+###############################################################################
+
+
+#
+# This script generates fleets of synthetic plugins used by the benchmarks.
+# Each plugin is generated from the templates in the fleet/ folder and built
+# with the same PluginCommon.cmake file as the test app plugins.
+#
+
+include(CMakeParseArguments)
+
+set(PLUGIN_FLEET_TEMPLATE_DIR ${CMAKE_CURRENT_LIST_DIR}/fleet)
+
+# Minimal standard random generator (Park & Miller), computed with the Schrage
+# method so that it never overflows 32 bits integers.
+# Parameters:
+#   VARIABLE    - The name of the variable holding the generator state (updated in place).
+function(FLEET_RANDOM VARIABLE)
+    math(EXPR hi "${${VARIABLE}} / 127773")
+    math(EXPR lo "${${VARIABLE}} % 127773")
+    math(EXPR state "16807 * ${lo} - 2836 * ${hi}")
+    if(NOT state GREATER 0)
+        math(EXPR state "${state} + 2147483647")
+    endif()
+    set(${VARIABLE} ${state} PARENT_SCOPE)
+endfunction()
+
+# Pick COUNT distinct plugins ids in [FIRST, FIRST + RANGE)
+# Parameters:
+#   STATE_VARIABLE  - The random generator state (updated in place).
+#   RESULT_VARIABLE - The list of ids.
+function(FLEET_PICK_DEPENDENCIES STATE_VARIABLE RESULT_VARIABLE FIRST RANGE COUNT)
+    set(state ${${STATE_VARIABLE}})
+    set(ids)
+    if(COUNT GREATER RANGE)
+        set(COUNT ${RANGE})
+    endif()
+
+    set(picked 0)
+    while(picked LESS COUNT)
+        fleet_random(state)
+        math(EXPR id "${FIRST} + ${state} % ${RANGE}")
+        list(FIND ids ${id} found)
+        if(found EQUAL -1)
+            list(APPEND ids ${id})
+            math(EXPR picked "${picked} + 1")
+        endif()
+    endwhile()
+
+    set(${STATE_VARIABLE} ${state} PARENT_SCOPE)
+    set(${RESULT_VARIABLE} ${ids} PARENT_SCOPE)
+endfunction()
+
+# Function to generate and add a fleet of synthetic plugins.
+# Plugins are named <PREFIX>_<id> and are built in CMAKE_LIBRARY_OUTPUT_DIRECTORY.
+# Parameters
+#   PREFIX          - Prefix of the plugins names (default to SHAPE).
+#   SHAPE           - Shape of the dependencies graph:
+#                       random:  each plugin depends on up to MAX_DEPS previous plugins
+#                       layered: plugins are grouped by layers of LAYER_WIDTH plugins, and
+#                                depend on 1 to MAX_DEPS plugins of the previous layer
+#                       chain:   each plugin depends on the previous one
+#                       fanout:  the last plugin depends on every other plugins
+#   COUNT           - Number of plugins to generate.
+#   SEED            - Seed of the random generator (random and layered shapes).
+#   MAX_DEPS        - Maximum number of dependencies per plugin (random and layered shapes).
+#   LAYER_WIDTH     - Number of plugins per layer (layered shape).
+#   LOAD_WORK_US    - Busy time simulated by each plugin in loaded() (in microseconds).
+#   RESOURCES       - Files embedded in every plugin with embed_resources() (absolute paths).
+#   LAZY_DEPS       - Mark every dependency as lazy (loaded on the first request of its dependent).
+#   OPTIONAL_DEPS   - Mark every dependency as optional.
+#   EVICTABLE       - Mark every plugin as evictable.
+#   NO_LOAD_OPTIMIZATION - Build the plugins without the load optimizations of justplug_add_plugin().
+#
+# Every plugin handles the request code 0 by returning SUCCESS, and the request code 1
+# by reading one byte of each page of its embedded resources.
+#
+# Usage
+#   generate_plugin_fleet(SHAPE layered COUNT 1000 LAYER_WIDTH 50)
+function(GENERATE_PLUGIN_FLEET)
+    set(oneValueArgs PREFIX SHAPE COUNT SEED MAX_DEPS LAYER_WIDTH LOAD_WORK_US)
+    cmake_parse_arguments(FLEET "NO_LOAD_OPTIMIZATION;LAZY_DEPS;OPTIONAL_DEPS;EVICTABLE" "${oneValueArgs}" "RESOURCES" ${ARGN})
+
+    if(NOT FLEET_PREFIX)
+        set(FLEET_PREFIX ${FLEET_SHAPE})
+    endif()
+    if(NOT FLEET_SEED)
+        set(FLEET_SEED 42)
+    endif()
+    if(NOT FLEET_MAX_DEPS)
+        set(FLEET_MAX_DEPS 4)
+    endif()
+    if(NOT FLEET_LAYER_WIDTH)
+        set(FLEET_LAYER_WIDTH 10)
+    endif()
+    if(NOT FLEET_LOAD_WORK_US)
+        set(FLEET_LOAD_WORK_US 0)
+    endif()
+
+    if(FLEET_NO_LOAD_OPTIMIZATION)
+        set(FLEET_LOAD_OPTIMIZED OFF)
+    else()
+        set(FLEET_LOAD_OPTIMIZED ON)
+    endif()
+    if(FLEET_RESOURCES)
+        set(FLEET_HAS_RESOURCES 1)
+    else()
+        set(FLEET_HAS_RESOURCES 0)
+    endif()
+    set(depFlags "")
+    if(FLEET_LAZY_DEPS)
+        set(depFlags "${depFlags}, \"lazy\":true")
+    endif()
+    if(FLEET_OPTIONAL_DEPS)
+        set(depFlags "${depFlags}, \"optional\":true")
+    endif()
+    if(FLEET_EVICTABLE)
+        set(FLEET_EVICTABLE_JSON true)
+    else()
+        set(FLEET_EVICTABLE_JSON false)
+    endif()
+
+    if(NOT FLEET_SHAPE MATCHES "^(random|layered|chain|fanout)$")
+        message(FATAL_ERROR "Unknown plugin fleet shape: ${FLEET_SHAPE}")
+    endif()
+
+    message(STATUS "Generate ${FLEET_COUNT} ${FLEET_PREFIX} plugins with a ${FLEET_SHAPE} dependencies graph")
+
+    set(state ${FLEET_SEED})
+    math(EXPR lastId "${FLEET_COUNT} - 1")
+    foreach(id RANGE ${lastId})
+        set(depIds)
+
+        if(FLEET_SHAPE STREQUAL "random" AND id GREATER 0)
+            fleet_random(state)
+            math(EXPR depNb "${state} % (${FLEET_MAX_DEPS} + 1)")
+            fleet_pick_dependencies(state depIds 0 ${id} ${depNb})
+        elseif(FLEET_SHAPE STREQUAL "layered")
+            math(EXPR layer "${id} / ${FLEET_LAYER_WIDTH}")
+            if(layer GREATER 0)
+                fleet_random(state)
+                math(EXPR depNb "1 + ${state} % ${FLEET_MAX_DEPS}")
+                math(EXPR first "(${layer} - 1) * ${FLEET_LAYER_WIDTH}")
+                fleet_pick_dependencies(state depIds ${first} ${FLEET_LAYER_WIDTH} ${depNb})
+            endif()
+        elseif(FLEET_SHAPE STREQUAL "chain" AND id GREATER 0)
+            math(EXPR depIds "${id} - 1")
+        elseif(FLEET_SHAPE STREQUAL "fanout" AND id EQUAL lastId AND id GREATER 0)
+            math(EXPR lastDep "${id} - 1")
+            foreach(depId RANGE ${lastDep})
+                list(APPEND depIds ${depId})
+            endforeach()
+        endif()
+
+        # Format dependencies for meta.json, and their names for main.cpp
+        set(FLEET_DEPENDENCIES "")
+        set(FLEET_DEPENDENCY_NAMES "")
+        foreach(depId ${depIds})
+            if(NOT FLEET_DEPENDENCIES STREQUAL "")
+                set(FLEET_DEPENDENCIES "${FLEET_DEPENDENCIES},\n                      ")
+            endif()
+            set(FLEET_DEPENDENCIES "${FLEET_DEPENDENCIES}{\"name\":\"${FLEET_PREFIX}_${depId}\", \"version\":\"1.0.0\"${depFlags}}")
+            set(FLEET_DEPENDENCY_NAMES "${FLEET_DEPENDENCY_NAMES}\"${FLEET_PREFIX}_${depId}\", ")
+        endforeach()
+
+        set(FLEET_PLUGIN_NAME ${FLEET_PREFIX}_${id})
+        set(pluginDir ${CMAKE_CURRENT_BINARY_DIR}/fleet/${FLEET_PREFIX}/${FLEET_PLUGIN_NAME})
+        configure_file(${PLUGIN_FLEET_TEMPLATE_DIR}/CMakeLists.txt.in ${pluginDir}/CMakeLists.txt @ONLY)
+        configure_file(${PLUGIN_FLEET_TEMPLATE_DIR}/main.cpp.in ${pluginDir}/main.cpp @ONLY)
+        configure_file(${PLUGIN_FLEET_TEMPLATE_DIR}/meta.json.in ${pluginDir}/meta.json @ONLY)
+        add_subdirectory(${pluginDir} ${CMAKE_CURRENT_BINARY_DIR}/fleet-build/${FLEET_PREFIX}/${FLEET_PLUGIN_NAME})
+    endforeach()
+endfunction()
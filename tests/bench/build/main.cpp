@@ -0,0 +1,248 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Plugin build benchmark: compares the same fleet of plugins built with the previous
+ * plugin template (-fvisibility=hidden only) and with the load optimizations of
+ * justplug_add_plugin() (see EmbedMetadata.cmake).
+ *
+ * Reports the size of the libraries, the number of dynamic symbols and relocations
+ * (ELF only), and the time of searchForPlugins() (dlopen() of every library),
+ * loadPlugins() and unloadPlugins().
+ * With -c, each iteration is also run with a cold page cache.
+ *
+ * Usage: justplug-bench-build [-n iterations] [-c] [-o results.json]
+ */
+
+#include <cstdlib> // for std::atoi
+#include <cstring> // for strcmp
+#include <fstream> // for std::ifstream, std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+#include <iterator> // for std::istreambuf_iterator
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+#include "pagecache.h"
+
+#if defined(__linux__)
+#include <dirent.h> // for opendir
+#include <elf.h> // for Elf64_Ehdr
+#include <link.h> // for ElfW
+#endif
+
+using namespace jp;
+using namespace jp_bench;
+
+namespace
+{
+
+struct LibraryStats
+{
+    size_t files = 0;
+    size_t bytes = 0;
+    size_t dynamicSymbols = 0;
+    size_t relocations = 0;
+};
+
+#if defined(__linux__)
+// Add the size, the dynamic symbols and the relocations of the library at path
+void addLibraryStats(const std::string& path, LibraryStats* stats)
+{
+    std::ifstream file(path, std::ios::binary);
+    const std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    stats->files++;
+    stats->bytes += data.size();
+
+    if(data.size() < sizeof(ElfW(Ehdr)))
+        return;
+    const ElfW(Ehdr)* header = reinterpret_cast<const ElfW(Ehdr)*>(data.data());
+    if(memcmp(header->e_ident, ELFMAG, SELFMAG) != 0
+       || header->e_shoff + header->e_shnum * sizeof(ElfW(Shdr)) > data.size())
+        return;
+
+    const ElfW(Shdr)* sections = reinterpret_cast<const ElfW(Shdr)*>(data.data() + header->e_shoff);
+    for(int i=0; i < header->e_shnum; ++i)
+    {
+        const ElfW(Shdr)& section = sections[i];
+        if(section.sh_entsize == 0)
+            continue;
+        if(section.sh_type == SHT_DYNSYM)
+            stats->dynamicSymbols += section.sh_size / section.sh_entsize;
+        else if(section.sh_type == SHT_RELA || section.sh_type == SHT_REL)
+            stats->relocations += section.sh_size / section.sh_entsize;
+    }
+}
+
+LibraryStats libraryStats(const std::string& dir)
+{
+    LibraryStats stats;
+    DIR* d = opendir(dir.c_str());
+    if(!d)
+        return stats;
+    while(dirent* entry = readdir(d))
+    {
+        const std::string name = entry->d_name;
+        if(name.size() > 3 && name.compare(name.size() - 3, 3, ".so") == 0)
+            addLibraryStats(dir + "/" + name, &stats);
+    }
+    closedir(d);
+    return stats;
+}
+#else
+LibraryStats libraryStats(const std::string& dir)
+{
+    (void)dir;
+    return LibraryStats();
+}
+#endif
+
+struct BuildSeries
+{
+    Series search;
+    Series load;
+    Series unload;
+
+    explicit BuildSeries(const std::string& prefix)
+        : search{prefix + "/search", "ms", {}},
+          load{prefix + "/load", "ms", {}},
+          unload{prefix + "/unload", "ms", {}}
+    {
+    }
+};
+
+bool runIteration(PluginManager& mgr, const std::string& dir, BuildSeries* series)
+{
+    const Clock::time_point start = Clock::now();
+    if(!mgr.searchForPlugins(dir))
+        return false;
+    const Clock::time_point searched = Clock::now();
+    if(!mgr.loadPlugins())
+        return false;
+    const Clock::time_point loaded = Clock::now();
+    mgr.unloadPlugins();
+    const Clock::time_point unloaded = Clock::now();
+
+    series->search.samples.push_back(elapsedMs(start, searched));
+    series->load.samples.push_back(elapsedMs(searched, loaded));
+    series->unload.samples.push_back(elapsedMs(loaded, unloaded));
+    return true;
+}
+
+void printSeries(const std::string& variant, const char* cache, const LibraryStats& stats, const BuildSeries& series)
+{
+    std::cout << std::left << std::fixed << std::setprecision(1)
+              << std::setw(12) << variant
+              << std::setw(8) << cache
+              << std::setw(12) << stats.bytes / 1024.0
+              << std::setw(10) << stats.dynamicSymbols
+              << std::setw(10) << stats.relocations
+              << std::setprecision(3)
+              << std::setw(12) << computeStats(series.search.samples).median
+              << std::setw(12) << computeStats(series.load.samples).median
+              << computeStats(series.unload.samples).median << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int iterations = 20;
+    bool cold = false;
+    std::string jsonPath;
+
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            iterations = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-c") == 0)
+            cold = true;
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+    }
+    if(iterations < 1)
+        iterations = 1;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+
+    std::cout << "Plugin build benchmark (" << iterations << " iterations, medians in ms)" << std::endl;
+    std::cout << std::left << std::setw(12) << "build"
+              << std::setw(8) << "cache"
+              << std::setw(12) << "size (kB)"
+              << std::setw(10) << "symbols"
+              << std::setw(10) << "relocs"
+              << std::setw(12) << "search"
+              << std::setw(12) << "load"
+              << "unload" << std::endl;
+
+    std::vector<Series> results;
+    for(const std::string variant : {"template", "optimized"})
+    {
+        const std::string dir = mgr.appDirectory() + "/fleet/" + variant;
+        const LibraryStats stats = libraryStats(dir);
+        BuildSeries warmSeries(variant + "/warm");
+        BuildSeries coldSeries(variant + "/cold");
+
+        // Warm-up
+        BuildSeries warmUp(variant);
+        if(!runIteration(mgr, dir, &warmUp))
+        {
+            std::cerr << "Cannot load the " << variant << " plugins" << std::endl;
+            return 1;
+        }
+
+        for(int it=0; it < iterations; ++it)
+        {
+            if(cold)
+            {
+                evictFromPageCache(dir);
+                runIteration(mgr, dir, &coldSeries);
+            }
+            runIteration(mgr, dir, &warmSeries);
+        }
+
+        printSeries(variant, "warm", stats, warmSeries);
+        for(const Series& series : {warmSeries.search, warmSeries.load, warmSeries.unload})
+            results.push_back(series);
+        if(cold)
+        {
+            printSeries(variant, "cold", stats, coldSeries);
+            for(const Series& series : {coldSeries.search, coldSeries.load, coldSeries.unload})
+                results.push_back(series);
+        }
+        results.push_back(Series{variant + "/size", "kB", {stats.bytes / 1024.0}});
+        results.push_back(Series{variant + "/symbols", "symbols", {double(stats.dynamicSymbols)}});
+        results.push_back(Series{variant + "/relocations", "relocations", {double(stats.relocations)}});
+    }
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "build", results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Request coalescing benchmark: posts tiny requests (4 bytes) from a plugin to one of its
+ * dependencies with IPlugin::postRequest(), without coalescing and with the adaptive
+ * coalescing of PluginManager::setRequestCoalescing().
+ *
+ * - burst: the requests are posted back to back, the throughput is measured until the
+ *   last one is delivered.
+ * - paced: one request every 500 us (low load), the coalescing delay should drop to 0.
+ *
+ * Reports the time per request, the post to delivery latency (median and 99th percentile)
+ * and the number of requests delivered per wake-up of the request thread.
+ *
+ * Uses the dispatch fleet (dispatch_65 depends on dispatch_0 ... dispatch_64).
+ *
+ * Usage: justplug-bench-coalesce [-n requests] [-r repetitions] [-d max_delay_us] [-o results.json]
+ */
+
+#include <algorithm> // for std::sort
+#include <atomic> // for std::atomic
+#include <cstdlib> // for std::atoi
+#include <cstring> // for strcmp
+#include <fstream> // for std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+#include <thread> // for std::this_thread
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+namespace
+{
+
+const char* const HUB_PLUGIN = "dispatch_65";
+const char* const TARGET_PLUGIN = "dispatch_0";
+
+// Post and delivery times of the requests of a run (indexed by the posted value)
+std::vector<Clock::time_point> postTimes;
+std::vector<Clock::time_point> deliveryTimes;
+std::atomic<uint32_t> deliveredCount(0);
+
+struct RunResult
+{
+    double nsPerRequest = 0.0;
+    double requestsPerBatch = 0.0;
+};
+
+// Post count requests, one every interval us (back to back if 0), and wait for their delivery.
+// The latencies (in us) are appended to latencies.
+RunResult run(PluginManager& mgr, IPlugin* hub, uint32_t count, int interval, std::vector<double>* latencies)
+{
+    postTimes.assign(count, Clock::time_point());
+    deliveryTimes.assign(count, Clock::time_point());
+    deliveredCount = 0;
+    const ManagerMetrics before = mgr.metrics();
+
+    const Clock::time_point start = Clock::now();
+    for(uint32_t i=0; i < count; ++i)
+    {
+        if(interval > 0)
+            std::this_thread::sleep_until(start + std::chrono::microseconds(int64_t(interval) * i));
+        postTimes[i] = Clock::now();
+        hub->postRequest(TARGET_PLUGIN, 4, &i, sizeof(i));
+    }
+    while(deliveredCount.load() < count)
+        std::this_thread::yield();
+    const Clock::time_point end = Clock::now();
+
+    const ManagerMetrics after = mgr.metrics();
+    RunResult result;
+    result.nsPerRequest = elapsedMs(start, end) * 1e6 / count;
+    result.requestsPerBatch = double(count) / double(after.requestBatches - before.requestBatches);
+    for(uint32_t i=0; i < count; ++i)
+        latencies->push_back(elapsedMs(postTimes[i], deliveryTimes[i]) * 1000.0);
+    return result;
+}
+
+double percentile(std::vector<double> samples, double p)
+{
+    if(samples.empty())
+        return 0.0;
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, size_t(p * samples.size()))];
+}
+
+} // namespace
+
+// Called by the target plugin for each delivered request
+extern "C" JP_EXPORT_SYMBOL void jp_bench_requestDelivered(uint32_t value)
+{
+    if(value < deliveryTimes.size())
+        deliveryTimes[value] = Clock::now();
+    deliveredCount++;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t requests = 100000;
+    int repetitions = 10;
+    unsigned int maxDelay = 50;
+    std::string jsonPath;
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            requests = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-r") == 0 && i+1 < argc)
+            repetitions = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-d") == 0 && i+1 < argc)
+            maxDelay = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+    }
+    if(requests < 1)
+        requests = 1;
+    if(repetitions < 1)
+        repetitions = 1;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+    const std::string dir = mgr.appDirectory() + "/fleet/dispatch";
+    if(!mgr.searchForPlugins(dir) || !mgr.loadPlugins())
+    {
+        std::cerr << "Cannot load the plugins of " << dir << std::endl;
+        return 1;
+    }
+    std::shared_ptr<IPlugin> hub = mgr.pluginObject(HUB_PLUGIN);
+
+    std::cout << "Request coalescing benchmark (" << requests << " requests, " << repetitions
+              << " repetitions, max delay " << maxDelay << " us, medians)" << std::endl;
+    std::cout << std::left << std::setw(10) << "load"
+              << std::setw(10) << "mode"
+              << std::setw(14) << "ns/request"
+              << std::setw(16) << "latency (us)"
+              << std::setw(16) << "p99 (us)"
+              << "requests/wake-up" << std::endl;
+
+    std::vector<Series> results;
+    for(const std::string load : {"burst", "paced"})
+    {
+        // The paced runs last 500 us per request
+        const int interval = load == "paced" ? 500 : 0;
+        const uint32_t count = load == "paced" ? std::min<uint32_t>(requests, 2000) : requests;
+        for(const std::string mode : {"off", "coalesce"})
+        {
+            mgr.setRequestCoalescing(TARGET_PLUGIN, mode == "coalesce" ? maxDelay : 0);
+
+            Series time{"coalesce/" + load + "/" + mode + "/time", "ns/op", {}};
+            Series batch{"coalesce/" + load + "/" + mode + "/batch", "requests", {}};
+            std::vector<double> latencies;
+            // The first repetition is not measured (warm-up)
+            for(int rep=-1; rep < repetitions; ++rep)
+            {
+                std::vector<double> repLatencies;
+                const RunResult result = run(mgr, hub.get(), count, interval, &repLatencies);
+                if(rep < 0)
+                    continue;
+                time.samples.push_back(result.nsPerRequest);
+                batch.samples.push_back(result.requestsPerBatch);
+                latencies.insert(latencies.end(), repLatencies.begin(), repLatencies.end());
+            }
+            Series latency{"coalesce/" + load + "/" + mode + "/latency", "us", latencies};
+
+            std::cout << std::left << std::fixed << std::setprecision(2)
+                      << std::setw(10) << load
+                      << std::setw(10) << mode
+                      << std::setw(14) << computeStats(time.samples).median
+                      << std::setw(16) << computeStats(latencies).median
+                      << std::setw(16) << percentile(latencies, 0.99)
+                      << computeStats(batch.samples).median << std::endl;
+            results.push_back(time);
+            results.push_back(latency);
+            results.push_back(batch);
+        }
+    }
+    hub.reset();
+    mgr.unloadPlugins();
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "coalesce", results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,320 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+/*
+ * Small helpers shared by all benchmark executables.
+ */
+
+#include <algorithm> // for std::sort
+#include <chrono> // for std::chrono::steady_clock
+#include <cmath> // for std::sqrt
+#include <cstdint> // for uint64_t
+#include <cstring> // for memset
+#include <ctime> // for std::time
+#include <fstream> // for std::ifstream
+#include <thread> // for std::thread::hardware_concurrency
+#include <utility> // for std::pair
+#include <ostream> // for std::ostream
+#include <string> // for std::string
+#include <vector> // for std::vector
+
+#include "json/json.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h> // for gethostname
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h> // for mallinfo2
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h> // for perf_event_attr
+#include <sys/ioctl.h> // for ioctl
+#include <sys/syscall.h> // for syscall
+#endif
+
+namespace jp_bench
+{
+
+typedef std::chrono::steady_clock Clock;
+
+// Returns the time elapsed between from and to in milliseconds
+inline double elapsedMs(const Clock::time_point& from, const Clock::time_point& to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+// Returns the number of bytes allocated on the heap (0 if unknown)
+inline size_t heapInUse()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+// Returns the proportional set size of the process in bytes (0 if unknown).
+// Pages mapped several times (by several mappings or processes) are only counted once.
+inline size_t proportionalSetSize()
+{
+    std::ifstream file("/proc/self/smaps_rollup");
+    std::string field;
+    size_t value = 0;
+    while(file >> field)
+    {
+        if(field == "Pss:" && file >> value)
+            return value * 1024;
+    }
+    return 0;
+}
+
+struct Stats
+{
+    double min = 0.0;
+    double median = 0.0;
+    double mean = 0.0;
+    double stddev = 0.0;
+    double max = 0.0;
+};
+
+// Version of the JSON results format (increased on incompatible changes)
+const int RESULTS_SCHEMA_VERSION = 1;
+
+inline Stats computeStats(std::vector<double> samples)
+{
+    Stats stats;
+    if(samples.empty())
+        return stats;
+
+    std::sort(samples.begin(), samples.end());
+    const size_t n = samples.size();
+    stats.min = samples.front();
+    stats.max = samples.back();
+    stats.median = (n % 2 == 1) ? samples[n/2] : (samples[n/2 - 1] + samples[n/2]) / 2.0;
+
+    for(double v : samples)
+        stats.mean += v;
+    stats.mean /= n;
+
+    if(n > 1)
+    {
+        for(double v : samples)
+            stats.stddev += (v - stats.mean) * (v - stats.mean);
+        stats.stddev = std::sqrt(stats.stddev / (n - 1));
+    }
+    return stats;
+}
+
+// Result of the Mann-Whitney U test (two-sided, normal approximation with
+// ties and continuity corrections)
+struct UTestResult
+{
+    double u = 0.0; // U statistic of the first sample
+    double z = 0.0;
+    double pValue = 1.0; // 1 if the test cannot be computed
+};
+
+// Non-parametric test checking if a and b come from the same distribution.
+// It does not assume normally distributed samples, so it handles well the
+// outliers of timing measures.
+// NOTE: At least 5 samples per side are needed to reach p < 0.05.
+inline UTestResult mannWhitneyUTest(const std::vector<double>& a, const std::vector<double>& b)
+{
+    UTestResult result;
+    const size_t n1 = a.size();
+    const size_t n2 = b.size();
+    if(n1 == 0 || n2 == 0)
+        return result;
+
+    // Rank all values (ties get the average of their ranks)
+    std::vector<std::pair<double, int>> values;
+    values.reserve(n1 + n2);
+    for(double v : a)
+        values.emplace_back(v, 0);
+    for(double v : b)
+        values.emplace_back(v, 1);
+    std::sort(values.begin(), values.end());
+
+    const double n = static_cast<double>(n1 + n2);
+    double rankSumA = 0.0;
+    double tiesTerm = 0.0;
+    for(size_t i=0; i < values.size();)
+    {
+        size_t j = i;
+        while(j < values.size() && values[j].first == values[i].first)
+            ++j;
+        const double rank = (i + j + 1) / 2.0; // ranks start at 1
+        for(size_t k=i; k < j; ++k)
+        {
+            if(values[k].second == 0)
+                rankSumA += rank;
+        }
+        const double t = static_cast<double>(j - i);
+        tiesTerm += t*t*t - t;
+        i = j;
+    }
+
+    result.u = rankSumA - n1 * (n1 + 1) / 2.0;
+    const double mean = n1 * n2 / 2.0;
+    const double variance = n1 * n2 / 12.0 * ((n + 1) - tiesTerm / (n * (n - 1)));
+    if(variance <= 0.0)
+        return result;
+
+    const double diff = result.u - mean;
+    const double correction = diff > 0 ? -0.5 : (diff < 0 ? 0.5 : 0.0);
+    result.z = (diff + correction) / std::sqrt(variance);
+    result.pValue = std::erfc(std::fabs(result.z) / std::sqrt(2.0));
+    return result;
+}
+
+// A named list of measures (one value per iteration)
+struct Series
+{
+    std::string name;
+    std::string unit;
+    std::vector<double> samples;
+};
+
+// Counts a user-space hardware event of the calling thread
+// (using perf_event_open on Linux). isValid() returns false if hardware counters
+// are not available (other systems, containers, perf_event_paranoid, ...).
+class PerfCounter
+{
+public:
+#if defined(__linux__)
+    PerfCounter(uint32_t type, uint64_t config)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = type;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~PerfCounter()
+    {
+        if(_fd != -1)
+            close(_fd);
+    }
+
+    void start()
+    {
+        ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    uint64_t stop()
+    {
+        ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t count = 0;
+        if(read(_fd, &count, sizeof(count)) != sizeof(count))
+            return 0;
+        return count;
+    }
+#else
+    PerfCounter() {}
+
+    void start() {}
+    uint64_t stop() { return 0; }
+#endif
+
+    bool isValid() const
+    { return _fd != -1; }
+
+    // Non-copyable
+    PerfCounter(const PerfCounter&) = delete;
+    const PerfCounter& operator=(const PerfCounter&) = delete;
+
+private:
+    int _fd = -1;
+};
+
+// Instructions retired
+class InstructionCounter: public PerfCounter
+{
+public:
+#if defined(__linux__)
+    InstructionCounter(): PerfCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS) {}
+#endif
+};
+
+// Instruction TLB misses (page walks caused by instruction fetches)
+class ITlbMissCounter: public PerfCounter
+{
+public:
+#if defined(__linux__)
+    ITlbMissCounter(): PerfCounter(PERF_TYPE_HW_CACHE,
+                                   PERF_COUNT_HW_CACHE_ITLB
+                                   | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                   | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)) {}
+#endif
+};
+
+// Write all series (with their stats) as a JSON document.
+// The document is versioned (schemaVersion) and records the suite name
+// and the environment, so it can be used as a baseline by justplug-bench-compare.
+inline void writeJson(std::ostream& stream, const std::string& suite, const std::vector<Series>& seriesList)
+{
+    using json = nlohmann::json;
+    json root;
+    root["schemaVersion"] = RESULTS_SCHEMA_VERSION;
+    root["suite"] = suite;
+    root["timestamp"] = static_cast<int64_t>(std::time(nullptr));
+    root["cpus"] = std::thread::hardware_concurrency();
+    root["host"] = "";
+#if defined(__unix__) || defined(__APPLE__)
+    char host[256] = {0};
+    if(gethostname(host, sizeof(host) - 1) == 0)
+        root["host"] = host;
+#endif
+    root["benchmarks"] = json::array();
+    for(const Series& series : seriesList)
+    {
+        const Stats stats = computeStats(series.samples);
+        json entry;
+        entry["name"] = series.name;
+        entry["unit"] = series.unit;
+        entry["samples"] = series.samples;
+        entry["min"] = stats.min;
+        entry["median"] = stats.median;
+        entry["mean"] = stats.mean;
+        entry["stddev"] = stats.stddev;
+        entry["max"] = stats.max;
+        root["benchmarks"].push_back(entry);
+    }
+    stream << root.dump(4) << std::endl;
+}
+
+} // namespace jp_bench
+
+#endif // BENCHUTIL_H
@@ -0,0 +1,159 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+/*
+ * Page cache helpers used by the benchmarks to measure cold starts.
+ * Only implemented on POSIX systems (other systems report 0 files).
+ */
+
+#include <string> // for std::string
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h> // for opendir
+#include <fcntl.h> // for open and posix_fadvise
+#include <sys/mman.h> // for mmap and mincore
+#include <sys/stat.h> // for fstat
+#include <unistd.h> // for close and fdatasync
+#include <vector> // for std::vector
+#endif
+
+namespace jp_bench
+{
+
+struct CacheState
+{
+    size_t files = 0; // Number of files in the directory
+    size_t pages = 0; // Total number of pages of these files
+    size_t residentPages = 0; // Number of pages still in the page cache
+};
+
+namespace pagecache_private
+{
+
+#if defined(__unix__) || defined(__APPLE__)
+// Count the pages of fd that are in the page cache
+inline size_t residentPages(int fd, size_t size, size_t pageSize)
+{
+    if(size == 0)
+        return 0;
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if(addr == MAP_FAILED)
+        return 0;
+
+    const size_t pages = (size + pageSize - 1) / pageSize;
+#if defined(__APPLE__)
+    std::vector<char> vec(pages);
+#else
+    std::vector<unsigned char> vec(pages);
+#endif
+    size_t resident = 0;
+    if(mincore(addr, size, vec.data()) == 0)
+    {
+        for(auto v : vec)
+            resident += (v & 1);
+    }
+    munmap(addr, size);
+    return resident;
+}
+
+// Apply func(fd, size) on each regular file of dir (and on dir itself)
+template<typename Func>
+CacheState forEachFile(const std::string& dir, Func func)
+{
+    CacheState state;
+    DIR* dirp = opendir(dir.c_str());
+    if(!dirp)
+        return state;
+
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    while(dirent* entry = readdir(dirp))
+    {
+        const std::string path = dir + "/" + entry->d_name;
+        const int fd = open(path.c_str(), O_RDONLY);
+        if(fd == -1)
+            continue;
+
+        struct stat st;
+        if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            const size_t size = static_cast<size_t>(st.st_size);
+            func(fd, size);
+            state.files++;
+            state.pages += (size + pageSize - 1) / pageSize;
+            state.residentPages += residentPages(fd, size, pageSize);
+        }
+        close(fd);
+    }
+    closedir(dirp);
+
+    // The directory blocks themselves (ignored by some filesystems)
+    const int dirFd = open(dir.c_str(), O_RDONLY);
+    if(dirFd != -1)
+    {
+        func(dirFd, 0);
+        close(dirFd);
+    }
+    return state;
+}
+#endif
+
+} // namespace pagecache_private
+
+// Evict all files of dir (not recursive) and the directory blocks from the page cache.
+// Dirty pages are written first, since only clean pages can be dropped.
+// Returns the state of the page cache after the eviction: on some filesystems (like tmpfs)
+// pages cannot be evicted, so residentPages should be checked.
+inline CacheState evictFromPageCache(const std::string& dir)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    return pagecache_private::forEachFile(dir, [](int fd, size_t size) {
+        fdatasync(fd);
+#if defined(POSIX_FADV_DONTNEED)
+        posix_fadvise(fd, 0, static_cast<off_t>(size), POSIX_FADV_DONTNEED);
+#endif
+    });
+#else
+    (void)dir;
+    return CacheState();
+#endif
+}
+
+// Returns the page cache state for all files of dir (not recursive)
+inline CacheState pageCacheState(const std::string& dir)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    return pagecache_private::forEachFile(dir, [](int, size_t) {});
+#else
+    (void)dir;
+    return CacheState();
+#endif
+}
+
+} // namespace jp_bench
+
+#endif // PAGECACHE_H
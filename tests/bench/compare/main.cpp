@@ -0,0 +1,232 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Compare benchmark results with a baseline (both written by the benchmarks
+ * with the -o option).
+ *
+ * For each benchmark, a Mann-Whitney U test is performed on the samples of
+ * both files. A benchmark is a regression if its median is higher than the
+ * baseline median by more than the threshold, and if the difference is
+ * statistically significant (p-value < alpha).
+ * Deterministic measures (like allocations/op) are compared directly.
+ *
+ * Usage: justplug-bench-compare [-t threshold_percent] [-a alpha] baseline.json results.json [baseline2.json results2.json ...]
+ *
+ * Returns 0 if no regression was found, 1 if at least one regression was found
+ * and 2 on errors.
+ */
+
+#include <cmath> // for std::fabs
+#include <cstdlib> // for std::atof
+#include <cstring> // for strcmp
+#include <fstream> // for std::ifstream
+#include <iomanip> // for std::setw
+#include <iostream>
+#include <map> // for std::map
+
+#include "benchutil.h"
+
+using namespace jp_bench;
+using json = nlohmann::json;
+
+namespace
+{
+
+struct Options
+{
+    double threshold = 5.0; // in percent
+    double alpha = 0.05;
+};
+
+enum Verdict
+{
+    UNCHANGED,
+    IMPROVEMENT,
+    REGRESSION,
+    NOT_SIGNIFICANT
+};
+
+const char* verdictString(Verdict verdict)
+{
+    switch(verdict)
+    {
+    case UNCHANGED:
+        return "unchanged";
+    case IMPROVEMENT:
+        return "improvement";
+    case REGRESSION:
+        return "REGRESSION";
+    case NOT_SIGNIFICANT:
+        return "noise";
+    }
+    return "";
+}
+
+bool readResults(const std::string& path, json* results)
+{
+    std::ifstream file(path);
+    if(!file)
+    {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+
+    try
+    {
+        file >> *results;
+        const int version = results->at("schemaVersion").get<int>();
+        if(version != RESULTS_SCHEMA_VERSION)
+        {
+            std::cerr << path << ": unsupported schema version " << version
+                      << " (expected " << RESULTS_SCHEMA_VERSION << ")" << std::endl;
+            return false;
+        }
+        results->at("benchmarks");
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << path << ": invalid results file (" << e.what() << ")" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Compare two results files, returns the number of regressions (or -1 on errors)
+int compareResults(const std::string& baselinePath, const std::string& resultsPath, const Options& options)
+{
+    json baseline;
+    json results;
+    if(!readResults(baselinePath, &baseline) || !readResults(resultsPath, &results))
+        return -1;
+
+    if(baseline.value("suite", "") != results.value("suite", ""))
+        std::cerr << "Warning: comparing different suites (" << baselinePath << " and " << resultsPath << ")" << std::endl;
+    if(baseline.value("host", "") != results.value("host", "")
+       || baseline.value("cpus", 0) != results.value("cpus", 0))
+        std::cerr << "Warning: the baseline was recorded on a different machine" << std::endl;
+
+    std::map<std::string, std::vector<double>> baselineSamples;
+    for(const json& entry : baseline.at("benchmarks"))
+        baselineSamples[entry.at("name").get<std::string>()] = entry.at("samples").get<std::vector<double>>();
+
+    std::cout << "Comparing " << resultsPath << " with " << baselinePath << std::endl;
+    std::cout << std::left << std::setw(44) << "benchmark"
+              << std::setw(14) << "baseline"
+              << std::setw(14) << "current"
+              << std::setw(10) << "change"
+              << std::setw(10) << "p-value"
+              << "verdict" << std::endl;
+
+    int regressions = 0;
+    for(const json& entry : results.at("benchmarks"))
+    {
+        const std::string name = entry.at("name").get<std::string>();
+        auto it = baselineSamples.find(name);
+        if(it == baselineSamples.end())
+        {
+            std::cout << std::setw(44) << name << "(not in the baseline)" << std::endl;
+            continue;
+        }
+
+        const std::vector<double> samples = entry.at("samples").get<std::vector<double>>();
+        const Stats baseStats = computeStats(it->second);
+        const Stats stats = computeStats(samples);
+        const UTestResult test = mannWhitneyUTest(it->second, samples);
+
+        double change = 0.0;
+        if(baseStats.median != 0.0)
+            change = 100.0 * (stats.median - baseStats.median) / baseStats.median;
+        else if(stats.median != 0.0)
+            change = 100.0; // From nothing to something
+
+        // Without any variance, the measure is deterministic: every change is significant
+        const bool deterministic = baseStats.min == baseStats.max && stats.min == stats.max;
+        const bool significant = deterministic ? baseStats.median != stats.median
+                                               : test.pValue < options.alpha;
+
+        Verdict verdict = UNCHANGED;
+        if(std::fabs(change) > options.threshold)
+        {
+            if(!significant)
+                verdict = NOT_SIGNIFICANT;
+            else
+                verdict = change > 0 ? REGRESSION : IMPROVEMENT;
+        }
+        if(verdict == REGRESSION)
+            regressions++;
+
+        std::cout << std::setw(44) << name
+                  << std::setw(14) << baseStats.median
+                  << std::setw(14) << stats.median
+                  << std::setw(10) << (std::to_string(static_cast<int>(std::round(change))) + "%")
+                  << std::setw(10) << (deterministic ? std::string("-") : std::to_string(test.pValue).substr(0, 6))
+                  << verdictString(verdict) << std::endl;
+    }
+    std::cout << std::endl;
+
+    return regressions;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    std::vector<std::string> files;
+
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-t") == 0 && i+1 < argc)
+            options.threshold = std::atof(argv[++i]);
+        else if(strcmp(argv[i], "-a") == 0 && i+1 < argc)
+            options.alpha = std::atof(argv[++i]);
+        else
+            files.push_back(argv[i]);
+    }
+
+    if(files.empty() || files.size() % 2 != 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " [-t threshold_percent] [-a alpha] baseline.json results.json [...]" << std::endl;
+        return 2;
+    }
+
+    int regressions = 0;
+    for(size_t i=0; i < files.size(); i += 2)
+    {
+        const int count = compareResults(files[i], files[i+1], options);
+        if(count < 0)
+            return 2;
+        regressions += count;
+    }
+
+    if(regressions > 0)
+    {
+        std::cout << regressions << " regression(s) above " << options.threshold << "% found" << std::endl;
+        return 1;
+    }
+    std::cout << "No regression above " << options.threshold << "% found" << std::endl;
+    return 0;
+}
@@ -0,0 +1,245 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Health checks benchmark: measures the cost of the request observation on the
+ * dependency path (health checks disabled, then enabled), and the time needed to
+ * detect a plugin whose health check blocks and a plugin whose requests fail.
+ * The recovery time includes the end of the blocked check (10 check intervals).
+ *
+ * Uses the dispatch fleet (dispatch_65 depends on dispatch_0 ... dispatch_64).
+ *
+ * Usage: justplug-bench-health [-n operations] [-r repetitions] [-i interval] [-o results.json]
+ */
+
+#include <atomic> // for std::atomic
+#include <condition_variable> // for std::condition_variable
+#include <cstdlib> // for std::atoi
+#include <cstring> // for strcmp
+#include <fstream> // for std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+#include <mutex> // for std::mutex
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+namespace
+{
+
+const char* const HUB_PLUGIN = "dispatch_65";
+const char* const TARGET_PLUGIN = "dispatch_0";
+
+// Avoid the compiler to optimize out the requests
+std::atomic<uint32_t> sink(0);
+
+// Health states reported by the callback for TARGET_PLUGIN
+std::mutex stateMutex;
+std::condition_variable stateCond;
+IPlugin::HealthState targetState = IPlugin::HEALTH_UNKNOWN;
+
+uint16_t sendRequest(IPlugin* sender, const char* receiver, uint16_t code, uint32_t dataSize)
+{
+    void* data = nullptr;
+    return sender->sendRequest(receiver, code, &data, &dataSize);
+}
+
+// Median time of a dependency request (in ns)
+double requestTime(PluginManager& mgr, long operations, int repetitions, Series* series)
+{
+    std::shared_ptr<IPlugin> hub = mgr.pluginObject(HUB_PLUGIN);
+    // The first repetition is not measured (warm-up)
+    for(int rep=-1; rep < repetitions; ++rep)
+    {
+        uint32_t result = 0;
+        const Clock::time_point start = Clock::now();
+        for(long i=0; i < operations; ++i)
+            result += sendRequest(hub.get(), TARGET_PLUGIN, 0, 0);
+        if(rep >= 0)
+            series->samples.push_back(elapsedMs(start, Clock::now()) * 1e6 / operations);
+        sink += result;
+    }
+    return computeStats(series->samples).median;
+}
+
+// Wait until the callback reports state for TARGET_PLUGIN. If sendFailing is true, requests are
+// sent to TARGET_PLUGIN meanwhile. Returns the elapsed time in ms, or -1 after 10 s.
+double waitForState(IPlugin* hub, IPlugin::HealthState state, bool sendFailing)
+{
+    const Clock::time_point start = Clock::now();
+    std::unique_lock<std::mutex> lock(stateMutex);
+    while(targetState != state)
+    {
+        if(elapsedMs(start, Clock::now()) > 10000)
+            return -1.0;
+        if(sendFailing)
+        {
+            lock.unlock();
+            sink += sendRequest(hub, TARGET_PLUGIN, 0, 0);
+            lock.lock();
+        }
+        else
+            stateCond.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    return elapsedMs(start, Clock::now());
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    long operations = 1000000;
+    int repetitions = 10;
+    unsigned int interval = 20;
+    std::string jsonPath;
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            operations = std::atol(argv[++i]);
+        else if(strcmp(argv[i], "-r") == 0 && i+1 < argc)
+            repetitions = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-i") == 0 && i+1 < argc)
+            interval = static_cast<unsigned int>(std::atoi(argv[++i]));
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+    }
+    if(operations < 1)
+        operations = 1;
+    if(repetitions < 1)
+        repetitions = 1;
+    if(interval < 1)
+        interval = 1;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+    std::vector<Series> results;
+
+    std::cout << "Health checks benchmark (" << repetitions << " x " << operations
+              << " requests, check interval " << interval << " ms, medians)" << std::endl;
+
+    // Overhead of the request observation
+    Series offSeries{"health/request/off", "ns/op", {}};
+    Series onSeries{"health/request/on", "ns/op", {}};
+    const std::string dir = mgr.appDirectory() + "/fleet/dispatch";
+    if(!mgr.searchForPlugins(dir) || !mgr.loadPlugins())
+    {
+        std::cerr << "Cannot load the dispatch plugins" << std::endl;
+        return 1;
+    }
+    const double offTime = requestTime(mgr, operations, repetitions, &offSeries);
+    mgr.unloadPlugins();
+
+    mgr.setHealthCallback([](const std::string& name, IPlugin::HealthState state, IPlugin::HealthState) {
+        if(name != TARGET_PLUGIN)
+            return;
+        std::lock_guard<std::mutex> lock(stateMutex);
+        targetState = state;
+        stateCond.notify_all();
+    });
+    // The error rate is evaluated once per interval, after at least 20 requests
+    mgr.enableHealthChecks(interval, interval / 2 + 1, 50, 20);
+    // The proxies observing the requests are created when the plugins are loaded
+    if(!mgr.searchForPlugins(dir) || !mgr.loadPlugins())
+    {
+        std::cerr << "Cannot load the dispatch plugins" << std::endl;
+        return 1;
+    }
+    const double onTime = requestTime(mgr, operations, repetitions, &onSeries);
+    std::cout << std::left << std::fixed << std::setprecision(1)
+              << std::setw(28) << "request (ns/op)" << std::setw(12) << "off" << offTime << std::endl
+              << std::setw(28) << "" << std::setw(12) << "on" << onTime << std::endl;
+    results.push_back(offSeries);
+    results.push_back(onSeries);
+
+    // Detection latency
+    std::shared_ptr<IPlugin> hub = mgr.pluginObject(HUB_PLUGIN);
+    std::shared_ptr<IPlugin> target = mgr.pluginObject(TARGET_PLUGIN);
+    Series wedgedSeries{"health/detection/wedged", "ms", {}};
+    Series failingSeries{"health/detection/failing", "ms", {}};
+    Series recoverySeries{"health/detection/recovery", "ms", {}};
+    const int detections = repetitions < 5 ? repetitions : 5;
+    bool success = waitForState(hub.get(), IPlugin::HEALTHY, false) >= 0.0;
+    for(int rep=0; success && rep < detections; ++rep)
+    {
+        // The health check blocks for 10 intervals
+        void* data = nullptr;
+        uint32_t delay = interval * 10;
+        target->handleRequest("bench", 2, &data, &delay);
+        wedgedSeries.samples.push_back(waitForState(hub.get(), IPlugin::UNHEALTHY, false));
+        delay = 0;
+        target->handleRequest("bench", 2, &data, &delay);
+        recoverySeries.samples.push_back(waitForState(hub.get(), IPlugin::HEALTHY, false));
+
+        // Every request fails
+        uint32_t fail = 1;
+        target->handleRequest("bench", 3, &data, &fail);
+        failingSeries.samples.push_back(waitForState(hub.get(), IPlugin::UNHEALTHY, true));
+        fail = 0;
+        target->handleRequest("bench", 3, &data, &fail);
+        // Send successful requests until the plugin is healthy again
+        const Clock::time_point start = Clock::now();
+        while(mgr.pluginHealth(TARGET_PLUGIN)->state() != IPlugin::HEALTHY && elapsedMs(start, Clock::now()) < 10000)
+            sink += sendRequest(hub.get(), TARGET_PLUGIN, 0, 0);
+        waitForState(hub.get(), IPlugin::HEALTHY, false);
+
+        for(const Series* series : {&wedgedSeries, &recoverySeries, &failingSeries})
+        {
+            if(series->samples.back() < 0.0)
+                success = false;
+        }
+    }
+    hub.reset();
+    target.reset();
+    mgr.unloadPlugins();
+    mgr.disableHealthChecks();
+    if(!success)
+    {
+        std::cerr << "The health state of " << TARGET_PLUGIN << " did not change" << std::endl;
+        return 1;
+    }
+
+    std::cout << std::setprecision(3)
+              << std::setw(28) << "detection (ms)" << std::setw(12) << "wedged" << computeStats(wedgedSeries.samples).median << std::endl
+              << std::setw(28) << "" << std::setw(12) << "failing" << computeStats(failingSeries.samples).median << std::endl
+              << std::setw(28) << "" << std::setw(12) << "recovery" << computeStats(recoverySeries.samples).median << std::endl;
+    results.push_back(wedgedSeries);
+    results.push_back(failingSeries);
+    results.push_back(recoverySeries);
+
+    const ManagerMetrics metrics = mgr.metrics();
+    std::cout << "checks: " << metrics.healthChecks << ", failures: " << metrics.healthCheckFailures
+              << ", timeouts: " << metrics.healthCheckTimeouts << ", state changes: " << metrics.healthStateChanges << std::endl;
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "health", results);
+    }
+
+    return 0;
+}
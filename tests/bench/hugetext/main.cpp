@@ -0,0 +1,126 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Huge pages benchmark: measures the cost of running code spread over many
+ * pages, with the plugin code on normal pages (hugetext_4k) and moved onto
+ * transparent huge pages by the manager (hugetext_2m, "hugePageText": true).
+ *
+ * Each request calls JP_BENCH_HUGETEXT_PAGES functions, each one on its own 4 kB page.
+ * Reports us/request and iTLB misses/request (if hardware counters are available).
+ *
+ * Usage: justplug-bench-hugetext [-n requests] [-r repetitions] [-o results.json]
+ */
+
+#include <cstdlib> // for std::atoi
+#include <cstring> // for strcmp
+#include <fstream> // for std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+int main(int argc, char** argv)
+{
+    long requests = 100;
+    int repetitions = 10;
+    std::string jsonPath;
+
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            requests = std::atol(argv[++i]);
+        else if(strcmp(argv[i], "-r") == 0 && i+1 < argc)
+            repetitions = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+    }
+    if(requests < 1)
+        requests = 1;
+    if(repetitions < 1)
+        repetitions = 1;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+    if(!mgr.searchForPlugins(mgr.appDirectory() + "/hugetext") || !mgr.loadPlugins())
+    {
+        std::cerr << "Cannot load the hugetext plugins" << std::endl;
+        return 1;
+    }
+
+    const ManagerMetrics metrics = mgr.metrics();
+    std::cout << "Huge pages benchmark (" << repetitions << " x " << requests << " requests, medians)" << std::endl;
+    std::cout << "Code on huge pages: " << metrics.hugePageTextBytes / 1024 << " kB"
+              << (metrics.hugePageTextFallbacks > 0 ? " (fallback: THP not available)" : "") << std::endl;
+    std::cout << std::left << std::setw(16) << "plugin"
+              << std::setw(16) << "us/request"
+              << "iTLB misses/request" << std::endl;
+
+    std::vector<Series> results;
+    for(const char* name : {"hugetext_4k", "hugetext_2m"})
+    {
+        std::shared_ptr<IPlugin> plugin = mgr.pluginObject(name);
+        Series time{std::string("hugetext/") + name + "/time", "us/request", {}};
+        Series misses{std::string("hugetext/") + name + "/itlb_misses", "misses/request", {}};
+
+        // Fault in all pages before measuring
+        plugin->handleRequest("bench", 0, nullptr, nullptr);
+
+        ITlbMissCounter counter;
+        for(int rep=0; rep < repetitions; ++rep)
+        {
+            counter.start();
+            const Clock::time_point start = Clock::now();
+            for(long i=0; i < requests; ++i)
+                plugin->handleRequest("bench", 0, nullptr, nullptr);
+            const Clock::time_point end = Clock::now();
+            const uint64_t count = counter.stop();
+
+            time.samples.push_back(elapsedMs(start, end) * 1000.0 / requests);
+            misses.samples.push_back(static_cast<double>(count) / requests);
+        }
+
+        std::cout << std::left << std::setw(16) << name
+                  << std::setw(16) << computeStats(time.samples).median
+                  << (counter.isValid() ? std::to_string(computeStats(misses.samples).median) : "n/a") << std::endl;
+
+        results.push_back(time);
+        if(counter.isValid())
+            results.push_back(misses);
+    }
+    mgr.unloadPlugins();
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "hugetext", results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Integrity check benchmark: times searchForPlugins() on a fleet of plugins
+ * without integrity check, with the fast hash only (the hashes are computed on
+ * each iteration, or reused from the cache), and with a SHA-256 hash set with
+ * PluginManager::setCryptoHashFunction() (minimal implementation below).
+ *
+ * The manifest is written by PluginManager::createIntegrityManifest() before each mode.
+ *
+ * Usage: justplug-bench-integrity [-n iterations] [-o results.json] [shape]
+ */
+
+#include <cstdio> // for std::remove
+#include <cstdlib> // for std::atoi
+#include <cstring> // for strcmp
+#include <fstream> // for std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+namespace
+{
+
+// Minimal SHA-256 (FIPS 180-4), used as the cryptographic hash of the benchmark
+class Sha256
+{
+public:
+    static std::string digest(const unsigned char* data, size_t size)
+    {
+        uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        size_t offset = 0;
+        for(; offset + 64 <= size; offset += 64)
+            block(state, data + offset);
+
+        // Padding: 0x80, zeros and the size in bits (big endian)
+        unsigned char last[128] = {0};
+        const size_t rest = size - offset;
+        memcpy(last, data + offset, rest);
+        last[rest] = 0x80;
+        const size_t lastSize = rest < 56 ? 64 : 128;
+        const uint64_t bits = static_cast<uint64_t>(size) * 8;
+        for(int i=0; i < 8; ++i)
+            last[lastSize - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+        block(state, last);
+        if(lastSize == 128)
+            block(state, last + 64);
+
+        char hex[65];
+        for(int i=0; i < 8; ++i)
+            snprintf(hex + 8 * i, 9, "%08x", state[i]);
+        return std::string(hex, 64);
+    }
+
+private:
+    static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    static void block(uint32_t* state, const unsigned char* data)
+    {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+        uint32_t w[64];
+        for(int i=0; i < 16; ++i)
+            w[i] = (uint32_t(data[4*i]) << 24) | (uint32_t(data[4*i+1]) << 16) | (uint32_t(data[4*i+2]) << 8) | data[4*i+3];
+        for(int i=16; i < 64; ++i)
+        {
+            const uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+            const uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+            w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+
+        uint32_t v[8];
+        memcpy(v, state, sizeof(v));
+        for(int i=0; i < 64; ++i)
+        {
+            const uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+            const uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+            const uint32_t t1 = v[7] + s1 + ch + k[i] + w[i];
+            const uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+            const uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+            const uint32_t t2 = s0 + maj;
+            memmove(v + 1, v, 7 * sizeof(uint32_t));
+            v[4] += t1;
+            v[0] = t1 + t2;
+        }
+        for(int i=0; i < 8; ++i)
+            state[i] += v[i];
+    }
+};
+
+enum Mode
+{
+    MODE_OFF = 0,
+    MODE_FAST,
+    MODE_FAST_CACHED,
+    MODE_CRYPTO
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int iterations = 20;
+    std::string jsonPath;
+    std::string shape = "random";
+
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            iterations = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+        else
+            shape = argv[i];
+    }
+    if(iterations < 1)
+        iterations = 1;
+
+    // Check the implementation with the FIPS 180-4 example
+    const std::string abc = Sha256::digest(reinterpret_cast<const unsigned char*>("abc"), 3);
+    if(abc != "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad")
+    {
+        std::cerr << "Invalid SHA-256 implementation" << std::endl;
+        return 1;
+    }
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+    const std::string dir = mgr.appDirectory() + "/fleet/" + shape;
+    const std::string manifest = mgr.appDirectory() + "/integrity-" + shape + ".manifest";
+
+    std::cout << "Integrity check benchmark (" << shape << " fleet, " << iterations << " iterations, medians)" << std::endl;
+    std::cout << std::left << std::setw(14) << "mode"
+              << std::setw(14) << "search (ms)"
+              << std::setw(14) << "hashed files"
+              << std::setw(14) << "cache hits"
+              << "failures" << std::endl;
+
+    const char* names[] = {"off", "fast", "fast-cached", "sha256"};
+    std::vector<Series> results;
+    for(int mode = MODE_OFF; mode <= MODE_CRYPTO; ++mode)
+    {
+        mgr.disableIntegrityCheck();
+        mgr.setCryptoHashFunction(mode == MODE_CRYPTO ? PluginManager::hashFunction(Sha256::digest) : PluginManager::hashFunction());
+        if(mode != MODE_OFF
+           && (!mgr.createIntegrityManifest(dir, manifest) || !mgr.enableIntegrityCheck(manifest)))
+        {
+            std::cerr << "Cannot create the manifest of " << dir << std::endl;
+            return 1;
+        }
+
+        Series search{std::string("integrity/") + names[mode] + "/search", "ms", {}};
+        const ManagerMetrics before = mgr.metrics();
+        for(int it=0; it < iterations; ++it)
+        {
+            // Setting the hash function clears the cache
+            if(mode == MODE_FAST || mode == MODE_CRYPTO)
+                mgr.setCryptoHashFunction(mode == MODE_CRYPTO ? PluginManager::hashFunction(Sha256::digest) : PluginManager::hashFunction());
+
+            const Clock::time_point start = Clock::now();
+            if(!mgr.searchForPlugins(dir))
+            {
+                std::cerr << "Cannot find the plugins of " << dir << std::endl;
+                return 1;
+            }
+            search.samples.push_back(elapsedMs(start, Clock::now()));
+            mgr.unloadPlugins();
+        }
+        const ManagerMetrics after = mgr.metrics();
+
+        std::cout << std::left << std::fixed << std::setprecision(3)
+                  << std::setw(14) << names[mode]
+                  << std::setw(14) << computeStats(search.samples).median
+                  << std::setw(14) << (after.integrityHashedFiles - before.integrityHashedFiles) / iterations
+                  << std::setw(14) << (after.integrityCacheHits - before.integrityCacheHits) / iterations
+                  << after.integrityFailures - before.integrityFailures << std::endl;
+        results.push_back(search);
+    }
+    mgr.disableIntegrityCheck();
+    std::remove(manifest.c_str());
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "integrity", results);
+    }
+
+    return 0;
+}
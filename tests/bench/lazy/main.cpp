@@ -0,0 +1,151 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Lazy dependencies benchmark: a hub depends on 16 plugins which take 10 ms in loaded().
+ * With eager dependencies (default), they are all loaded before the hub. With lazy ones,
+ * loadPlugins() only loads the hub, and each dependency is loaded by its first request.
+ *
+ * Reports the loadPlugins() time, the time of the first request to a dependency, and the
+ * time of the next requests.
+ *
+ * Usage: justplug-bench-lazy [-n iterations] [-o results.json]
+ */
+
+#include <cstdlib> // for std::atoi
+#include <cstring> // for strcmp
+#include <fstream> // for std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+namespace
+{
+
+const int DEPENDENCIES = 16;
+const int REQUESTS = 100000;
+
+uint16_t sendRequest(IPlugin* sender, const std::string& receiver)
+{
+    void* data = nullptr;
+    uint32_t dataSize = 0;
+    return sender->sendRequest(receiver.c_str(), 0, &data, &dataSize);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int iterations = 10;
+    std::string jsonPath;
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            iterations = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+    }
+    if(iterations < 1)
+        iterations = 1;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+
+    std::cout << "Lazy dependencies benchmark (" << DEPENDENCIES << " dependencies, "
+              << iterations << " iterations, medians)" << std::endl;
+    std::cout << std::left << std::setw(10) << "mode"
+              << std::setw(14) << "load (ms)"
+              << std::setw(20) << "first request (ms)"
+              << "request (ns/op)" << std::endl;
+
+    std::vector<Series> results;
+    for(const std::string mode : {"eager", "lazy"})
+    {
+        const std::string hubName = mode + "_" + std::to_string(DEPENDENCIES);
+        const std::string depName = mode + "_0";
+        Series load{"lazy/" + mode + "/load", "ms", {}};
+        Series firstRequest{"lazy/" + mode + "/first_request", "ms", {}};
+        Series request{"lazy/" + mode + "/request", "ns/op", {}};
+
+        for(int it=0; it < iterations; ++it)
+        {
+            if(!mgr.searchForPlugins(mgr.appDirectory() + "/fleet/" + mode))
+            {
+                std::cerr << "Cannot find the " << mode << " plugins" << std::endl;
+                return 1;
+            }
+            Clock::time_point start = Clock::now();
+            ReturnCode loaded = mgr.loadPlugins();
+            load.samples.push_back(elapsedMs(start, Clock::now()));
+
+            std::shared_ptr<IPlugin> hub = mgr.pluginObject(hubName);
+            if(!loaded || !hub)
+            {
+                std::cerr << "Cannot load the " << mode << " plugins" << std::endl;
+                return 1;
+            }
+
+            start = Clock::now();
+            uint16_t ret = sendRequest(hub.get(), depName);
+            firstRequest.samples.push_back(elapsedMs(start, Clock::now()));
+
+            start = Clock::now();
+            for(int i=0; i < REQUESTS; ++i)
+                ret |= sendRequest(hub.get(), depName);
+            request.samples.push_back(elapsedMs(start, Clock::now()) * 1e6 / REQUESTS);
+            if(ret != IPlugin::SUCCESS)
+            {
+                std::cerr << "Request to " << depName << " failed" << std::endl;
+                return 1;
+            }
+
+            hub.reset();
+            mgr.unloadPlugins();
+        }
+
+        std::cout << std::left << std::fixed << std::setprecision(3)
+                  << std::setw(10) << mode
+                  << std::setw(14) << computeStats(load.samples).median
+                  << std::setw(20) << computeStats(firstRequest.samples).median
+                  << computeStats(request.samples).median << std::endl;
+        results.push_back(load);
+        results.push_back(firstRequest);
+        results.push_back(request);
+    }
+    std::cout << "deferred plugins loaded: " << mgr.metrics().lazyLoads << std::endl;
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "lazy", results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Optional dependencies test (run by ctest): in compact mode, a plugin with an optional
+ * dependency is evicted with it, then reloaded. The dependency must still be bound to the
+ * plugin, after the reload and after a second loadPlugins().
+ *
+ * Uses the optional fleet (optional_1 depends on optional_0, optional and both evictable).
+ *
+ * Usage: justplug-test-optional
+ */
+
+#include <iostream>
+
+#include "pluginmanager.h"
+
+using namespace jp;
+
+namespace
+{
+
+int failures = 0;
+
+void check(bool condition, const char* what)
+{
+    std::cout << (condition ? "PASS: " : "FAIL: ") << what << std::endl;
+    if(!condition)
+        failures++;
+}
+
+// Request forwarded by optional_1 to its dependencies (NOT_A_DEPENDENCY if optional_0 is not bound)
+uint16_t forwardRequest(PluginManager& mgr)
+{
+    std::shared_ptr<IPlugin> plugin = mgr.pluginObject("optional_1");
+    if(!plugin)
+        return IPlugin::COMMON_ERROR;
+    void* data = nullptr;
+    uint32_t dataSize = 0;
+    return plugin->handleRequest("test", 5, &data, &dataSize);
+}
+
+} // namespace
+
+int main()
+{
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+    const std::string dir = mgr.appDirectory() + "/fleet/optional";
+    if(!mgr.searchForPlugins(dir) || !mgr.loadPlugins())
+    {
+        std::cerr << "Cannot load the plugins of " << dir << std::endl;
+        return 1;
+    }
+    mgr.setCompactMode(true);
+
+    check(mgr.isOptionalDependency("optional_1", "optional_0"), "optional_0 is an optional dependency of optional_1");
+    check(forwardRequest(mgr) == IPlugin::SUCCESS, "optional_0 is bound after loading");
+
+    check(mgr.evictIdlePlugins() == 2, "both plugins are evicted");
+    check(forwardRequest(mgr) == IPlugin::SUCCESS, "optional_0 is bound after reloading optional_1");
+    check(mgr.isPluginLoaded("optional_0"), "optional_0 is reloaded with optional_1");
+
+    check(bool(mgr.loadPlugins()), "second loadPlugins()");
+    check(forwardRequest(mgr) == IPlugin::SUCCESS, "optional_0 is bound after the second loadPlugins()");
+
+    mgr.unloadPlugins();
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,201 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Rate limits benchmark: measures the cost of a dependency request without limit, through
+ * a limit that is never reached (single thread and contended), and the accuracy of the
+ * limit when a sender floods its dependency.
+ *
+ * Uses the dispatch fleet (dispatch_65 depends on dispatch_0 ... dispatch_64).
+ *
+ * Usage: justplug-bench-ratelimit [-n operations] [-r repetitions] [-t threads] [-l rate] [-o results.json]
+ */
+
+#include <atomic> // for std::atomic
+#include <cstdlib> // for std::atoi, std::atof
+#include <cstring> // for strcmp
+#include <fstream> // for std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+#include <thread> // for std::thread
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+namespace
+{
+
+const char* const HUB_PLUGIN = "dispatch_65";
+const char* const TARGET_PLUGIN = "dispatch_1";
+
+uint16_t sendRequest(IPlugin* sender)
+{
+    void* data = nullptr;
+    uint32_t dataSize = 0;
+    return sender->sendRequest(TARGET_PLUGIN, 0, &data, &dataSize);
+}
+
+// Time per request (ns) of threads sending operations requests each, the mean of the threads is appended to series
+void runRequests(IPlugin* hub, long operations, int threads, Series* series)
+{
+    std::vector<double> threadTimes(threads, 0.0);
+    std::vector<std::thread> threadList;
+    std::atomic<int> ready(0);
+    for(int t=0; t < threads; ++t)
+    {
+        threadList.emplace_back([&, t]() {
+            ready++;
+            while(ready.load() < threads) {}
+            const Clock::time_point start = Clock::now();
+            for(long i=0; i < operations; ++i)
+                sendRequest(hub);
+            threadTimes[t] = elapsedMs(start, Clock::now()) * 1e6 / operations;
+        });
+    }
+    for(std::thread& thread : threadList)
+        thread.join();
+    series->samples.push_back(computeStats(threadTimes).mean);
+}
+
+bool loadFleet(PluginManager& mgr)
+{
+    return mgr.searchForPlugins(mgr.appDirectory() + "/fleet/dispatch") && mgr.loadPlugins();
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    long operations = 1000000;
+    int repetitions = 10;
+    int threads = 4;
+    double rate = 100000.0;
+    std::string jsonPath;
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            operations = std::atol(argv[++i]);
+        else if(strcmp(argv[i], "-r") == 0 && i+1 < argc)
+            repetitions = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-t") == 0 && i+1 < argc)
+            threads = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-l") == 0 && i+1 < argc)
+            rate = std::atof(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+    }
+    if(operations < 1)
+        operations = 1;
+    if(repetitions < 1)
+        repetitions = 1;
+    if(threads < 1)
+        threads = 1;
+    if(rate <= 0.0)
+        rate = 100000.0;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+    std::vector<Series> results;
+
+    std::cout << "Rate limits benchmark (" << repetitions << " x " << operations << " requests, medians)" << std::endl;
+    std::cout << std::left << std::setw(24) << "case" << "ns/op" << std::endl;
+
+    // The limit is bound when the sender is loaded
+    for(const std::string mode : {"unlimited", "limited"})
+    {
+        if(mode == "limited")
+            mgr.setRateLimit(HUB_PLUGIN, TARGET_PLUGIN, 1e15, 1e6);
+        if(!loadFleet(mgr))
+        {
+            std::cerr << "Cannot load the dispatch plugins" << std::endl;
+            return 1;
+        }
+        std::shared_ptr<IPlugin> hub = mgr.pluginObject(HUB_PLUGIN);
+
+        Series single{"ratelimit/" + mode + "/time", "ns/op", {}};
+        Series contended{"ratelimit/" + mode + "_" + std::to_string(threads) + "threads/time", "ns/op", {}};
+        runRequests(hub.get(), operations, 1, &single); // Warm-up
+        single.samples.clear();
+        for(int rep=0; rep < repetitions; ++rep)
+        {
+            runRequests(hub.get(), operations, 1, &single);
+            runRequests(hub.get(), operations / threads, threads, &contended);
+        }
+        std::cout << std::left << std::fixed << std::setprecision(2)
+                  << std::setw(24) << mode << computeStats(single.samples).median << std::endl
+                  << std::setw(24) << mode + "_" + std::to_string(threads) + "threads"
+                  << computeStats(contended.samples).median << std::endl;
+        results.push_back(single);
+        results.push_back(contended);
+
+        if(mode == "limited")
+        {
+            // The limit of the bound pair is updated, the hub floods its dependency for 1 s
+            mgr.setRateLimit(HUB_PLUGIN, TARGET_PLUGIN, rate);
+            Series accepted{"ratelimit/flood/accepted_rate", "requests/s", {}};
+            Series throttledTime{"ratelimit/flood/time", "ns/op", {}};
+            for(int rep=0; rep < repetitions && rep < 3; ++rep)
+            {
+                long sent = 0, passed = 0;
+                const Clock::time_point start = Clock::now();
+                double elapsed = 0.0;
+                while(elapsed < 1000.0)
+                {
+                    for(int i=0; i < 1000; ++i)
+                        passed += sendRequest(hub.get()) == IPlugin::SUCCESS ? 1 : 0;
+                    sent += 1000;
+                    elapsed = elapsedMs(start, Clock::now());
+                }
+                accepted.samples.push_back(passed * 1000.0 / elapsed);
+                throttledTime.samples.push_back(elapsed * 1e6 / sent);
+            }
+            std::cout << std::setw(24) << "flood" << computeStats(throttledTime.samples).median << std::endl;
+            std::cout << "flood: " << computeStats(accepted.samples).median << " requests/s accepted (limit "
+                      << rate << "), " << mgr.metrics().throttledRequests << " throttled" << std::endl;
+            results.push_back(throttledTime);
+            results.push_back(accepted);
+        }
+
+        hub.reset();
+        mgr.unloadPlugins();
+    }
+
+    for(const RateLimitStats& stats : mgr.rateLimitStats())
+    {
+        std::cout << stats.sender << " -> " << stats.receiver << ": " << stats.requests << " requests, "
+                  << stats.throttled << " throttled" << std::endl;
+    }
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "ratelimit", results);
+    }
+
+    return 0;
+}
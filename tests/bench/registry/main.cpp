@@ -0,0 +1,200 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Shared registry benchmark: starts several processes at the same time which all
+ * search and load the same fleet, without the shared registry (each process loads
+ * every library to read its metadata) and with it (the registry is filled by a
+ * first process, the others read the search results from the shared memory).
+ *
+ * The search and total (search + load) times of every process are reported.
+ *
+ * Usage: justplug-bench-registry [-n iterations] [-p processes] [-o results.json] [shape]
+ */
+
+#include <cstdlib> // for std::atoi
+#include <cstring> // for strcmp
+#include <fstream> // for std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h> // for shm_unlink
+#include <sys/wait.h> // for waitpid
+#include <unistd.h> // for fork
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+namespace
+{
+
+struct ProcessTimes
+{
+    double search;
+    double total;
+};
+
+// Search and load the plugins of dir in a new process, the times are written to fd
+pid_t startProcess(const std::string& dir, const std::string& registry, int fd)
+{
+    const pid_t pid = fork();
+    if(pid != 0)
+        return pid;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+    if(!registry.empty() && !mgr.enableSharedRegistry(registry))
+        _exit(1);
+
+    ProcessTimes times;
+    const Clock::time_point start = Clock::now();
+    ReturnCode found = mgr.searchForPlugins(dir);
+    const Clock::time_point searched = Clock::now();
+    ReturnCode loaded = mgr.loadPlugins();
+    times.search = elapsedMs(start, searched);
+    times.total = elapsedMs(start, Clock::now());
+    mgr.unloadPlugins();
+
+    if(!found || !loaded || write(fd, &times, sizeof(times)) != sizeof(times))
+        _exit(1);
+    _exit(0);
+}
+
+// Run processes at the same time. Returns false if one of them failed.
+bool runProcesses(int processes, const std::string& dir, const std::string& registry,
+                  Series* search, Series* total)
+{
+    int fds[2];
+    if(pipe(fds) != 0)
+        return false;
+
+    std::vector<pid_t> pids;
+    for(int i=0; i < processes; ++i)
+        pids.push_back(startProcess(dir, registry, fds[1]));
+    close(fds[1]);
+
+    bool success = true;
+    for(pid_t pid : pids)
+    {
+        int status = 0;
+        if(pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            success = false;
+    }
+
+    ProcessTimes times;
+    while(read(fds[0], &times, sizeof(times)) == sizeof(times))
+    {
+        if(search)
+            search->samples.push_back(times.search);
+        if(total)
+            total->samples.push_back(times.total);
+    }
+    close(fds[0]);
+    return success;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int iterations = 10;
+    int processes = 32;
+    std::string jsonPath;
+    std::string shape = "random";
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            iterations = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-p") == 0 && i+1 < argc)
+            processes = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+        else
+            shape = argv[i];
+    }
+    if(iterations < 1)
+        iterations = 1;
+    if(processes < 1)
+        processes = 1;
+
+    // The manager of this process never loads plugins (they are loaded by the forked processes)
+    const std::string dir = PluginManager::instance().appDirectory() + "/fleet/" + shape;
+    const std::string registry = "/justplug-bench-" + std::to_string(getpid());
+
+    std::cout << "Shared registry benchmark (" << shape << " fleet, " << processes << " processes, "
+              << iterations << " iterations, medians)" << std::endl;
+    std::cout << std::left << std::setw(12) << "mode"
+              << std::setw(14) << "search (ms)"
+              << std::setw(14) << "total (ms)"
+              << "max total (ms)" << std::endl;
+
+    std::vector<Series> results;
+    for(const std::string mode : {"scan", "registry"})
+    {
+        const bool useRegistry = mode == "registry";
+        // The first process fills the registry
+        if(useRegistry && !runProcesses(1, dir, registry, nullptr, nullptr))
+        {
+            std::cerr << "Cannot use the shared registry" << std::endl;
+            shm_unlink(registry.c_str());
+            return 1;
+        }
+
+        Series search{"registry/" + mode + "/search", "ms", {}};
+        Series total{"registry/" + mode + "/total", "ms", {}};
+        for(int it=0; it < iterations; ++it)
+        {
+            if(!runProcesses(processes, dir, useRegistry ? registry : std::string(), &search, &total))
+            {
+                std::cerr << "Cannot load the plugins of " << dir << std::endl;
+                shm_unlink(registry.c_str());
+                return 1;
+            }
+        }
+
+        const Stats totalStats = computeStats(total.samples);
+        std::cout << std::left << std::fixed << std::setprecision(3)
+                  << std::setw(12) << mode
+                  << std::setw(14) << computeStats(search.samples).median
+                  << std::setw(14) << totalStats.median
+                  << totalStats.max << std::endl;
+        results.push_back(search);
+        results.push_back(total);
+    }
+    shm_unlink(registry.c_str());
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "registry", results);
+    }
+
+    return 0;
+}
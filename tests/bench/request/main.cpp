@@ -0,0 +1,282 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Request dispatch microbenchmark: measures the cost of IPlugin::sendRequest()
+ * for each routing path (manager, dependencies, self and non-dependency requests),
+ * and under multi-threaded contention.
+ *
+ * The dispatch fleet is a fanout graph: dispatch_65 depends on dispatch_0 ... dispatch_64,
+ * and dispatch_0 is registered as the main plugin.
+ *
+ * Reports ns/op, instructions/op (if hardware counters are available) and
+ * allocations/op (operator new calls).
+ *
+ * Usage: justplug-bench-request [-n operations] [-r repetitions] [-t threads] [-o results.json]
+ */
+
+#include <atomic> // for std::atomic
+#include <cstdlib> // for std::atoi and std::malloc
+#include <cstring> // for strcmp
+#include <fstream> // for std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+#include <new> // for std::bad_alloc
+#include <thread> // for std::thread
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+/*****************************************************************************/
+/***** Allocations counter ***************************************************/
+/*****************************************************************************/
+
+// The global operator new is replaced for the whole process (including the
+// JustPlug library and the plugins).
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#  pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+// Allocations are counted per thread, so that the threads creation is not counted.
+static thread_local uint64_t allocationsCount = 0;
+
+void* operator new(std::size_t size)
+{
+    allocationsCount++;
+    if(void* ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+/*****************************************************************************/
+/***** Benchmark *************************************************************/
+/*****************************************************************************/
+
+namespace
+{
+
+const char* const HUB_PLUGIN = "dispatch_65";
+const char* const MAIN_PLUGIN = "dispatch_0";
+
+// Avoid the compiler to optimize out the requests
+std::atomic<uint32_t> sink(0);
+
+struct Options
+{
+    long operations = 1000000;
+    int repetitions = 10;
+    int threads = 4;
+};
+
+// Run op() options.operations times, repetitions times, and append the results to seriesList
+template<typename Op>
+void runCase(const std::string& name, const Options& options, Op op, std::vector<Series>* seriesList)
+{
+    Series time{"request/" + name + "/time", "ns/op", {}};
+    Series instructions{"request/" + name + "/instructions", "instructions/op", {}};
+    Series allocations{"request/" + name + "/allocations", "allocations/op", {}};
+
+    InstructionCounter counter;
+    for(int rep=0; rep < options.repetitions; ++rep)
+    {
+        uint32_t result = 0;
+        const uint64_t allocStart = allocationsCount;
+        counter.start();
+        const Clock::time_point start = Clock::now();
+        for(long i=0; i < options.operations; ++i)
+            result += op();
+        const Clock::time_point end = Clock::now();
+        const uint64_t instr = counter.stop();
+        const uint64_t allocs = allocationsCount - allocStart;
+        sink += result;
+
+        time.samples.push_back(elapsedMs(start, end) * 1e6 / options.operations);
+        instructions.samples.push_back(static_cast<double>(instr) / options.operations);
+        allocations.samples.push_back(static_cast<double>(allocs) / options.operations);
+    }
+
+    const Stats timeStats = computeStats(time.samples);
+    std::cout << std::left << std::setw(24) << name
+              << std::setw(14) << timeStats.median
+              << std::setw(18) << (counter.isValid() ? std::to_string(computeStats(instructions.samples).median) : "n/a")
+              << computeStats(allocations.samples).median << std::endl;
+
+    seriesList->push_back(time);
+    if(counter.isValid())
+        seriesList->push_back(instructions);
+    seriesList->push_back(allocations);
+}
+
+// Same as runCase(), but op() is called concurrently by options.threads threads.
+// The time per operation is the mean of the time per operation of each thread.
+template<typename Op>
+void runContendedCase(const std::string& name, const Options& options, Op op, std::vector<Series>* seriesList)
+{
+    Series time{"request/" + name + "/time", "ns/op", {}};
+    Series allocations{"request/" + name + "/allocations", "allocations/op", {}};
+
+    for(int rep=0; rep < options.repetitions; ++rep)
+    {
+        std::vector<double> threadTimes(options.threads, 0.0);
+        std::atomic<uint64_t> allocs(0);
+        std::vector<std::thread> threads;
+        std::atomic<int> ready(0);
+
+        for(int t=0; t < options.threads; ++t)
+        {
+            threads.emplace_back([&, t]() {
+                // Start all threads at the same time
+                ready++;
+                while(ready.load() < options.threads) {}
+
+                uint32_t result = 0;
+                const uint64_t allocStart = allocationsCount;
+                const Clock::time_point start = Clock::now();
+                for(long i=0; i < options.operations; ++i)
+                    result += op();
+                threadTimes[t] = elapsedMs(start, Clock::now()) * 1e6 / options.operations;
+                allocs += allocationsCount - allocStart;
+                sink += result;
+            });
+        }
+        for(std::thread& thread : threads)
+            thread.join();
+
+        time.samples.push_back(computeStats(threadTimes).mean);
+        allocations.samples.push_back(static_cast<double>(allocs) / (options.operations * options.threads));
+    }
+
+    std::cout << std::left << std::setw(24) << name
+              << std::setw(14) << computeStats(time.samples).median
+              << std::setw(18) << "n/a"
+              << computeStats(allocations.samples).median << std::endl;
+
+    seriesList->push_back(time);
+    seriesList->push_back(allocations);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    std::string jsonPath;
+
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            options.operations = std::atol(argv[++i]);
+        else if(strcmp(argv[i], "-r") == 0 && i+1 < argc)
+            options.repetitions = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-t") == 0 && i+1 < argc)
+            options.threads = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+    }
+    if(options.operations < 1)
+        options.operations = 1;
+    if(options.repetitions < 1)
+        options.repetitions = 1;
+    if(options.threads < 1)
+        options.threads = 1;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+    if(!mgr.searchForPlugins(mgr.appDirectory() + "/fleet/dispatch")
+       || !mgr.registerMainPlugin(MAIN_PLUGIN)
+       || !mgr.loadPlugins())
+    {
+        std::cerr << "Cannot load the dispatch plugins" << std::endl;
+        return 1;
+    }
+
+    std::shared_ptr<IPlugin> hub = mgr.pluginObject(HUB_PLUGIN);
+    std::shared_ptr<IPlugin> main = mgr.pluginObject(MAIN_PLUGIN);
+
+    auto request = [](IPlugin* sender, const char* receiver, uint16_t code, const char* arg) -> uint32_t {
+        void* data = (void*)arg;
+        uint32_t dataSize = 0;
+        return sender->sendRequest(receiver, code, &data, &dataSize);
+    };
+
+    std::cout << "Request dispatch benchmark (" << options.repetitions << " x " << options.operations << " requests, medians)" << std::endl;
+    std::cout << std::left << std::setw(24) << "case"
+              << std::setw(14) << "ns/op"
+              << std::setw(18) << "instructions/op"
+              << "allocations/op" << std::endl;
+
+    std::vector<Series> results;
+    runCase("manager", options, [&]() {
+        return request(hub.get(), nullptr, IPlugin::CHECK_PLUGIN, MAIN_PLUGIN);
+    }, &results);
+    runCase("dependency_1", options, [&]() {
+        return request(hub.get(), "dispatch_0", 0, nullptr);
+    }, &results);
+    runCase("dependency_64", options, [&]() {
+        return request(hub.get(), "dispatch_63", 0, nullptr);
+    }, &results);
+    runCase("self", options, [&]() {
+        return request(hub.get(), HUB_PLUGIN, 0, nullptr);
+    }, &results);
+    runCase("non_dependency", options, [&]() {
+        return request(main.get(), "dispatch_1", 0, nullptr);
+    }, &results);
+
+    const std::string threadsSuffix = "_" + std::to_string(options.threads) + "threads";
+    runContendedCase("manager" + threadsSuffix, options, [&]() {
+        return request(hub.get(), nullptr, IPlugin::CHECK_PLUGIN, MAIN_PLUGIN);
+    }, &results);
+    runContendedCase("dependency_64" + threadsSuffix, options, [&]() {
+        return request(hub.get(), "dispatch_63", 0, nullptr);
+    }, &results);
+    runContendedCase("non_dependency" + threadsSuffix, options, [&]() {
+        return request(main.get(), "dispatch_1", 0, nullptr);
+    }, &results);
+
+    hub.reset();
+    main.reset();
+    mgr.unloadPlugins();
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "request", results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Resources benchmark: compression ratio and access throughput of the embedded
+ * resources (resources.h). json.hpp is embedded twice in the benchmark: as is and
+ * compressed. Other files can be given on the command line, they are compressed in
+ * memory with the same codec (lzcodec.h).
+ *
+ * For each resource, reports the compression ratio, the compression throughput (files
+ * given on the command line only), the streaming throughput (ResourceReader) and the
+ * throughput of random 4 kB reads through a cold and a warm ResourceCache.
+ * The decompressed content is checked against the original data.
+ *
+ * Usage: justplug-bench-resources [-r repetitions] [-o results.json] [file ...]
+ */
+
+#include <cstdlib> // for std::atoi
+#include <cstring> // for strcmp, memcmp
+#include <fstream> // for std::ifstream, std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+#include <iterator> // for std::istreambuf_iterator
+
+#include "resources.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+namespace
+{
+
+const size_t READ_SIZE = 4096;
+const size_t RANDOM_READS = 4096;
+
+struct Input
+{
+    std::string name;
+    std::vector<unsigned char> original;
+    // Views on the original (raw) and compressed data
+    ResourceView raw;
+    ResourceView compressed;
+    // Files given on the command line: the views point to original and packed
+    bool inMemory = false;
+    std::vector<unsigned char> packed;
+    Series compression;
+};
+
+double throughput(size_t bytes, const Clock::time_point& from, const Clock::time_point& to)
+{
+    return bytes / (1024.0 * 1024.0) / (elapsedMs(from, to) / 1000.0);
+}
+
+// Reads the whole resource, returns false if the content differs from the original
+bool streamResource(const ResourceView& view, const std::vector<unsigned char>& original, Series* series)
+{
+    ResourceReader reader(view);
+    std::vector<unsigned char> content(reader.size());
+    std::vector<unsigned char> buffer(64 * 1024);
+
+    const Clock::time_point start = Clock::now();
+    size_t pos = 0;
+    size_t read;
+    while((read = reader.read(buffer.data(), buffer.size())) > 0)
+    {
+        memcpy(content.data() + pos, buffer.data(), read);
+        pos += read;
+    }
+    series->samples.push_back(throughput(pos, start, Clock::now()));
+
+    return content == original;
+}
+
+// Random reads of READ_SIZE bytes (same offsets for each run).
+// The throughput is not recorded if series is null (warm-up).
+void randomReads(const ResourceView& view, size_t size, ResourceCache* cache, Series* series)
+{
+    std::vector<unsigned char> buffer(READ_SIZE);
+    uint32_t random = 12345;
+    size_t total = 0;
+
+    const Clock::time_point start = Clock::now();
+    for(size_t i=0; i < RANDOM_READS; ++i)
+    {
+        random = random * 1664525u + 1013904223u;
+        const size_t offset = size > READ_SIZE ? random % (size - READ_SIZE) : 0;
+        total += cache->read(view, offset, buffer.data(), buffer.size());
+    }
+    if(series)
+        series->samples.push_back(throughput(total, start, Clock::now()));
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int repetitions = 10;
+    std::string jsonPath;
+    std::vector<std::string> files;
+
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-r") == 0 && i+1 < argc)
+            repetitions = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+        else
+            files.push_back(argv[i]);
+    }
+    if(repetitions < 1)
+        repetitions = 1;
+
+    std::vector<Input> inputs;
+
+    // Embedded resources (see CMakeLists.txt)
+    {
+        Input input;
+        input.name = "json.hpp";
+        input.raw = findResource("resources/json.hpp");
+        input.compressed = findResource("resources/json.hpp.lz");
+        if(!input.raw.isValid() || !input.compressed.isValid())
+        {
+            std::cerr << "The embedded resources are missing" << std::endl;
+            return 1;
+        }
+        input.original.assign(input.raw.data, input.raw.data + input.raw.size);
+        inputs.push_back(input);
+    }
+
+    for(const std::string& path : files)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if(!file)
+        {
+            std::cerr << "Cannot read " << path << std::endl;
+            return 1;
+        }
+
+        Input input;
+        input.name = path.substr(path.find_last_of('/') + 1);
+        input.original.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        input.compression = Series{input.name + "/compression", "MB/s", {}};
+        for(int it=0; it < repetitions; ++it)
+        {
+            const Clock::time_point start = Clock::now();
+            input.packed = jp_private::lz::compressResource(input.original.data(), input.original.size());
+            input.compression.samples.push_back(throughput(input.original.size(), start, Clock::now()));
+        }
+        input.inMemory = true;
+        inputs.push_back(input);
+    }
+
+    std::cout << "Resources benchmark (" << repetitions << " repetitions, medians in MB/s, "
+              << RANDOM_READS << " random reads of " << READ_SIZE << " bytes)" << std::endl;
+    std::cout << std::left << std::setw(24) << "resource"
+              << std::setw(6) << "mode"
+              << std::setw(12) << "size (kB)"
+              << std::setw(10) << "ratio"
+              << std::setw(14) << "compression"
+              << std::setw(12) << "stream"
+              << std::setw(14) << "random cold"
+              << std::setw(14) << "random warm" << std::endl;
+
+    std::vector<Series> results;
+    bool valid = true;
+    for(Input& input : inputs)
+    {
+        if(input.inMemory)
+        {
+            input.raw.name = input.name.c_str();
+            input.raw.data = input.original.data();
+            input.raw.size = input.original.size();
+            input.compressed.name = input.name.c_str();
+            input.compressed.data = input.packed.data();
+            input.compressed.size = input.packed.size();
+            input.compressed.compressed = true;
+        }
+
+        for(int mode=0; mode < 2; ++mode)
+        {
+            const ResourceView& view = mode == 0 ? input.raw : input.compressed;
+            const std::string prefix = input.name + (mode == 0 ? "/raw" : "/lz");
+            const double ratio = double(view.size) / input.original.size();
+
+            Series stream{prefix + "/stream", "MB/s", {}};
+            Series randomCold{prefix + "/random-cold", "MB/s", {}};
+            Series randomWarm{prefix + "/random-warm", "MB/s", {}};
+            for(int it=0; it < repetitions; ++it)
+            {
+                if(!streamResource(view, input.original, &stream))
+                    valid = false;
+
+                // A cache without capacity decompresses every chunk
+                ResourceCache coldCache(0);
+                randomReads(view, input.original.size(), &coldCache, &randomCold);
+
+                ResourceCache warmCache;
+                randomReads(view, input.original.size(), &warmCache, nullptr);
+                randomReads(view, input.original.size(), &warmCache, &randomWarm);
+            }
+
+            const bool hasCompression = mode == 1 && !input.compression.samples.empty();
+            std::cout << std::left << std::fixed << std::setprecision(1)
+                      << std::setw(24) << input.name
+                      << std::setw(6) << (mode == 0 ? "raw" : "lz")
+                      << std::setw(12) << view.size / 1024.0
+                      << std::setprecision(3) << std::setw(10) << ratio << std::setprecision(1)
+                      << std::setw(14) << (hasCompression ? std::to_string(int(computeStats(input.compression.samples).median)) : std::string("-"))
+                      << std::setw(12) << computeStats(stream.samples).median
+                      << std::setw(14) << computeStats(randomCold.samples).median
+                      << std::setw(14) << computeStats(randomWarm.samples).median << std::endl;
+
+            results.push_back(stream);
+            results.push_back(randomCold);
+            results.push_back(randomWarm);
+            if(mode == 1)
+                results.push_back(Series{prefix + "/ratio", "ratio", {ratio}});
+        }
+        if(!input.compression.samples.empty())
+            results.push_back(input.compression);
+    }
+
+    if(!valid)
+        std::cerr << "Error: the decompressed content differs from the original data" << std::endl;
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "resources", results);
+    }
+
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Resource sharing benchmark: loads the sharing fleet (every plugin embeds the same
+ * copy of json.hpp) with and without PluginManager::enableResourceSharing(), then
+ * reads every page of the resources of all plugins.
+ *
+ * Reports the load time, the memory shared by the manager (ManagerMetrics::sharedResourceBytes)
+ * and the growth of the proportional set size of the process (pages mapped by several
+ * plugins are only counted once in the PSS, unlike the RSS).
+ *
+ * Usage: justplug-bench-sharing [-r repetitions] [-o results.json]
+ */
+
+#include <cstdlib> // for std::atoi
+#include <cstring> // for strcmp
+#include <fstream> // for std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+int main(int argc, char** argv)
+{
+    int repetitions = 5;
+    std::string jsonPath;
+
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-r") == 0 && i+1 < argc)
+            repetitions = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+    }
+    if(repetitions < 1)
+        repetitions = 1;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+
+    std::cout << "Resource sharing benchmark (" << repetitions << " repetitions, medians)" << std::endl;
+    std::cout << std::left << std::setw(10) << "sharing"
+              << std::setw(12) << "plugins"
+              << std::setw(16) << "load (ms)"
+              << std::setw(16) << "shared (kB)"
+              << "PSS growth (kB)" << std::endl;
+
+    std::vector<Series> results;
+    for(int sharing=0; sharing < 2; ++sharing)
+    {
+        const std::string prefix = std::string("sharing/") + (sharing ? "on" : "off");
+        Series load{prefix + "/load", "ms", {}};
+        Series shared{prefix + "/shared", "kB", {}};
+        Series pss{prefix + "/pss", "kB", {}};
+        size_t pluginsCount = 0;
+
+        mgr.enableResourceSharing(sharing == 1);
+        for(int rep=0; rep < repetitions; ++rep)
+        {
+            const size_t pssBefore = proportionalSetSize();
+            const Clock::time_point start = Clock::now();
+            if(!mgr.searchForPlugins(mgr.appDirectory() + "/fleet/sharing") || !mgr.loadPlugins())
+            {
+                std::cerr << "Cannot load the sharing plugins" << std::endl;
+                return 1;
+            }
+            load.samples.push_back(elapsedMs(start, Clock::now()));
+            shared.samples.push_back(mgr.metrics().sharedResourceBytes / 1024.0);
+
+            // Read the resources of all plugins
+            pluginsCount = mgr.pluginsCount();
+            for(const std::string& name : mgr.pluginsList())
+            {
+                uint32_t sum = 0;
+                mgr.pluginObject(name)->handleRequest("bench", 1, nullptr, &sum);
+            }
+            pss.samples.push_back((double(proportionalSetSize()) - pssBefore) / 1024.0);
+
+            mgr.unloadPlugins();
+        }
+
+        std::cout << std::left << std::fixed << std::setprecision(1)
+                  << std::setw(10) << (sharing ? "on" : "off")
+                  << std::setw(12) << pluginsCount
+                  << std::setw(16) << computeStats(load.samples).median
+                  << std::setw(16) << computeStats(shared.samples).median
+                  << computeStats(pss.samples).median << std::endl;
+
+        results.push_back(load);
+        results.push_back(shared);
+        results.push_back(pss);
+    }
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "sharing", results);
+    }
+
+    return 0;
+}
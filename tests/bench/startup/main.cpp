@@ -0,0 +1,308 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Startup benchmark: times searchForPlugins(), the dependencies resolution,
+ * the loading and the unloading of each synthetic plugins fleet.
+ *
+ * With -c, each iteration is also run with a cold page cache: every plugin
+ * library and the fleet directory are evicted from the page cache before the
+ * iteration (cold and warm iterations are interleaved).
+ * The warm iterations are also run with the load order cache (mode "cache",
+ * see PluginManager::setLoadOrderCache()), which skips the dependencies resolution.
+ *
+ * The heap memory kept by the manager once a fleet is loaded is also measured,
+ * with and without the compact mode (glibc only).
+ *
+ * Usage: justplug-bench [-n iterations] [-c] [-o results.json] [shape ...]
+ */
+
+#include <cstdio> // for std::remove
+#include <cstdlib> // for std::atoi
+#include <cstring> // for strcmp
+#include <fstream> // for std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+#include <sstream> // for std::stringstream
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+#include "pagecache.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+namespace
+{
+
+size_t loadedCount = 0;
+Clock::time_point firstLoadedTime;
+
+std::vector<std::string> splitShapes(const std::string& list)
+{
+    std::vector<std::string> shapes;
+    std::stringstream stream(list);
+    std::string shape;
+    while(std::getline(stream, shape, ','))
+        shapes.push_back(shape);
+    return shapes;
+}
+
+void errorCallback(const ReturnCode& code, const char* data)
+{
+    std::cerr << "Error: " << code.message();
+    if(data)
+        std::cerr << " (" << data << ")";
+    std::cerr << std::endl;
+}
+
+std::string formatStats(const Series& series)
+{
+    const Stats stats = computeStats(series.samples);
+    std::stringstream str;
+    str << std::fixed << std::setprecision(2) << stats.median
+        << " [" << stats.min << "-" << stats.max << "]";
+    return str.str();
+}
+
+// Series of one shape in one mode (warm or cold)
+struct StartupSeries
+{
+    StartupSeries(const std::string& prefix)
+        : search{prefix + "/search", "ms", {}},
+          resolution{prefix + "/resolution", "ms", {}},
+          load{prefix + "/load", "ms", {}},
+          unload{prefix + "/unload", "ms", {}},
+          total{prefix + "/total", "ms", {}}
+    {}
+
+    Series search;
+    Series resolution;
+    Series load;
+    Series unload;
+    Series total;
+    size_t pluginsCount = 0;
+};
+
+void runIteration(PluginManager& mgr, const std::string& dir, StartupSeries* series)
+{
+    loadedCount = 0;
+
+    const Clock::time_point start = Clock::now();
+    mgr.searchForPlugins(dir, errorCallback);
+    const Clock::time_point searched = Clock::now();
+    series->pluginsCount = mgr.pluginsCount();
+    mgr.loadPlugins(errorCallback);
+    const Clock::time_point loaded = Clock::now();
+    mgr.unloadPlugins(errorCallback);
+    const Clock::time_point unloaded = Clock::now();
+
+    if(loadedCount != series->pluginsCount)
+        std::cerr << "Warning: only " << loadedCount << " of " << series->pluginsCount
+                  << " plugins were loaded from " << dir << std::endl;
+
+    // Without any loaded plugin, the whole step is the resolution
+    const Clock::time_point resolved = loadedCount > 0 ? firstLoadedTime : loaded;
+    series->search.samples.push_back(elapsedMs(start, searched));
+    series->resolution.samples.push_back(elapsedMs(searched, resolved));
+    series->load.samples.push_back(elapsedMs(resolved, loaded));
+    series->unload.samples.push_back(elapsedMs(loaded, unloaded));
+    series->total.samples.push_back(elapsedMs(start, unloaded));
+}
+
+void printSeries(const std::string& shape, const std::string& mode, const StartupSeries& series)
+{
+    std::cout << std::left << std::setw(10) << shape
+              << std::setw(6) << mode
+              << std::setw(10) << series.pluginsCount
+              << std::setw(24) << formatStats(series.search)
+              << std::setw(24) << formatStats(series.resolution)
+              << std::setw(24) << formatStats(series.load)
+              << std::setw(24) << formatStats(series.unload)
+              << std::setw(24) << formatStats(series.total) << std::endl;
+}
+
+void appendSeries(const StartupSeries& series, std::vector<Series>* results)
+{
+    results->push_back(series.search);
+    results->push_back(series.resolution);
+    results->push_back(series.load);
+    results->push_back(series.unload);
+    results->push_back(series.total);
+}
+
+// Returns the heap memory (in kB) kept by the manager after loading the plugins in dir
+double retainedHeap(PluginManager& mgr, const std::string& dir, bool compact)
+{
+    mgr.setCompactMode(compact);
+    const size_t before = heapInUse();
+    mgr.searchForPlugins(dir, errorCallback);
+    mgr.loadPlugins(errorCallback);
+    const size_t after = heapInUse();
+    mgr.unloadPlugins(errorCallback);
+    mgr.setCompactMode(false);
+
+    return after > before ? (after - before) / 1024.0 : 0.0;
+}
+
+} // namespace
+
+// Called by each synthetic plugin at the beginning of loaded()
+// The first call marks the end of the dependencies resolution.
+extern "C" JP_EXPORT_SYMBOL void jp_bench_pluginLoaded(const char*)
+{
+    if(loadedCount++ == 0)
+        firstLoadedTime = Clock::now();
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 10;
+    bool cold = false;
+    std::string jsonPath;
+    std::vector<std::string> shapes;
+
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            iterations = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-c") == 0)
+            cold = true;
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+        else
+            shapes.push_back(argv[i]);
+    }
+    if(shapes.empty())
+        shapes = splitShapes(JP_BENCH_FLEET_SHAPES);
+    if(iterations < 1)
+        iterations = 1;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+    const std::string fleetDir = mgr.appDirectory() + "/fleet/";
+
+    std::cout << "Startup benchmark (" << iterations << " iterations, median [min-max] in ms)" << std::endl;
+    std::cout << std::left << std::setw(10) << "shape"
+              << std::setw(6) << "mode"
+              << std::setw(10) << "plugins"
+              << std::setw(24) << "search"
+              << std::setw(24) << "resolution"
+              << std::setw(24) << "load"
+              << std::setw(24) << "unload"
+              << std::setw(24) << "total" << std::endl;
+
+    std::vector<Series> results;
+    std::vector<Series> memoryResults;
+    for(const std::string& shape : shapes)
+    {
+        const std::string dir = fleetDir + shape;
+        StartupSeries warmSeries(shape + "/warm");
+        StartupSeries coldSeries(shape + "/cold");
+        StartupSeries cacheSeries(shape + "/cache");
+        size_t residentPages = 0;
+        size_t totalPages = 0;
+
+        // Warm-up: make sure the warm iterations start with a hot cache
+        if(!cold)
+        {
+            StartupSeries warmUp(shape);
+            runIteration(mgr, dir, &warmUp);
+        }
+
+        for(int it=0; it < iterations; ++it)
+        {
+            if(cold)
+            {
+                const CacheState state = evictFromPageCache(dir);
+                residentPages += state.residentPages;
+                totalPages += state.pages;
+                runIteration(mgr, dir, &coldSeries);
+            }
+            runIteration(mgr, dir, &warmSeries);
+        }
+
+        // The first iteration writes the cache
+        const std::string cachePath = fleetDir + shape + ".loadorder";
+        mgr.setLoadOrderCache(cachePath);
+        StartupSeries cacheFill(shape);
+        runIteration(mgr, dir, &cacheFill);
+        for(int it=0; it < iterations; ++it)
+            runIteration(mgr, dir, &cacheSeries);
+        mgr.setLoadOrderCache(std::string());
+        std::remove(cachePath.c_str());
+
+        printSeries(shape, "warm", warmSeries);
+        appendSeries(warmSeries, &results);
+        if(cold)
+        {
+            printSeries(shape, "cold", coldSeries);
+            appendSeries(coldSeries, &results);
+
+            // Pages can stay in the page cache (tmpfs, pages mapped by another process, ...)
+            if(residentPages > 0)
+                std::cerr << "Warning: " << (100 * residentPages / totalPages) << "% of the "
+                          << shape << " pages were still cached after eviction" << std::endl;
+        }
+        printSeries(shape, "cache", cacheSeries);
+        appendSeries(cacheSeries, &results);
+
+        if(heapInUse() > 0)
+        {
+            memoryResults.push_back(Series{shape + "/memory/full", "kB", {retainedHeap(mgr, dir, false)}});
+            memoryResults.push_back(Series{shape + "/memory/compact", "kB", {retainedHeap(mgr, dir, true)}});
+        }
+    }
+
+    if(!memoryResults.empty())
+    {
+        std::cout << std::endl << "Heap kept after loading (kB)" << std::endl;
+        std::cout << std::left << std::setw(10) << "shape"
+                  << std::setw(12) << "full"
+                  << std::setw(12) << "compact"
+                  << std::setw(12) << "saved" << std::endl;
+        for(size_t i=0; i+1 < memoryResults.size(); i += 2)
+        {
+            const double full = memoryResults[i].samples.front();
+            const double compact = memoryResults[i+1].samples.front();
+            const std::string& name = memoryResults[i].name;
+            std::cout << std::left << std::fixed << std::setprecision(1)
+                      << std::setw(10) << name.substr(0, name.find('/'))
+                      << std::setw(12) << full
+                      << std::setw(12) << compact
+                      << std::setw(12) << (full - compact) << std::endl;
+        }
+        results.insert(results.end(), memoryResults.begin(), memoryResults.end());
+    }
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "startup", results);
+    }
+
+    return 0;
+}
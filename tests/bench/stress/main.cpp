@@ -0,0 +1,325 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Concurrency stress harness: many threads run a random schedule of searches,
+ * loads, unloads, queries and requests against the test app plugins.
+ * The throughput of each operation is reported at a regular interval.
+ *
+ * Plugin objects and requests between plugins must not be used during
+ * unloadPlugins(), so the harness serializes unloads with them (see LifecycleLock).
+ * Everything else only relies on the manager thread-safety.
+ *
+ * Some test app plugins are evictable: they are evicted by the evict operation,
+ * and by the idle eviction thread when enabled with -e.
+ *
+ * Build with JP_BENCH_TSAN=ON to run it under ThreadSanitizer.
+ *
+ * Usage: justplug-stress [-t threads] [-d duration_s] [-i interval_ms] [-s seed] [-e eviction_delay_ms]
+ */
+
+#include <atomic> // for std::atomic
+#include <condition_variable> // for std::condition_variable
+#include <cstdlib> // for std::atoi
+#include <cstring> // for strcmp
+#include <iomanip> // for std::setw
+#include <iostream>
+#include <mutex> // for std::mutex
+#include <random> // for std::mt19937
+#include <streambuf> // for std::streambuf
+#include <thread> // for std::thread
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+namespace
+{
+
+enum Operation
+{
+    SEARCH = 0,
+    LOAD,
+    UNLOAD,
+    HAS_PLUGIN,
+    PLUGIN_OBJECT,
+    PLUGIN_INFO,
+    REQUEST,
+    EVICT,
+    OPERATIONS_COUNT
+};
+
+const char* const OPERATION_NAMES[OPERATIONS_COUNT] = {
+    "search", "load", "unload", "hasPlugin", "pluginObject", "pluginInfo", "request", "evict"
+};
+
+// Relative probability of each operation in the schedule
+const int OPERATION_WEIGHTS[OPERATIONS_COUNT] = { 2, 2, 1, 25, 20, 15, 35, 1 };
+
+const char* const PLUGIN_NAMES[] = {
+    "plugin_test", "plugin_1", "plugin_2", "plugin_3", "plugin_4", "plugin_5",
+    "plugin_6", "plugin_7", "plugin_8", "plugin_9", "plugin_10", "plugin_unknown"
+};
+const int PLUGINS_COUNT = sizeof(PLUGIN_NAMES) / sizeof(PLUGIN_NAMES[0]);
+
+// Readers-writer lock (std::shared_mutex is not available in C++11).
+// Writers have priority, so unloads are not starved by requests.
+class LifecycleLock
+{
+public:
+    void lockShared()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [this]() { return !_writer && _waitingWriters == 0; });
+        _readers++;
+    }
+
+    void unlockShared()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(--_readers == 0)
+            _cond.notify_all();
+    }
+
+    void lock()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _waitingWriters++;
+        _cond.wait(lock, [this]() { return !_writer && _readers == 0; });
+        _waitingWriters--;
+        _writer = true;
+    }
+
+    void unlock()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _writer = false;
+        _cond.notify_all();
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    int _readers = 0;
+    int _waitingWriters = 0;
+    bool _writer = false;
+};
+
+// Plugins print to std::cout when they are loaded, so it is silenced during the run
+class NullBuffer: public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+};
+
+struct Context
+{
+    std::string pluginDir;
+    LifecycleLock lifecycle;
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> counters[OPERATIONS_COUNT];
+};
+
+// Send a random request from a loaded plugin: to the manager, to a dependency,
+// to itself or to a non-dependency (refused)
+void sendRandomRequest(PluginManager& mgr, std::mt19937& rng)
+{
+    std::shared_ptr<IPlugin> sender = mgr.pluginObject(PLUGIN_NAMES[rng() % PLUGINS_COUNT]);
+    if(!sender)
+        return;
+
+    const char* receiver = nullptr;
+    void* data = nullptr;
+    uint32_t dataSize = 0;
+    uint16_t code = 0;
+    switch(rng() % 4)
+    {
+    case 0:
+        code = IPlugin::CHECK_PLUGINLOADED;
+        data = (void*)PLUGIN_NAMES[rng() % PLUGINS_COUNT];
+        break;
+    case 1:
+        // plugin_1 is a dependency of plugin_2, plugin_3 and plugin_4
+        receiver = "plugin_1";
+        break;
+    case 2:
+        receiver = "plugin_5";
+        break;
+    default:
+        receiver = PLUGIN_NAMES[rng() % PLUGINS_COUNT];
+        break;
+    }
+    sender->sendRequest(receiver, code, &data, &dataSize);
+}
+
+void workerThread(Context* ctx, unsigned int seed)
+{
+    PluginManager& mgr = PluginManager::instance();
+    std::mt19937 rng(seed);
+    std::discrete_distribution<int> schedule(std::begin(OPERATION_WEIGHTS), std::end(OPERATION_WEIGHTS));
+
+    while(!ctx->stop.load())
+    {
+        const int op = schedule(rng);
+        const std::string name = PLUGIN_NAMES[rng() % PLUGINS_COUNT];
+
+        switch(op)
+        {
+        case SEARCH:
+            mgr.searchForPlugins(ctx->pluginDir);
+            break;
+        case LOAD:
+            mgr.loadPlugins();
+            break;
+        case UNLOAD:
+            ctx->lifecycle.lock();
+            mgr.unloadPlugins();
+            ctx->lifecycle.unlock();
+            break;
+        case HAS_PLUGIN:
+            mgr.hasPlugin(name);
+            mgr.hasPlugin(name, "1.0.0");
+            mgr.isPluginLoaded(name);
+            break;
+        case PLUGIN_OBJECT:
+            ctx->lifecycle.lockShared();
+            mgr.pluginObject(name).reset();
+            ctx->lifecycle.unlockShared();
+            break;
+        case PLUGIN_INFO:
+        {
+            PluginInfo info = mgr.pluginInfo(name);
+            if(info.name)
+                info.free();
+            break;
+        }
+        case REQUEST:
+            ctx->lifecycle.lockShared();
+            sendRandomRequest(mgr, rng);
+            ctx->lifecycle.unlockShared();
+            break;
+        case EVICT:
+            mgr.evictIdlePlugins();
+            break;
+        }
+
+        ctx->counters[op].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int threadsCount = 8;
+    int duration = 10;
+    int interval = 1000;
+    unsigned int seed = std::random_device()();
+    int evictionDelay = 0;
+
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-t") == 0 && i+1 < argc)
+            threadsCount = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-d") == 0 && i+1 < argc)
+            duration = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-i") == 0 && i+1 < argc)
+            interval = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-s") == 0 && i+1 < argc)
+            seed = static_cast<unsigned int>(std::atol(argv[++i]));
+        else if(strcmp(argv[i], "-e") == 0 && i+1 < argc)
+            evictionDelay = std::atoi(argv[++i]);
+    }
+    if(threadsCount < 1)
+        threadsCount = 1;
+    if(interval < 1)
+        interval = 1;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+    if(evictionDelay > 0)
+        mgr.setIdleEvictionDelay(evictionDelay);
+
+    Context ctx;
+    ctx.pluginDir = mgr.appDirectory() + "/plugin";
+    for(auto& counter : ctx.counters)
+        counter = 0;
+
+    // Reports are written to the real stdout, plugins outputs are discarded
+    std::ostream out(std::cout.rdbuf());
+    NullBuffer nullBuffer;
+    std::cout.rdbuf(&nullBuffer);
+
+    out << "Stress test: " << threadsCount << " threads, " << duration << "s, seed " << seed << std::endl;
+    out << std::left << std::setw(8) << "time";
+    for(const char* name : OPERATION_NAMES)
+        out << std::setw(14) << name;
+    out << std::setw(14) << "total (ops/s)" << std::endl;
+
+    std::vector<std::thread> threads;
+    for(int t=0; t < threadsCount; ++t)
+        threads.emplace_back(workerThread, &ctx, seed + t);
+
+    // Report the throughput of each operation at each interval
+    uint64_t previous[OPERATIONS_COUNT] = {0};
+    const Clock::time_point start = Clock::now();
+    Clock::time_point last = start;
+    while(elapsedMs(start, Clock::now()) < duration * 1000.0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+        const Clock::time_point now = Clock::now();
+        const double seconds = elapsedMs(last, now) / 1000.0;
+        last = now;
+
+        uint64_t total = 0;
+        out << std::setw(8) << std::fixed << std::setprecision(1) << elapsedMs(start, now) / 1000.0;
+        for(int op=0; op < OPERATIONS_COUNT; ++op)
+        {
+            const uint64_t count = ctx.counters[op].load();
+            out << std::setw(14) << std::setprecision(0) << (count - previous[op]) / seconds;
+            total += count - previous[op];
+            previous[op] = count;
+        }
+        out << std::setw(14) << total / seconds << std::endl;
+    }
+
+    ctx.stop = true;
+    for(std::thread& thread : threads)
+        thread.join();
+
+    mgr.unloadPlugins();
+    std::cout.rdbuf(out.rdbuf());
+
+    uint64_t total = 0;
+    for(auto& counter : ctx.counters)
+        total += counter.load();
+    const ManagerMetrics metrics = mgr.metrics();
+    std::cout << "Done: " << total << " operations, " << metrics.evictions << " evictions, "
+              << metrics.reloads << " reloads" << std::endl;
+    return 0;
+}
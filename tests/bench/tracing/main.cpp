@@ -0,0 +1,242 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Request tracing benchmark: a request sent by the last plugin of the tracing fleet
+ * (a chain of 7 plugins) is forwarded from plugin to plugin with nested requests
+ * (6 requests per tree). Measures the time per request tree with the tracing disabled,
+ * enabled without sampling any tree, with 1% of the trees and with every tree sampled
+ * (to an in-memory sink and to the file sink).
+ *
+ * The traces are then checked: a synchronous tree has 6 spans, a tree whose first
+ * plugin posts the request has 7 (the POST_REQUEST sent to the manager is a span,
+ * and the parent of the delivery), all linked to a single root.
+ *
+ * Usage: justplug-bench-tracing [-n trees] [-r repetitions] [-o results.json]
+ */
+
+#include <atomic> // for std::atomic
+#include <cstdio> // for std::remove
+#include <cstdlib> // for std::atol
+#include <cstring> // for strcmp
+#include <fstream> // for std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+#include <set> // for std::set
+#include <thread> // for std::this_thread
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+namespace
+{
+
+const char* const HUB_PLUGIN = "tracing_6";
+const char* const FIRST_PLUGIN = "tracing_5";
+
+// Avoid the compiler to optimize out the requests
+std::atomic<uint32_t> sink(0);
+
+// Traces received by the checking sink
+std::atomic<uint64_t> traces(0);
+std::atomic<uint64_t> spans(0);
+std::atomic<uint64_t> invalidTraces(0);
+std::atomic<uint64_t> asyncSpans(0);
+
+// A valid trace has one root, and the parent of every other span is in the trace
+void checkTrace(const std::vector<TraceSpan>& trace)
+{
+    std::set<uint64_t> ids;
+    for(const TraceSpan& span : trace)
+        ids.insert(span.spanId);
+
+    size_t roots = 0;
+    bool valid = ids.size() == trace.size();
+    for(const TraceSpan& span : trace)
+    {
+        if(span.parentId == 0)
+            roots++;
+        else if(ids.count(span.parentId) == 0)
+            valid = false;
+        if(span.async)
+            asyncSpans++;
+        if(span.traceId != trace.front().traceId)
+            valid = false;
+    }
+    if(!valid || roots != 1)
+        invalidTraces++;
+    spans += trace.size();
+    traces++;
+}
+
+uint16_t sendTree(IPlugin* hub, uint32_t posted)
+{
+    void* data = nullptr;
+    return hub->sendRequest(FIRST_PLUGIN, 5, &data, &posted);
+}
+
+bool loadFleet(PluginManager& mgr, const std::string& dir)
+{
+    // The proxies recording the spans are bound when the plugins are loaded
+    mgr.unloadPlugins();
+    return mgr.searchForPlugins(dir) && mgr.loadPlugins();
+}
+
+// Median time of a request tree (in ns)
+double treeTime(PluginManager& mgr, long trees, int repetitions, Series* series)
+{
+    std::shared_ptr<IPlugin> hub = mgr.pluginObject(HUB_PLUGIN);
+    // The first repetition is not measured (warm-up)
+    for(int rep=-1; rep < repetitions; ++rep)
+    {
+        uint32_t result = 0;
+        const Clock::time_point start = Clock::now();
+        for(long i=0; i < trees; ++i)
+            result += sendTree(hub.get(), 0);
+        if(rep >= 0)
+            series->samples.push_back(elapsedMs(start, Clock::now()) * 1e6 / trees);
+        sink += result;
+    }
+    return computeStats(series->samples).median;
+}
+
+// Send trees and wait for their traces. Returns false if they are not all received within 10 s.
+bool checkTrees(IPlugin* hub, long trees, uint32_t posted)
+{
+    const uint64_t expected = traces + trees;
+    for(long i=0; i < trees; ++i)
+        sink += sendTree(hub, posted);
+    const Clock::time_point start = Clock::now();
+    while(traces < expected && elapsedMs(start, Clock::now()) < 10000)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return traces == expected;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    long trees = 10000;
+    int repetitions = 5;
+    std::string jsonPath;
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            trees = std::atol(argv[++i]);
+        else if(strcmp(argv[i], "-r") == 0 && i+1 < argc)
+            repetitions = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+    }
+    if(trees < 1)
+        trees = 1;
+    if(repetitions < 1)
+        repetitions = 1;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+    const std::string dir = mgr.appDirectory() + "/fleet/tracing";
+    const std::string traceFile = mgr.appDirectory() + "/bench-traces.jsonl";
+    std::vector<Series> results;
+
+    std::cout << "Request tracing benchmark (" << repetitions << " x " << trees
+              << " trees of 6 requests, medians)" << std::endl;
+
+    struct Mode
+    {
+        const char* name;
+        bool enabled;
+        double sampleRate;
+        bool file;
+    };
+    const Mode modes[] = {
+        {"off", false, 0.0, false},
+        {"unsampled", true, 0.0, false},
+        {"sampled-1%", true, 0.01, false},
+        {"sampled", true, 1.0, false},
+        {"file", true, 1.0, true}
+    };
+    for(const Mode& mode : modes)
+    {
+        if(mode.enabled)
+            mgr.enableTracing(mode.sampleRate);
+        else
+            mgr.disableTracing();
+        std::remove(traceFile.c_str());
+        mgr.setTraceSink(mode.file ? PluginManager::fileTraceSink(traceFile) : checkTrace);
+        if(!loadFleet(mgr, dir))
+        {
+            std::cerr << "Cannot load the tracing plugins" << std::endl;
+            return 1;
+        }
+
+        Series series{std::string("tracing/tree/") + mode.name, "ns/op", {}};
+        const double time = treeTime(mgr, trees, repetitions, &series);
+        std::cout << std::left << std::fixed << std::setprecision(1)
+                  << std::setw(28) << (&mode == modes ? "tree (ns/op)" : "") << std::setw(12) << mode.name << time << std::endl;
+        results.push_back(series);
+    }
+    mgr.setTraceSink(nullptr);
+    std::remove(traceFile.c_str());
+
+    // Trees of the last loading (every tree is sampled)
+    mgr.setTraceSink(checkTrace);
+    std::shared_ptr<IPlugin> hub = mgr.pluginObject(HUB_PLUGIN);
+    const long checkedTrees = trees < 1000 ? trees : 1000;
+    traces = 0;
+    spans = 0;
+    const bool syncReceived = checkTrees(hub.get(), checkedTrees, 0);
+    const double syncSpans = double(spans) / checkedTrees;
+    spans = 0;
+    const bool postedReceived = checkTrees(hub.get(), checkedTrees, 1);
+    const double postedSpans = double(spans) / checkedTrees;
+    hub.reset();
+    mgr.unloadPlugins();
+    mgr.disableTracing();
+
+    std::cout << std::setprecision(2)
+              << std::setw(28) << "spans per trace" << std::setw(12) << "sync" << syncSpans << std::endl
+              << std::setw(28) << "" << std::setw(12) << "posted" << postedSpans
+              << " (" << asyncSpans << " async)" << std::endl;
+    const ManagerMetrics metrics = mgr.metrics();
+    std::cout << "sampled traces: " << metrics.sampledTraces << ", spans: " << metrics.tracedSpans
+              << ", invalid traces: " << invalidTraces << std::endl;
+    if(!syncReceived || !postedReceived || invalidTraces != 0 || syncSpans != 6.0 || postedSpans != 7.0)
+    {
+        std::cerr << "The traces are incomplete" << std::endl;
+        return 1;
+    }
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "tracing", results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Worker pool benchmark: times searchForPlugins() with the integrity check enabled,
+ * with the hashing threads pinned to 1, pinned to one per available CPU (the previous
+ * behaviour), and sized automatically by the manager.
+ *
+ * Two storages are simulated through the cryptographic hash function: "slow" waits
+ * before hashing, like a read from network storage, "local" only hashes the data
+ * (CPU bound). The automatic pool should grow on the first, and match the CPUs on the
+ * second. The slow storage runs first, so the automatic pool of the local one starts
+ * from the size chosen for the slow storage, and must shrink back.
+ *
+ * Usage: justplug-bench-workers [-n iterations] [-d delay_us] [-o results.json] [shape]
+ */
+
+#include <chrono> // for std::chrono::microseconds
+#include <cstdio> // for std::remove
+#include <cstdlib> // for std::atoi
+#include <cstring> // for strcmp
+#include <fstream> // for std::ofstream
+#include <iomanip> // for std::setw
+#include <iostream>
+#include <thread> // for std::this_thread::sleep_for
+
+#include "pluginmanager.h"
+
+#include "benchutil.h"
+
+using namespace jp;
+using namespace jp_bench;
+
+namespace
+{
+
+int storageDelay = 0; // In us
+
+// FNV-1a of the data, after the simulated storage delay
+std::string storageHash(const unsigned char* data, size_t size)
+{
+    if(storageDelay > 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(storageDelay));
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i=0; i < size; ++i)
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(hash));
+    return buffer;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    int iterations = 10;
+    int delay = 500;
+    std::string jsonPath;
+    std::string shape = "random";
+
+    for(int i=1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            iterations = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-d") == 0 && i+1 < argc)
+            delay = std::atoi(argv[++i]);
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            jsonPath = argv[++i];
+        else
+            shape = argv[i];
+    }
+    if(iterations < 1)
+        iterations = 1;
+
+    PluginManager& mgr = PluginManager::instance();
+    mgr.disableLogOutput();
+    const std::string dir = mgr.appDirectory() + "/fleet/" + shape;
+    const std::string manifest = mgr.appDirectory() + "/workers-" + shape + ".manifest";
+
+    // Written without delay, the hashes do not depend on it
+    mgr.setCryptoHashFunction(storageHash);
+    if(!mgr.createIntegrityManifest(dir, manifest) || !mgr.enableIntegrityCheck(manifest))
+    {
+        std::cerr << "Cannot create the manifest of " << dir << std::endl;
+        return 1;
+    }
+    const unsigned int cpus = mgr.workerPoolInfo().cpuLimit;
+
+    std::cout << "Worker pool benchmark (" << shape << " fleet, " << cpus << " available CPUs, "
+              << iterations << " iterations, medians)" << std::endl;
+    std::cout << std::left << std::setw(10) << "storage"
+              << std::setw(10) << "pool"
+              << std::setw(14) << "search (ms)"
+              << std::setw(14) << "peak threads"
+              << std::setw(14) << "wait ratio"
+              << "chosen" << std::endl;
+
+    std::vector<Series> results;
+    for(const std::string storage : {"slow", "local"})
+    {
+        storageDelay = storage == "slow" ? delay : 0;
+        for(const std::string pool : {"1", "cpus", "auto"})
+        {
+            mgr.setWorkerCount(pool == "1" ? 1 : (pool == "cpus" ? cpus : 0));
+
+            Series search{"workers/" + storage + "/" + pool + "/search", "ms", {}};
+            for(int it=0; it < iterations; ++it)
+            {
+                // Setting the hash function clears the cache
+                mgr.setCryptoHashFunction(storageHash);
+                const Clock::time_point start = Clock::now();
+                if(!mgr.searchForPlugins(dir))
+                {
+                    std::cerr << "Cannot find the plugins of " << dir << std::endl;
+                    return 1;
+                }
+                search.samples.push_back(elapsedMs(start, Clock::now()));
+                mgr.unloadPlugins();
+            }
+
+            const WorkerPoolInfo info = mgr.workerPoolInfo();
+            std::cout << std::left << std::fixed << std::setprecision(3)
+                      << std::setw(10) << storage
+                      << std::setw(10) << pool
+                      << std::setw(14) << computeStats(search.samples).median
+                      << std::setw(14) << info.peakWorkers
+                      << std::setw(14) << info.waitRatio
+                      << info.workers << std::endl;
+            results.push_back(search);
+        }
+    }
+    mgr.disableIntegrityCheck();
+    std::remove(manifest.c_str());
+
+    if(!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+        writeJson(file, "workers", results);
+    }
+
+    return 0;
+}
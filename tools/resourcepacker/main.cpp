@@ -0,0 +1,73 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Fabien Caylus
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Resource packer: compresses a resource file with lzcodec.h at build time.
+ * Used by embed_resources() (see EmbedMetadata.cmake) for the COMPRESSED_FILES option.
+ *
+ * Usage: justplug-resourcepacker chunk_size input output
+ */
+
+#include <cstdlib> // for std::strtoull
+#include <fstream> // for std::ifstream, std::ofstream
+#include <iostream>
+#include <iterator> // for std::istreambuf_iterator
+
+#include "../../include/lzcodec.h"
+
+int main(int argc, char** argv)
+{
+    if(argc != 4)
+    {
+        std::cerr << "Usage: " << argv[0] << " chunk_size input output" << std::endl;
+        return 1;
+    }
+
+    const unsigned long long chunkSize = std::strtoull(argv[1], nullptr, 10);
+    if(chunkSize == 0 || chunkSize > 0xffffffffu)
+    {
+        std::cerr << "Invalid chunk size: " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::ifstream input(argv[2], std::ios::binary);
+    if(!input)
+    {
+        std::cerr << "Cannot read " << argv[2] << std::endl;
+        return 1;
+    }
+    const std::vector<uint8_t> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+
+    const std::vector<uint8_t> container = jp_private::lz::compressResource(data.data(), data.size(), chunkSize);
+
+    std::ofstream output(argv[3], std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char*>(container.data()), container.size());
+    if(!output)
+    {
+        std::cerr << "Cannot write " << argv[3] << std::endl;
+        return 1;
+    }
+    return 0;
+}